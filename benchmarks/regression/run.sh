@@ -0,0 +1,89 @@
+#! /bin/bash
+#
+# Runs the local performance regression benchmarks and compares
+# the time of each clock in cpu.txt to the stored baselines.
+#
+# Usage: run.sh [-u] [config ...]
+#   -u     store the timings as the new baselines instead of comparing.
+#   config dm, hydro or bh. All of them if none are given.
+#
+# The number of ranks, threads and measured steps can be set with
+# NRANKS, NTHREADS and NSTEPS. Baselines are only comparable with the same values,
+# on the same machine.
+
+NRANKS=${NRANKS:-2}
+NTHREADS=${NTHREADS:-2}
+NSTEPS=${NSTEPS:-16}
+MPIRUN=${MPIRUN:-mpirun}
+
+BENCH=$(cd $(dirname $0); pwd)
+ROOT=$BENCH/../..
+DATA=$ROOT/examples
+WORK=${WORK:-$BENCH/work}
+
+update=0
+if [ "x$1" == "x-u" ]; then
+    update=1
+    shift
+fi
+configs=${@:-dm hydro bh}
+
+export OMP_NUM_THREADS=$NTHREADS
+mkdir -p $BENCH/baselines
+
+# Substitute the paths into a parameter file
+params() {
+    sed -e "s;@PREFIX@;$2;" -e "s;@DATA@;$DATA;" $BENCH/$1 > $2/$1
+}
+
+# Value of a parameter in a parameter file
+getparam() {
+    sed -n -e "s;^ *$2 *= *\([^ #]*\).*;\1;p" $BENCH/$1
+}
+
+# The number of PM steps the run reaches before TimeMax is at least log(TimeMax/TimeBegin) / MaxSizeTimestep,
+# as MaxSizeTimestep is in units of dloga. There are more steps if some particles are on shorter steps.
+min_steps() {
+    python3 -c "import math; print(math.ceil(math.log($2 * (1 + $1)) / $3))"
+}
+
+failed=0
+for config in $configs; do
+    if [ "$config" == "dm" ]; then
+        ics=dm
+    else
+        ics=gas
+    fi
+    # Check that the run reaches NSTEPS before starting it
+    maxsteps=$(min_steps $(getparam paramfile.genic-$ics Redshift) $(getparam paramfile.gadget-$config TimeMax) $(getparam paramfile.gadget-$config MaxSizeTimestep))
+    if [ $NSTEPS -gt $maxsteps ]; then
+        echo "$config: NSTEPS=$NSTEPS, but the run may stop after $maxsteps steps. Use a smaller NSTEPS or a later TimeMax."
+        exit 1
+    fi
+    # The ICs are deterministic, so they are only made once for each species mix
+    icdir=$WORK/ics-$ics
+    if [ ! -d $icdir/ICS/IC ]; then
+        mkdir -p $icdir
+        params paramfile.genic-$ics $icdir
+        $MPIRUN -np $NRANKS $ROOT/genic/MP-GenIC $icdir/paramfile.genic-$ics || exit 1
+    fi
+    dir=$WORK/$config
+    rm -rf $dir/output
+    mkdir -p $dir
+    ln -sfn $icdir/ICS $dir/ICS
+    params paramfile.gadget-$config $dir
+    $MPIRUN -np $NRANKS $ROOT/gadget/MP-Gadget $dir/paramfile.gadget-$config > $dir/gadget.log 2>&1 || { echo "$config: run failed, see $dir/gadget.log"; exit 1; }
+    python3 $ROOT/tools/benchcompare.py extract $dir/output $NSTEPS > $dir/timings.json || exit 1
+
+    baseline=$BENCH/baselines/$config-$NRANKS-$NTHREADS.json
+    if [ $update -eq 1 ]; then
+        cp $dir/timings.json $baseline
+        echo "$config: stored baseline $baseline"
+    elif [ ! -f $baseline ]; then
+        echo "$config: no baseline for $NRANKS ranks and $NTHREADS threads. Run $0 -u $config on this machine first."
+    else
+        echo "$config: clock, baseline (s), now (s)"
+        python3 $ROOT/tools/benchcompare.py compare $dir/timings.json $baseline $BENCH/tolerances.json || failed=1
+    fi
+done
+exit $failed
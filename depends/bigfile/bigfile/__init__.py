@@ -348,6 +348,8 @@ class Dataset(pyxbigfile.Dataset):
         dtype = []
         for name in column_names:
             column = file.open(name)
+            if column.compressed:
+                raise BigFileError("Compressed column %s cannot be read as part of a Dataset" % name)
             if size is None:
                 size = column.size
             elif column.size != size:
@@ -81,6 +81,7 @@ cdef extern from "bigfile.h":
     CBigAttr * big_block_lookup_attr(CBigBlock * block, char * attrname) nogil
     CBigAttr * big_block_list_attrs(CBigBlock * block, size_t * count) nogil
     int big_array_init(CBigArray * array, void * buf, char * dtype, int ndim, size_t dims[], ptrdiff_t strides[]) nogil
+    int big_codec_decode(char * codec, double precision, char * dtype, int nmemb, size_t nitems, void * src, size_t srcsize, void * dst) nogil
 
     int big_file_open_block(CBigFile * bf, CBigBlock * block, char * blockname) nogil
     int big_file_create_block(CBigFile * bf, CBigBlock * block, char * blockname, char * dtype, int nmemb, int Nfile, size_t fsize[]) nogil
@@ -292,10 +293,18 @@ cdef class ColumnLowLevelAPI:
 
     property size:
         def __get__(self):
+            if self.compressed:
+                return int(self.attrs['CodecSize'][0])
             return self.bb.size
 
     property dtype:
         def __get__(self):
+            if self.compressed:
+                dtype = numpy.dtype(''.join(self.attrs['CodecDType']))
+                nmemb = int(self.attrs['CodecNmemb'][0])
+                if nmemb != 1:
+                    return numpy.dtype((dtype, (nmemb, )))
+                return dtype
             # numpy no longer treats dtype = (x, 1) as dtype = x.
             # but bigfile relies on this.
             if self.bb.nmemb != 1:
@@ -308,6 +317,12 @@ cdef class ColumnLowLevelAPI:
     property Nfile:
         def __get__(self):
             return self.bb.Nfile
+    property compressed:
+        """ True if the column is written with a codec, by big_file_mpi_write_block_compressed.
+            size and dtype are those of the uncompressed data, which read decodes.
+        """
+        def __get__(self):
+            return big_block_lookup_attr(&self.bb, b"Codec") != NULL
 
     def __cinit__(self):
         self.comm = None
@@ -488,6 +503,10 @@ cdef class ColumnLowLevelAPI:
             if result.dtype.base.itemsize != self.dtype.base.itemsize:
                 raise ValueError("output array type mismatches with the block")
 
+        if self.compressed:
+            self._read_compressed(start, length, result)
+            return result
+
         big_array_init(&array, result.data, self.bb.dtype, 
                 result.ndim, 
                 <size_t *> result.shape,
@@ -504,6 +523,66 @@ cdef class ColumnLowLevelAPI:
             raise Error()
         return result
 
+    def _read_compressed(self, numpy.intp_t start, numpy.intp_t length, numpy.ndarray result):
+        """ read rows [start, start + length) of a compressed column into result.
+
+            The column stores the chunks of all ranks one after another, as bytes;
+            the CodecChunkItems and CodecChunkBytes attributes index them.
+            Only the chunks overlapping the rows are read and decoded.
+        """
+        cdef CBigArray array
+        cdef CBigBlockPtr ptr
+        cdef numpy.ndarray raw
+        cdef numpy.ndarray chunk
+        cdef numpy.intp_t i, lo, hi, rawstart, rawsize, offset
+
+        if length == 0:
+            return
+
+        codec = ''.join(self.attrs['Codec']).encode()
+        dtype = ''.join(self.attrs['CodecDType']).encode()
+        cdef char * codecptr = codec
+        cdef char * dtypeptr = dtype
+        cdef int nmemb = self.attrs['CodecNmemb'][0]
+        cdef double precision = self.attrs['CodecPrecision'][0]
+        if not numpy.dtype(dtype.decode()).isnative:
+            raise Error("Compressed block of dtype %s has a different endianness from this machine" % dtype.decode())
+
+        items = numpy.asarray(self.attrs['CodecChunkItems'], dtype='intp')
+        nbytes = numpy.asarray(self.attrs['CodecChunkBytes'], dtype='intp')
+        itemstart = numpy.concatenate([[0], numpy.cumsum(items)])
+        bytestart = numpy.concatenate([[0], numpy.cumsum(nbytes)])
+        # chunks [first, last) overlap the rows
+        first = numpy.searchsorted(itemstart, start, side='right') - 1
+        last = numpy.searchsorted(itemstart, start + length, side='left')
+
+        rawstart = bytestart[first]
+        rawsize = bytestart[last] - rawstart
+        raw = numpy.empty(rawsize, dtype='u1')
+        big_array_init(&array, raw.data, self.bb.dtype,
+                raw.ndim,
+                <size_t *> raw.shape,
+                <ptrdiff_t *> raw.strides)
+        with nogil:
+            rt = big_block_seek(&self.bb, &ptr, rawstart)
+        if rt != 0:
+            raise Error()
+        with nogil:
+            rt = big_block_read(&self.bb, &ptr, &array)
+        if rt != 0:
+            raise Error()
+
+        for i in range(first, last):
+            chunk = numpy.empty(items[i], dtype=self.dtype)
+            offset = bytestart[i] - rawstart
+            rt = big_codec_decode(codecptr, precision, dtypeptr, nmemb, items[i],
+                    raw.data + offset, nbytes[i], chunk.data)
+            if rt != 0:
+                raise Error()
+            lo = max(itemstart[i], start)
+            hi = min(itemstart[i + 1], start + length)
+            result[lo - start:hi - start] = chunk[lo - itemstart[i]:hi - itemstart[i]]
+
     def _flush(self):
         with nogil:
             rt = big_block_flush(&self.bb)
@@ -590,3 +590,85 @@ def test_slicing(comm):
             assert_equal(b[3], data[3])
 
     shutil.rmtree(fname)
+
+def _codec_encode(codec, precision, data):
+    """ Encode the rows of data as big_codec_encode does,
+        but with an LZ stream of literals only. """
+    data = numpy.ascontiguousarray(data)
+    if codec == 'quantise-lz':
+        words = numpy.rint(data / precision).astype('i8').view('u8')
+    elif data.dtype.kind in 'iu':
+        words = data.view('u%d' % data.dtype.itemsize)
+    else:
+        words = data
+    if codec == 'quantise-lz' or data.dtype.kind in 'iu':
+        # delta along each column, then zig-zag
+        nmemb = 1 if data.ndim == 1 else data.shape[1]
+        flat = words.ravel()
+        prev = numpy.zeros_like(flat)
+        prev[nmemb:] = flat[:-nmemb]
+        d = flat - prev
+        bits = 8 * flat.dtype.itemsize
+        words = (d << 1) ^ (flat.dtype.type(0) - (d >> (bits - 1)))
+    width = words.dtype.itemsize
+    shuffled = words.ravel().view('u1').reshape(-1, width).T.ravel()
+    n = len(shuffled)
+    stream = [min(n, 15) << 4]
+    if n >= 15:
+        stream += [255] * ((n - 15) // 255) + [(n - 15) % 255]
+    return numpy.concatenate([numpy.array(stream, dtype='u1'), shuffled])
+
+def _write_compressed(x, name, codec, precision, data, chunks):
+    """ Write data as a compressed block, as big_file_mpi_write_block_compressed does """
+    edges = numpy.concatenate([[0], numpy.cumsum(chunks)])
+    encoded = [_codec_encode(codec, precision, data[edges[i]:edges[i + 1]]) for i in range(len(chunks))]
+    raw = numpy.concatenate(encoded)
+    with x.create(name, Nfile=1, dtype='u1', size=len(raw)) as b:
+        b.write(0, raw)
+        b.attrs['Codec'] = codec
+        b.attrs['CodecDType'] = data.dtype.str
+        b.attrs['CodecNmemb'] = numpy.int32(1 if data.ndim == 1 else data.shape[1])
+        b.attrs['CodecSize'] = numpy.uint64(len(data))
+        b.attrs['CodecPrecision'] = numpy.float64(precision)
+        b.attrs['CodecChunkItems'] = numpy.array(chunks, dtype='u8')
+        b.attrs['CodecChunkBytes'] = numpy.array([len(e) for e in encoded], dtype='u8')
+
+@MPITest([1])
+def test_compressed(comm):
+    fname = tempfile.mkdtemp()
+    x = BigFile(fname, create=True)
+    x.create('.')
+
+    numpy.random.seed(1234)
+    chunks = [40, 30, 30]
+    ids = numpy.arange(100, dtype='u8') * 3 + 2**40
+    numpy.random.shuffle(ids[50:])
+    _write_compressed(x, 'ID', 'shuffle-lz', 0, ids, chunks)
+    mass = numpy.random.uniform(size=100).astype('f4')
+    _write_compressed(x, 'Mass', 'shuffle-lz', 0, mass, chunks)
+    pos = numpy.random.uniform(-100, 100, size=(100, 3))
+    _write_compressed(x, 'Position', 'quantise-lz', 1e-3, pos, chunks)
+
+    with x['ID'] as b:
+        assert b.compressed
+        assert_equal(b.size, 100)
+        assert_equal(b.dtype, numpy.dtype('u8'))
+        assert_array_equal(b[:], ids)
+        # Within one chunk and across chunks
+        assert_array_equal(b[45:60], ids[45:60])
+        assert_array_equal(b[10:95], ids[10:95])
+        assert_array_equal(b[99:], ids[99:])
+
+    with x['Mass'] as b:
+        assert_array_equal(b[:], mass)
+
+    with x['Position'] as b:
+        assert_equal(b.dtype, numpy.dtype(('f8', 3)))
+        assert_equal(b.size, 100)
+        assert numpy.abs(b[:] - pos).max() <= 0.5e-3
+        assert_array_equal(b[30:70], b[:][30:70])
+
+    # The bytes of a compressed block are not records
+    assert_raises(BigFileError, Dataset, x, ['ID', 'Mass'])
+
+    shutil.rmtree(fname)
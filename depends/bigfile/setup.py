@@ -9,6 +9,7 @@ extensions = [
                 "bigfile/pyxbigfile.pyx",
                 "src/bigfile.c",
                 "src/bigfile-record.c",
+                "src/bigfile-codec.c",
             ],
             depends = [
                 "src/bigfile.h",
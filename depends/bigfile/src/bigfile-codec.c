@@ -0,0 +1,371 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "bigfile.h"
+#include "bigfile-internal.h"
+
+/*
+ * Codecs for compressed blocks.
+ *
+ * The data of a chunk is first turned into fixed width words:
+ *  - integer columns are delta coded along each column (wrapping) and zig-zag coded,
+ *    so that slowly varying values, such as IDs of particles sorted along the
+ *    Peano curve, become small positive words;
+ *  - with quantise-lz floating point columns are rounded to integer multiples
+ *    of the precision and treated as 8 byte integers;
+ *  - other columns are used as they are.
+ * The words are then byte shuffled, so that the (mostly zero) high bytes of
+ * all words are adjacent, and compressed with a simple LZ77 coder.
+ *
+ * The LZ stream is a sequence of
+ *      token, [literal length bytes], literals, offset (2 bytes, LE), [match length bytes]
+ * The high nibble of the token is the number of literals, the low nibble the match length
+ * minus LZ_MINMATCH. A nibble of 15 is followed by bytes which are added to it, until a byte
+ * is less than 255. The final sequence has no match; the decoder stops when the expected
+ * number of bytes has been produced.
+ * */
+
+#define LZ_MINMATCH 4
+#define LZ_HASHLOG 16
+#define LZ_MAXOFFSET 65535
+
+static uint32_t
+_read32(const unsigned char * p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static unsigned int
+_hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASHLOG);
+}
+
+static unsigned char *
+_write_length(unsigned char * op, size_t len)
+{
+    while(len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+    return op;
+}
+
+static unsigned char *
+_write_sequence(unsigned char * op, const unsigned char * literals, size_t nlit, size_t offset, size_t matchlen)
+{
+    size_t mcode = matchlen > 0 ? matchlen - LZ_MINMATCH : 0;
+    unsigned char * token = op++;
+    *token = ((nlit < 15 ? nlit : 15) << 4) | (mcode < 15 ? mcode : 15);
+    if(nlit >= 15)
+        op = _write_length(op, nlit - 15);
+    memcpy(op, literals, nlit);
+    op += nlit;
+    if(matchlen > 0) {
+        *op++ = offset & 0xff;
+        *op++ = offset >> 8;
+        if(mcode >= 15)
+            op = _write_length(op, mcode - 15);
+    }
+    return op;
+}
+
+/* Worst case output size of _big_lz_compress*/
+static size_t
+_big_lz_bound(size_t n)
+{
+    return n + n / 255 + 16;
+}
+
+static size_t
+_big_lz_compress(const unsigned char * src, size_t n, unsigned char * dst)
+{
+    /* Position + 1 of the last occurance of a hash; 0 if none.*/
+    size_t * table = calloc(1 << LZ_HASHLOG, sizeof(size_t));
+    unsigned char * op = dst;
+    size_t ip = 0, anchor = 0;
+
+    while(ip + LZ_MINMATCH <= n) {
+        const uint32_t seq = _read32(src + ip);
+        const unsigned int h = _hash32(seq);
+        const size_t ref = table[h];
+        table[h] = ip + 1;
+        if(ref == 0 || ip - (ref - 1) > LZ_MAXOFFSET || _read32(src + ref - 1) != seq) {
+            ip ++;
+            continue;
+        }
+        const size_t mpos = ref - 1;
+        size_t len = LZ_MINMATCH;
+        while(ip + len < n && src[mpos + len] == src[ip + len])
+            len ++;
+        op = _write_sequence(op, src + anchor, ip - anchor, ip - mpos, len);
+        ip += len;
+        anchor = ip;
+    }
+    /* Final literals; always present, so the stream ends with a sequence without a match.*/
+    op = _write_sequence(op, src + anchor, n - anchor, 0, 0);
+    free(table);
+    return op - dst;
+}
+
+static int
+_read_length(const unsigned char ** ip, const unsigned char * iend, size_t * len)
+{
+    unsigned char b;
+    do {
+        if(*ip >= iend)
+            return -1;
+        b = *(*ip)++;
+        *len += b;
+    } while(b == 255);
+    return 0;
+}
+
+/* Decompress exactly n bytes into dst. Returns 0 on success, -1 on corrupt input. */
+static int
+_big_lz_decompress(const unsigned char * src, size_t srcsize, unsigned char * dst, size_t n)
+{
+    const unsigned char * ip = src;
+    const unsigned char * iend = src + srcsize;
+    size_t op = 0;
+
+    while(1) {
+        if(ip >= iend)
+            return -1;
+        const unsigned char token = *ip++;
+        size_t nlit = token >> 4;
+        if(nlit == 15 && _read_length(&ip, iend, &nlit))
+            return -1;
+        if(nlit > (size_t) (iend - ip) || nlit > n - op)
+            return -1;
+        memcpy(dst + op, ip, nlit);
+        ip += nlit;
+        op += nlit;
+        if(op == n)
+            break;
+        if(iend - ip < 2)
+            return -1;
+        const size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if(len == 15 && _read_length(&ip, iend, &len))
+            return -1;
+        len += LZ_MINMATCH;
+        if(offset == 0 || offset > op || len > n - op)
+            return -1;
+        /* Byte by byte, as the match may overlap the output*/
+        size_t i;
+        for(i = 0; i < len; i ++)
+            dst[op + i] = dst[op - offset + i];
+        op += len;
+    }
+    return ip == iend ? 0 : -1;
+}
+
+static void
+_shuffle(const unsigned char * src, unsigned char * dst, size_t nwords, int width)
+{
+    size_t j;
+    int b;
+    for(j = 0; j < nwords; j ++)
+        for(b = 0; b < width; b ++)
+            dst[b * nwords + j] = src[j * width + b];
+}
+
+static void
+_unshuffle(const unsigned char * src, unsigned char * dst, size_t nwords, int width)
+{
+    size_t j;
+    int b;
+    for(j = 0; j < nwords; j ++)
+        for(b = 0; b < width; b ++)
+            dst[j * width + b] = src[b * nwords + j];
+}
+
+/* Delta along each column, then zig-zag, with wrapping unsigned arithmetic.*/
+#define DELTA_CODEC(T, bits) \
+static void \
+_delta_encode_ ## bits(const void * src, void * dst, size_t nvalues, int nmemb) \
+{ \
+    const T * v = src; \
+    T * r = dst; \
+    size_t j; \
+    for(j = 0; j < nvalues; j ++) { \
+        const T prev = j >= (size_t) nmemb ? v[j - nmemb] : 0; \
+        const T d = v[j] - prev; \
+        r[j] = (T) (d << 1) ^ (T) (-(T) (d >> (bits - 1))); \
+    } \
+} \
+static void \
+_delta_decode_ ## bits(const void * src, void * dst, size_t nvalues, int nmemb) \
+{ \
+    const T * r = src; \
+    T * v = dst; \
+    size_t j; \
+    for(j = 0; j < nvalues; j ++) { \
+        const T prev = j >= (size_t) nmemb ? v[j - nmemb] : 0; \
+        const T d = (T) (r[j] >> 1) ^ (T) (-(T) (r[j] & 1)); \
+        v[j] = prev + d; \
+    } \
+}
+
+DELTA_CODEC(uint8_t, 8)
+DELTA_CODEC(uint16_t, 16)
+DELTA_CODEC(uint32_t, 32)
+DELTA_CODEC(uint64_t, 64)
+
+static int
+_delta_encode(const void * src, void * dst, size_t nvalues, int nmemb, int width)
+{
+    switch(width) {
+        case 1: _delta_encode_8(src, dst, nvalues, nmemb); return 0;
+        case 2: _delta_encode_16(src, dst, nvalues, nmemb); return 0;
+        case 4: _delta_encode_32(src, dst, nvalues, nmemb); return 0;
+        case 8: _delta_encode_64(src, dst, nvalues, nmemb); return 0;
+    }
+    return -1;
+}
+
+static int
+_delta_decode(const void * src, void * dst, size_t nvalues, int nmemb, int width)
+{
+    switch(width) {
+        case 1: _delta_decode_8(src, dst, nvalues, nmemb); return 0;
+        case 2: _delta_decode_16(src, dst, nvalues, nmemb); return 0;
+        case 4: _delta_decode_32(src, dst, nvalues, nmemb); return 0;
+        case 8: _delta_decode_64(src, dst, nvalues, nmemb); return 0;
+    }
+    return -1;
+}
+
+static int
+_quantise(const void * src, int64_t * q, size_t nvalues, int width, double precision)
+{
+    size_t j;
+    for(j = 0; j < nvalues; j ++) {
+        double v = width == 4 ? ((const float *) src)[j] : ((const double *) src)[j];
+        double x = v / precision;
+        /* Also catches NaN*/
+        if(!(fabs(x) < 4.0e18))
+            return -1;
+        q[j] = llround(x);
+    }
+    return 0;
+}
+
+static void
+_dequantise(const int64_t * q, void * dst, size_t nvalues, int width, double precision)
+{
+    size_t j;
+    for(j = 0; j < nvalues; j ++) {
+        if(width == 4)
+            ((float *) dst)[j] = q[j] * precision;
+        else
+            ((double *) dst)[j] = q[j] * precision;
+    }
+}
+
+/* Width of the words that are shuffled and compressed, or 0 if the codec
+ * does not support the dtype.*/
+static int
+_big_codec_word_width(const char * codec, const char * dtype)
+{
+    const int width = big_file_dtype_itemsize(dtype);
+    const char kind = dtype[1];
+    if(0 == strcmp(codec, BIG_CODEC_SHUFFLE_LZ))
+        return width;
+    if(0 == strcmp(codec, BIG_CODEC_QUANTISE_LZ)) {
+        if(kind == 'f' && (width == 4 || width == 8))
+            return 8;
+        return 0;
+    }
+    return 0;
+}
+
+size_t
+big_codec_bound(const char * codec, const char * dtype, int nmemb, size_t nitems)
+{
+    const int width = _big_codec_word_width(codec, dtype);
+    return _big_lz_bound(width * nmemb * nitems);
+}
+
+ptrdiff_t
+big_codec_encode(const char * codec, double precision, const char * dtype, int nmemb, size_t nitems, const void * src, void * dst, size_t dstsize)
+{
+    const int width = _big_codec_word_width(codec, dtype);
+    const size_t nvalues = nitems * nmemb;
+    const size_t nbytes = nvalues * width;
+    unsigned char * words = NULL;
+    unsigned char * shuffled = NULL;
+    ptrdiff_t used = -1;
+
+    RAISEIF(width == 0, ex_codec, "Codec %s does not support dtype %s", codec, dtype);
+    RAISEIF(dstsize < _big_lz_bound(nbytes), ex_codec, "Output buffer of %td bytes too small for codec %s", dstsize, codec);
+
+    words = malloc(nbytes + 1);
+    shuffled = malloc(nbytes + 1);
+
+    if(0 == strcmp(codec, BIG_CODEC_QUANTISE_LZ)) {
+        RAISEIF(!(precision > 0), ex_encode, "Codec %s needs a positive precision, not %g", codec, precision);
+        RAISEIF(0 != _quantise(src, (int64_t *) shuffled, nvalues, big_file_dtype_itemsize(dtype), precision),
+            ex_encode, "Value too large to be quantised at precision %g", precision);
+        _delta_encode(shuffled, words, nvalues, nmemb, 8);
+    }
+    else if(dtype[1] == 'i' || dtype[1] == 'u') {
+        _delta_encode(src, words, nvalues, nmemb, width);
+    }
+    else {
+        memcpy(words, src, nbytes);
+    }
+    _shuffle(words, shuffled, nvalues, width);
+    used = _big_lz_compress(shuffled, nbytes, dst);
+
+ex_encode:
+    free(shuffled);
+    free(words);
+ex_codec:
+    return used;
+}
+
+int
+big_codec_decode(const char * codec, double precision, const char * dtype, int nmemb, size_t nitems, const void * src, size_t srcsize, void * dst)
+{
+    const int width = _big_codec_word_width(codec, dtype);
+    const size_t nvalues = nitems * nmemb;
+    const size_t nbytes = nvalues * width;
+    unsigned char * words = NULL;
+    unsigned char * shuffled = NULL;
+    int rt = -1;
+
+    RAISEIF(width == 0, ex_codec, "Codec %s does not support dtype %s", codec, dtype);
+
+    words = malloc(nbytes + 1);
+    shuffled = malloc(nbytes + 1);
+
+    RAISEIF(0 != _big_lz_decompress(src, srcsize, shuffled, nbytes),
+        ex_decode, "Corrupted compressed data: %td bytes do not decode to %td bytes", srcsize, nbytes);
+    _unshuffle(shuffled, words, nvalues, width);
+
+    if(0 == strcmp(codec, BIG_CODEC_QUANTISE_LZ)) {
+        _delta_decode(words, shuffled, nvalues, nmemb, 8);
+        _dequantise((int64_t *) shuffled, dst, nvalues, big_file_dtype_itemsize(dtype), precision);
+    }
+    else if(dtype[1] == 'i' || dtype[1] == 'u') {
+        _delta_decode(words, dst, nvalues, nmemb, width);
+    }
+    else {
+        memcpy(dst, words, nbytes);
+    }
+    rt = 0;
+
+ex_decode:
+    free(shuffled);
+    free(words);
+ex_codec:
+    return rt;
+}
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <alloca.h>
 #include <string.h>
+#include <stdint.h>
 #include "bigfile-mpi.h"
 #include "bigfile-internal.h"
 #include "mp-mpiu.h"
@@ -555,13 +556,289 @@ big_block_mpi_write(BigBlock * block, BigBlockPtr * ptr, BigArray * array, int c
     return rt;
 }
 
+static int
+_big_block_mpi_read_compressed(BigBlock * block, BigBlockPtr * ptr, BigArray * array, int concurrency, MPI_Comm comm);
+
 int
 big_block_mpi_read(BigBlock * block, BigBlockPtr * ptr, BigArray * array, int concurrency, MPI_Comm comm)
 {
+    if(big_block_lookup_attr(block, "Codec"))
+        return _big_block_mpi_read_compressed(block, ptr, array, concurrency, comm);
     int rt = _throttle_action(comm, concurrency, block, ptr, array, big_block_read);
     return rt;
 }
 
+/* Rows per compressed chunk. Each rank compresses its data in chunks
+ * of at most this size, so that readers only decompress the chunks they need.*/
+#define CODEC_CHUNK_ITEMS (1 << 18)
+
+/* Copy a BigArray to a contiguous buffer in machine endianness; dtype is replaced by the native dtype. */
+static void *
+_big_array_to_native(BigArray * array, char * dtype, int * nmemb)
+{
+    char native[8];
+    _dtype_normalize(native, "u1");
+    _dtype_normalize(dtype, array->dtype);
+    dtype[0] = native[0];
+    *nmemb = array->ndim > 1 ? array->dims[1] : 1;
+
+    size_t localsize = array->dims[0];
+    void * buf = malloc(localsize * *nmemb * big_file_dtype_itemsize(dtype) + 1);
+    BigArray larray[1];
+    BigArrayIter iarray[1], ilarray[1];
+    big_array_init(larray, buf, dtype, 2, (size_t[]){localsize, *nmemb}, NULL);
+    big_array_iter_init(iarray, array);
+    big_array_iter_init(ilarray, larray);
+    _dtype_convert(ilarray, iarray, localsize * *nmemb);
+    return buf;
+}
+
+int
+big_file_mpi_write_block_compressed(BigFile * bf, const char * blockname, BigArray * array,
+    const char * codec, double precision, int Nfile, int concurrency, MPI_Comm comm)
+{
+    int rank, NTask, i;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &NTask);
+
+    char dtype[8];
+    int nmemb;
+    size_t localsize = array->dims[0];
+    void * src = _big_array_to_native(array, dtype, &nmemb);
+    const size_t rowsize = big_file_dtype_itemsize(dtype) * nmemb;
+
+    int nchunks = (localsize + CODEC_CHUNK_ITEMS - 1) / CODEC_CHUNK_ITEMS;
+    uint64_t * chunkitems = malloc(sizeof(uint64_t) * (nchunks + 1));
+    uint64_t * chunkbytes = malloc(sizeof(uint64_t) * (nchunks + 1));
+    size_t bound = 1;
+    for(i = 0; i < nchunks; i ++) {
+        chunkitems[i] = localsize - (size_t) i * CODEC_CHUNK_ITEMS;
+        if(chunkitems[i] > CODEC_CHUNK_ITEMS)
+            chunkitems[i] = CODEC_CHUNK_ITEMS;
+        bound += big_codec_bound(codec, dtype, nmemb, chunkitems[i]);
+    }
+
+    char * dst = malloc(bound);
+    size_t used = 0;
+    int rt = 0;
+    for(i = 0; i < nchunks; i ++) {
+        ptrdiff_t bytes = big_codec_encode(codec, precision, dtype, nmemb, chunkitems[i],
+                (char *) src + (size_t) i * CODEC_CHUNK_ITEMS * rowsize, dst + used, bound - used);
+        if(bytes < 0) {
+            rt = -1;
+            break;
+        }
+        chunkbytes[i] = bytes;
+        used += bytes;
+    }
+    free(src);
+    if(0 != (rt = big_file_mpi_broadcast_anyerror(rt, comm)))
+        goto ex_encode;
+
+    /* The chunk index of all ranks, in rank order, on the root. */
+    int * counts = malloc(sizeof(int) * NTask);
+    int * displs = malloc(sizeof(int) * (NTask + 1));
+    MPI_Allgather(&nchunks, 1, MPI_INT, counts, 1, MPI_INT, comm);
+    displs[0] = 0;
+    for(i = 0; i < NTask; i ++)
+        displs[i + 1] = displs[i] + counts[i];
+    const int totalchunks = displs[NTask];
+    /* One extra zero entry so that the attributes are never empty */
+    uint64_t * allitems = calloc(totalchunks + 1, sizeof(uint64_t));
+    uint64_t * allbytes = calloc(totalchunks + 1, sizeof(uint64_t));
+    MPI_Gatherv(chunkitems, nchunks, MPI_UINT64_T, allitems, counts, displs, MPI_UINT64_T, 0, comm);
+    MPI_Gatherv(chunkbytes, nchunks, MPI_UINT64_T, allbytes, counts, displs, MPI_UINT64_T, 0, comm);
+    free(displs);
+    free(counts);
+
+    uint64_t totalbytes = used, totalsize = localsize;
+    MPI_Allreduce(MPI_IN_PLACE, &totalbytes, 1, MPI_UINT64_T, MPI_SUM, comm);
+    MPI_Allreduce(MPI_IN_PLACE, &totalsize, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+    if(totalbytes == 0)
+        Nfile = 0;
+
+    BigBlock bb[1];
+    BigBlockPtr ptr[1];
+    if(0 != (rt = big_file_mpi_create_block(bf, bb, blockname, "u1", 1, Nfile, totalbytes, comm)))
+        goto ex_create;
+
+    if(rank == 0) {
+        const int nattr = totalchunks > 0 ? totalchunks : 1;
+        if((0 != big_block_set_attr(bb, "Codec", codec, "S1", strlen(codec))) ||
+           (0 != big_block_set_attr(bb, "CodecDType", dtype, "S1", strlen(dtype))) ||
+           (0 != big_block_set_attr(bb, "CodecNmemb", &nmemb, "i4", 1)) ||
+           (0 != big_block_set_attr(bb, "CodecSize", &totalsize, "u8", 1)) ||
+           (0 != big_block_set_attr(bb, "CodecPrecision", &precision, "f8", 1)) ||
+           (0 != big_block_set_attr(bb, "CodecChunkItems", allitems, "u8", nattr)) ||
+           (0 != big_block_set_attr(bb, "CodecChunkBytes", allbytes, "u8", nattr)))
+            rt = -1;
+    }
+    if(0 != (rt = big_file_mpi_broadcast_anyerror(rt, comm)))
+        goto ex_write;
+
+    BigArray carray[1];
+    big_array_init(carray, dst, "u1", 2, (size_t[]){used, 1}, NULL);
+    if((0 != (rt = big_block_seek(bb, ptr, 0))) ||
+       (0 != (rt = big_block_mpi_write(bb, ptr, carray, concurrency, comm))))
+        goto ex_write;
+
+    rt = big_block_mpi_close(bb, comm);
+    goto ex_create;
+
+ex_write:
+    big_block_mpi_close(bb, comm);
+ex_create:
+    free(allbytes);
+    free(allitems);
+ex_encode:
+    free(dst);
+    free(chunkbytes);
+    free(chunkitems);
+    return rt;
+}
+
+/* Read a string attribute into a null terminated buffer of size n*/
+static int
+_get_string_attr(BigBlock * block, const char * name, char * buf, size_t n)
+{
+    BigAttr * attr = big_block_lookup_attr(block, name);
+    RAISEIF(attr == NULL || attr->nmemb >= n, ex_attr, "Bad attribute %s in compressed block", name);
+    memcpy(buf, attr->data, attr->nmemb);
+    buf[attr->nmemb] = 0;
+    return 0;
+ex_attr:
+    return -1;
+}
+
+/* Read a compressed block: every rank reads and decodes only the chunks
+ * overlapping its rows. The position of ptr counts rows of the uncompressed block. */
+static int
+_big_block_mpi_read_compressed(BigBlock * block, BigBlockPtr * ptr, BigArray * array, int concurrency, MPI_Comm comm)
+{
+    int rank, NTask, i;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &NTask);
+    if(concurrency <= 0)
+        concurrency = NTask;
+
+    char codec[32], dtype[8], native[8];
+    int nmemb;
+    uint64_t totalsize;
+    double precision;
+    int rt = -1;
+    uint64_t * chunkitems = NULL, * chunkbytes = NULL;
+    char * cbuf = NULL, * dbuf = NULL, * out = NULL;
+
+    uint64_t localsize = array->dims[0];
+    uint64_t start = 0;
+    MPI_Exscan(&localsize, &start, 1, MPI_UINT64_T, MPI_SUM, comm);
+    if(rank == 0)
+        start = 0;
+    start += ptr->aoffset;
+
+    const BigAttr * items = big_block_lookup_attr(block, "CodecChunkItems");
+    const int nchunks = items ? items->nmemb : 0;
+    RAISEIF(0 != _get_string_attr(block, "Codec", codec, sizeof(codec)), ex_check, "Bad codec");
+    RAISEIF(0 != _get_string_attr(block, "CodecDType", dtype, sizeof(dtype)), ex_check, "Bad codec dtype");
+    RAISEIF((0 != big_block_get_attr(block, "CodecNmemb", &nmemb, "i4", 1)) ||
+            (0 != big_block_get_attr(block, "CodecSize", &totalsize, "u8", 1)) ||
+            (0 != big_block_get_attr(block, "CodecPrecision", &precision, "f8", 1)),
+            ex_check, "Missing codec attributes");
+    _dtype_normalize(native, "u1");
+    RAISEIF(dtype[0] != native[0], ex_check, "Compressed block of dtype %s has a different endianness from this machine", dtype);
+    RAISEIF((array->ndim > 1 ? array->dims[1] : 1) != nmemb, ex_check, "Compressed block has %d columns, but %td are requested", nmemb, array->dims[1]);
+    RAISEIF(start + localsize > totalsize, ex_check, "Reading beyond the end of compressed block of size %lu", (unsigned long) totalsize);
+
+    chunkitems = malloc(sizeof(uint64_t) * (nchunks + 1));
+    chunkbytes = malloc(sizeof(uint64_t) * (nchunks + 1));
+    RAISEIF((0 != big_block_get_attr(block, "CodecChunkItems", chunkitems, "u8", nchunks)) ||
+            (0 != big_block_get_attr(block, "CodecChunkBytes", chunkbytes, "u8", nchunks)),
+            ex_check, "Bad chunk index");
+    rt = 0;
+
+ex_check:
+    /* Ranks must agree before the collective reading rounds. */
+    if(0 != big_file_mpi_broadcast_anyerror(rt, comm)) {
+        rt = -1;
+        goto ex_read;
+    }
+    rt = -1;
+
+    const size_t rowsize = big_file_dtype_itemsize(dtype) * nmemb;
+    out = malloc(localsize * rowsize + 1);
+
+    /* Find the chunks overlapping [start, start + localsize) */
+    uint64_t chunkstart = 0, bytestart = 0;
+    int first = 0;
+    while(first < nchunks && chunkstart + chunkitems[first] <= start) {
+        chunkstart += chunkitems[first];
+        bytestart += chunkbytes[first];
+        first ++;
+    }
+    int last = first;
+    uint64_t readbytes = 0, readitems = 0;
+    while(last < nchunks && chunkstart + readitems < start + localsize) {
+        readitems += chunkitems[last];
+        readbytes += chunkbytes[last];
+        last ++;
+    }
+    cbuf = malloc(readbytes + 1);
+
+    /* Only concurrency ranks read at the same time. */
+    int round, readerr = 0;
+    for(round = 0; round < (NTask + concurrency - 1) / concurrency; round ++) {
+        MPI_Barrier(comm);
+        if(rank / concurrency != round || readbytes == 0) continue;
+        BigBlockPtr rptr[1];
+        BigArray carray[1];
+        big_array_init(carray, cbuf, "u1", 2, (size_t[]){readbytes, 1}, NULL);
+        if(0 != big_block_seek(block, rptr, bytestart) || 0 != big_block_read(block, rptr, carray))
+            readerr = 1;
+    }
+    if(readerr)
+        goto ex_read;
+
+    uint64_t cpos = 0;
+    for(i = first; i < last; i ++) {
+        dbuf = malloc(chunkitems[i] * rowsize + 1);
+        RAISEIF(0 != big_codec_decode(codec, precision, dtype, nmemb, chunkitems[i], cbuf + cpos, chunkbytes[i], dbuf),
+            ex_read, "Failed to decode chunk %d of compressed block", i);
+        /* Overlap of this chunk with the local rows */
+        uint64_t lo = chunkstart > start ? chunkstart : start;
+        uint64_t hi = chunkstart + chunkitems[i];
+        if(hi > start + localsize)
+            hi = start + localsize;
+        memcpy(out + (lo - start) * rowsize, dbuf + (lo - chunkstart) * rowsize, (hi - lo) * rowsize);
+        free(dbuf);
+        dbuf = NULL;
+        cpos += chunkbytes[i];
+        chunkstart += chunkitems[i];
+    }
+
+    BigArray larray[1];
+    BigArrayIter iarray[1], ilarray[1];
+    big_array_init(larray, out, dtype, 2, (size_t[]){localsize, nmemb}, NULL);
+    big_array_iter_init(iarray, array);
+    big_array_iter_init(ilarray, larray);
+    _dtype_convert(iarray, ilarray, localsize * nmemb);
+    rt = 0;
+
+ex_read:
+    free(dbuf);
+    free(cbuf);
+    free(out);
+    free(chunkbytes);
+    free(chunkitems);
+    rt = big_file_mpi_broadcast_anyerror(rt, comm);
+    if(rt == 0) {
+        MPI_Allreduce(MPI_IN_PLACE, &localsize, 1, MPI_UINT64_T, MPI_SUM, comm);
+        ptr->aoffset += localsize;
+    }
+    return rt;
+}
+
+
 
 int
 big_file_mpi_create_records(BigFile * bf,
@@ -128,6 +128,25 @@ int big_block_mpi_write(BigBlock * bb, BigBlockPtr * ptr, BigArray * array, int
  */
 int big_block_mpi_read(BigBlock * bb, BigBlockPtr * ptr, BigArray * array, int concurrency, MPI_Comm comm);
 
+/** Create a compressed block and write the data of a BigArray to it.
+ *
+ * The data of each rank is compressed in chunks with codec (see big_codec_encode) and
+ * stored in a block of dtype u1. The attributes Codec, CodecDType, CodecNmemb, CodecSize,
+ * CodecPrecision, CodecChunkItems and CodecChunkBytes describe the uncompressed data.
+ *
+ * big_block_mpi_read recognises compressed blocks and decompresses them transparently;
+ * for compressed blocks the read position counts rows of the uncompressed data.
+ *
+ * This is a collective MPI operation.
+ *
+ * @param codec - BIG_CODEC_SHUFFLE_LZ or BIG_CODEC_QUANTISE_LZ.
+ * @param precision - quantisation step of BIG_CODEC_QUANTISE_LZ.
+ * @param Nfile - Number of files of the block.
+ * @param concurrency - Max number of MPI ranks that issues write operation at the same time.
+ * @returns 0 if successful. */
+int big_file_mpi_write_block_compressed(BigFile * bf, const char * blockname, BigArray * array,
+    const char * codec, double precision, int Nfile, int concurrency, MPI_Comm comm);
+
 /** Flush the BigBlock 
  *
  *  Flush will write the attrset from root rank, and gather the checksums from all ranks.
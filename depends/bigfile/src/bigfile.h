@@ -250,6 +250,28 @@ int big_array_init(BigArray * array,
 int big_array_iter_init(BigArrayIter * iter, BigArray * array);
 void big_array_iter_advance(BigArrayIter * iter);
 
+/**
+ * Codecs for compressed blocks.
+ *
+ * BIG_CODEC_SHUFFLE_LZ is lossless: integer columns are delta coded, then all
+ * words are byte shuffled and LZ compressed.
+ * BIG_CODEC_QUANTISE_LZ is for floating point columns: values are rounded to the nearest
+ * integer multiple of precision (so the error is at most precision / 2) before
+ * being delta coded, shuffled and compressed.
+ *
+ * dtype must be a normalized dtype in machine endianness. src and dst hold
+ * nitems rows of nmemb columns in C order.
+ * */
+#define BIG_CODEC_SHUFFLE_LZ "shuffle-lz"
+#define BIG_CODEC_QUANTISE_LZ "quantise-lz"
+
+/* Size of the output buffer needed by big_codec_encode. */
+size_t big_codec_bound(const char * codec, const char * dtype, int nmemb, size_t nitems);
+/* Compress nitems rows from src to dst. Returns the number of bytes used, or -1 on error. (raises) */
+ptrdiff_t big_codec_encode(const char * codec, double precision, const char * dtype, int nmemb, size_t nitems, const void * src, void * dst, size_t dstsize);
+/* Decompress srcsize bytes from src to nitems rows in dst. Returns 0 on success. (raises) */
+int big_codec_decode(const char * codec, double precision, const char * dtype, int nmemb, size_t nitems, const void * src, size_t srcsize, void * dst);
+
 /**
  * Record is a composite of fields. Currently each field must be a scalar dtype.
  *
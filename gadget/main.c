@@ -40,10 +40,15 @@ int main(int argc, char **argv)
 {
     int NTask;
     int thread_provided;
-    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &thread_provided);
+    /* MPI_THREAD_MULTIPLE is only needed to overlap the PM and tree forces (PMOverlapThreads)
+     * and to write snapshots in the background (AsyncSnapshotMemory). The parameter file is read
+     * after MPI is initialised, so these features are enabled from the environment. */
+    const char * multiple = getenv("MP_GADGET_THREAD_MULTIPLE");
+    const int thread_required = (multiple && atoi(multiple)) ? MPI_THREAD_MULTIPLE : MPI_THREAD_FUNNELED;
+    MPI_Init_thread(&argc, &argv, thread_required, &thread_provided);
     MPI_Comm_size(MPI_COMM_WORLD, &NTask);
-    if(thread_provided != MPI_THREAD_FUNNELED)
-        message(1, "MPI_Init_thread returned %d != MPI_THREAD_FUNNELED\n", thread_provided);
+    if(thread_provided < thread_required)
+        message(1, "MPI_Init_thread returned %d < %d requested\n", thread_provided, thread_required);
 
     if(argc < 2)
     {
@@ -80,7 +85,8 @@ int main(int argc, char **argv)
 
     int ShowBacktrace;
     double MaxMemSizePerNode;
-    read_parameter_file(argv[1], &ShowBacktrace, &MaxMemSizePerNode);	/* ... read in parameters for this run */
+    int MemoryProfile;
+    read_parameter_file(argv[1], &ShowBacktrace, &MaxMemSizePerNode, &MemoryProfile);	/* ... read in parameters for this run */
 
     int RestartFlag, RestartSnapNum;
 
@@ -108,6 +114,8 @@ int main(int argc, char **argv)
 
     /*Initialize the memory manager*/
     mymalloc_init(MaxMemSizePerNode);
+    if(MemoryProfile && allocator_profile_enable(A_MAIN))
+        endrun(1, "Could not allocate the memory profile\n");
 
     /* Make sure memory has finished initialising on all ranks before doing more.
      * This may improve stability */
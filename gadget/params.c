@@ -21,6 +21,7 @@
 #include <libgadget/petaio.h>
 #include <libgadget/cooling_qso_lightup.h>
 #include <libgadget/metal_return.h>
+#include <libgadget/exchange.h>
 
 static int
 BlackHoleFeedbackMethodAction (ParameterSet * ps, char * name, void * data)
@@ -68,6 +69,8 @@ create_gadget_parameter_set()
     param_declare_string(ps, "EnergyFile", OPTIONAL, "energy.txt", "File to output energy statistics.");
     param_declare_int(ps,    "OutputEnergyDebug", OPTIONAL, 0, "Should we output energy statistics to energy.txt");
     param_declare_string(ps, "CpuFile", OPTIONAL, "cpu.txt", "File to output cpu usage information");
+    param_declare_string(ps, "TraceFile", OPTIONAL, "trace", "Directory for the per-rank timeline traces of the walltime clocks, in Chrome trace format.");
+    param_declare_int(ps, "TraceEvents", OPTIONAL, 0, "Number of walltime intervals each rank buffers between writes to TraceFile. 0 disables the trace.");
     param_declare_string(ps, "OutputList", REQUIRED, NULL, "List of output scale factors.");
 
     /*Cosmology parameters*/
@@ -89,6 +92,18 @@ create_gadget_parameter_set()
     param_declare_int(ps,    "OutputDebugFields", OPTIONAL, 0, "Save a large number of debug fields in snapshots.");
     param_declare_int(ps,    "ShowBacktrace", OPTIONAL, 1, "Print a backtrace on crash. Hangs on stampede.");
     param_declare_double(ps,    "MaxMemSizePerNode", OPTIONAL, 0.6, "Pre-allocate this much memory per computing node/ host, in MB. Passing < 1 allocates a fraction of total available memory per node, defaults to 0.6 available memory.");
+    static ParameterEnum MainArenaEnum [] = {
+        {"malloc", 0},
+        {"hugepages", ALLOC_ARENA_HUGEPAGES},
+        {"hugetlb", ALLOC_ARENA_HUGETLB},
+        {"firsttouch", ALLOC_ARENA_FIRSTTOUCH},
+        {NULL, 0},
+    };
+    param_declare_enum(ps, "MainMemoryArena", MainArenaEnum, OPTIONAL, "malloc",
+            "How to obtain the memory reserved by MaxMemSizePerNode. A comma separated list of: "
+            "hugepages, to map it with transparent huge pages; hugetlb, to map it from the explicit huge page pool, falling back to transparent huge pages; "
+            "firsttouch, to zero each allocation from all threads when it first reaches a page, so particles, tree and mesh are spread over the NUMA domains of a multi-socket node as the loops over them are. Or malloc, for none of these.");
+    param_declare_int(ps,    "MemoryProfile", OPTIONAL, 0, "Record the high-water marks of the main memory allocator: overall, for each timer phase and for each allocation, with the blocks live at the peak. A summary for each rank is appended to OutputDir/MemoryProfile/ at every snapshot. Useful for choosing MaxMemSizePerNode and PartAllocFactor.");
     param_declare_double(ps, "AutoSnapshotTime", OPTIONAL, 0, "Seconds after which to automatically generate a snapshot if nothing is output.");
 
     param_declare_double(ps, "TimeMax", OPTIONAL, 1.0, "Scale factor to end run.");
@@ -96,8 +111,21 @@ create_gadget_parameter_set()
 
     param_declare_int   (ps, "MaxDomainTimeBinDepth", OPTIONAL, 8, "Forces a domain decompositon every 2^MaxDomainTimeBinDepth timesteps.");
     param_declare_int   (ps, "DomainOverDecompositionFactor", OPTIONAL, -1, "Create on average this number of sub domains on a MPI rank. Higher numbers improve the load balancing. For optimal tree building efficiency, use one domain per thread (the default).");
+    param_declare_int   (ps, "DomainOverDecompositionSearch", OPTIONAL, 0, "If non-zero, time this many PM steps with each of DomainOverDecompositionFactor, twice it and half it (if at least 4) at the start of the run, taking turns step by step, then keep the fastest. The chosen factor is printed so it can be fixed for production runs.");
     param_declare_double(ps, "RandomParticleOffset", OPTIONAL, 8., "Internally shift the particles within a periodic box by a random fraction of a PM grid cell each domain decomposition, ensuring that tree openings are decorrelated between timesteps. This shift is subtracted before particles are saved.");
 
+    static ParameterEnum HierarchicalAlltoallvEnum [] = {
+        {"none", 0},
+        {"pm", ALLTOALLV_PM},
+        {"exchange", ALLTOALLV_EXCHANGE},
+        {"treewalk", ALLTOALLV_TREEWALK},
+        {"all", ALLTOALLV_PM | ALLTOALLV_EXCHANGE | ALLTOALLV_TREEWALK},
+        {NULL, 0},
+    };
+    param_declare_enum(ps, "HierarchicalAlltoallv", HierarchicalAlltoallvEnum, OPTIONAL, "none",
+            "Which all-to-all exchanges aggregate their messages through one leader rank per node, so that only the leaders talk between nodes. "
+            "Helps with many ranks per node. A comma separated list of pm, exchange and treewalk, or all or none.");
+    param_declare_int   (ps, "DomainExchangeDirectSend", OPTIONAL, 0, "Send exchanged particles directly from the particle table using MPI derived datatypes, rather than copying them into a send buffer. Only used when the incoming particles fit without a garbage collection.");
     param_declare_int   (ps, "DomainUseGlobalSorting", OPTIONAL, 1, "Determining the initial refinement of chunks globally. Enabling this produces better domains at costs of slowing down the domain decomposition.");
     param_declare_double(ps, "ErrTolIntAccuracy", OPTIONAL, 0.02, "Controls the length of the short-range timestep. Smaller values are shorter timesteps.");
     param_declare_double(ps, "ErrTolForceAcc", OPTIONAL, 0.002, "Force accuracy required from tree. Controls tree opening criteria. Lower values are more accurate.");
@@ -107,6 +135,11 @@ create_gadget_parameter_set()
     param_declare_double(ps, "Asmth", OPTIONAL, 1.5, "The scale of the short-range/long-range force split in units of FFT-mesh cells."
                                                       "Larger values suppresses grid anisotropy. ShortRangeForceWindowType = erfc supports any value. 'exact' only supports 1.5. ");
     param_declare_int(ps,    "Nmesh", OPTIONAL, -1, "Size of the PM grid on which to compute the long-range force.");
+    param_declare_int(ps,    "HighResNmesh", OPTIONAL, 0, "Size of a second, non-periodic PM grid placed around the high resolution particles of a zoom simulation. "
+                                                         "The grid is zero-padded, so the high resolution region covers half of it in each dimension. 0 disables the high resolution grid.");
+    param_declare_int(ps,    "HighResParticleTypes", OPTIONAL, 2, "Bitmask of the high resolution particle types, around which the high resolution PM grid is placed. All particles inside the grid are placed on it. Default is 2, ie, type 1 only.");
+    param_declare_int(ps,    "PMOverlapThreads", OPTIONAL, 0, "On PM steps, compute the PM force on this many OpenMP threads concurrently with the short-range tree force, which uses the remaining threads. "
+                                                             "The PM FFTs are then planned for this many threads. Needs MPI_THREAD_MULTIPLE: set MP_GADGET_THREAD_MULTIPLE=1 in the environment. 0 (default) computes the forces one after the other.");
 
     static ParameterEnum ShortRangeForceWindowTypeEnum [] = {
         {"exact", SHORTRANGE_FORCE_WINDOW_TYPE_EXACT},
@@ -137,6 +170,15 @@ create_gadget_parameter_set()
     param_declare_int(ps, "NumWriters", OPTIONAL, 0, "Max number of concurrent writer processes. 0 implies Number of Tasks; ");
     param_declare_int(ps, "MinNumWriters", OPTIONAL, 1, "Min number of concurrent writer processes. We increase number of Files to avoid too few writers. ");
     param_declare_int(ps, "WritersPerFile", OPTIONAL, 8, "Number of Writer groups assigned to a file; total number of writers is capped by NumWriters.");
+    param_declare_double(ps, "AsyncSnapshotMemory", OPTIONAL, 0, "Memory in MB per rank, in addition to MaxMemSizePerNode, for staging snapshots which are then written by a background thread while the simulation continues. "
+                                                                "Snapshots which do not fit are written synchronously. Needs MPI_THREAD_MULTIPLE: set MP_GADGET_THREAD_MULTIPLE=1 in the environment. 0 (default) writes all snapshots synchronously.");
+    param_declare_int(ps, "ReadIntoDomain", OPTIONAL, 0, "If 1, when reading a snapshot compute a Peano-Hilbert ordered placement of the particles from their positions first, "
+                                                     "and send every block to its destination rank as it is read. The first domain decomposition then moves few particles.");
+    param_declare_int(ps, "CompressIntegerBlocks", OPTIONAL, 0, "If 1, particle blocks of integer type (IDs, generations, ...) are written delta coded, byte shuffled and compressed. Compression is lossless and reading is transparent.");
+    param_declare_double(ps, "QuantisedPositionPrecision", OPTIONAL, 0, "If > 0, particle positions are written rounded to multiples of this length (internal units) and compressed. "
+                                                                   "This is lossy: restarting from such a snapshot is not bit-identical. 0 (default) writes positions exactly.");
+    param_declare_double(ps, "QuantisedVelocityPrecision", OPTIONAL, 0, "If > 0, particle velocities are written rounded to multiples of this velocity (internal units) and compressed. "
+                                                                   "This is lossy: restarting from such a snapshot is not bit-identical. 0 (default) writes velocities exactly.");
 
     param_declare_int(ps, "EnableAggregatedIO", OPTIONAL, 0, "Use the Aggregated IO policy for small data set (Experimental).");
     param_declare_int(ps, "AggregatedIOThreshold", OPTIONAL, 1024 * 1024 * 256, "Max number of bytes on a writer before reverting to throttled IO.");
@@ -181,6 +223,9 @@ create_gadget_parameter_set()
     param_declare_int(ps, "GravitySofteningGas", OPTIONAL, 1, "0 to use adaptive softening, where the gas softening is the smoothing length of the last step.");
 
     param_declare_int(ps, "ImportBufferBoost", OPTIONAL, 2, "Memory factor to allow for there being more particles imported during treewlk than exported. Increase this if code crashes during treewalk with out of memory.");
+    param_declare_int(ps, "TreeWalkAutoTune", OPTIONAL, 0, "Tune TreeWalkMaxChunkSize and TreeWalkBufferFraction at runtime, separately for each treewalk, by timing the first iteration of each treewalk every step. The chosen values are printed once tuning converges, so they can be fixed for production runs.");
+    param_declare_int(ps, "TreeWalkMaxChunkSize", OPTIONAL, 100, "Largest number of particles a thread takes from the treewalk queue at once. Larger chunks reduce contention, smaller chunks improve the thread balance.");
+    param_declare_double(ps, "TreeWalkBufferFraction", OPTIONAL, 1., "Fraction of the free memory used for the treewalk export buffer. Smaller buffers need more export iterations but send smaller messages.");
     param_declare_double(ps, "PartAllocFactor", OPTIONAL, 1.5, "Over-allocation factor of particles. The load can be imbalanced to allow for the work to be more balanced.");
     param_declare_double(ps, "TopNodeAllocFactor", OPTIONAL, 0.5, "Initial TopNode allocation as a fraction of maximum particle number.");
     param_declare_double(ps, "SlotsIncreaseFactor", OPTIONAL, 0.01, "Percentage factor to increase slot allocation by when requested.");
@@ -342,7 +387,7 @@ create_gadget_parameter_set()
  *  exactly once in the parameterfile, otherwise error messages are
  *  produced that complain about the missing parameters.
  */
-void read_parameter_file(char *fname, int * ShowBacktrace, double * MaxMemSizePerNode)
+void read_parameter_file(char *fname, int * ShowBacktrace, double * MaxMemSizePerNode, int * MemoryProfile)
 {
     ParameterSet * ps = create_gadget_parameter_set();
 
@@ -363,10 +408,13 @@ void read_parameter_file(char *fname, int * ShowBacktrace, double * MaxMemSizePe
     message(0, "----------------------------------------------\n");
 
     *ShowBacktrace = param_get_int(ps, "ShowBacktrace");
+    MPIU_Set_hierarchical_alltoallv(param_get_enum(ps, "HierarchicalAlltoallv"));
     *MaxMemSizePerNode = param_get_double(ps, "MaxMemSizePerNode");
     if(*MaxMemSizePerNode <= 1) {
         *MaxMemSizePerNode *= get_physmem_bytes() / (1024. * 1024.);
     }
+    *MemoryProfile = param_get_int(ps, "MemoryProfile");
+    mymalloc_set_arena_options(param_get_enum(ps, "MainMemoryArena"));
 
     /*Initialize per-module parameters.*/
     set_init_params(ps);
@@ -379,6 +427,7 @@ void read_parameter_file(char *fname, int * ShowBacktrace, double * MaxMemSizePe
     set_treewalk_params(ps);
     set_gravshort_tree_params(ps);
     set_domain_params(ps);
+    set_exchange_params(ps);
     set_sfr_params(ps);
     set_winds_params(ps);
     set_fof_params(ps);
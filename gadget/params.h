@@ -1,4 +1,4 @@
 #ifndef __GADGET_PARAMS_H
 #define __GADGET_PARAMS_H
-void read_parameter_file(char *fname, int * ShowBacktrace, double * MaxMemSizePerNode);
+void read_parameter_file(char *fname, int * ShowBacktrace, double * MaxMemSizePerNode, int * MemoryProfile);
 #endif
@@ -19,6 +19,75 @@
 
 static void print_spec(int ThisTask, const int Ngrid, struct genic_config All2, Cosmology * CP);
 
+/* Add thermal velocities to the particles of a grid. The random numbers are seeded
+ * by the x,y index of each column, so do not depend on the domain or slab decomposition.*/
+static void
+add_thermal_to_grid(struct thermalvel * therm, unsigned int * seedtable, IDGenerator * idgen, struct ic_part_data * ICP)
+{
+    int i;
+    gsl_rng * g_rng = gsl_rng_alloc(gsl_rng_ranlxd1);
+    /*Just in case*/
+    gsl_rng_set(g_rng, seedtable[0]);
+    for(i = 0; i < idgen->NumPart; i++) {
+         /*Find the slab, and reseed if it has zero z rank*/
+         if(i % idgen->Ngrid == 0) {
+              uint64_t id = idgen_create_id_from_index(idgen, i);
+              /*Seed the random number table with x,y index.*/
+              gsl_rng_set(g_rng, seedtable[id / idgen->Ngrid]);
+         }
+         add_thermal_speeds(therm, g_rng, ICP[i].Vel);
+    }
+    gsl_rng_free(g_rng);
+}
+
+/* Make, displace and write the particles of a grid, in NumSlabs slabs of x rows
+ * appended to the blocks in turn, so only one slab of particles is in memory at a time.
+ * The 2LPT source is made once for all slabs; each slab repeats the Fourier transforms of displacement_fields.
+ * If therm is not NULL thermal velocities are added, seeded by thermseed.*/
+static void
+make_grid_particles(PetaPM * pm, pfft_complex * noise_k, IDGenerator * idgen, const int NumSlabs,
+        enum TransferType Type, const int ptype, const double shift, const double mass, const uint64_t FirstID,
+        struct thermalvel * therm, const int thermseed, BigFile * bf, Cosmology * CP, const struct genic_config All2)
+{
+    const int64_t TotNumPart = (int64_t) idgen->Ngrid * idgen->Ngrid * idgen->Ngrid;
+    ICWriter writer;
+    open_particle_data(&writer, ptype, bf, TotNumPart, All2.SavePrePos, All2.NumFiles, All2.NumWriters);
+
+    pfft_complex * source_k = make_lpt2_source(pm, Type, noise_k, All2);
+    unsigned int * seedtable = NULL;
+    if(therm)
+        seedtable = init_rng(thermseed, idgen->Ngrid);
+    /*The largest slab*/
+    const int MaxSlabPart = (idgen->size[0] + NumSlabs - 1) / NumSlabs * idgen->size[1] * idgen->size[2];
+    struct ic_part_data * ICP = (struct ic_part_data *) mymalloc("PartTable", MaxSlabPart * sizeof(struct ic_part_data));
+
+    int islab;
+    for(islab = 0; islab < NumSlabs; islab++) {
+        IDGenerator slab[1];
+        idgen_init_slab(slab, idgen, islab, NumSlabs);
+        setup_grid(slab, shift, mass, ICP);
+
+        /*Write initial positions into ICP struct*/
+        int j, k;
+        for(j = 0; j < slab->NumPart; j++)
+            for(k = 0; k < 3; k++)
+                ICP[j].PrePos[k] = ICP[j].Pos[k];
+
+        displacement_fields(pm, Type, noise_k, source_k, ICP, slab->NumPart, CP, All2);
+        if(therm)
+            add_thermal_to_grid(therm, seedtable, slab, ICP);
+        append_particle_data(&writer, slab, FirstID, ICP);
+        if(NumSlabs > 1)
+            message(0, "Written slab %d of %d for type %d\n", islab + 1, NumSlabs, ptype);
+    }
+    myfree(ICP);
+    if(seedtable)
+        myfree(seedtable);
+    if(source_k)
+        myfree(source_k);
+    close_particle_data(&writer);
+}
+
 int main(int argc, char **argv)
 {
   int thread_provided, ThisTask;
@@ -126,115 +195,106 @@ int main(int argc, char **argv)
   idgen_init(idgen_cdm, pm, All2.Ngrid, All2.BoxSize);
   idgen_init(idgen_gas, pm, All2.NgridGas, All2.BoxSize);
 
-  int NumPartCDM = idgen_cdm->NumPart;
-  int NumPartGas = idgen_gas->NumPart;
+  /*Add a thermal velocity to WDM particles*/
+  struct thermalvel WDM;
+  if(All2.WDM_therm_mass > 0){
+      double v_th = WDM_V0(All2.TimeIC, All2.WDM_therm_mass, CP.Omega0 - CP.OmegaBaryon - get_omega_nu(&CP.ONu, 1), CP.HubbleParam, All2.UnitVelocity_in_cm_per_s);
+      if(!All2.UsePeculiarVelocity)
+         v_th /= sqrt(All2.TimeIC);
+      init_thermalvel(&WDM, v_th, 10000/v_th, 0);
+  }
+  struct thermalvel * WDMtherm = All2.WDM_therm_mass > 0 ? &WDM : NULL;
+
+  /* Glass particles need the whole table at once, both to make the glass and
+   * to evolve the CDM and gas glasses together, so only pure grids are made in slabs.*/
+  int NumSlabs = All2.NumSlabs;
+  if(NumSlabs > 1 && (All2.MakeGlassCDM || (All2.ProduceGas && All2.MakeGlassGas))) {
+      message(0, "Glass particles are made all at once: CDM and gas will not be made in %d slabs.\n", NumSlabs);
+      NumSlabs = 1;
+  }
 
-  /*Space for both CDM and baryons*/
-  struct ic_part_data * ICP = (struct ic_part_data *) mymalloc("PartTable", (NumPartCDM + All2.ProduceGas * NumPartGas)*sizeof(struct ic_part_data));
+  pfft_complex * noise_k = NULL;
 
-  /* If we have incoherent glass files, we need to store both the particle tables
-   * to ensure that there are no close particle pairs*/
-  /*Make the table for the CDM*/
-  if(!All2.MakeGlassCDM) {
-      setup_grid(idgen_cdm, shift_dm, mass[1], ICP);
-  } else {
-      setup_glass(idgen_cdm, pm, 0, GLASS_SEED_HASH(All2.Seed), mass[1], ICP, All2.UnitLength_in_cm, All2.OutputDir);
+  if(NumSlabs > 1) {
+      /* The Gaussian white noise is made once and shared by all species and slabs*/
+      noise_k = make_white_noise(pm, All2);
+      if(TotNumPart > 0)
+          make_grid_particles(pm, noise_k, idgen_cdm, NumSlabs, DMType, 1, shift_dm, mass[1], 0, WDMtherm, All2.Seed+1, &bf, &CP, All2);
+      if(All2.ProduceGas)
+          make_grid_particles(pm, noise_k, idgen_gas, NumSlabs, GasType, 0, shift_gas, mass[0], TotNumPart, NULL, 0, &bf, &CP, All2);
   }
-
-  /*Make the table for the baryons if we need, using the second half of the memory.*/
-  if(All2.ProduceGas) {
-    if(!All2.MakeGlassGas) {
-        setup_grid(idgen_gas, shift_gas, mass[0], ICP+NumPartCDM);
+  else {
+    int NumPartCDM = idgen_cdm->NumPart;
+    int NumPartGas = idgen_gas->NumPart;
+
+    /*Space for both CDM and baryons*/
+    struct ic_part_data * ICP = (struct ic_part_data *) mymalloc("PartTable", (NumPartCDM + All2.ProduceGas * NumPartGas)*sizeof(struct ic_part_data));
+
+    /* If we have incoherent glass files, we need to store both the particle tables
+     * to ensure that there are no close particle pairs*/
+    /*Make the table for the CDM*/
+    if(!All2.MakeGlassCDM) {
+        setup_grid(idgen_cdm, shift_dm, mass[1], ICP);
     } else {
-        setup_glass(idgen_gas, pm, 0, GLASS_SEED_HASH(All2.Seed + 1), mass[0], ICP+NumPartCDM, All2.UnitLength_in_cm, All2.OutputDir);
+        setup_glass(idgen_cdm, pm, 0, GLASS_SEED_HASH(All2.Seed), mass[1], ICP, All2.GlassP, All2.UnitLength_in_cm, All2.OutputDir);
     }
-    /*Do coherent glass evolution to avoid close pairs*/
-    if(All2.MakeGlassGas || All2.MakeGlassCDM)
-        glass_evolve(pm, 14, "powerspectrum-glass-tot", ICP, NumPartCDM+NumPartGas, All2.UnitLength_in_cm, All2.OutputDir);
-  }
 
-  /*Write initial positions into ICP struct (for CDM and gas)*/
-  int j,k;
-  for(j=0; j<NumPartCDM+NumPartGas; j++)
-      for(k=0; k<3; k++)
-          ICP[j].PrePos[k] = ICP[j].Pos[k];
-
-  if(NumPartCDM > 0) {
-    displacement_fields(pm, DMType, ICP, NumPartCDM, &CP, All2);
-
-    /*Add a thermal velocity to WDM particles*/
-    if(All2.WDM_therm_mass > 0){
-        int i;
-        double v_th = WDM_V0(All2.TimeIC, All2.WDM_therm_mass, CP.Omega0 - CP.OmegaBaryon - get_omega_nu(&CP.ONu, 1), CP.HubbleParam, All2.UnitVelocity_in_cm_per_s);
-        if(!All2.UsePeculiarVelocity)
-           v_th /= sqrt(All2.TimeIC);
-        struct thermalvel WDM;
-        init_thermalvel(&WDM, v_th, 10000/v_th, 0);
-        unsigned int * seedtable = init_rng(All2.Seed+1,All2.Ngrid);
-        gsl_rng * g_rng = gsl_rng_alloc(gsl_rng_ranlxd1);
-        /*Seed the random number table with the Id.*/
-        gsl_rng_set(g_rng, seedtable[0]);
-
-        for(i = 0; i < NumPartCDM; i++) {
-             /*Find the slab, and reseed if it has zero z rank*/
-             if(i % All2.Ngrid == 0) {
-                  uint64_t id = idgen_create_id_from_index(idgen_cdm, i);
-                  /*Seed the random number table with x,y index.*/
-                  gsl_rng_set(g_rng, seedtable[id / All2.Ngrid]);
-             }
-             add_thermal_speeds(&WDM, g_rng, ICP[i].Vel);
-        }
-        gsl_rng_free(g_rng);
-        myfree(seedtable);
+    /*Make the table for the baryons if we need, using the second half of the memory.*/
+    if(All2.ProduceGas) {
+      if(!All2.MakeGlassGas) {
+          setup_grid(idgen_gas, shift_gas, mass[0], ICP+NumPartCDM);
+      } else {
+          setup_glass(idgen_gas, pm, 0, GLASS_SEED_HASH(All2.Seed + 1), mass[0], ICP+NumPartCDM, All2.GlassP, All2.UnitLength_in_cm, All2.OutputDir);
+      }
+      /*Do coherent glass evolution to avoid close pairs*/
+      if(All2.MakeGlassGas || All2.MakeGlassCDM)
+          glass_evolve(pm, All2.GlassP, "powerspectrum-glass-tot", ICP, NumPartCDM+NumPartGas, All2.UnitLength_in_cm, All2.OutputDir);
     }
 
-    write_particle_data(idgen_cdm, 1, &bf, 0, All2.SavePrePos, All2.NumFiles, All2.NumWriters, ICP);
-  }
+    /*Write initial positions into ICP struct (for CDM and gas)*/
+    int j,k;
+    for(j=0; j<NumPartCDM+NumPartGas; j++)
+        for(k=0; k<3; k++)
+            ICP[j].PrePos[k] = ICP[j].Pos[k];
+
+    /* The Gaussian white noise is made once and shared by all species, which apply their own transfer functions.
+     * It is on the top of the stack, so the particle tables can be freed under it.*/
+    noise_k = make_white_noise(pm, All2);
+
+    if(NumPartCDM > 0) {
+      pfft_complex * source_k = make_lpt2_source(pm, DMType, noise_k, All2);
+      displacement_fields(pm, DMType, noise_k, source_k, ICP, NumPartCDM, &CP, All2);
+      if(source_k)
+          myfree(source_k);
+
+      if(WDMtherm) {
+          unsigned int * seedtable = init_rng(All2.Seed+1,All2.Ngrid);
+          add_thermal_to_grid(WDMtherm, seedtable, idgen_cdm, ICP);
+          myfree(seedtable);
+      }
 
-  /*Now make the gas if required*/
-  if(All2.ProduceGas) {
-    displacement_fields(pm, GasType, ICP+NumPartCDM, NumPartGas, &CP, All2);
-    write_particle_data(idgen_gas, 0, &bf, TotNumPart, All2.SavePrePos, All2.NumFiles, All2.NumWriters, ICP+NumPartCDM);
+      write_particle_data(idgen_cdm, 1, &bf, 0, All2.SavePrePos, All2.NumFiles, All2.NumWriters, ICP);
+    }
+
+    /*Now make the gas if required*/
+    if(All2.ProduceGas) {
+      pfft_complex * source_k = make_lpt2_source(pm, GasType, noise_k, All2);
+      displacement_fields(pm, GasType, noise_k, source_k, ICP+NumPartCDM, NumPartGas, &CP, All2);
+      if(source_k)
+          myfree(source_k);
+      write_particle_data(idgen_gas, 0, &bf, TotNumPart, All2.SavePrePos, All2.NumFiles, All2.NumWriters, ICP+NumPartCDM);
+    }
+    myfree(ICP);
   }
-  myfree(ICP);
 
   /*Now add random velocity neutrino particles*/
   if(All2.NGridNu > 0) {
-      int i;
       IDGenerator idgen_nu[1];
       idgen_init(idgen_nu, pm, All2.NGridNu, All2.BoxSize);
-
-      int NumPartNu = idgen_nu->NumPart;
-      ICP = (struct ic_part_data *) mymalloc("PartTable", NumPartNu*sizeof(struct ic_part_data));
-
-      NumPartNu = setup_grid(idgen_nu, shift_nu, mass[2], ICP);
-
-	  /*Write initial positions into ICP struct (for neutrinos)*/
-	  for(j=0; j<NumPartNu; j++)
-		  for(k=0; k<3; k++)
-		      ICP[j].PrePos[k] = ICP[j].Pos[k];
-
-      displacement_fields(pm, NuType, ICP, NumPartNu, &CP, All2);
-      unsigned int * seedtable = init_rng(All2.Seed+2,All2.NGridNu);
-      gsl_rng * g_rng = gsl_rng_alloc(gsl_rng_ranlxd1);
-      /*Just in case*/
-      gsl_rng_set(g_rng, seedtable[0]);
-      for(i = 0; i < NumPartNu; i++) {
-           /*Find the slab, and reseed if it has zero z rank*/
-           if(i % All2.NGridNu == 0) {
-                uint64_t id = idgen_create_id_from_index(idgen_nu, i);
-                /*Seed the random number table with x,y index.*/
-                gsl_rng_set(g_rng, seedtable[id / All2.NGridNu]);
-           }
-           add_thermal_speeds(&nu_therm, g_rng, ICP[i].Vel);
-      }
-      gsl_rng_free(g_rng);
-      myfree(seedtable);
-
-      write_particle_data(idgen_nu, 2, &bf, TotNumPart+TotNumPartGas, All2.SavePrePos, All2.NumFiles, All2.NumWriters, ICP);
-      myfree(ICP);
+      make_grid_particles(pm, noise_k, idgen_nu, All2.NumSlabs, NuType, 2, shift_nu, mass[2], TotNumPart+TotNumPartGas, &nu_therm, All2.Seed+2, &bf, &CP, All2);
   }
 
+  myfree(noise_k);
   petapm_destroy(pm);
   big_file_mpi_close(&bf, MPI_COMM_WORLD);
 
@@ -32,6 +32,9 @@ create_parameters(void)
     param_declare_int(ps, "Seed", REQUIRED, 0, "Random number generator seed used for the phases of the Gaussian random field.");
     param_declare_int(ps, "MakeGlassGas", OPTIONAL, -1, "Generate Glass IC for gas instead of Grid IC.");
     param_declare_int(ps, "MakeGlassCDM", OPTIONAL, 0, "Generate Glass IC for CDM instead of Grid IC.");
+    param_declare_int(ps, "GlassTree", OPTIONAL, 0, "Relax glasses with a TreePM force rather than the PM force alone. Resolves the interparticle scale, so the PM mesh need not be finer than the particle grid.");
+    param_declare_double(ps, "GlassPowerTol", OPTIONAL, 0, "Stop relaxing a glass once its power spectrum on large scales changes by less than this fraction in a step. If 0, always take GlassMaxSteps steps.");
+    param_declare_int(ps, "GlassMaxSteps", OPTIONAL, 14, "Maximum number of steps taken to relax a glass.");
 
     param_declare_int(ps, "UnitaryAmplitude", OPTIONAL, 1, "If 0, each Fourier mode in the initial power spectrum is scattered. If 1 each Fourier mode is not scattered and we generate unitary gaussians for the initial phases.");
     param_declare_int(ps, "WhichSpectrum", OPTIONAL, 2, "Type of spectrum, 2 for file ");
@@ -55,6 +58,8 @@ create_parameters(void)
     param_declare_int(ps, "SavePrePos", OPTIONAL, 1, "Save the pre-displacement positions in the snapshot.");
     param_declare_int(ps, "InvertPhase", OPTIONAL, 0, "Flip phase for paired simulation");
     param_declare_int(ps, "PrePosGridCenter", OPTIONAL, 0, "Set pre-displacement positions at the center of the grid");
+    param_declare_int(ps, "TwoLPT", OPTIONAL, 0, "Add second order Lagrangian perturbation theory (2LPT) displacements and velocities to the Zel'dovich ones, so the simulation can start at a lower redshift. Not applied to neutrino particles.");
+    param_declare_int(ps, "NumSlabs", OPTIONAL, 1, "Make and write the particles of each grid in this many slabs along x, so that only one slab of particles is in memory at a time. Each slab repeats the Fourier transforms, so more slabs use less memory but take longer. Glass particles are always made at once.");
     param_declare_int(ps, "ShowBacktrace", OPTIONAL, 1, "Print a backtrace on crash. Hangs on stampede.");
 
     param_declare_double(ps, "PrimordialAmp", OPTIONAL, 2.215e-9, "Ignored, but used by external CLASS script to set powr spectrum amplitude.");
@@ -153,6 +158,10 @@ void read_parameterfile(char *fname, struct genic_config * GenicConfig, int * Sh
     GenicConfig->UsePeculiarVelocity = param_get_int(ps, "UsePeculiarVelocity");
     GenicConfig->SavePrePos = param_get_int(ps, "SavePrePos");
     GenicConfig->PrePosGridCenter = param_get_int(ps, "PrePosGridCenter");
+    GenicConfig->TwoLPT = param_get_int(ps, "TwoLPT");
+    GenicConfig->NumSlabs = param_get_int(ps, "NumSlabs");
+    if(GenicConfig->NumSlabs < 1)
+        endrun(0, "NumSlabs = %d must be at least 1.\n", GenicConfig->NumSlabs);
     GenicConfig->BoxSize = param_get_double(ps, "BoxSize");
     GenicConfig->Nmesh = param_get_int(ps, "Nmesh");
     GenicConfig->Ngrid = param_get_int(ps, "Ngrid");
@@ -180,6 +189,9 @@ void read_parameterfile(char *fname, struct genic_config * GenicConfig, int * Sh
             GenicConfig->MakeGlassGas = 0;
     }
     GenicConfig->MakeGlassCDM = param_get_int(ps, "MakeGlassCDM");
+    GenicConfig->GlassP.UseTree = param_get_int(ps, "GlassTree");
+    GenicConfig->GlassP.PowerTol = param_get_double(ps, "GlassPowerTol");
+    GenicConfig->GlassP.MaxSteps = param_get_int(ps, "GlassMaxSteps");
 
     int64_t NumPartPerFile = param_get_int(ps, "NumPartPerFile");
 
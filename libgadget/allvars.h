@@ -113,6 +113,12 @@ extern struct global_data_all_processes
     } cf;
 
     int Nmesh;
+    /* Size of the zero-padded high resolution PM mesh for zoom simulations. 0 disables it. */
+    int HighResNmesh;
+    /* Bitmask of particle types placed on the high resolution PM mesh*/
+    int HighResParticleTypes;
+    /* Number of OpenMP threads computing the PM force concurrently with the short-range tree force. 0 disables the overlap. */
+    int PMOverlapThreads;
 
     /* variables that keep track of cumulative CPU consumption */
 
@@ -130,7 +136,11 @@ extern struct global_data_all_processes
          SnapshotFileBase[100],
          FOFFileBase[100],
          EnergyFile[100],
-         CpuFile[100];
+         CpuFile[100],
+         TraceFile[100];
+
+    /* Size of the per-rank ring buffer of walltime intervals written to TraceFile. 0 disables the trace.*/
+    int TraceEvents;
 
     /*Should we store the energy to EnergyFile on PM timesteps.*/
     int OutputEnergyDebug;
@@ -1181,6 +1181,7 @@ blackhole_feedback_ngbiter(TreeWalkQueryBHFeedback * I,
 
         BHP(other).SwallowTime = All.Time;
         P[other].Swallowed = 1;
+        slots_emit_change(other, PartManager);
         O->BH_CountProgs += BHP(other).CountProgs;
         O->BH_Mass += (BHP(other).Mass);
 
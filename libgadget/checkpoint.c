@@ -20,34 +20,99 @@
  *  This file delegates the functions to petaio and fof.
  */
 
+/* A snapshot being written in the background. It is only recorded in Snapshots.txt
+ * once complete, so a restart never finds a partial snapshot.*/
+static struct {
+    int snapnum;
+    double Time;
+    const char * OutputDir;
+} PendingSnapshot = {-1, 0, NULL};
+
+static void
+record_snapshot(int snapnum, double Time, const char * OutputDir)
+{
+    int ThisTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    if(ThisTask == 0) {
+        char * buf = fastpm_strdup_printf("%s/Snapshots.txt", OutputDir);
+        FILE * fd = fopen(buf, "a");
+        fprintf(fd, "%03d %g\n", snapnum, Time);
+        fclose(fd);
+        myfree(buf);
+    }
+}
+
+/* Append the memory high-water marks of this rank to OutputDir/MemoryProfile/<rank>,
+ * and report the largest peak, if the allocator profile is enabled.*/
+static void
+write_memory_profile(int snapnum, double Time, const char * OutputDir)
+{
+    if(!A_MAIN->profile)
+        return;
+    int ThisTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    char * buf = fastpm_strdup_printf("%s/MemoryProfile/%06X", OutputDir, ThisTask);
+    fastpm_path_ensure_dirname(buf);
+    FILE * fd = fopen(buf, "a");
+    if(!fd)
+        endrun(1, "Failed to open memory profile %s\n", buf);
+    fprintf(fd, "Snapshot %03d Time %g\n", snapnum, Time);
+    allocator_profile_report(A_MAIN, fd);
+    fprintf(fd, "\n");
+    fclose(fd);
+    myfree(buf);
+
+    struct {
+        double peak;
+        int rank;
+    } local = {allocator_profile_peak(A_MAIN), ThisTask}, global;
+    MPI_Allreduce(&local, &global, 1, MPI_DOUBLE_INT, MPI_MAXLOC, MPI_COMM_WORLD);
+    if(global.rank == ThisTask)
+        message(1, "Highest memory usage %g MB of %g MB, on this rank; see MemoryProfile/%06X\n",
+                global.peak / (1024. * 1024.), A_MAIN->size / (1024. * 1024.), ThisTask);
+}
+
 void
 write_checkpoint(int snapnum, int WriteSnapshot, int WriteGroupID, double Time, const char * OutputDir, const char * SnapshotFileBase, const int OutputDebugFields)
 {
     walltime_measure("/Misc");
     if(WriteSnapshot)
     {
+        /* The previous snapshot must be complete before we start another*/
+        wait_checkpoint();
         /* write snapshot of particles */
         struct IOTable IOTable = {0};
         register_io_blocks(&IOTable, WriteGroupID);
         if(OutputDebugFields)
             register_debug_io_blocks(&IOTable);
-        petaio_save_snapshot(&IOTable, 1, "%s/%s_%03d", OutputDir, SnapshotFileBase, snapnum);
+        int async = petaio_save_snapshot_async(&IOTable, 1, "%s/%s_%03d", OutputDir, SnapshotFileBase, snapnum);
 
         destroy_io_blocks(&IOTable);
         walltime_measure("/Snapshot/Write");
 
-        int ThisTask;
-        MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
-        if(ThisTask == 0) {
-            char * buf = fastpm_strdup_printf("%s/Snapshots.txt", OutputDir);
-            FILE * fd = fopen(buf, "a");
-            fprintf(fd, "%03d %g\n", snapnum, Time);
-            fclose(fd);
-            myfree(buf);
+        if(async) {
+            PendingSnapshot.snapnum = snapnum;
+            PendingSnapshot.Time = Time;
+            PendingSnapshot.OutputDir = OutputDir;
         }
+        else
+            record_snapshot(snapnum, Time, OutputDir);
+        write_memory_profile(snapnum, Time, OutputDir);
      }
 }
 
+void
+wait_checkpoint(void)
+{
+    if(PendingSnapshot.snapnum < 0)
+        return;
+    walltime_measure("/Misc");
+    petaio_wait_snapshot();
+    record_snapshot(PendingSnapshot.snapnum, PendingSnapshot.Time, PendingSnapshot.OutputDir);
+    PendingSnapshot.snapnum = -1;
+    walltime_measure("/Snapshot/Wait");
+}
+
 void
 dump_snapshot(const char * dump, const char * OutputDir)
 {
@@ -2,6 +2,9 @@
 #define CHECKPOINT_H
 
 void write_checkpoint(int snapnum, int WriteSnapshot, int WriteGroupID, double Time, const char * OutputDir, const char * SnapshotFileBase, const int OutputDebugFields);
+/* Wait until a snapshot written in the background by write_checkpoint is complete
+ * and record it for restarts. Collective.*/
+void wait_checkpoint(void);
 void dump_snapshot(const char * dump, const char * OutputDir);
 int find_last_snapnum(const char * OutputDir);
 
@@ -41,6 +41,19 @@
  */
 
 static DomainParams domain_params;
+
+/* State of the search over DomainOverDecompositionFactor during the first PM steps*/
+static struct OverDecompositionSearch
+{
+    int Factor[3];
+    double Time[3];
+    int NFactor;
+    /* Factor used by the PM step being timed and number of PM steps timed so far*/
+    int Current;
+    int NSteps;
+    int Started;
+    int Done;
+} OverDecompSearch;
 /**
  * Policy for domain decomposition.
  *
@@ -94,6 +107,7 @@ void set_domain_params(ParameterSet * ps)
             domain_params.DomainOverDecompositionFactor = 4;
         domain_params.TopNodeAllocFactor = param_get_double(ps, "TopNodeAllocFactor");
         domain_params.DomainUseGlobalSorting = param_get_int(ps, "DomainUseGlobalSorting");
+        domain_params.DomainOverDecompositionSearch = param_get_int(ps, "DomainOverDecompositionSearch");
         domain_params.SetAsideFactor = 1.;
         if((param_get_int(ps, "StarformationOn") && param_get_double(ps, "QuickLymanAlphaProbability") == 0.)
             || param_get_int(ps, "BlackHoleOn"))
@@ -102,6 +116,48 @@ void set_domain_params(ParameterSet * ps)
     MPI_Bcast(&domain_params, sizeof(DomainParams), MPI_BYTE, 0, MPI_COMM_WORLD);
 }
 
+/* Try DomainOverDecompositionFactor, twice it and half it for DomainOverDecompositionSearch PM steps each,
+ * then keep the fastest. The factors take turns, one PM step each, starting one later every round:
+ * the PM steps get slower as structure forms, and this gives every factor steps from the same time.
+ * The first PM step is not timed, as it includes the start up of the run.
+ * The step time is the maximum over ranks, so that all ranks choose the same factor.*/
+void
+domain_tune_overdecomposition(double steptime)
+{
+    struct OverDecompositionSearch * ss = &OverDecompSearch;
+    if(domain_params.DomainOverDecompositionSearch <= 0 || ss->Done)
+        return;
+    MPI_Allreduce(MPI_IN_PLACE, &steptime, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    if(!ss->Started) {
+        const int factor = domain_params.DomainOverDecompositionFactor;
+        ss->Factor[ss->NFactor++] = factor;
+        ss->Factor[ss->NFactor++] = 2 * factor;
+        if(factor / 2 >= 4)
+            ss->Factor[ss->NFactor++] = factor / 2;
+        ss->Started = 1;
+        return;
+    }
+    ss->Time[ss->Current] += steptime;
+    ss->NSteps++;
+    int i;
+    if(ss->NSteps < domain_params.DomainOverDecompositionSearch * ss->NFactor) {
+        const int round = ss->NSteps / ss->NFactor;
+        ss->Current = (ss->NSteps + round) % ss->NFactor;
+        domain_params.DomainOverDecompositionFactor = ss->Factor[ss->Current];
+        return;
+    }
+    int best = 0;
+    for(i = 0; i < ss->NFactor; i++) {
+        message(0, "DomainOverDecompositionFactor %d: %g s per PM step.\n",
+            ss->Factor[i], ss->Time[i] / domain_params.DomainOverDecompositionSearch);
+        if(ss->Time[i] < ss->Time[best])
+            best = i;
+    }
+    domain_params.DomainOverDecompositionFactor = ss->Factor[best];
+    ss->Done = 1;
+    message(0, "Chose DomainOverDecompositionFactor = %d.\n", ss->Factor[best]);
+}
+
 static int
 order_by_key(const void *a, const void *b);
 static void
@@ -57,6 +57,8 @@ typedef struct DomainParams
     double TopNodeAllocFactor;
     /** Fraction of local particle slots to leave free for, eg, star formation*/
     double SetAsideFactor;
+    /** Number of PM steps to time each trial DomainOverDecompositionFactor for, at the start of the run. 0 disables the search.*/
+    int DomainOverDecompositionSearch;
 } DomainParams;
 
 /*Set the parameters of the domain module*/
@@ -68,6 +70,9 @@ void set_domain_par(DomainParams dp);
 void domain_decompose_full(DomainDecomp * ddecomp);
 /* Exchange particles which have moved into the new domains, not re-doing the split unless we have to*/
 void domain_maintain(DomainDecomp * ddecomp, struct DriftData * drift);
+/* Time a PM step (including its domain decomposition) for the search over DomainOverDecompositionFactor,
+ * which changes the factor used by the next full decompositions. Does nothing once the search is done.*/
+void domain_tune_overdecomposition(double steptime);
 
 /** This function determines the TopLeaves entry for the given key.*/
 static inline int
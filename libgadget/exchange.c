@@ -10,6 +10,7 @@
 
 #include "utils.h"
 #include "utils/mpsort.h"
+#include "utils/paramset.h"
 
 /*Number of structure types for particles*/
 typedef struct {
@@ -19,6 +20,25 @@ typedef struct {
 
 static MPI_Datatype MPI_TYPE_PLAN_ENTRY = 0;
 
+static struct ExchangeParams exchange_params;
+
+/*Set the parameters of the exchange module*/
+void set_exchange_params(ParameterSet * ps)
+{
+    int ThisTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    if(ThisTask == 0) {
+        exchange_params.DirectSend = param_get_int(ps, "DomainExchangeDirectSend");
+    }
+    MPI_Bcast(&exchange_params, sizeof(struct ExchangeParams), MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+/* Test helper*/
+void set_exchange_par(struct ExchangeParams ep)
+{
+    exchange_params = ep;
+}
+
 /*Small struct to cache the layout function and particle data*/
 typedef struct {
     unsigned int ptype;
@@ -74,6 +94,17 @@ _transpose_plan_entries(ExchangePlanEntry * entries, int * count, int ptype, int
     }
 }
 
+/* Send the particle and slot buffers: optionally aggregated per node*/
+static void
+exchange_alltoallv(void * sendbuf, int * sendcnts, int * sdispls, MPI_Datatype sendtype,
+        void * recvbuf, int * recvcnts, int * rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    if(MPIU_Use_hierarchical_alltoallv(ALLTOALLV_EXCHANGE))
+        MPI_Alltoallv_hierarchical(sendbuf, sendcnts, sdispls, sendtype, recvbuf, recvcnts, rdispls, recvtype, comm);
+    else
+        MPI_Alltoallv_sparse(sendbuf, sendcnts, sdispls, sendtype, recvbuf, recvcnts, rdispls, recvtype, comm);
+}
+
 static ExchangePlan
 domain_init_exchangeplan(MPI_Comm Comm)
 {
@@ -192,9 +223,298 @@ shall_we_compact_slots(int * compact, ExchangePlan * plan, const struct slots_ma
     MPI_Allreduce(lcompact, compact, 6, MPI_INT, MPI_LOR, Comm);
 }
 
-static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_manager_type * pman, struct slots_manager_type * sman, MPI_Comm Comm)
+/* Work out where each thread writes its particles in the send buffers.
+ * The plan is split into nchunk contiguous chunks of chnk particles; chunk t writes
+ * its particles for each target after those of the lower chunks, so the buffers
+ * are ordered exactly as a serial pack would order them.
+ * Returns an array of nchunk * NTask entries, allocated on the top of the stack. */
+static ExchangePlanEntry *
+domain_pack_offsets(const ExchangePlan * plan, const int nchunk, const size_t chnk)
 {
+    const int NTask = plan->NTask;
+    ExchangePlanEntry * chunkOffset = (ExchangePlanEntry *) mymalloc2("chunkOffset", sizeof(ExchangePlanEntry) * NTask * nchunk);
+    memset(chunkOffset, 0, sizeof(ExchangePlanEntry) * NTask * nchunk);
+
+    int t;
+    #pragma omp parallel for
+    for(t = 0; t < nchunk; t++) {
+        ExchangePlanEntry * mine = chunkOffset + (size_t) t * NTask;
+        size_t n, end = (t + 1) * chnk;
+        if(end > plan->last)
+            end = plan->last;
+        for(n = t * chnk; n < end; n++) {
+            mine[plan->layouts[n].target].base++;
+            mine[plan->layouts[n].target].slots[plan->layouts[n].ptype]++;
+        }
+    }
+    /* Exclusive prefix sum over the chunks, starting from the offset of each target*/
+    int target;
+    #pragma omp parallel for
+    for(target = 0; target < NTask; target++) {
+        ExchangePlanEntry off;
+        memcpy(&off, &plan->toGoOffset[target], sizeof(off));
+        for(t = 0; t < nchunk; t++) {
+            ExchangePlanEntry * cur = &chunkOffset[(size_t) t * NTask + target];
+            int ptype, count = cur->base;
+            cur->base = off.base;
+            off.base += count;
+            for(ptype = 0; ptype < 6; ptype++) {
+                count = cur->slots[ptype];
+                cur->slots[ptype] = off.slots[ptype];
+                off.slots[ptype] += count;
+            }
+        }
+    }
+    return chunkOffset;
+}
+
+/* Number of pack chunks: one per thread.*/
+static int
+domain_pack_nchunk(const ExchangePlan * plan, size_t * chnk)
+{
+    int nchunk = omp_get_max_threads();
+    *chnk = plan->last / nchunk + 1;
+    return nchunk;
+}
+
+/* Copy the exported particles and their slots into the send buffers, ordered by target,
+ * and mark them as garbage. */
+static void
+domain_pack_buffers(const ExchangePlan * plan, struct particle_data * partBuf, char ** slotBuf, struct part_manager_type * pman, struct slots_manager_type * sman)
+{
+    size_t chnk;
+    const int nchunk = domain_pack_nchunk(plan, &chnk);
+    ExchangePlanEntry * chunkOffset = domain_pack_offsets(plan, nchunk, chnk);
+
+    int t;
+    #pragma omp parallel for
+    for(t = 0; t < nchunk; t++) {
+        ExchangePlanEntry * mine = chunkOffset + (size_t) t * plan->NTask;
+        size_t n, end = (t + 1) * chnk;
+        if(end > plan->last)
+            end = plan->last;
+        for(n = t * chnk; n < end; n++) {
+            const int i = plan->ExchangeList[n];
+            const int target = plan->layouts[n].target;
+            const int type = plan->layouts[n].ptype;
+            const size_t elsize = sman->info[type].elsize;
+            if(sman->info[type].enabled)
+                memcpy(slotBuf[type] + mine[target].slots[type] * elsize,
+                    (char*) sman->info[type].ptr + pman->Base[i].PI * elsize, elsize);
+            mine[target].slots[type]++;
+            memcpy(&partBuf[mine[target].base], pman->Base+i, sizeof(struct particle_data));
+            mine[target].base++;
+            /* mark the particle for removal. Both secondary and base slots will be marked. */
+            slots_mark_garbage(i, pman, sman);
+        }
+    }
+    myfree(chunkOffset);
+}
+
+/* Set the PI of the received particles, which are stored from pman->NumPart,
+ * to point at the received slots, which are stored from sman->info[ptype].size.
+ * Each source rank is independent. */
+static void
+domain_unpack_received(const ExchangePlan * plan, struct part_manager_type * pman, struct slots_manager_type * sman)
+{
+    int src;
+    #pragma omp parallel for schedule(dynamic)
+    for(src = 0; src < plan->NTask; src++) {
+        /* unpack each source rank */
+        int newPI[6];
+        int ptype;
+        int64_t i;
+        for(ptype = 0; ptype < 6; ptype ++) {
+            newPI[ptype] = sman->info[ptype].size + plan->toGetOffset[src].slots[ptype];
+        }
+
+        for(i = pman->NumPart + plan->toGetOffset[src].base;
+            i < pman->NumPart + plan->toGetOffset[src].base + plan->toGet[src].base;
+            i++) {
+
+            int ptype = pman->Base[i].Type;
+
+            pman->Base[i].PI = newPI[ptype];
+
+            newPI[ptype]++;
+
+            if(!sman->info[ptype].enabled) continue;
+
+            int PI = pman->Base[i].PI;
+            if(BASESLOT_PI(PI, ptype, sman)->ID != pman->Base[i].ID) {
+                endrun(1, "Exchange: P[%ld].ID = %ld (type %d) != SLOT ID = %ld. garbage: %d ReverseLink: %d\n",i,pman->Base[i].ID, pman->Base[i].Type, BASESLOT_PI(PI, ptype, sman)->ID, pman->Base[i].IsGarbage, BASESLOT_PI(PI, ptype, sman)->ReverseLink);
+            }
+        }
+        for(ptype = 0; ptype < 6; ptype ++) {
+            if(newPI[ptype] !=
+                sman->info[ptype].size + plan->toGetOffset[src].slots[ptype]
+              + plan->toGet[src].slots[ptype]) {
+                endrun(1, "N_slots mismatched\n");
+            }
+        }
+    }
+}
+
+/* Reserve the slots needed for the incoming particles. Returns the new number of particles.*/
+static int64_t
+domain_reserve_received(const ExchangePlan * plan, int64_t * newSlots, struct part_manager_type * pman, struct slots_manager_type * sman)
+{
+    int ptype;
+    int64_t newNumPart = pman->NumPart + plan->toGetSum.base;
+
+    for(ptype = 0; ptype < 6; ptype ++) {
+        newSlots[ptype] = 0;
+        if(!sman->info[ptype].enabled) continue;
+        newSlots[ptype] = sman->info[ptype].size + plan->toGetSum.slots[ptype];
+    }
+
+    if(newNumPart > pman->MaxPart) {
+        endrun(787878, "NumPart=%ld MaxPart=%ld\n", newNumPart, pman->MaxPart);
+    }
+
+    slots_reserve(1, newSlots, sman);
+    return newNumPart;
+}
+
+/* Build an MPI datatype selecting the elements at the (sorted) indices idx[0..n] of an array of oldtype.
+ * Consecutive indices are merged into one block, so for a Peano-sorted array, where the
+ * particles going to one rank are mostly contiguous, the type has few blocks.
+ * blocklen and displ are scratch space of length n.*/
+static MPI_Datatype
+domain_indexed_type(const int * idx, const int n, int * blocklen, int * displ, MPI_Datatype oldtype)
+{
+    int k, nblock = 0;
+    for(k = 0; k < n; k++) {
+        if(nblock > 0 && idx[k] == displ[nblock-1] + blocklen[nblock-1]) {
+            blocklen[nblock-1]++;
+            continue;
+        }
+        displ[nblock] = idx[k];
+        blocklen[nblock] = 1;
+        nblock++;
+    }
+    MPI_Datatype type;
+    MPI_Type_indexed(nblock, blocklen, displ, oldtype, &type);
+    MPI_Type_commit(&type);
+    return type;
+}
+
+/* Exchange without intermediate send buffers: the exported particles and slots are sent
+ * straight out of P and the slot arrays with indexed MPI datatypes,
+ * and received at the end of the arrays. Only valid if the incoming particles fit
+ * without a garbage collection. The exported particles are marked as garbage afterwards.*/
+static void
+domain_exchange_direct(ExchangePlan * plan, struct part_manager_type * pman, struct slots_manager_type * sman, MPI_Comm Comm)
+{
+    int ptype, target;
+    int * sendList = (int *) mymalloc2("sendList", sizeof(int) * (plan->toGoSum.base + 1));
+    int * slotList[6] = {NULL};
+    for(ptype = 0; ptype < 6; ptype++) {
+        if(!sman->info[ptype].enabled) continue;
+        slotList[ptype] = (int *) mymalloc2("slotList", sizeof(int) * (plan->toGoSum.slots[ptype] + 1));
+    }
+
+    /* Sort the particle and slot indices by target, keeping the particle order within a target*/
+    size_t chnk;
+    const int nchunk = domain_pack_nchunk(plan, &chnk);
+    ExchangePlanEntry * chunkOffset = domain_pack_offsets(plan, nchunk, chnk);
+    int t;
+    #pragma omp parallel for
+    for(t = 0; t < nchunk; t++) {
+        ExchangePlanEntry * mine = chunkOffset + (size_t) t * plan->NTask;
+        size_t n, end = (t + 1) * chnk;
+        if(end > plan->last)
+            end = plan->last;
+        for(n = t * chnk; n < end; n++) {
+            const int i = plan->ExchangeList[n];
+            const int target = plan->layouts[n].target;
+            const int type = plan->layouts[n].ptype;
+            if(sman->info[type].enabled)
+                slotList[type][mine[target].slots[type]] = pman->Base[i].PI;
+            mine[target].slots[type]++;
+            sendList[mine[target].base++] = i;
+        }
+    }
+    myfree(chunkOffset);
+    /* The slots may be reallocated below, so the layouts, which are above them, must go first.*/
+    myfree(plan->layouts);
+    walltime_measure("/Domain/exchange/makebuf");
+
+    int64_t newSlots[6];
+    const int64_t newNumPart = domain_reserve_received(plan, newSlots, pman, sman);
+
+    int maxsend = 1;
+    for(target = 0; target < plan->NTask; target++)
+        if(maxsend < plan->toGo[target].base)
+            maxsend = plan->toGo[target].base;
+    int * blocklen = (int *) mymalloc2("blocklen", sizeof(int) * maxsend);
+    int * displ = (int *) mymalloc2("displ", sizeof(int) * maxsend);
+
+    MPI_Request * requests = (MPI_Request *) mymalloc2("requests", sizeof(MPI_Request) * plan->NTask * 14);
+    MPI_Datatype * types = (MPI_Datatype *) mymalloc2("types", sizeof(MPI_Datatype) * plan->NTask * 7);
+    int nrequests = 0, ntypes = 0;
+
+    /* Post the receives: each source is contiguous at the end of P and of the slots */
+    for(target = 0; target < plan->NTask; target++) {
+        if(plan->toGet[target].base == 0) continue;
+        MPI_Irecv(pman->Base + pman->NumPart + plan->toGetOffset[target].base, plan->toGet[target].base,
+                MPI_TYPE_PARTICLE, target, 101935, Comm, &requests[nrequests++]);
+        for(ptype = 0; ptype < 6; ptype++) {
+            if(!sman->info[ptype].enabled || plan->toGet[target].slots[ptype] == 0) continue;
+            char * ptr = sman->info[ptype].ptr + (sman->info[ptype].size + plan->toGetOffset[target].slots[ptype]) * sman->info[ptype].elsize;
+            MPI_Irecv(ptr, plan->toGet[target].slots[ptype], MPI_TYPE_SLOT[ptype], target, 101936 + ptype, Comm, &requests[nrequests++]);
+        }
+    }
+
+    for(target = 0; target < plan->NTask; target++) {
+        if(plan->toGo[target].base == 0) continue;
+        types[ntypes] = domain_indexed_type(sendList + plan->toGoOffset[target].base, plan->toGo[target].base, blocklen, displ, MPI_TYPE_PARTICLE);
+        MPI_Isend(pman->Base, 1, types[ntypes], target, 101935, Comm, &requests[nrequests++]);
+        ntypes++;
+        for(ptype = 0; ptype < 6; ptype++) {
+            if(!sman->info[ptype].enabled || plan->toGo[target].slots[ptype] == 0) continue;
+            types[ntypes] = domain_indexed_type(slotList[ptype] + plan->toGoOffset[target].slots[ptype], plan->toGo[target].slots[ptype], blocklen, displ, MPI_TYPE_SLOT[ptype]);
+            MPI_Isend(sman->info[ptype].ptr, 1, types[ntypes], target, 101936 + ptype, Comm, &requests[nrequests++]);
+            ntypes++;
+        }
+    }
+
+    MPI_Waitall(nrequests, requests, MPI_STATUSES_IGNORE);
+
+    for(t = 0; t < ntypes; t++)
+        MPI_Type_free(&types[t]);
+
+    myfree(types);
+    myfree(requests);
+    myfree(displ);
+    myfree(blocklen);
+
+    /* Now the data has left, mark the exported particles for removal.*/
     size_t n;
+    #pragma omp parallel for
+    for(n = 0; n < plan->toGoSum.base; n++)
+        slots_mark_garbage(sendList[n], pman, sman);
+
+    for(ptype = 5; ptype >= 0; ptype--) {
+        if(!sman->info[ptype].enabled) continue;
+        myfree(slotList[ptype]);
+    }
+    myfree(sendList);
+
+    domain_unpack_received(plan, pman, sman);
+
+    walltime_measure("/Domain/exchange/alltoall");
+
+    pman->NumPart = newNumPart;
+
+    for(ptype = 0; ptype < 6; ptype++) {
+        if(!sman->info[ptype].enabled) continue;
+        sman->info[ptype].size = newSlots[ptype];
+    }
+}
+
+static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_manager_type * pman, struct slots_manager_type * sman, MPI_Comm Comm)
+{
     int ptype;
     struct particle_data *partBuf;
     char * slotBuf[6] = {NULL, NULL, NULL, NULL, NULL, NULL};
@@ -208,6 +528,24 @@ static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_mana
     if(MPIU_Any(needed > pman->MaxPart, Comm))
         return 1;
 
+    /* If the incoming particles fit without collecting the garbage first,
+     * we can send straight from P and skip the send buffers.*/
+    if(exchange_params.DirectSend && !MPIU_Any(pman->NumPart + plan->toGetSum.base > pman->MaxPart, Comm)) {
+        domain_exchange_direct(plan, pman, sman, Comm);
+        if(MPIU_Any(do_gc, Comm)) {
+            int compact[6] = {0};
+            shall_we_compact_slots(compact, plan, sman, Comm);
+            slots_gc(compact, pman, sman);
+            walltime_measure("/Domain/exchange/garbage");
+        }
+#ifdef DEBUG
+        domain_test_id_uniqueness(pman);
+        slots_check_id_consistency(pman, sman);
+#endif
+        walltime_measure("/Domain/exchange/finalize");
+        return 0;
+    }
+
     partBuf = (struct particle_data *) mymalloc2("partBuf", plan->toGoSum.base * sizeof(struct particle_data));
 
     for(ptype = 0; ptype < 6; ptype++) {
@@ -215,33 +553,9 @@ static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_mana
         slotBuf[ptype] = mymalloc2("SlotBuf", plan->toGoSum.slots[ptype] * sman->info[ptype].elsize);
     }
 
-    ExchangePlanEntry * toGoPtr = ta_malloc("toGoPtr", ExchangePlanEntry, plan->NTask);
-    memset(toGoPtr, 0, sizeof(toGoPtr[0]) * plan->NTask);
-
-    for(n = 0; n < plan->last; n++)
-    {
-        const int i = plan->ExchangeList[n];
-        /* preparing for export */
-        const int target = plan->layouts[n].target;
-
-        int type = plan->layouts[n].ptype;
-
-        /* watch out thread unsafe */
-        int bufPI = toGoPtr[target].slots[type];
-        toGoPtr[target].slots[type] ++;
-        size_t elsize = sman->info[type].elsize;
-        if(sman->info[type].enabled)
-            memcpy(slotBuf[type] + (bufPI + plan->toGoOffset[target].slots[type]) * elsize,
-                (char*) sman->info[type].ptr + pman->Base[i].PI * elsize, elsize);
-        /* now copy the base P; after PI has been updated */
-        memcpy(&(partBuf[plan->toGoOffset[target].base + toGoPtr[target].base]), pman->Base+i, sizeof(struct particle_data));
-        toGoPtr[target].base ++;
-        /* mark the particle for removal. Both secondary and base slots will be marked. */
-        slots_mark_garbage(i, pman, sman);
-    }
+    domain_pack_buffers(plan, partBuf, slotBuf, pman, sman);
 
     myfree(plan->layouts);
-    ta_free(toGoPtr);
     walltime_measure("/Domain/exchange/makebuf");
 
     /* Do a gc if we were asked to, or if we need one
@@ -256,20 +570,8 @@ static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_mana
         walltime_measure("/Domain/exchange/garbage");
     }
 
-    int64_t newNumPart;
-    int64_t newSlots[6] = {0};
-    newNumPart = pman->NumPart + plan->toGetSum.base;
-
-    for(ptype = 0; ptype < 6; ptype ++) {
-        if(!sman->info[ptype].enabled) continue;
-        newSlots[ptype] = sman->info[ptype].size + plan->toGetSum.slots[ptype];
-    }
-
-    if(newNumPart > pman->MaxPart) {
-        endrun(787878, "NumPart=%ld MaxPart=%ld\n", newNumPart, pman->MaxPart);
-    }
-
-    slots_reserve(1, newSlots, sman);
+    int64_t newSlots[6];
+    const int64_t newNumPart = domain_reserve_received(plan, newSlots, pman, sman);
 
     int * sendcounts = (int*) ta_malloc("sendcounts", int, plan->NTask);
     int * senddispls = (int*) ta_malloc("senddispls", int, plan->NTask);
@@ -282,7 +584,7 @@ static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_mana
     _transpose_plan_entries(plan->toGetOffset, recvdispls, -1, plan->NTask);
 
     /* recv at the end */
-    MPI_Alltoallv_sparse(partBuf, sendcounts, senddispls, MPI_TYPE_PARTICLE,
+    exchange_alltoallv(partBuf, sendcounts, senddispls, MPI_TYPE_PARTICLE,
                  pman->Base + pman->NumPart, recvcounts, recvdispls, MPI_TYPE_PARTICLE,
                  Comm);
 
@@ -299,47 +601,13 @@ static int domain_exchange_once(ExchangePlan * plan, int do_gc, struct part_mana
         _transpose_plan_entries(plan->toGetOffset, recvdispls, ptype, plan->NTask);
 
         /* recv at the end */
-        MPI_Alltoallv_sparse(slotBuf[ptype], sendcounts, senddispls, MPI_TYPE_SLOT[ptype],
+        exchange_alltoallv(slotBuf[ptype], sendcounts, senddispls, MPI_TYPE_SLOT[ptype],
                      ptr + N_slots * elsize,
                      recvcounts, recvdispls, MPI_TYPE_SLOT[ptype],
                      Comm);
     }
 
-    int src;
-    for(src = 0; src < plan->NTask; src++) {
-        /* unpack each source rank */
-        int newPI[6];
-        int64_t i;
-        for(ptype = 0; ptype < 6; ptype ++) {
-            newPI[ptype] = sman->info[ptype].size + plan->toGetOffset[src].slots[ptype];
-        }
-
-        for(i = pman->NumPart + plan->toGetOffset[src].base;
-            i < pman->NumPart + plan->toGetOffset[src].base + plan->toGet[src].base;
-            i++) {
-
-            int ptype = pman->Base[i].Type;
-
-
-            pman->Base[i].PI = newPI[ptype];
-
-            newPI[ptype]++;
-
-            if(!sman->info[ptype].enabled) continue;
-
-            int PI = pman->Base[i].PI;
-            if(BASESLOT_PI(PI, ptype, sman)->ID != pman->Base[i].ID) {
-                endrun(1, "Exchange: P[%d].ID = %ld (type %d) != SLOT ID = %ld. garbage: %d ReverseLink: %d\n",i,pman->Base[i].ID, pman->Base[i].Type, BASESLOT_PI(PI, ptype, sman)->ID, pman->Base[i].IsGarbage, BASESLOT_PI(PI, ptype, sman)->ReverseLink);
-            }
-        }
-        for(ptype = 0; ptype < 6; ptype ++) {
-            if(newPI[ptype] !=
-                sman->info[ptype].size + plan->toGetOffset[src].slots[ptype]
-              + plan->toGet[src].slots[ptype]) {
-                endrun(1, "N_slots mismatched\n");
-            }
-        }
-    }
+    domain_unpack_received(plan, pman, sman);
 
     walltime_measure("/Domain/exchange/alltoall");
 
@@ -445,6 +713,12 @@ domain_find_iter_space(ExchangePlan * plan, const struct part_manager_type * pma
 
     nlimit -= 4096 * 2 + plan->NTask * 2 * sizeof(MPI_Request);
 
+    /* Per-thread pack offsets*/
+    const size_t packoffsets = plan->NTask * omp_get_max_threads() * sizeof(ExchangePlanEntry) + 4096 * 2;
+    if (nlimit < packoffsets)
+        endrun(1, "Not enough memory free to store pack offsets!\n");
+    nlimit -= packoffsets;
+
     /* Save some memory for memory headers and wasted space at the end of each allocation.
      * Need max. 2*4096 for each heap-allocated array.*/
     nlimit -= 4096 * 4;
@@ -512,7 +786,8 @@ domain_build_plan(ExchangeLayoutFunc layoutfunc, const void * layout_userdata, E
         plan->toGo[plan->layouts[n].target].slots[plan->layouts[n].ptype]++;
     }
 
-    MPI_Alltoall(plan->toGo, 1, MPI_TYPE_PLAN_ENTRY, plan->toGet, 1, MPI_TYPE_PLAN_ENTRY, MPI_COMM_WORLD);
+    /* Each rank usually only exchanges with its neighbours in Peano order*/
+    MPI_Alltoall_sparse(plan->toGo, plan->toGet, MPI_TYPE_PLAN_ENTRY, MPI_COMM_WORLD);
 
     memset(&plan->toGoOffset[0], 0, sizeof(plan->toGoOffset[0]));
     memset(&plan->toGetOffset[0], 0, sizeof(plan->toGetOffset[0]));
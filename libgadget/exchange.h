@@ -5,8 +5,24 @@
 #include "slotsmanager.h"
 #include "drift.h"
 
+#include "utils/paramset.h"
+
 typedef int (*ExchangeLayoutFunc) (int p, const void * userdata);
 
+/*Parameters of the particle exchange, set by the input parameter file*/
+struct ExchangeParams
+{
+    /* If true, send particles straight from the particle table with indexed MPI datatypes
+     * when the incoming particles fit, instead of packing them into a send buffer.
+     * Works best when the particles are Peano-sorted, so those going to one rank are contiguous.*/
+    int DirectSend;
+};
+
+/*Set the parameters of the exchange module*/
+void set_exchange_params(ParameterSet * ps);
+/* Test helper*/
+void set_exchange_par(struct ExchangeParams ep);
+
 int domain_exchange(ExchangeLayoutFunc, const void * layout_userdata, int do_gc, struct DriftData * drift, struct part_manager_type * pman, struct slots_manager_type * sman, int maxiter, MPI_Comm Comm);
 void domain_test_id_uniqueness(struct part_manager_type * pman);
 
@@ -276,6 +276,8 @@ static void init_internal_node(struct NODE *nfreep, struct NODE *parent, int sub
     nfreep->f.InternalTopLevel = 0;
     nfreep->f.DependsOnLocalMass = 0;
     nfreep->f.ChildType = PARTICLE_NODE_TYPE;
+    nfreep->f.HighResMass = 0;
+    nfreep->f.LowResMass = 0;
     nfreep->f.unused = 0;
 
     for(j = 0; j < 3; j++) {
@@ -417,6 +419,8 @@ create_new_node_layer(int firstparent, int p_toplace,
         tb.Nodes[nprnt->s.suns[7]].sibling = nprnt->sibling;
         /* Zero the momenta for the parent*/
         memset(&nprnt->mom, 0, sizeof(nprnt->mom));
+        nprnt->f.HighResMass = 0;
+        nprnt->f.LowResMass = 0;
 
         /* Now try again to add the new particle*/
         int subnode = get_subnode(nprnt, p_toplace);
@@ -643,6 +647,8 @@ int force_tree_create_nodes(const ForceTree tb, const int npart, DomainDecomp *
         nfreep->f.InternalTopLevel = 0;
         nfreep->f.DependsOnLocalMass = 0;
         nfreep->f.ChildType = PARTICLE_NODE_TYPE;
+        nfreep->f.HighResMass = 0;
+        nfreep->f.LowResMass = 0;
         nfreep->f.unused = 0;
         memset(&(nfreep->mom.cofm),0,3*sizeof(MyFloat));
         nfreep->mom.mass = 0;
@@ -865,6 +871,11 @@ add_particle_moment_to_node(struct NODE * pnode, int i)
     pnode->mom.mass += (P[i].Mass);
     for(k=0; k<3; k++)
         pnode->mom.cofm[k] += (P[i].Mass * P[i].Pos[k]);
+    /* The short-range force window for a high resolution particle depends on where its sources were placed.*/
+    if(P[i].HighRes)
+        pnode->f.HighResMass = 1;
+    else
+        pnode->f.LowResMass = 1;
 
     if(P[i].Type == 0)
     {
@@ -999,6 +1010,8 @@ force_update_node_recursive(int no, int sib, int level, const ForceTree * tree)
         tree->Nodes[no].mom.cofm[2] += (tree->Nodes[p].mom.mass * tree->Nodes[p].mom.cofm[2]);
         if(tree->Nodes[p].mom.hmax > tree->Nodes[no].mom.hmax)
             tree->Nodes[no].mom.hmax = tree->Nodes[p].mom.hmax;
+        tree->Nodes[no].f.HighResMass |= tree->Nodes[p].f.HighResMass;
+        tree->Nodes[no].f.LowResMass |= tree->Nodes[p].f.LowResMass;
     }
 
     /*Set the center of mass moments*/
@@ -1064,6 +1077,8 @@ void force_exchange_pseudodata(ForceTree * tree, const DomainDecomp * ddecomp)
         MyFloat s[3];
         MyFloat mass;
         MyFloat hmax;
+        unsigned int HighResMass :1;
+        unsigned int LowResMass :1;
     }
     *TopLeafMoments;
 
@@ -1084,6 +1099,8 @@ void force_exchange_pseudodata(ForceTree * tree, const DomainDecomp * ddecomp)
         TopLeafMoments[i].s[2] = tree->Nodes[no].mom.cofm[2];
         TopLeafMoments[i].mass = tree->Nodes[no].mom.mass;
         TopLeafMoments[i].hmax = tree->Nodes[no].mom.hmax;
+        TopLeafMoments[i].HighResMass = tree->Nodes[no].f.HighResMass;
+        TopLeafMoments[i].LowResMass = tree->Nodes[no].f.LowResMass;
 
         /*Set the local base nodes dependence on local mass*/
         while(no >= 0)
@@ -1131,6 +1148,8 @@ void force_exchange_pseudodata(ForceTree * tree, const DomainDecomp * ddecomp)
             tree->Nodes[no].mom.cofm[2] = TopLeafMoments[i].s[2];
             tree->Nodes[no].mom.mass = TopLeafMoments[i].mass;
             tree->Nodes[no].mom.hmax = TopLeafMoments[i].hmax;
+            tree->Nodes[no].f.HighResMass = TopLeafMoments[i].HighResMass;
+            tree->Nodes[no].f.LowResMass = TopLeafMoments[i].LowResMass;
          }
     }
     myfree(TopLeafMoments);
@@ -1145,6 +1164,7 @@ void force_treeupdate_pseudos(int no, const ForceTree * tree)
     int j, p;
     MyFloat hmax;
     MyFloat s[3], mass;
+    int highres = 0, lowres = 0;
 
     mass = 0;
     s[0] = 0;
@@ -1180,6 +1200,8 @@ void force_treeupdate_pseudos(int no, const ForceTree * tree)
 
         if(tree->Nodes[p].mom.hmax > hmax)
             hmax = tree->Nodes[p].mom.hmax;
+        highres |= tree->Nodes[p].f.HighResMass;
+        lowres |= tree->Nodes[p].f.LowResMass;
 
         p = tree->Nodes[p].sibling;
     }
@@ -1203,6 +1225,8 @@ void force_treeupdate_pseudos(int no, const ForceTree * tree)
     tree->Nodes[no].mom.mass = mass;
 
     tree->Nodes[no].mom.hmax = hmax;
+    tree->Nodes[no].f.HighResMass = highres;
+    tree->Nodes[no].f.LowResMass = lowres;
 }
 
 /*! This function updates the hmax-values in tree nodes that hold SPH
@@ -41,7 +41,9 @@ struct NODE
         unsigned int DependsOnLocalMass :1;  /* Intersects with local mass */
         unsigned int ChildType :2; /* Specify the type of children this node has: particles, other nodes, or pseudo-particles.
                                     * (should be an enum, but not standard in C).*/
-        unsigned int unused : 3; /* Spare bits*/
+        unsigned int HighResMass :1; /* Contains mass placed on the high resolution PM mesh*/
+        unsigned int LowResMass :1; /* Contains mass not placed on the high resolution PM mesh*/
+        unsigned int unused : 1; /* Spare bits*/
     } f;
 
     struct {
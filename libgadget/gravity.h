@@ -25,6 +25,25 @@ enum ShortRangeForceWindowType {
     SHORTRANGE_FORCE_WINDOW_TYPE_ERFC = 1,
 };
 
+/* A second, non-periodic PM mesh placed around the high resolution particles of a zoom simulation.
+ * The mesh is zero-padded: the high resolution region covers the lower half of the mesh in each dimension.
+ * It computes the force between the high resolution split scale, Asmth high resolution cells,
+ * and the split scale of the periodic mesh. Every particle inside the region is placed on the mesh,
+ * and pairs of such particles use the high resolution split scale in the short-range tree.*/
+typedef struct {
+    /* Bitmask of the high resolution particle types, around which the region is placed. 0 if the mesh is disabled.*/
+    int ParticleTypes;
+    /* Force split scale of the periodic mesh, in internal length units.*/
+    double PeriodicSmth;
+    /* Lower corner and side length of the (cubic) high resolution region, in the internal periodic frame.
+     * Recomputed on every PM step.*/
+    double Origin[3];
+    double Size;
+    /* Size of the periodic box containing the region */
+    double BoxSize;
+    PetaPM pm[1];
+} GravPMHighRes;
+
 /* Fill the short-range gravity table*/
 void gravshort_fill_ntab(const enum ShortRangeForceWindowType ShortRangeForceWindowType, const double Asmth);
 
@@ -38,6 +57,20 @@ double FORCE_SOFTENING(int i, int type);
 /*Defined in gravpm.c*/
 void gravpm_init_periodic(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G);
 
+/* Initialise the non-periodic high resolution mesh, with HighResNmesh cells on the zero-padded mesh.
+ * The periodic mesh has Nmesh cells over BoxSize. */
+void gravpm_init_highres(GravPMHighRes * hr, double BoxSize, double Asmth, int Nmesh, int HighResNmesh, int ParticleTypes, double G);
+
+/* Place the high resolution region around the bounding box of the high resolution particles,
+ * and flag the particles inside it, which are placed on the mesh until the next call.
+ * Collective; must be called on PM steps before the tree is built, when all positions are synchronised.*/
+void gravpm_highres_set_region(GravPMHighRes * hr);
+
+/* Returns 1 if particle i was inside the high resolution region on the last PM step. hr may be NULL.*/
+int gravpm_is_highres_particle(const GravPMHighRes * hr, int i);
+
+void gravpm_destroy_highres(GravPMHighRes * hr);
+
 /* Apply the short-range window function, which includes the smoothing kernel.*/
 int grav_apply_short_range_window(double r, double * fac, double * pot, const double cellsize);
 
@@ -47,15 +80,29 @@ void set_gravshort_tree_params(ParameterSet * ps);
 void set_gravshort_treepar(struct gravshort_tree_params tree_params);
 struct gravshort_tree_params get_gravshort_treepar(void);
 
-/*Note: tree is rebuilt during this function*/
-void gravpm_force(PetaPM * pm, ForceTree * tree);
+/*Note: tree is freed during this function. hr is the high resolution mesh, which may be NULL.*/
+void gravpm_force(PetaPM * pm, GravPMHighRes * hr, ForceTree * tree);
+
+/* Computes the short-range force on the calling thread while gravpm_force is running*/
+typedef void (*gravpm_shortrange_func)(void * userdata);
+/* As gravpm_force, but the periodic PM force is computed by PMThreads OpenMP threads
+ * concurrently with shortrange(userdata), which gets the remaining threads.
+ * GravPM is only updated once both are done. Falls back to computing them
+ * one after the other if PMThreads is zero or the overlap is not possible.*/
+void gravpm_force_overlap(PetaPM * pm, GravPMHighRes * hr, ForceTree * tree, int PMThreads, gravpm_shortrange_func shortrange, void * userdata);
 
-void grav_short_pair(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, double Rcut, double rho0, int NeutrinoTracer, int FastParticleType);
-void grav_short_tree(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, double rho0, int NeutrinoTracer, int FastParticleType);
+void grav_short_pair(const ActiveParticles * act, PetaPM * pm, const GravPMHighRes * hr, ForceTree * tree, double Rcut, double rho0, int NeutrinoTracer, int FastParticleType);
+void grav_short_tree(const ActiveParticles * act, PetaPM * pm, const GravPMHighRes * hr, ForceTree * tree, double rho0, int NeutrinoTracer, int FastParticleType);
+/* Number of particle and node interactions evaluated on this rank by the last grav_short_tree*/
+int64_t grav_short_tree_interactions(void);
 
 /*Read the power spectrum, without changing the input value.*/
 void measure_power_spectrum(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value);
 
+/* Transfer function from the density to the long-range potential, smoothed on the scale pm->Asmth
+ * and CIC deconvolved. Also adds to the power spectrum in pm->ps, which must be allocated.*/
+void gravpm_potential_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value);
+
 /* Compute the power spectrum of the Fourier transformed grid in value.*/
 void powerspectrum_add_mode(Power * PowerSpectrum, const int64_t k2, const int kpos[3], pfft_complex * const value, const double invwindow, double Nmesh);
 
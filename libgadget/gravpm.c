@@ -20,7 +20,6 @@ static int pm_mark_region_for_node(int startno, int rid, int * RegionInd, const
 static void convert_node_to_region(PetaPM * pm, PetaPMRegion * r, struct NODE * Nodes);
 
 static int hybrid_nu_gravpm_is_active(int i);
-static void potential_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
 static void compute_neutrino_power(PetaPM * pm);
 static void force_x_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
 static void force_y_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
@@ -38,10 +37,23 @@ static PetaPMFunctions functions [] =
     {NULL, NULL, NULL},
 };
 
-static PetaPMGlobalFunctions global_functions = {NULL, NULL, potential_transfer};
+static PetaPMGlobalFunctions global_functions = {NULL, NULL, gravpm_potential_transfer};
 
 static PetaPMRegion * _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nregions);
 
+/* While the periodic PM force runs concurrently with the short-range force
+ * it is read out into these buffers, rather than the particle table.*/
+static struct {
+    MyFloat (*GravPM)[3];
+    MyFloat * Potential;
+} PMOverlap;
+
+static void potential_transfer_highres(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
+static PetaPMGlobalFunctions global_functions_highres = {NULL, NULL, potential_transfer_highres};
+
+static PetaPMRegion * _prepare_highres(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nregions);
+static void gravpm_force_highres(GravPMHighRes * hr, ForceTree * tree);
+
 void
 gravpm_init_periodic(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G) {
     petapm_init(pm, BoxSize, Asmth, Nmesh, G, MPI_COMM_WORLD);
@@ -54,10 +66,170 @@ gravpm_init_periodic(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, doubl
     }
 }
 
-/* Computes the gravitational force on the PM grid
- * and saves the total matter power spectrum.*/
 void
-gravpm_force(PetaPM * pm, ForceTree * tree) {
+gravpm_init_highres(GravPMHighRes * hr, double BoxSize, double Asmth, int Nmesh, int HighResNmesh, int ParticleTypes, double G)
+{
+    /* Need a few cells of padding around the particles*/
+    if(HighResNmesh <= 16)
+        endrun(0, "High resolution PM mesh needs more than 16 cells, not %d\n", HighResNmesh);
+    if(!ParticleTypes)
+        endrun(0, "High resolution PM mesh enabled, but no high resolution particle types set.\n");
+    hr->ParticleTypes = ParticleTypes;
+    hr->BoxSize = BoxSize;
+    hr->PeriodicSmth = Asmth * BoxSize / Nmesh;
+    hr->Size = BoxSize / 2.;
+    hr->Origin[0] = hr->Origin[1] = hr->Origin[2] = 0;
+    /* The box size is reset when the region is placed*/
+    petapm_init(hr->pm, BoxSize, Asmth, HighResNmesh, G, MPI_COMM_WORLD);
+}
+
+void
+gravpm_destroy_highres(GravPMHighRes * hr)
+{
+    if(!hr->ParticleTypes)
+        return;
+    petapm_destroy(hr->pm);
+    hr->ParticleTypes = 0;
+}
+
+/* Does this particle gravitate? Garbage and swallowed black holes do not.*/
+static int
+highres_gravitates(int i)
+{
+    return !(P[i].IsGarbage || (P[i].Type == 5 && P[i].Swallowed));
+}
+
+/* Is this particle of a high resolution type, around which the region is placed?*/
+static int
+highres_particle_type(const GravPMHighRes * hr, int i)
+{
+    if(!highres_gravitates(i))
+        return 0;
+    return (hr->ParticleTypes >> P[i].Type) & 1;
+}
+
+/* Position relative to the origin of the high resolution region, in [0, BoxSize).*/
+static double
+highres_relative_pos(const GravPMHighRes * hr, double x, int k)
+{
+    x -= hr->Origin[k];
+    if(x < 0)
+        x += hr->BoxSize;
+    if(x >= hr->BoxSize)
+        x -= hr->BoxSize;
+    return x;
+}
+
+int
+gravpm_is_highres_particle(const GravPMHighRes * hr, int i)
+{
+    if(!hr || !hr->ParticleTypes)
+        return 0;
+    return P[i].HighRes;
+}
+
+void
+gravpm_highres_set_region(GravPMHighRes * hr)
+{
+    if(!hr->ParticleTypes)
+        return;
+
+    int ThisTask, NTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+
+    const double BoxSize = hr->BoxSize;
+    /* Find a reference high resolution particle, so that we can measure
+     * the extent of the region in a frame where it does not wrap around the box.*/
+    int64_t i;
+    int first = -1;
+    for(i = 0; i < PartManager->NumPart; i++)
+        if(highres_particle_type(hr, i)) {
+            first = i;
+            break;
+        }
+    int root = first >= 0 ? ThisTask : NTask;
+    MPI_Allreduce(MPI_IN_PLACE, &root, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+    if(root == NTask)
+        endrun(0, "High resolution PM mesh enabled, but there are no particles of types %x\n", hr->ParticleTypes);
+
+    double ref[3] = {0};
+    if(ThisTask == root) {
+        int k;
+        for(k = 0; k < 3; k++)
+            ref[k] = P[first].Pos[k];
+    }
+    MPI_Bcast(ref, 3, MPI_DOUBLE, root, MPI_COMM_WORLD);
+
+    double xmin[3] = {0}, xmax[3] = {0};
+    for(i = 0; i < PartManager->NumPart; i++) {
+        if(!highres_particle_type(hr, i))
+            continue;
+        int k;
+        for(k = 0; k < 3; k++) {
+            double dx = NEAREST(P[i].Pos[k] - ref[k], BoxSize);
+            xmin[k] = DMIN(xmin[k], dx);
+            xmax[k] = DMAX(xmax[k], dx);
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, xmin, 3, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, xmax, 3, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+
+    double extent = 0;
+    int k;
+    for(k = 0; k < 3; k++)
+        extent = DMAX(extent, xmax[k] - xmin[k]);
+
+    /* Leave two cells of padding on each side of the particles for the CIC kernel:
+     * the region covers Nmesh / 2 cells of the padded mesh. */
+    const int Nmesh = hr->pm->Nmesh;
+    double Size = extent / (1 - 8. / Nmesh);
+    /* The transform is periodic on twice the region size. The images of the
+     * high resolution force kernel are at least Size away, so make sure the region
+     * is large enough that the kernel has fallen off by then, like the tree cutoff. */
+    struct gravshort_tree_params tp = get_gravshort_treepar();
+    const double minsize = DMAX(tp.Rcut, 4.5) * hr->PeriodicSmth;
+    if(Size < minsize)
+        Size = minsize;
+    if(Size > BoxSize / 2.)
+        endrun(0, "High resolution region of size %g is larger than half the box %g: use a periodic mesh instead.\n", Size, BoxSize);
+
+    hr->Size = Size;
+    for(k = 0; k < 3; k++) {
+        /* Centre the particles in the region*/
+        double origin = ref[k] + (xmin[k] + xmax[k]) / 2. - Size / 2.;
+        while(origin < 0)
+            origin += BoxSize;
+        while(origin >= BoxSize)
+            origin -= BoxSize;
+        hr->Origin[k] = origin;
+    }
+    petapm_set_nonperiodic_region(hr->pm, hr->Origin, 2 * Size, BoxSize);
+
+    /* Every particle inside the region is placed on the mesh, whatever its type,
+     * so the mesh has all the mass which the tree treats with the high resolution split.
+     * The flag is kept until the next PM step, as is the mesh force.*/
+    int64_t nhighres = 0;
+    #pragma omp parallel for reduction(+: nhighres)
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int inside = highres_gravitates(i);
+        int k;
+        for(k = 0; k < 3; k++)
+            if(highres_relative_pos(hr, P[i].Pos[k], k) >= Size)
+                inside = 0;
+        P[i].HighRes = inside;
+        nhighres += inside;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &nhighres, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+    message(0, "High resolution PM region: origin %g %g %g size %g, split scale %g (periodic %g), %ld particles\n",
+            hr->Origin[0], hr->Origin[1], hr->Origin[2], hr->Size, hr->pm->Asmth * hr->pm->CellSize, hr->PeriodicSmth, nhighres);
+}
+
+/* Computes the periodic PM force, readout into GravPM and Potential
+ * (or the overlap staging buffers).*/
+static void
+gravpm_force_periodic(PetaPM * pm, ForceTree * tree)
+{
     PetaPMParticleStruct pstruct = {
         P,
         sizeof(P[0]),
@@ -73,19 +245,18 @@ gravpm_force(PetaPM * pm, ForceTree * tree) {
     if(All.HybridNeutrinosOn && particle_nu_fraction(&All.CP.ONu.hybnu, All.Time, 0) == 0.)
         pstruct.active = &hybrid_nu_gravpm_is_active;
 
-    int i;
-    #pragma omp parallel for
-    for(i = 0; i < PartManager->NumPart; i++)
-    {
-        P[i].GravPM[0] = P[i].GravPM[1] = P[i].GravPM[2] = 0;
-    }
-
     /*
      * we apply potential transfer immediately after the R2C transform,
      * Therefore the force transfer functions are based on the potential,
      * not the density.
      * */
     petapm_force(pm, _prepare, &global_functions, functions, &pstruct, tree);
+}
+
+/* Sum, save and free the power spectrum measured by the periodic PM force.*/
+static void
+gravpm_save_power(PetaPM * pm)
+{
     powerspectrum_sum(pm->ps);
     /*Now save the power spectrum*/
     powerspectrum_save(pm->ps, All.OutputDir, "powerspectrum", All.Time, GrowthFactor(&All.CP, All.Time, 1.0));
@@ -94,7 +265,152 @@ gravpm_force(PetaPM * pm, ForceTree * tree) {
         powerspectrum_nu_save(pm->ps, All.OutputDir, "powerspectrum-nu", All.Time);
     /*We are done with the power spectrum, free it*/
     powerspectrum_free(pm->ps);
+}
+
+/* Computes the gravitational force on the PM grid
+ * and saves the total matter power spectrum.*/
+void
+gravpm_force(PetaPM * pm, GravPMHighRes * hr, ForceTree * tree) {
+    int i;
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i++)
+    {
+        P[i].GravPM[0] = P[i].GravPM[1] = P[i].GravPM[2] = 0;
+    }
+
+    /* The high resolution mesh goes first as it needs the tree,
+     * which is freed to save memory during the periodic PM step.*/
+    if(hr && hr->ParticleTypes)
+        gravpm_force_highres(hr, tree);
+
+    gravpm_force_periodic(pm, tree);
+    gravpm_save_power(pm);
+    walltime_measure("/LongRange");
+}
+
+/* Can the periodic PM force run concurrently with the short-range force?
+ * Collective, as both sides must agree on the communicator used by the PM.*/
+static int
+gravpm_can_overlap(PetaPM * pm, int PMThreads, size_t bytes)
+{
+    static int warned = 0;
+    char * reason = NULL;
+    int provided;
+    MPI_Query_thread(&provided);
+
+    if(PMThreads >= omp_get_max_threads())
+        reason = "not enough OpenMP threads";
+    else if(provided != MPI_THREAD_MULTIPLE)
+        reason = "MPI does not provide MPI_THREAD_MULTIPLE (set MP_GADGET_THREAD_MULTIPLE=1)";
+    /* The neutrino analysis communicates on MPI_COMM_WORLD from inside the PM force*/
+    else if(All.MassiveNuLinRespOn)
+        reason = "not supported with the neutrino linear response";
+    else if(MPIU_Any(bytes > mymalloc_freebytes() / 2, MPI_COMM_WORLD))
+        reason = "not enough memory";
+
+    if(reason && !warned) {
+        message(0, "Cannot compute the PM force concurrently with the short-range force: %s. Computing them one after the other.\n", reason);
+        warned = 1;
+    }
+    return reason == NULL;
+}
+
+void
+gravpm_force_overlap(PetaPM * pm, GravPMHighRes * hr, ForceTree * tree, int PMThreads, gravpm_shortrange_func shortrange, void * userdata)
+{
+    const size_t pmbytes = petapm_force_memory_estimate(pm, PartManager->NumPart);
+    const size_t stagebytes = PartManager->NumPart * 4 * sizeof(MyFloat);
+
+    if(PMThreads <= 0 || !gravpm_can_overlap(pm, PMThreads, pmbytes + stagebytes)) {
+        shortrange(userdata);
+        gravpm_force(pm, hr, tree);
+        return;
+    }
+
+    /* The tree walk reads GravPM from the last step for its opening criterion,
+     * and writes Potential: the PM force goes to staging buffers until both are done.*/
+    PMOverlap.GravPM = (MyFloat (*)[3]) mymalloc2("PMOverlapAcc", 3 * sizeof(MyFloat) * PartManager->NumPart);
+    PMOverlap.Potential = (MyFloat *) mymalloc2("PMOverlapPot", sizeof(MyFloat) * PartManager->NumPart);
+    memset(PMOverlap.GravPM, 0, 3 * sizeof(MyFloat) * PartManager->NumPart);
+    memset(PMOverlap.Potential, 0, sizeof(MyFloat) * PartManager->NumPart);
+
+    /* The PM thread allocates from its own arena and communicates
+     * on its own communicator, so neither interleaves with the tree walk.*/
+    Allocator pmalloc[1];
+    if(ALLOC_ENOMEMORY == allocator_init(pmalloc, "PMOVERLAP", pmbytes, 0, A_MAIN))
+        endrun(1, "Could not reserve %td bytes for the PM force\n", pmbytes);
+    MPI_Comm worldcomm = pm->comm;
+    MPI_Comm_dup(worldcomm, &pm->comm);
+
+    const int NThreads = omp_get_max_threads();
+    /* The FFTs of this PM force only get the PM threads*/
+    petapm_set_fft_threads(pm, PMThreads);
+    const int maxlevels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+
+    double tshort = 0, tpm = 0;
+    const double tstart = MPI_Wtime();
+    #pragma omp parallel num_threads(2)
+    {
+        /* If we did not get a second thread, do the two one after the other*/
+        const int concurrent = omp_get_num_threads() > 1;
+        if(omp_get_thread_num() == 0) {
+            omp_set_num_threads(concurrent ? NThreads - PMThreads : NThreads);
+            shortrange(userdata);
+            tshort = MPI_Wtime() - tstart;
+        }
+        if(omp_get_thread_num() == 1 || !concurrent) {
+            const double t0 = MPI_Wtime();
+            if(concurrent) {
+                omp_set_num_threads(PMThreads);
+                walltime_reset();
+            }
+            mymalloc_set_thread_allocator(pmalloc);
+            gravpm_force_periodic(pm, tree);
+            mymalloc_set_thread_allocator(NULL);
+            tpm = MPI_Wtime() - t0;
+        }
+    }
+    const double telapsed = MPI_Wtime() - tstart;
+    omp_set_max_active_levels(maxlevels);
+    /* The wait for the PM thread is in the clocks of the PM thread*/
+    walltime_measure(WALLTIME_IGNORE);
+
+    MPI_Comm_free(&pm->comm);
+    pm->comm = worldcomm;
+    petapm_set_fft_threads(pm, NThreads);
+
+    /* The power spectrum lives in the PM arena*/
+    gravpm_save_power(pm);
+    allocator_destroy(pmalloc);
+
+    int64_t i;
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int k;
+        for(k = 0; k < 3; k++)
+            P[i].GravPM[k] = PMOverlap.GravPM[i][k];
+        P[i].Potential += PMOverlap.Potential[i];
+    }
+    myfree(PMOverlap.Potential);
+    myfree(PMOverlap.GravPM);
+    PMOverlap.Potential = NULL;
+    PMOverlap.GravPM = NULL;
+
+    if(hr && hr->ParticleTypes)
+        gravpm_force_highres(hr, tree);
+
+    /*This is done to conserve memory after the PM step*/
+    if(force_tree_allocated(tree)) force_tree_free(tree);
+
     walltime_measure("/LongRange");
+    /* Both threads charge their own clocks, so the time they overlapped is counted twice.
+     * It is charged back to the PM clocks, negative, so the clocks still sum to the step time
+     * and /PMgrav is the PM time which was not hidden behind the tree walk.*/
+    double overlap = tshort + tpm - telapsed;
+    if(overlap < 0)
+        overlap = 0;
+    walltime_add("/PMgrav/Overlap", -overlap);
 }
 
 static PetaPMRegion * _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nregions) {
@@ -143,7 +459,7 @@ static PetaPMRegion * _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void
 
     *Nregions = r;
     int maxNregions;
-    MPI_Reduce(&r, &maxNregions, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    MPI_Reduce(&r, &maxNregions, 1, MPI_INT, MPI_MAX, 0, pm->comm);
     message(0, "max number of regions is %d\n", maxNregions);
 
     int64_t i;
@@ -179,8 +495,9 @@ static PetaPMRegion * _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void
     for(r =0; r < *Nregions; r++) {
         convert_node_to_region(pm, &regions[r], tree->Nodes);
     }
-    /*This is done to conserve memory during the PM step*/
-    if(force_tree_allocated(tree)) force_tree_free(tree);
+    /*This is done to conserve memory during the PM step,
+     * unless the short-range force is still walking the tree*/
+    if(!PMOverlap.GravPM && force_tree_allocated(tree)) force_tree_free(tree);
 
     /*Allocate memory for a power spectrum*/
     powerspectrum_alloc(pm->ps, pm->Nmesh, omp_get_max_threads(), All.MassiveNuLinRespOn, pm->BoxSize*All.UnitLength_in_cm);
@@ -189,6 +506,193 @@ static PetaPMRegion * _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void
     return regions;
 }
 
+/* userdata of the high resolution force, for the prepare and transfer functions*/
+struct HighResForceData {
+    const GravPMHighRes * hr;
+    ForceTree * tree;
+};
+
+static void
+gravpm_force_highres(GravPMHighRes * hr, ForceTree * tree)
+{
+    PetaPMParticleStruct pstruct = {
+        P,
+        sizeof(P[0]),
+        (char*) &P[0].Pos[0]  - (char*) P,
+        (char*) &P[0].Mass  - (char*) P,
+        /* Regions allocated inside _prepare_highres*/
+        NULL,
+        /* Particles outside the high resolution region have no region*/
+        NULL,
+        PartManager->NumPart,
+    };
+    struct HighResForceData data = {hr, tree};
+    petapm_force(hr->pm, _prepare_highres, &global_functions_highres, functions, &pstruct, &data);
+    walltime_measure("/LongRange/HighRes");
+}
+
+/* Does the tree node overlap the high resolution region?*/
+static int
+highres_node_overlaps(const GravPMHighRes * hr, const struct NODE * node)
+{
+    int k;
+    for(k = 0; k < 3; k++) {
+        /* Distance from the region centre*/
+        double dx = NEAREST(node->center[k] - (hr->Origin[k] + hr->Size / 2.), hr->BoxSize);
+        if(fabs(dx) > (node->len + hr->Size) / 2.)
+            return 0;
+    }
+    return 1;
+}
+
+/* Walks the tree to find nodes containing local mass which overlap the high resolution region.
+ * Unlike the periodic mesh, top leaves are opened, so that regions stay small.
+ * Returns the number of regions found. If regions is not NULL, they are stored. */
+static int
+highres_find_regions(const GravPMHighRes * hr, const ForceTree * tree, PetaPMRegion * regions)
+{
+    int r = 0;
+    int no = tree->firstnode;
+    while(no >= 0) {
+        const struct NODE * nop = &tree->Nodes[no];
+        /* Only top level nodes have DependsOnLocalMass set: nodes below a top leaf are all local*/
+        if((nop->f.TopLevel && !nop->f.DependsOnLocalMass) || !highres_node_overlaps(hr, nop)) {
+            no = nop->sibling;
+            continue;
+        }
+        if(nop->len <= hr->pm->CellSize * 24 || nop->f.ChildType != NODE_NODE_TYPE) {
+            if(regions)
+                regions[r].no = no;
+            r++;
+            no = nop->sibling;
+            continue;
+        }
+        no = nop->s.suns[0];
+    }
+    return r;
+}
+
+/* Mark the particles in the node which are inside the high resolution region to the mesh region and
+ * size the region to fit them. Returns the number of particles marked.*/
+static int
+highres_mark_region_for_node(const GravPMHighRes * hr, PetaPMRegion * region, int rid, int * RegionInd, const ForceTree * tree)
+{
+    const PetaPM * pm = hr->pm;
+    int numpart = 0;
+    int cmin[3] = {pm->Nmesh, pm->Nmesh, pm->Nmesh};
+    int cmax[3] = {-1, -1, -1};
+    int no = region->no;
+    int endno = tree->Nodes[region->no].sibling;
+    while(no >= 0 && no != endno)
+    {
+        const struct NODE * nop = &tree->Nodes[no];
+        if(nop->f.ChildType == PARTICLE_NODE_TYPE) {
+            int i;
+            for(i = 0; i < nop->s.noccupied; i++) {
+                int p = nop->s.suns[i];
+                if(!gravpm_is_highres_particle(hr, p))
+                    continue;
+                RegionInd[p] = rid;
+                numpart++;
+                int k;
+                for(k = 0; k < 3; k++) {
+                    int cell = floor(highres_relative_pos(hr, P[p].Pos[k], k) / pm->CellSize);
+                    if(cell < cmin[k])
+                        cmin[k] = cell;
+                    if(cell > cmax[k])
+                        cmax[k] = cell;
+                }
+            }
+            no = nop->sibling;
+        }
+        else if(nop->f.ChildType == PSEUDO_NODE_TYPE)
+            no = nop->sibling;
+        else if(nop->f.ChildType == NODE_NODE_TYPE)
+            no = nop->s.suns[0];
+        else
+            endrun(122, "Unrecognised Node type %d, memory corruption!\n", nop->f.ChildType);
+    }
+    int k;
+    for(k = 0; k < 3; k ++) {
+        if(numpart == 0) {
+            region->offset[k] = 0;
+            region->size[k] = 0;
+        }
+        else {
+            region->offset[k] = cmin[k];
+            /* One extra cell for the CIC kernel and one so the particle is strictly inside.*/
+            region->size[k] = cmax[k] - cmin[k] + 2;
+        }
+        region->center[k] = tree->Nodes[region->no].center[k];
+    }
+    region->len = tree->Nodes[region->no].len;
+    region->numpart = numpart;
+    return numpart;
+}
+
+static PetaPMRegion * _prepare_highres(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nregions)
+{
+    struct HighResForceData * data = (struct HighResForceData *) userdata;
+    const GravPMHighRes * hr = data->hr;
+    const ForceTree * tree = data->tree;
+
+    if(!force_tree_allocated(tree))
+        endrun(5, "High resolution PM needs the tree\n");
+
+    int Nalloc = highres_find_regions(hr, tree, NULL);
+    PetaPMRegion * regions = mymalloc2("Regions", sizeof(PetaPMRegion) * (Nalloc + 1));
+    highres_find_regions(hr, tree, regions);
+
+    pstruct->RegionInd = mymalloc2("RegionInd", PartManager->NumPart * sizeof(int));
+    int64_t i;
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i ++)
+        pstruct->RegionInd[i] = -1;
+
+    int64_t numpart = 0;
+    int r;
+    #pragma omp parallel for reduction(+: numpart)
+    for(r = 0; r < Nalloc; r++)
+        numpart += highres_mark_region_for_node(hr, &regions[r], r, pstruct->RegionInd, tree);
+
+    int64_t numhighres = 0;
+    #pragma omp parallel for reduction(+: numhighres)
+    for(i = 0; i < PartManager->NumPart; i ++)
+        numhighres += gravpm_is_highres_particle(hr, i);
+
+    if(numpart != numhighres)
+        endrun(1, "Placed only %ld high resolution particles out of %ld on the mesh. Are they all in the tree?\n", numpart, numhighres);
+
+    /* Remove regions which contain no high resolution particles*/
+    int * newind = ta_malloc("newind", int, Nalloc + 1);
+    int nr = 0;
+    for(r = 0; r < Nalloc; r++) {
+        if(regions[r].numpart == 0) {
+            newind[r] = -1;
+            continue;
+        }
+        newind[r] = nr;
+        regions[nr] = regions[r];
+        nr++;
+    }
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i ++)
+        if(pstruct->RegionInd[i] >= 0)
+            pstruct->RegionInd[i] = newind[pstruct->RegionInd[i]];
+    ta_free(newind);
+
+    for(r = 0; r < nr; r++)
+        petapm_region_init_strides(&regions[r]);
+
+    *Nregions = nr;
+    int maxNregions;
+    MPI_Reduce(&nr, &maxNregions, 1, MPI_INT, MPI_MAX, 0, MPI_COMM_WORLD);
+    message(0, "max number of high resolution regions is %d\n", maxNregions);
+
+    walltime_measure("/PMgrav/Regions");
+    return regions;
+}
+
 static int pm_mark_region_for_node(int startno, int rid, int * RegionInd, const ForceTree * tree) {
     int numpart = 0;
     int no = startno;
@@ -283,7 +787,7 @@ static double sinc_unnormed(double x) {
 /* Update the model prediction of LinResp neutrino power spectrum.
  * This should happen after the CFT is computed,
  * and after powerspectrum_add_mode() has been called,
- * but before potential_transfer is called.*/
+ * but before gravpm_potential_transfer is called.*/
 static void compute_neutrino_power(PetaPM * pm) {
     if(!All.MassiveNuLinRespOn)
         return;
@@ -361,8 +865,8 @@ measure_power_spectrum(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value
     powerspectrum_add_mode(pm->ps, k2, kpos, value, f, pm->Nmesh);
 }
 
-static void
-potential_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value)
+void
+gravpm_potential_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value)
 {
     const double asmth2 = pow((2 * M_PI) * pm->Asmth / pm->Nmesh,2);
     double f = 1.0;
@@ -434,6 +938,35 @@ potential_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value)
     value[0][1] *= fac;
 }
 
+/* Green's function of the high resolution mesh. This is the difference between the
+ * Gaussian-smoothed potential at the high resolution and the periodic split scales, so the mesh
+ * contains the force between the two scales. Images from the periodic transform are at least
+ * half the (padded) mesh away, where this kernel has fallen off. */
+static void
+potential_transfer_highres(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *value)
+{
+    const GravPMHighRes * hr = ((struct HighResForceData *) pm->userdata)->hr;
+    const double asmth2 = pow((2 * M_PI) * pm->Asmth / pm->Nmesh, 2);
+    const double lrsmth2 = pow((2 * M_PI) * hr->PeriodicSmth / pm->BoxSize, 2);
+    /* The k -> 0 limit is finite: the mean is not removed for an isolated mesh.*/
+    double smth = lrsmth2 - asmth2;
+    if(k2 > 0)
+        smth = (exp(-k2 * asmth2) - exp(-k2 * lrsmth2)) / k2;
+    const double pot_factor = - pm->G / (M_PI * pm->BoxSize);	/* to get potential */
+
+    /* CIC deconvolution, as for the periodic mesh*/
+    double f = 1.0;
+    int k;
+    for(k = 0; k < 3; k ++) {
+        double tmp = (kpos[k] * M_PI) / pm->Nmesh;
+        tmp = sinc_unnormed(tmp);
+        f *= 1. / (tmp * tmp);
+    }
+    const double fac = pot_factor * smth * f * f;
+    value[0][0] *= fac;
+    value[0][1] *= fac;
+}
+
 /* the transfer functions for force in fourier space applied to potential */
 /* super lanzcos in CH6 P 122 Digital Filters by Richard W. Hamming */
 static double diff_kernel(double w) {
@@ -478,14 +1011,19 @@ static void force_z_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex
     force_transfer(pm, kpos[2], value);
 }
 static void readout_potential(PetaPM * pm, int i, double * mesh, double weight) {
-    P[i].Potential += weight * mesh[0];
+    MyFloat * pot = PMOverlap.Potential ? &PMOverlap.Potential[i] : &P[i].Potential;
+    *pot += weight * mesh[0];
+}
+static void readout_force(int i, int k, double value) {
+    MyFloat * acc = PMOverlap.GravPM ? PMOverlap.GravPM[i] : P[i].GravPM;
+    acc[k] += value;
 }
 static void readout_force_x(PetaPM * pm, int i, double * mesh, double weight) {
-    P[i].GravPM[0] += weight * mesh[0];
+    readout_force(i, 0, weight * mesh[0]);
 }
 static void readout_force_y(PetaPM * pm, int i, double * mesh, double weight) {
-    P[i].GravPM[1] += weight * mesh[0];
+    readout_force(i, 1, weight * mesh[0]);
 }
 static void readout_force_z(PetaPM * pm, int i, double * mesh, double weight) {
-    P[i].GravPM[2] += weight * mesh[0];
+    readout_force(i, 2, weight * mesh[0]);
 }
@@ -21,13 +21,14 @@ grav_short_pair_ngbiter(
         LocalTreeWalk * lv);
 
 void
-grav_short_pair(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, double Rcut, double rho0, int NeutrinoTracer, int FastParticleType)
+grav_short_pair(const ActiveParticles * act, PetaPM * pm, const GravPMHighRes * hr, ForceTree * tree, double Rcut, double rho0, int NeutrinoTracer, int FastParticleType)
 {
     TreeWalk tw[1] = {{0}};
 
     struct GravShortPriv priv;
     priv.cellsize = tree->BoxSize / pm->Nmesh;
     priv.Rcut = Rcut * pm->Asmth * priv.cellsize;
+    grav_short_set_highres(&priv, hr, Rcut);
     priv.FastParticleType = FastParticleType;
     priv.NeutrinoTracer = NeutrinoTracer;
     priv.G = pm->G;
@@ -64,9 +65,8 @@ grav_short_pair_ngbiter(
         TreeWalkNgbIterGravShort * iter,
         LocalTreeWalk * lv)
 {
-    const double cellsize = GRAV_GET_PRIV(lv->tw)->cellsize;
-
     if(iter->base.other == -1) {
+        /* Sources not on the high resolution mesh use the periodic cutoff, even for high resolution particles*/
         iter->base.Hsml = GRAV_GET_PRIV(lv->tw)->Rcut;
         iter->base.mask = 0xff; /* all particles */
         iter->base.symmetric = NGB_TREEFIND_ASYMMETRIC;
@@ -88,6 +88,8 @@ grav_short_pair_ngbiter(
         return;
 
     double mass = P[other].Mass;
+    /* The high resolution split only if both particles were placed on the high resolution mesh*/
+    const double cellsize = (I->HighRes && P[other].HighRes) ? GRAV_GET_PRIV(lv->tw)->cellsize_hr : GRAV_GET_PRIV(lv->tw)->cellsize;
 
     double h = I->Soft;
     double otherh = FORCE_SOFTENING(other, P[other].Type);
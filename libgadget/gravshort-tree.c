@@ -27,6 +27,8 @@
  */
 
 static struct gravshort_tree_params TreeParams;
+/* Interactions evaluated by the last tree force on this rank*/
+static int64_t TreeInteractions;
 /*Softening length*/
 double GravitySoftening;
 
@@ -102,7 +104,7 @@ force_treeev_shortrange(TreeWalkQueryGravShort * input,
  *  rho0 = All.CP.Omega0 * 3 * All.CP.Hubble * All.CP.Hubble / (8 * M_PI * All.G)
  */
 void
-grav_short_tree(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, double rho0, int NeutrinoTracer, int FastParticleType)
+grav_short_tree(const ActiveParticles * act, PetaPM * pm, const GravPMHighRes * hr, ForceTree * tree, double rho0, int NeutrinoTracer, int FastParticleType)
 {
     double timeall = 0;
     double timetree, timewait, timecomm;
@@ -110,7 +112,8 @@ grav_short_tree(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, doub
     TreeWalk tw[1] = {{0}};
     struct GravShortPriv priv;
     priv.cellsize = tree->BoxSize / pm->Nmesh;
-    priv.Rcut = TreeParams.Rcut * pm->Asmth * priv.cellsize;;
+    priv.Rcut = TreeParams.Rcut * pm->Asmth * priv.cellsize;
+    grav_short_set_highres(&priv, hr, TreeParams.Rcut);
     priv.ErrTolForceAcc = TreeParams.ErrTolForceAcc;
     priv.TreeUseBH = TreeParams.TreeUseBH;
     priv.BHOpeningAngle = TreeParams.BHOpeningAngle;
@@ -144,6 +147,7 @@ grav_short_tree(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, doub
     walltime_measure("/Misc");
 
     treewalk_run(tw, act->ActiveParticle, act->NumActiveParticle);
+    TreeInteractions = tw->Ninteractions;
 
     /* Now the force computation is finished */
     /*  gather some diagnostic information */
@@ -170,6 +174,12 @@ grav_short_tree(const ActiveParticles * act, PetaPM * pm, ForceTree * tree, doub
         TreeParams.TreeUseBH = 0;
 }
 
+int64_t
+grav_short_tree_interactions(void)
+{
+    return TreeInteractions;
+}
+
 /* Add the acceleration from a node or particle to the output structure,
  * computing the short-range kernel and softening.*/
 static void
@@ -275,6 +285,11 @@ int force_treeev_shortrange(TreeWalkQueryGravShort * input,
     const double cellsize = GRAV_GET_PRIV(lv->tw)->cellsize;
     const double rcut = GRAV_GET_PRIV(lv->tw)->Rcut;
     const double rcut2 = rcut * rcut;
+    /* A particle on the high resolution mesh uses its force split for sources also on the mesh:
+     * the mesh has the force between the two split scales for those pairs only.*/
+    const int HighRes = input->HighRes;
+    const double cellsize_hr = GRAV_GET_PRIV(lv->tw)->cellsize_hr;
+    const double rcut_hr = GRAV_GET_PRIV(lv->tw)->Rcut_hr;
     const double aold = GRAV_GET_PRIV(lv->tw)->ErrTolForceAcc * input->OldAcc;
     const int TreeUseBH = GRAV_GET_PRIV(lv->tw)->TreeUseBH;
     const double BHOpeningAngle2 = GRAV_GET_PRIV(lv->tw)->BHOpeningAngle * GRAV_GET_PRIV(lv->tw)->BHOpeningAngle;
@@ -318,8 +333,14 @@ int force_treeev_shortrange(TreeWalkQueryGravShort * input,
                 dx[i] = NEAREST(nop->mom.cofm[i] - inpos[i], BoxSize);
             const double r2 = dx[0] * dx[0] + dx[1] * dx[1] + dx[2] * dx[2];
 
+            /* Nodes entirely on the high resolution mesh use its split. Nodes with mass
+             * both on and off it have no single window, and are always opened.*/
+            const int nodehr = HighRes && nop->f.HighResMass && !nop->f.LowResMass;
+            const int mixed = HighRes && nop->f.HighResMass && nop->f.LowResMass;
+
             /* Discard this node, move to sibling*/
-            if(shall_we_discard_node(nop->len, r2, nop->center, inpos, BoxSize, rcut, rcut2))
+            if(nodehr ? shall_we_discard_node(nop->len, r2, nop->center, inpos, BoxSize, rcut_hr, rcut_hr * rcut_hr)
+                      : shall_we_discard_node(nop->len, r2, nop->center, inpos, BoxSize, rcut, rcut2))
             {
                 no = nop->sibling;
                 /* Don't add this node*/
@@ -327,7 +348,7 @@ int force_treeev_shortrange(TreeWalkQueryGravShort * input,
             }
 
             /* This node accelerates the particle directly, and is not opened.*/
-            if(!shall_we_open_node(nop->len, nop->mom.mass, r2, nop->center, inpos, BoxSize, aold, TreeUseBH, BHOpeningAngle2))
+            if(!mixed && !shall_we_open_node(nop->len, nop->mom.mass, r2, nop->center, inpos, BoxSize, aold, TreeUseBH, BHOpeningAngle2))
             {
                 double h = input->Soft;
                 if(TreeParams.AdaptiveSoftening == 1 && (input->Soft < nop->mom.hmax))
@@ -346,7 +367,7 @@ int force_treeev_shortrange(TreeWalkQueryGravShort * input,
                 /* ok, node can be used */
                 no = nop->sibling;
                 /* Compute the acceleration and apply it to the output structure*/
-                apply_accn_to_output(output, dx, r2, h, nop->mom.mass, cellsize);
+                apply_accn_to_output(output, dx, r2, h, nop->mom.mass, nodehr ? cellsize_hr : cellsize);
                 continue;
             }
 
@@ -399,7 +420,7 @@ int force_treeev_shortrange(TreeWalkQueryGravShort * input,
                 h = DMAX(input->Soft, FORCE_SOFTENING(pp, P[pp].Type));
             }
             /* Compute the acceleration and apply it to the output structure*/
-            apply_accn_to_output(output, dx, r2, h, P[pp].Mass, cellsize);
+            apply_accn_to_output(output, dx, r2, h, P[pp].Mass, (HighRes && P[pp].HighRes) ? cellsize_hr : cellsize);
         }
         lv->Ninteractions += numcand;
     }
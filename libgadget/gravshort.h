@@ -15,6 +15,8 @@ typedef struct
     /*Used for adaptive gravitational softening*/
     MyFloat Soft;
     MyFloat OldAcc;
+    /* Particle was placed on the high resolution PM mesh, and uses its force split for sources also placed on it*/
+    int HighRes;
 } TreeWalkQueryGravShort;
 
 typedef struct {
@@ -29,6 +31,11 @@ struct GravShortPriv {
     /* How many PM cells do we go
      * before we stop calculating the tree?*/
     double Rcut;
+    /* The high resolution PM mesh, or NULL. Pairs of particles placed on it
+     * use its cell size and cutoff instead of the periodic ones.*/
+    const GravPMHighRes * HighRes;
+    double cellsize_hr;
+    double Rcut_hr;
     /* Desired accuracy of the tree force in units of the old acceleration.*/
     double ErrTolForceAcc;
     /* If > 0, use the Barnes-Hut opening angle.
@@ -54,6 +61,20 @@ struct GravShortPriv {
 
 #define GRAV_GET_PRIV(tw) ((struct GravShortPriv *) ((tw)->priv))
 
+/* Set the cell size and cutoff of the high resolution mesh, if it is enabled.*/
+static inline void
+grav_short_set_highres(struct GravShortPriv * priv, const GravPMHighRes * hr, const double Rcut)
+{
+    priv->HighRes = NULL;
+    priv->cellsize_hr = priv->cellsize;
+    priv->Rcut_hr = priv->Rcut;
+    if(hr && hr->ParticleTypes) {
+        priv->HighRes = hr;
+        priv->cellsize_hr = hr->pm->CellSize;
+        priv->Rcut_hr = Rcut * hr->pm->Asmth * priv->cellsize_hr;
+    }
+}
+
 static void
 grav_short_postprocess(int i, TreeWalk * tw)
 {
@@ -83,7 +104,8 @@ grav_short_copy(int place, TreeWalkQueryGravShort * input, TreeWalk * tw)
     }
 
     input->OldAcc = sqrt(aold)/GRAV_GET_PRIV(tw)->G;
-
+    /* Set on the last PM step, with the high resolution mesh force*/
+    input->HighRes = gravpm_is_highres_particle(GRAV_GET_PRIV(tw)->HighRes, place);
 }
 static void
 grav_short_reduce(int place, TreeWalkResultGravShort * result, enum TreeWalkReduceMode mode, TreeWalk * tw)
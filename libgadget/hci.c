@@ -36,6 +36,23 @@ hci_init(HCIManager * manager, char * prefix, double WallClockTimeLimit, double
     manager->AutoCheckPointTime = AutoCheckPointTime;
     manager->FOFEnabled = FOFEnabled;
     manager->LongestTimeBetweenQueries = 0;
+    manager->NParameters = 0;
+}
+
+void
+hci_register_parameter(HCIManager * manager, const char * name, int isint, double min, double max,
+        double (*get)(void), void (*set)(double value))
+{
+    if(manager->NParameters >= HCI_MAX_PARAMETERS)
+        endrun(1, "Too many HCI parameters: %d, cannot add %s\n", manager->NParameters, name);
+    HCIParameter * par = &manager->Parameters[manager->NParameters++];
+    strncpy(par->name, name, sizeof(par->name) - 1);
+    par->name[sizeof(par->name) - 1] = '\0';
+    par->isint = isint;
+    par->min = min;
+    par->max = max;
+    par->get = get;
+    par->set = set;
 }
 
 void
@@ -149,6 +166,70 @@ hci_query_auto_checkpoint(HCIManager * manager, char ** request)
     return 0;
 }
 
+static HCIParameter *
+hci_find_parameter(HCIManager * manager, const char * name)
+{
+    int i;
+    for(i = 0; i < manager->NParameters; i++)
+        if(!strcmp(manager->Parameters[i].name, name))
+            return &manager->Parameters[i];
+    return NULL;
+}
+
+/*
+ * Parse a setparam request: one 'Name Value' pair per line, with # comments.
+ * Every line is validated before any is applied, so a bad request changes nothing.
+ * The request is the same on all ranks, so this is collective.
+ * Returns the number of parameters changed, or -1 if the request was rejected.
+ * */
+static int
+hci_set_parameters(HCIManager * manager, char * request)
+{
+    double values[HCI_MAX_PARAMETERS];
+    HCIParameter * pars[HCI_MAX_PARAMETERS];
+    int i, n = 0;
+    char * line = request;
+    while(line && *line) {
+        char * next = strchr(line, '\n');
+        if(next)
+            *(next++) = '\0';
+        char name[64], extra[2];
+        double value;
+        const int nitems = sscanf(line, " %63s %lf %1s", name, &value, extra);
+        line = next;
+        /* Blank line or comment*/
+        if(nitems < 1 || name[0] == '#')
+            continue;
+        if(nitems != 2 && !(nitems == 3 && extra[0] == '#')) {
+            message(0, "HCI: setparam line for %s is not 'Name Value'; no parameters changed.\n", name);
+            return -1;
+        }
+        HCIParameter * par = hci_find_parameter(manager, name);
+        if(!par) {
+            message(0, "HCI: %s cannot be changed at runtime; no parameters changed.\n", name);
+            return -1;
+        }
+        if(value < par->min || value > par->max || (par->isint && value != (int) value)) {
+            message(0, "HCI: %s = %g is not %s in [%g, %g]; no parameters changed.\n",
+                    name, value, par->isint ? "an integer" : "a number", par->min, par->max);
+            return -1;
+        }
+        if(n >= HCI_MAX_PARAMETERS) {
+            message(0, "HCI: setparam has more than %d lines; no parameters changed.\n", HCI_MAX_PARAMETERS);
+            return -1;
+        }
+        pars[n] = par;
+        values[n] = value;
+        n++;
+    }
+    for(i = 0; i < n; i++) {
+        const double old = pars[i]->get();
+        pars[i]->set(values[i]);
+        message(0, "HCI: %s changed from %g to %g.\n", pars[i]->name, old, values[i]);
+    }
+    return n;
+}
+
 /*
  * the return value is non-zero if the mainloop shall break.
  * */
@@ -223,6 +304,15 @@ hci_query(HCIManager * manager, HCIAction * action)
         return 1;
     }
 
+    /* Change some parameters at this step; the run carries on.*/
+    if(hci_query_filesystem(manager, "setparam", &request))
+    {
+        hci_set_parameters(manager, request);
+        action->type = HCI_SET_PARAMETERS;
+        myfree(request);
+        return 0;
+    }
+
     /* lower priority */
     if(hci_query_auto_checkpoint(manager, &request))
     {
@@ -1,6 +1,19 @@
 #ifndef _HCI_H
 #define _HCI_H
 
+#define HCI_MAX_PARAMETERS 32
+
+/* A runtime parameter which can be changed with the setparam file.
+ * get returns the current value; set applies a new value and is called on all ranks.*/
+typedef struct HCIParameter {
+    char name[64];
+    int isint;
+    double min;
+    double max;
+    double (*get)(void);
+    void (*set)(double value);
+} HCIParameter;
+
 typedef struct HCIManager {
     /* private: */
     char * prefix;
@@ -11,6 +24,8 @@ typedef struct HCIManager {
     double WallClockTimeLimit;
     double timer_query_begin;
     double timer_begin;
+    HCIParameter Parameters[HCI_MAX_PARAMETERS];
+    int NParameters;
 
     /* for debugging: */
     int OVERRIDE_NOW;
@@ -25,6 +40,7 @@ enum HCIActionType {
     HCI_CHECKPOINT = 4,
     HCI_TERMINATE = 5,
     HCI_IOCTL = 6,
+    HCI_SET_PARAMETERS = 7,
 };
 
 typedef struct HCIAction
@@ -39,6 +55,12 @@ extern HCIManager HCI_DEFAULT_MANAGER[];
 void
 hci_init(HCIManager * manager, char * prefix, double TimeLimitCPU, double AutoCheckPointTime, int FOFEnabled);
 
+/* Add a parameter to those which can be changed at runtime, with the allowed range of values.
+ * Must be called after hci_init on all ranks.*/
+void
+hci_register_parameter(HCIManager * manager, const char * name, int isint, double min, double max,
+        double (*get)(void), void (*set)(double value));
+
 void
 hci_action_init(HCIAction * action);
 
@@ -50,6 +50,8 @@ set_init_params(ParameterSet * ps)
         param_get_string2(ps, "EnergyFile", All.EnergyFile, sizeof(All.EnergyFile));
         All.OutputEnergyDebug = param_get_int(ps, "OutputEnergyDebug");
         param_get_string2(ps, "CpuFile", All.CpuFile, sizeof(All.CpuFile));
+        param_get_string2(ps, "TraceFile", All.TraceFile, sizeof(All.TraceFile));
+        All.TraceEvents = param_get_int(ps, "TraceEvents");
 
         All.CP.CMBTemperature = param_get_double(ps, "CMBTemperature");
         All.CP.RadiationOn = param_get_int(ps, "RadiationOn");
@@ -73,6 +75,9 @@ set_init_params(ParameterSet * ps)
         All.Asmth = param_get_double(ps, "Asmth");
         All.ShortRangeForceWindowType = param_get_enum(ps, "ShortRangeForceWindowType");
         All.Nmesh = param_get_int(ps, "Nmesh");
+        All.HighResNmesh = param_get_int(ps, "HighResNmesh");
+        All.HighResParticleTypes = param_get_int(ps, "HighResParticleTypes");
+        All.PMOverlapThreads = param_get_int(ps, "PMOverlapThreads");
 
         All.CoolingOn = param_get_int(ps, "CoolingOn");
         All.HydroOn = param_get_int(ps, "HydroOn");
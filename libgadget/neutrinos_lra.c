@@ -34,13 +34,34 @@
  If overwrite is true, overwrite the existing final entry.*/
 void update_delta_tot(_delta_tot_table * const d_tot, const double a, const double delta_cdm_curr[], const double delta_nu_curr[], const int overwrite);
 
+/** Quadrature for the integral over the delta_tot history in get_delta_nu.
+ * The stored times split the integral into intervals, each integrated with a fixed Gauss-Legendre rule.
+ * The nodes and the k-independent parts of the integrand do not depend on the neutrino mass either,
+ * so they are computed once per step.*/
+struct _lra_quadrature
+{
+    int nnodes;
+    double * loga;
+    /** Free-streaming length from each node to the current time*/
+    double * fsl;
+    /** Gauss-Legendre weight times fsl / (a H(a))*/
+    double * weight;
+    /** Free-streaming length from the transfer function time to the current time*/
+    double fsl_A0a;
+};
+
+/** Compute the quadrature for get_delta_nu at scale factor a. Free with lra_quadrature_free.*/
+static void lra_quadrature_init(struct _lra_quadrature * quad, Cosmology * CP, const _delta_tot_table * const d_tot, const double a);
+static void lra_quadrature_free(struct _lra_quadrature * quad);
+
 /** Main function: given tables of wavenumbers, total delta at Na earlier times (< = a),
  * and initial conditions for neutrinos, computes the current delta_nu.
  * @param d_tot Initialised structure for storing total matter density.
+ * @param quad Quadrature over the stored times, from lra_quadrature_init.
  * @param a Current scale factor.
  * @param delta_nu_curr Pointer to array to store square root of neutrino power spectrum. Main output.
  * @param mnu Neutrino mass in eV.*/
-void get_delta_nu(Cosmology * CP, const _delta_tot_table * const d_tot, const double a, double delta_nu_curr[], const double mnu);
+static void get_delta_nu(const _delta_tot_table * const d_tot, const struct _lra_quadrature * const quad, Cosmology * CP, const double a, double delta_nu_curr[], const double mnu);
 
 /** Function which wraps three get_delta_nu calls to get delta_nu three times,
  * so that the final value is for all neutrino species*/
@@ -497,6 +518,9 @@ void get_delta_nu_combined(Cosmology * CP, const _delta_tot_table * const d_tot,
     int mi;
     /*Initialise delta_nu_curr*/
     memset(delta_nu_curr, 0, d_tot->nk*sizeof(double));
+    /*The free-streaming lengths and quadrature are shared between species*/
+    struct _lra_quadrature quad;
+    lra_quadrature_init(&quad, CP, d_tot, a);
     /*Get each neutrinos species and density separately and add them to the total.
      * Neglect perturbations in massless neutrinos.*/
     for(mi=0; mi<NUSPECIES; mi++) {
@@ -504,12 +528,13 @@ void get_delta_nu_combined(Cosmology * CP, const _delta_tot_table * const d_tot,
                  int ik;
                  double * delta_nu_single = mymalloc("delta_nu_single", sizeof(double) * d_tot->nk);
                  const double omeganu = d_tot->omnu->nu_degeneracies[mi] * omega_nu_single(d_tot->omnu, a, mi);
-                 get_delta_nu(CP, d_tot, a, delta_nu_single,d_tot->omnu->RhoNuTab[mi].mnu);
+                 get_delta_nu(d_tot, &quad, CP, a, delta_nu_single,d_tot->omnu->RhoNuTab[mi].mnu);
                  for(ik=0; ik<d_tot->nk; ik++)
                     delta_nu_curr[ik]+=delta_nu_single[ik]*omeganu/Omega_nu_tot;
                  myfree(delta_nu_single);
             }
     }
+    lra_quadrature_free(&quad);
     return;
 }
 
@@ -621,42 +646,132 @@ double specialJ(const double x, const double qc, const double nufrac_low)
   return specialJ_fit(x);
 }
 
-/**A structure for the parameters for the below integration kernel*/
-struct _delta_nu_int_params
+/** Order of the Gauss-Legendre rule used on each piece of the delta_tot history*/
+#define LRA_GL_ORDER 8
+/** Widest interval in log a integrated by a single Gauss-Legendre rule*/
+#define LRA_MAX_DLOGA 0.01
+/** Number of entries in the table of specialJ*/
+#define SPECIALJ_TABLE 4096
+
+/** Table of specialJ for fixed qc and nufrac_low, on a grid uniform in log(1+x) from 0 to xmax.
+ * Computing J directly is expensive when qc > 0 (hybrid neutrinos).*/
+struct _specialJ_table
 {
-    /**Current wavenumber*/
-    double k;
-    /**Neutrino mass divided by k_B T_nu*/
-    double mnubykT;
-    gsl_interp_accel *acc;
-    gsl_interp *spline;
-    Cosmology * CP;
-    /**Precomputed free-streaming lengths*/
-    gsl_interp_accel *fs_acc;
-    gsl_interp *fs_spline;
-    double * fslengths;
-    double * fsscales;
-    /**Make sure this is at the same k as above*/
-    double * delta_tot;
-    double * scale;
-    /** qc is a dimensionless momentum (normalized to TNU): v_c * mnu / (k_B * T_nu).
-     * This is the critical momentum for hybrid neutrinos: it is unused if
-     * hybrid neutrinos are not defined, but left here to save ifdefs.*/
+    double dt;
     double qc;
-    /*Fraction of neutrinos in particles for normalisation with hybrid neutrinos*/
     double nufrac_low;
+    double * J;
 };
-typedef struct _delta_nu_int_params delta_nu_int_params;
 
-/**GSL integration kernel for get_delta_nu*/
-double get_delta_nu_int(double logai, void * params)
+static void
+specialJ_table_init(struct _specialJ_table * tab, const double xmax, const double qc, const double nufrac_low)
+{
+    int i;
+    tab->dt = log1p(xmax) / (SPECIALJ_TABLE - 1);
+    tab->qc = qc;
+    tab->nufrac_low = nufrac_low;
+    tab->J = mymalloc("specialJ", SPECIALJ_TABLE * sizeof(double));
+    #pragma omp parallel for
+    for(i = 0; i < SPECIALJ_TABLE; i++)
+        tab->J[i] = specialJ(expm1(i * tab->dt), qc, nufrac_low);
+}
+
+/* Cubic Lagrange interpolation on the four nearest entries*/
+static inline double
+specialJ_table_eval(const struct _specialJ_table * tab, const double x)
+{
+    const double t = log1p(x) / tab->dt;
+    int i = t;
+    if(i >= SPECIALJ_TABLE - 2)
+        return specialJ(x, tab->qc, tab->nufrac_low);
+    if(i < 1)
+        i = 1;
+    const double u = t - i;
+    const double * J = tab->J + i - 1;
+    return - u * (u - 1) * (u - 2) / 6 * J[0] + (u + 1) * (u - 1) * (u - 2) / 2 * J[1]
+           - (u + 1) * u * (u - 2) / 2 * J[2] + (u + 1) * u * (u - 1) / 6 * J[3];
+}
+
+/* Free-streaming length integral from logai to logaf with a Gauss-Legendre rule*/
+static double
+fslength_gl(Cosmology * CP, const double logai, const double logaf, gsl_integration_glfixed_table * gl)
 {
-    delta_nu_int_params * p = (delta_nu_int_params *) params;
-    double fsl_aia = gsl_interp_eval(p->fs_spline,p->fsscales,p->fslengths,logai,p->fs_acc);
-    double delta_tot_at_a = gsl_interp_eval(p->spline,p->scale,p->delta_tot,logai,p->acc);
-    double specJ = specialJ(p->k*fsl_aia/p->mnubykT, p->qc, p->nufrac_low);
-    double ai = exp(logai);
-    return fsl_aia/(ai*hubble_function(p->CP, ai)) * specJ * delta_tot_at_a;
+    double integ = 0;
+    int j;
+    for(j = 0; j < LRA_GL_ORDER; j++) {
+        double xj, wj;
+        gsl_integration_glfixed_point(logai, logaf, j, &xj, &wj, gl);
+        integ += wj * fslength_int(xj, CP);
+    }
+    return integ;
+}
+
+static void
+lra_quadrature_init(struct _lra_quadrature * quad, Cosmology * CP, const _delta_tot_table * const d_tot, const double a)
+{
+    const double logai = log(d_tot->TimeTransfer);
+    const double logaf = log(a);
+    const int Na = d_tot->ia;
+    int i, j;
+    quad->nnodes = 0;
+    quad->fsl_A0a = 0;
+    if(logaf <= logai)
+        return;
+    /* Count the nodes: the breakpoints are the stored times inside the integration range*/
+    double prev = logai;
+    for(i = 0; i <= Na; i++) {
+        const double next = i < Na ? d_tot->scalefact[i] : logaf;
+        if(next <= prev || next > logaf)
+            continue;
+        quad->nnodes += LRA_GL_ORDER * (int) ceil((next - prev) / LRA_MAX_DLOGA);
+        prev = next;
+    }
+    quad->loga = mymalloc("lra_quad", 3 * quad->nnodes * sizeof(double));
+    quad->fsl = quad->loga + quad->nnodes;
+    quad->weight = quad->fsl + quad->nnodes;
+
+    gsl_integration_glfixed_table * gl = gsl_integration_glfixed_table_alloc(LRA_GL_ORDER);
+    if(!gl)
+        endrun(2016,"Error allocating memory for gsl integration table.\n");
+    int n = 0;
+    prev = logai;
+    for(i = 0; i <= Na; i++) {
+        const double next = i < Na ? d_tot->scalefact[i] : logaf;
+        if(next <= prev || next > logaf)
+            continue;
+        const int npiece = ceil((next - prev) / LRA_MAX_DLOGA);
+        int p;
+        for(p = 0; p < npiece; p++) {
+            const double lo = prev + p * (next - prev) / npiece;
+            const double hi = prev + (p + 1) * (next - prev) / npiece;
+            for(j = 0; j < LRA_GL_ORDER; j++) {
+                double xj, wj;
+                gsl_integration_glfixed_point(lo, hi, j, &xj, &wj, gl);
+                quad->loga[n] = xj;
+                quad->weight[n] = wj;
+                n++;
+            }
+        }
+        prev = next;
+    }
+    /* The free-streaming lengths to the current time at each node, integrating backwards between nodes.
+     * This gives them all in one pass, and as accurately as the quadrature itself.*/
+    double fsl = 0;
+    for(n = quad->nnodes - 1; n >= 0; n--) {
+        const double ai = exp(quad->loga[n]);
+        fsl += d_tot->light * fslength_gl(CP, quad->loga[n], n + 1 < quad->nnodes ? quad->loga[n+1] : logaf, gl);
+        quad->fsl[n] = fsl;
+        quad->weight[n] *= fsl / (ai * hubble_function(CP, ai));
+    }
+    quad->fsl_A0a = fsl + d_tot->light * fslength_gl(CP, logai, quad->loga[0], gl);
+    gsl_integration_glfixed_table_free(gl);
+}
+
+static void
+lra_quadrature_free(struct _lra_quadrature * quad)
+{
+    if(quad->nnodes > 0)
+        myfree(quad->loga);
 }
 
 /*
@@ -664,9 +779,9 @@ Main function: given tables of wavenumbers, total delta at Na earlier times (<=
 and initial conditions for neutrinos, computes the current delta_nu.
 Na is the number of currently stored time steps.
 */
-void get_delta_nu(Cosmology * CP, const _delta_tot_table * const d_tot, const double a, double delta_nu_curr[],const double mnu)
+static void get_delta_nu(const _delta_tot_table * const d_tot, const struct _lra_quadrature * const quad, Cosmology * CP, const double a, double delta_nu_curr[],const double mnu)
 {
-  double fsl_A0a,deriv_prefac;
+  double deriv_prefac;
   int ik;
   /* Variable is unused unless we have hybrid neutrinos,
    * but we define it anyway to save ifdeffing later.*/
@@ -674,11 +789,9 @@ void get_delta_nu(Cosmology * CP, const _delta_tot_table * const d_tot, const do
   /*Number of stored power spectra. This includes the initial guess for the next step*/
   const int Na = d_tot->ia;
   const double mnubykT = mnu /d_tot->omnu->kBtnu;
-  /*Tolerated integration error*/
-  double relerr = 1e-6;
 //       message(0,"Start get_delta_nu: a=%g Na =%d wavenum[0]=%g delta_tot[0]=%g m_nu=%g\n",a,Na,wavenum[0],d_tot->delta_tot[0][Na-1],mnu);
 
-  fsl_A0a = fslength(CP, log(d_tot->TimeTransfer), log(a),d_tot->light);
+  const double fsl_A0a = quad->fsl_A0a;
   /*Precompute factor used to get delta_nu_init. This assumes that delta ~ a, so delta-dot is roughly 1.*/
   deriv_prefac = d_tot->TimeTransfer*(hubble_function(CP, d_tot->TimeTransfer)/d_tot->light)* d_tot->TimeTransfer;
   for (ik = 0; ik < d_tot->nk; ik++) {
@@ -702,65 +815,48 @@ void get_delta_nu(Cosmology * CP, const _delta_tot_table * const d_tot, const do
       if(1 - partnu < 1e-3)
           return;
       qc = d_tot->omnu->hybnu.vcrit * mnubykT;
-      /*More generous integration error for particle neutrinos*/
-      relerr /= (1.+1e-5-particle_nu_fraction(&d_tot->omnu->hybnu,a,0));
   }
   /*If only one time given, we are still at the initial time*/
   /*If neutrino mass is zero, we are not accurate, just use the initial conditions piece*/
-  if(Na > 1 && mnubykT > 0){
-        delta_nu_int_params params;
-        params.acc = gsl_interp_accel_alloc();
-        gsl_integration_workspace * w = gsl_integration_workspace_alloc (GSL_VAL);
-        gsl_function F;
-        F.function = &get_delta_nu_int;
-        F.params=&params;
-        /*Use cubic interpolation*/
-        if(Na > 2) {
-                params.spline=gsl_interp_alloc(gsl_interp_cspline,Na);
-        }
-        /*Unless we have only two points*/
-        else {
-                params.spline=gsl_interp_alloc(gsl_interp_linear,Na);
-        }
-        params.scale=d_tot->scalefact;
-        params.mnubykT=mnubykT;
-        params.qc = qc;
-        params.nufrac_low = d_tot->omnu->hybnu.nufrac_low[0];
-        /* Massively over-sample the free-streaming lengths.
-         * Interpolation is least accurate where the free-streaming length -> 0,
-         * which is exactly where it doesn't matter, but
-         * we still want to be safe. */
-        int Nfs = Na*16;
-        params.fs_acc = gsl_interp_accel_alloc();
-        params.fs_spline=gsl_interp_alloc(gsl_interp_cspline,Nfs);
-        params.CP = CP;
-        /*Pre-compute the free-streaming lengths, which are scale-independent*/
-        double * fslengths = mymalloc("fslengths", Nfs* sizeof(double));
-        double * fsscales = mymalloc("fsscales", Nfs* sizeof(double));
-        for(ik=0; ik < Nfs; ik++) {
-            fsscales[ik] = log(d_tot->TimeTransfer) + ik*(log(a) - log(d_tot->TimeTransfer))/(Nfs-1.);
-            fslengths[ik] = fslength(CP, fsscales[ik], log(a),d_tot->light);
+  if(Na > 1 && mnubykT > 0 && quad->nnodes > 0){
+        /* The largest argument of J: free-streaming lengths are largest from the earliest time*/
+        double kmax = 0;
+        for (ik = 0; ik < d_tot->nk; ik++)
+            if(d_tot->wavenum[ik] > kmax)
+                kmax = d_tot->wavenum[ik];
+        struct _specialJ_table Jtab;
+        specialJ_table_init(&Jtab, kmax * fsl_A0a / mnubykT, qc, d_tot->omnu->hybnu.nufrac_low[0]);
+
+        #pragma omp parallel
+        {
+            gsl_interp_accel *acc = gsl_interp_accel_alloc();
+            gsl_interp * spline;
+            /*Use cubic interpolation*/
+            if(Na > 2)
+                spline=gsl_interp_alloc(gsl_interp_cspline,Na);
+            /*Unless we have only two points*/
+            else
+                spline=gsl_interp_alloc(gsl_interp_linear,Na);
+            if(!spline || !acc)
+                endrun(2016,"Error initialising and allocating memory for gsl interpolator.\n");
+
+            #pragma omp for schedule(dynamic)
+            for (ik = 0; ik < d_tot->nk; ik++) {
+                const double kbymnu = d_tot->wavenum[ik] / mnubykT;
+                const double * delta_tot = d_tot->delta_tot[ik];
+                double d_nu_tmp = 0;
+                int j;
+                gsl_interp_init(spline, d_tot->scalefact, delta_tot, Na);
+                for(j = 0; j < quad->nnodes; j++) {
+                    const double delta_tot_at_a = gsl_interp_eval(spline, d_tot->scalefact, delta_tot, quad->loga[j], acc);
+                    d_nu_tmp += quad->weight[j] * specialJ_table_eval(&Jtab, kbymnu * quad->fsl[j]) * delta_tot_at_a;
+                }
+                delta_nu_curr[ik] += d_tot->delta_nu_prefac * d_nu_tmp;
+            }
+            gsl_interp_free(spline);
+            gsl_interp_accel_free(acc);
         }
-        params.fslengths = fslengths;
-        params.fsscales = fsscales;
-
-        if(!params.spline || !params.acc || !w || !params.fs_spline || !params.fs_acc || !fslengths || !fsscales)
-              endrun(2016,"Error initialising and allocating memory for gsl interpolator and integrator.\n");
-
-        gsl_interp_init(params.fs_spline,params.fsscales,params.fslengths,Nfs);
-        for (ik = 0; ik < d_tot->nk; ik++) {
-            double abserr,d_nu_tmp;
-            params.k=d_tot->wavenum[ik];
-            params.delta_tot=d_tot->delta_tot[ik];
-            gsl_interp_init(params.spline,params.scale,params.delta_tot,Na);
-            gsl_integration_qag (&F, log(d_tot->TimeTransfer), log(a), 0, relerr,GSL_VAL,6,w,&d_nu_tmp, &abserr);
-            delta_nu_curr[ik] += d_tot->delta_nu_prefac * d_nu_tmp;
-         }
-         gsl_integration_workspace_free (w);
-         gsl_interp_free(params.spline);
-         gsl_interp_accel_free(params.acc);
-         myfree(fsscales);
-         myfree(fslengths);
+        myfree(Jtab.J);
    }
 //     for(ik=0; ik< 3; ik++)
 //         message(0,"k %g d_nu %g\n",wavenum[d_tot->nk/8*ik], delta_nu_curr[d_tot->nk/8*ik]);
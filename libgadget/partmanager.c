@@ -14,6 +14,12 @@ particle_alloc_memory(int64_t MaxPart)
 {
     size_t bytes;
     PartManager->Base = (struct particle_data *) mymalloc("P", bytes = MaxPart * sizeof(struct particle_data));
+    /* Most changes between updates are particles leaving in an exchange. If there are more
+     * the lists are rebuilt.*/
+    PartManager->MaxTimeBinChanged = MaxPart / 16 + 4096;
+    PartManager->TimeBinLink = (struct timebin_link *) mymalloc("TimeBinLink", MaxPart * sizeof(struct timebin_link));
+    PartManager->TimeBinChanged = (int *) mymalloc("TimeBinChanged", PartManager->MaxTimeBinChanged * sizeof(int));
+    bytes += MaxPart * sizeof(struct timebin_link) + PartManager->MaxTimeBinChanged * sizeof(int);
     PartManager->MaxPart = MaxPart;
     PartManager->NumPart = 0;
     if(MaxPart >= 1L<<31 || MaxPart < 0)
@@ -20,7 +20,7 @@ struct particle_data
 
         unsigned int IsGarbage            :1; /* True for a garbage particle. readonly: Use slots_mark_garbage to mark this.*/
         unsigned int Swallowed            :1; /* True if the particle is being swallowed; used in BH to determine swallower and swallowee;*/
-        unsigned int spare_1              :1; /*Unused, ensures alignment to a char*/
+        unsigned int HighRes              :1; /* True if the particle was placed on the high resolution PM mesh on the last PM step. Set by gravpm_highres_set_region.*/
         unsigned int BHHeated              :1; /* Flags that particle was heated by a BH this timestep*/
         unsigned char Generation; /* How many particles it has spawned; used to generate unique particle ID.
                                      may wrap around with too many SFR/BH if a feedback model goes rogue */
@@ -63,8 +63,26 @@ struct particle_data
 
 };
 
+/* Links of a particle in the per-timebin membership lists, maintained by timestep.c*/
+struct timebin_link
+{
+    int Next;
+    int Prev;
+    /* Bin and type the particle is counted in; TIMEBIN_UNLISTED if it is not in a list.*/
+    unsigned char Bin;
+    unsigned char Type;
+};
+
+#define TIMEBIN_UNLISTED 255
+
 extern struct part_manager_type {
     struct particle_data *Base; /* Pointer to particle data on local processor. */
+    /* Time bin membership of each particle; may be NULL, in which case the
+     * active particles are found by scanning all particles.*/
+    struct timebin_link * TimeBinLink;
+    /* Particles whose time bin membership may have changed since the lists were last updated.*/
+    int * TimeBinChanged;
+    int64_t MaxTimeBinChanged;
     /*!< number of particles on the LOCAL processor: number of valid entries in P array. */
     int64_t NumPart;
     /*!< Amount of memory we have available for particles locally: maximum size of P array. */
@@ -5,6 +5,8 @@
 #include <math.h>
 #include <string.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <pthread.h>
 
 #include <bigfile-mpi.h>
 
@@ -22,6 +24,7 @@
 #include "neutrinos_lra.h"
 
 #include "utils.h"
+#include "utils/mpsort.h"
 /************
  *
  * The IO api , intented to replace io.c and read_ic.c
@@ -41,6 +44,11 @@ static struct petaio_params {
      * and v / sqrt(a) = sqrt(a) dx/dt in the ICs. Note that snapshots never match Gadget-2, which
      * saves physical peculiar velocity / sqrt(a) in both ICs and snapshots. */
     int UsePeculiarVelocity;
+    double AsyncSnapshotMemory; /* MB per rank for staging snapshots written by a background thread. 0 disables.*/
+    int CompressIntegerBlocks; /* Write integer particle blocks with the lossless shuffle-lz codec.*/
+    double QuantisedPositionPrecision; /* If > 0, write positions quantised to this precision.*/
+    double QuantisedVelocityPrecision; /* If > 0, write velocities quantised to this precision.*/
+    int ReadIntoDomain; /* Move the particles to a Peano-Hilbert ordered layout while reading the snapshot.*/
 } IO;
 
 /*Set the IO parameters*/
@@ -57,6 +65,11 @@ set_petaio_params(ParameterSet * ps)
         IO.WritersPerFile = param_get_int(ps, "WritersPerFile");
         IO.AggregatedIOThreshold = param_get_int(ps, "AggregatedIOThreshold");
         IO.EnableAggregatedIO = param_get_int(ps, "EnableAggregatedIO");
+        IO.AsyncSnapshotMemory = param_get_double(ps, "AsyncSnapshotMemory");
+        IO.CompressIntegerBlocks = param_get_int(ps, "CompressIntegerBlocks");
+        IO.QuantisedPositionPrecision = param_get_double(ps, "QuantisedPositionPrecision");
+        IO.QuantisedVelocityPrecision = param_get_double(ps, "QuantisedVelocityPrecision");
+        IO.ReadIntoDomain = param_get_int(ps, "ReadIntoDomain");
 
     }
     MPI_Bcast(&IO, sizeof(struct petaio_params), MPI_BYTE, 0, MPI_COMM_WORLD);
@@ -86,6 +99,8 @@ void petaio_init(void) {
 
 /* save a snapshot file */
 static void petaio_save_internal(char * fname, struct IOTable * IOTable, int verbose);
+static int petaio_save_async(char * fname, struct IOTable * IOTable, int verbose);
+static void petaio_save_block_comm(BigFile * bf, char * blockname, BigArray * array, int verbose, MPI_Comm comm);
 
 void
 petaio_save_snapshot(struct IOTable * IOTable, int verbose, const char *fmt, ...)
@@ -95,12 +110,32 @@ petaio_save_snapshot(struct IOTable * IOTable, int verbose, const char *fmt, ...
 
     char * fname = fastpm_strdup_vprintf(fmt, va);
     va_end(va);
+    /* The staging buffers may be reused, and the previous snapshot should be complete first*/
+    petaio_wait_snapshot();
     message(0, "saving snapshot into %s\n", fname);
 
     petaio_save_internal(fname, IOTable, verbose);
     myfree(fname);
 }
 
+int
+petaio_save_snapshot_async(struct IOTable * IOTable, int verbose, const char *fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+
+    char * fname = fastpm_strdup_vprintf(fmt, va);
+    va_end(va);
+    petaio_wait_snapshot();
+    message(0, "saving snapshot into %s\n", fname);
+
+    int async = petaio_save_async(fname, IOTable, verbose);
+    if(!async)
+        petaio_save_internal(fname, IOTable, verbose);
+    myfree(fname);
+    return async;
+}
+
 /* Build a list of the first particle of each type on the current processor.
  * This assumes that all particles are sorted!*/
 /**
@@ -198,6 +233,389 @@ static void petaio_save_internal(char * fname, struct IOTable * IOTable, int ver
     myfree(selection);
 }
 
+/* A snapshot whose blocks have been copied to staging buffers
+ * and are being written by a background thread,
+ * on its own communicator, while the simulation continues.*/
+static struct {
+    /* Staging arena, reserved outside of the main allocator on first use and kept.*/
+    Allocator stage[1];
+    int stage_allocated;
+    int running;
+    pthread_t thread;
+    MPI_Comm comm;
+    BigFile bf;
+    char * fname;
+    int nblocks;
+    char (*blockname)[128];
+    BigArray * arrays;
+    int verbose;
+    double start;
+} Async;
+
+/* Bytes taken by an allocation in the staging arena, which pads to pages and adds a header page.*/
+static size_t
+stage_bytes(size_t bytes)
+{
+    return ((bytes + 4095) / 4096 + 1) * 4096;
+}
+
+static void *
+petaio_async_writer(void * unused)
+{
+    int i;
+    for(i = 0; i < Async.nblocks; i ++)
+        petaio_save_block_comm(&Async.bf, Async.blockname[i], &Async.arrays[i], Async.verbose, Async.comm);
+
+    if(0 != big_file_mpi_close(&Async.bf, Async.comm)){
+        endrun(0, "Failed to close snapshot at %s:%s\n", Async.fname,
+                    big_file_get_error_message());
+    }
+    return NULL;
+}
+
+/* Copy the particle blocks of the snapshot to the staging arena and
+ * start a thread writing them. Returns 0, having done nothing,
+ * if asynchronous output is disabled or the snapshot does not fit in the budget.
+ * Collective.*/
+static int
+petaio_save_async(char * fname, struct IOTable * IOTable, int verbose)
+{
+    static int warned = 0;
+    if(IO.AsyncSnapshotMemory <= 0)
+        return 0;
+
+    int provided;
+    MPI_Query_thread(&provided);
+    if(provided != MPI_THREAD_MULTIPLE) {
+        if(!warned)
+            message(0, "MPI does not provide MPI_THREAD_MULTIPLE (set MP_GADGET_THREAD_MULTIPLE=1): snapshots will be written synchronously.\n");
+        warned = 1;
+        return 0;
+    }
+
+    int ptype_offset[6]={0};
+    int ptype_count[6]={0};
+    int64_t NTotal[6]={0};
+
+    int * selection = mymalloc("Selection", sizeof(int) * PartManager->NumPart);
+
+    petaio_build_selection(selection, ptype_offset, ptype_count, P, PartManager->NumPart, NULL);
+
+    /* Everything we keep: the name, the block list and the block buffers*/
+    size_t bytes = stage_bytes(strlen(fname) + 1) + stage_bytes(IOTable->used * 128) + stage_bytes(IOTable->used * sizeof(BigArray));
+    int i;
+    for(i = 0; i < IOTable->used; i ++) {
+        int ptype = IOTable->ent[i].ptype;
+        if(!(ptype < 6 && ptype >= 0))
+            continue;
+        bytes += stage_bytes((size_t) ptype_count[ptype] * dtype_itemsize(IOTable->ent[i].dtype) * IOTable->ent[i].items);
+    }
+    const size_t budget = IO.AsyncSnapshotMemory * 1024 * 1024;
+    if(MPIU_Any(bytes > budget, MPI_COMM_WORLD)) {
+        message(0, "Snapshot needs more staging memory than AsyncSnapshotMemory = %g MB on some ranks, writing it synchronously.\n", IO.AsyncSnapshotMemory);
+        myfree(selection);
+        return 0;
+    }
+    if(!Async.stage_allocated) {
+        if(MPIU_Any(ALLOC_ENOMEMORY == allocator_init(Async.stage, "IOSTAGE", budget, 0, NULL), MPI_COMM_WORLD))
+            endrun(0, "Insufficient memory for %g MB of snapshot staging buffers. Reduce AsyncSnapshotMemory.\n", IO.AsyncSnapshotMemory);
+        Async.stage_allocated = 1;
+    }
+
+    BigFile bf = {0};
+    if(0 != big_file_mpi_create(&bf, fname, MPI_COMM_WORLD)) {
+        endrun(0, "Failed to create snapshot at %s:%s\n", fname,
+                    big_file_get_error_message());
+    }
+
+    sumup_large_ints(6, ptype_count, NTotal);
+
+    petaio_write_header(&bf, NTotal);
+
+    /* These are small, so write them now.*/
+    if(All.MassiveNuLinRespOn) {
+        int ThisTask;
+        MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+        petaio_save_neutrinos(&bf, ThisTask);
+    }
+
+    /* Build the buffers in the staging arena*/
+    mymalloc_set_thread_allocator(Async.stage);
+    Async.fname = fastpm_strdup(fname);
+    Async.blockname = mymalloc("AsyncBlockNames", IOTable->used * 128);
+    Async.arrays = mymalloc("AsyncArrays", IOTable->used * sizeof(BigArray));
+    Async.nblocks = 0;
+    for(i = 0; i < IOTable->used; i ++) {
+        int ptype = IOTable->ent[i].ptype;
+        /*This exclude FOF blocks*/
+        if(!(ptype < 6 && ptype >= 0)) {
+            continue;
+        }
+        sprintf(Async.blockname[Async.nblocks], "%d/%s", ptype, IOTable->ent[i].name);
+        petaio_build_buffer(&Async.arrays[Async.nblocks], &IOTable->ent[i], selection + ptype_offset[ptype], ptype_count[ptype], P, SlotsManager);
+        Async.nblocks++;
+    }
+    mymalloc_set_thread_allocator(NULL);
+    myfree(selection);
+
+    Async.bf = bf;
+    Async.verbose = verbose;
+    Async.start = MPI_Wtime();
+    MPI_Comm_dup(MPI_COMM_WORLD, &Async.comm);
+    if(0 != pthread_create(&Async.thread, NULL, petaio_async_writer, NULL))
+        endrun(1, "Could not start the snapshot writer thread for %s\n", fname);
+    Async.running = 1;
+    message(0, "Writing %d blocks of %s in the background.\n", Async.nblocks, fname);
+    return 1;
+}
+
+void
+petaio_wait_snapshot(void)
+{
+    if(!Async.running)
+        return;
+    pthread_join(Async.thread, NULL);
+    MPI_Comm_free(&Async.comm);
+    Async.running = 0;
+    /* Make sure every rank has finished writing*/
+    MPI_Barrier(MPI_COMM_WORLD);
+    message(0, "Finished writing %s in the background after %g seconds.\n", Async.fname, MPI_Wtime() - Async.start);
+    /* All blocks are on disk: drop the staging buffers at once*/
+    allocator_reset(Async.stage, 0);
+}
+
+/* Where the records read by this rank are sent when reading a snapshot
+ * with ReadIntoDomain. Every rank reads an even share of each block by file offset,
+ * then sends record perm[ptype][k] to the rank of sendcounts in order.*/
+struct ReadPlacement {
+    int * perm[6];
+    /* Positions read to compute the placement, kept so the Position block is not read again.*/
+    double * pos[6];
+    /* 6 * NTask entries each.*/
+    int * sendcounts;
+    int * recvcounts;
+};
+
+struct PlacementKey {
+    peano_t Key;
+    int Task; /* Rank which read this record*/
+    int Type;
+    int Index; /* Index of the record among those of Type read by Task*/
+};
+
+struct PlacementReply {
+    int Type;
+    int Index;
+};
+
+static void
+placement_radix_key(const void * ptr, void * radix, void * arg)
+{
+    ((uint64_t *) radix)[0] = ((const struct PlacementKey *) ptr)->Key;
+}
+
+/* Read the positions and assign to every rank a contiguous Peano-Hilbert
+ * segment of the particles, with the same number of particles as it reads.
+ * The domain decomposition follows Peano-Hilbert order, so the first domain
+ * exchange after reading moves few particles. Sets NLocal to the number of
+ * particles of each type this rank will hold. */
+static void
+petaio_plan_placement(BigFile * bf, const int64_t * NTotal, const int64_t * NRead, int64_t * NLocal, struct ReadPlacement * plan, MPI_Comm Comm)
+{
+    int NTask, ThisTask;
+    MPI_Comm_size(Comm, &NTask);
+    MPI_Comm_rank(Comm, &ThisTask);
+    int ptype;
+    int64_t i, NReadTotal = 0;
+    int64_t offset[6];
+
+    for(ptype = 0; ptype < 6; ptype++) {
+        offset[ptype] = NReadTotal;
+        NReadTotal += NRead[ptype];
+    }
+
+    /* These last until the blocks are read.*/
+    plan->sendcounts = mymalloc2("PlacementCounts", 2 * 6 * NTask * sizeof(int));
+    plan->recvcounts = plan->sendcounts + 6 * NTask;
+    plan->perm[0] = mymalloc2("PlacementPerm", NReadTotal * sizeof(int));
+    plan->pos[0] = mymalloc2("PlacementPos", NReadTotal * 3 * sizeof(double) + 1);
+    for(ptype = 1; ptype < 6; ptype++) {
+        plan->perm[ptype] = plan->perm[0] + offset[ptype];
+        plan->pos[ptype] = plan->pos[0] + 3 * offset[ptype];
+    }
+    memset(plan->sendcounts, 0, 2 * 6 * NTask * sizeof(int));
+
+    int * dest = mymalloc("PlacementDest", NReadTotal * sizeof(int));
+    struct PlacementKey * keys = mymalloc("PlacementKeys", NReadTotal * sizeof(struct PlacementKey));
+
+    for(ptype = 0; ptype < 6; ptype++) {
+        if(NTotal[ptype] == 0)
+            continue;
+        char blockname[128];
+        BigArray array = {0};
+        double * pos = plan->pos[ptype];
+        big_array_init(&array, pos, "f8", 2, (size_t []){NRead[ptype], 3}, NULL);
+        snprintf(blockname, 128, "%d/Position", ptype);
+        petaio_read_block(bf, blockname, &array, 1);
+        #pragma omp parallel for
+        for(i = 0; i < NRead[ptype]; i++) {
+            double x[3];
+            int k;
+            for(k = 0; k < 3; k++)
+                x[k] = pos[3 * i + k] - floor(pos[3 * i + k] / All.BoxSize) * All.BoxSize;
+            struct PlacementKey * key = &keys[offset[ptype] + i];
+            key->Key = PEANO(x, All.BoxSize);
+            key->Task = ThisTask;
+            key->Type = ptype;
+            key->Index = i;
+        }
+    }
+
+    /* Keeps the number of items on each rank*/
+    mpsort_mpi(keys, NReadTotal, sizeof(struct PlacementKey), placement_radix_key, 8, NULL, Comm);
+
+    /* Tell each reader where its records go.*/
+    int * replycounts = ta_malloc("ReplyCounts", int, 4 * NTask);
+    int * replydispls = replycounts + NTask;
+    int * recvcounts = replycounts + 2 * NTask;
+    int * recvdispls = replycounts + 3 * NTask;
+    memset(replycounts, 0, NTask * sizeof(int));
+    for(ptype = 0; ptype < 6; ptype++)
+        NLocal[ptype] = 0;
+    for(i = 0; i < NReadTotal; i++) {
+        replycounts[keys[i].Task]++;
+        NLocal[keys[i].Type]++;
+        plan->recvcounts[keys[i].Type * NTask + keys[i].Task]++;
+    }
+    MPI_Alltoall(replycounts, 1, MPI_INT, recvcounts, 1, MPI_INT, Comm);
+    replydispls[0] = recvdispls[0] = 0;
+    for(i = 1; i < NTask; i++) {
+        replydispls[i] = replydispls[i - 1] + replycounts[i - 1];
+        recvdispls[i] = recvdispls[i - 1] + recvcounts[i - 1];
+    }
+
+    struct PlacementReply * recv = mymalloc("PlacementRecv", NReadTotal * sizeof(struct PlacementReply) + 1);
+    struct PlacementReply * reply = mymalloc("PlacementReply", NReadTotal * sizeof(struct PlacementReply) + 1);
+    memset(replycounts, 0, NTask * sizeof(int));
+    for(i = 0; i < NReadTotal; i++) {
+        const int task = keys[i].Task;
+        struct PlacementReply * r = &reply[replydispls[task] + replycounts[task]++];
+        r->Type = keys[i].Type;
+        r->Index = keys[i].Index;
+    }
+    MPI_Datatype MPI_REPLY;
+    MPI_Type_contiguous(sizeof(struct PlacementReply), MPI_BYTE, &MPI_REPLY);
+    MPI_Type_commit(&MPI_REPLY);
+    MPI_Alltoallv_smart(reply, replycounts, replydispls, MPI_REPLY, recv, recvcounts, recvdispls, MPI_REPLY, Comm);
+    MPI_Type_free(&MPI_REPLY);
+    myfree(reply);
+
+    int task;
+    for(task = 0; task < NTask; task++) {
+        for(i = recvdispls[task]; i < recvdispls[task] + recvcounts[task]; i++)
+            dest[offset[recv[i].Type] + recv[i].Index] = task;
+    }
+    myfree(recv);
+    ta_free(replycounts);
+    myfree(keys);
+
+    /* Sort the records by destination, keeping the file order within a destination.*/
+    for(ptype = 0; ptype < 6; ptype++) {
+        int * sendcounts = plan->sendcounts + ptype * NTask;
+        int * fill = ta_malloc("Fill", int, NTask);
+        for(i = 0; i < NRead[ptype]; i++)
+            sendcounts[dest[offset[ptype] + i]]++;
+        fill[0] = 0;
+        for(task = 1; task < NTask; task++)
+            fill[task] = fill[task - 1] + sendcounts[task - 1];
+        for(i = 0; i < NRead[ptype]; i++)
+            plan->perm[ptype][fill[dest[offset[ptype] + i]]++] = i;
+        ta_free(fill);
+    }
+    myfree(dest);
+}
+
+static void
+petaio_free_placement(struct ReadPlacement * plan)
+{
+    myfree(plan->pos[0]);
+    myfree(plan->perm[0]);
+    myfree(plan->sendcounts);
+}
+
+/* Reorder the rows of data in place so that row k holds the old row perm[k],
+ * following each cycle of the permutation. Needs one spare row instead of a second copy of the block.*/
+static void
+petaio_permute_rows(char * data, const size_t rowsize, const int * perm, const int64_t nrows)
+{
+    if(nrows == 0)
+        return;
+    char * done = mymalloc("PermDone", nrows);
+    char * row = ta_malloc("PermRow", char, rowsize);
+    memset(done, 0, nrows);
+    int64_t start;
+    for(start = 0; start < nrows; start++) {
+        if(done[start])
+            continue;
+        memcpy(row, data + start * rowsize, rowsize);
+        int64_t j = start;
+        while(perm[j] != start) {
+            memcpy(data + j * rowsize, data + (int64_t) perm[j] * rowsize, rowsize);
+            done[j] = 1;
+            j = perm[j];
+        }
+        memcpy(data + j * rowsize, row, rowsize);
+        done[j] = 1;
+    }
+    ta_free(row);
+    myfree(done);
+}
+
+/* Read a block evenly split over the ranks and send each record to its destination in plan.
+ * array has room for the records of the destination. The Position block is
+ * taken from the positions read by petaio_plan_placement.
+ * Returns 1 if the block is not present. */
+static int
+petaio_read_block_placed(BigFile * bf, char * blockname, BigArray * array, IOTableEntry * ent, int64_t NRead, const struct ReadPlacement * plan, MPI_Comm Comm)
+{
+    int NTask, task;
+    MPI_Comm_size(Comm, &NTask);
+    const int * sendcounts = plan->sendcounts + ent->ptype * NTask;
+    const int * recvcounts = plan->recvcounts + ent->ptype * NTask;
+    const size_t rowsize = array->strides[0];
+
+    BigArray readarray = {0};
+    const int cached = (0 == strcmp(ent->name, "Position")) && ent->items == 3
+                    && big_file_dtype_kind(ent->dtype) == 'f' && dtype_itemsize(ent->dtype) == sizeof(double);
+    if(cached)
+        big_array_init(&readarray, plan->pos[ent->ptype], "f8", 2, (size_t []){NRead, 3}, NULL);
+    else {
+        petaio_alloc_buffer(&readarray, ent, NRead);
+        if(0 != petaio_read_block(bf, blockname, &readarray, ent->required)) {
+            petaio_destroy_buffer(&readarray);
+            return 1;
+        }
+    }
+    petaio_permute_rows(readarray.data, rowsize, plan->perm[ent->ptype], NRead);
+
+    int * sdispls = ta_malloc("sdispls", int, 2 * NTask);
+    int * rdispls = sdispls + NTask;
+    sdispls[0] = rdispls[0] = 0;
+    for(task = 1; task < NTask; task++) {
+        sdispls[task] = sdispls[task - 1] + sendcounts[task - 1];
+        rdispls[task] = rdispls[task - 1] + recvcounts[task - 1];
+    }
+    MPI_Datatype MPI_ROW;
+    MPI_Type_contiguous(rowsize, MPI_BYTE, &MPI_ROW);
+    MPI_Type_commit(&MPI_ROW);
+    MPI_Alltoallv_smart(readarray.data, (int *) sendcounts, sdispls, MPI_ROW, array->data, (int *) recvcounts, rdispls, MPI_ROW, Comm);
+    MPI_Type_free(&MPI_ROW);
+    ta_free(sdispls);
+    if(!cached)
+        petaio_destroy_buffer(&readarray);
+    return 0;
+}
+
 void petaio_read_internal(char * fname, int ic, struct IOTable * IOTable, MPI_Comm Comm) {
     int ptype;
     int i;
@@ -257,14 +675,23 @@ void petaio_read_internal(char * fname, int ic, struct IOTable * IOTable, MPI_Co
     /*Allocate the particle memory*/
     particle_alloc_memory(MaxPart);
 
-    int64_t NLocal[6];
+    int64_t NLocal[6], NRead[6];
     for(ptype = 0; ptype < 6; ptype ++) {
         int64_t start = ThisTask * NTotal[ptype] / NTask;
         int64_t end = (ThisTask + 1) * NTotal[ptype] / NTask;
-        NLocal[ptype] = end - start;
-        PartManager->NumPart += NLocal[ptype];
+        NRead[ptype] = NLocal[ptype] = end - start;
+    }
+
+    struct ReadPlacement plan[1] = {0};
+    if(IO.ReadIntoDomain) {
+        double tstart = MPI_Wtime();
+        petaio_plan_placement(&bf, NTotal, NRead, NLocal, plan, Comm);
+        message(0, "Computed the placement of particles from their positions in %g seconds.\n", MPI_Wtime() - tstart);
     }
 
+    for(ptype = 0; ptype < 6; ptype ++)
+        PartManager->NumPart += NLocal[ptype];
+
     /* Allocate enough memory for stars and black holes.
      * This will be dynamically increased as needed.*/
 
@@ -323,10 +750,17 @@ void petaio_read_internal(char * fname, int ic, struct IOTable * IOTable, MPI_Co
         }
         sprintf(blockname, "%d/%s", ptype, IOTable->ent[i].name);
         petaio_alloc_buffer(&array, &IOTable->ent[i], NLocal[ptype]);
-        if(0 == petaio_read_block(&bf, blockname, &array, IOTable->ent[i].required))
+        int missing;
+        if(IO.ReadIntoDomain)
+            missing = petaio_read_block_placed(&bf, blockname, &array, &IOTable->ent[i], NRead[ptype], plan, Comm);
+        else
+            missing = petaio_read_block(&bf, blockname, &array, IOTable->ent[i].required);
+        if(!missing)
             petaio_readout_buffer(&array, &IOTable->ent[i]);
         petaio_destroy_buffer(&array);
     }
+    if(IO.ReadIntoDomain)
+        petaio_free_placement(plan);
 
     if(0 != big_file_mpi_close(&bf, Comm)) {
         endrun(0, "Failed to close snapshot at %s:%s\n", fname,
@@ -667,6 +1101,36 @@ int petaio_read_block(BigFile * bf, char * blockname, BigArray * array, int requ
 
 /* save a block to disk */
 void petaio_save_block(BigFile * bf, char * blockname, BigArray * array, int verbose)
+{
+    petaio_save_block_comm(bf, blockname, array, verbose, MPI_COMM_WORLD);
+}
+
+/* Choose the codec for a block, or NULL to write it uncompressed.
+ * Only particle blocks, named ptype/Name, are compressed. */
+static const char *
+petaio_block_codec(const char * blockname, const char * dtype, double * precision)
+{
+    const char * name = strchr(blockname, '/');
+    if(!name || name == blockname || !isdigit(blockname[0]))
+        return NULL;
+    name++;
+    const int kind = big_file_dtype_kind(dtype);
+    *precision = 0;
+    if(kind == 'f' && IO.QuantisedPositionPrecision > 0 && 0 == strcmp(name, "Position")) {
+        *precision = IO.QuantisedPositionPrecision;
+        return BIG_CODEC_QUANTISE_LZ;
+    }
+    if(kind == 'f' && IO.QuantisedVelocityPrecision > 0 && 0 == strcmp(name, "Velocity")) {
+        *precision = IO.QuantisedVelocityPrecision;
+        return BIG_CODEC_QUANTISE_LZ;
+    }
+    if((kind == 'i' || kind == 'u') && IO.CompressIntegerBlocks)
+        return BIG_CODEC_SHUFFLE_LZ;
+    return NULL;
+}
+
+static void
+petaio_save_block_comm(BigFile * bf, char * blockname, BigArray * array, int verbose, MPI_Comm comm)
 {
 
     BigBlock bb;
@@ -676,7 +1140,9 @@ void petaio_save_block(BigFile * bf, char * blockname, BigArray * array, int ver
 
     int NumWriters = IO.NumWriters;
 
-    size_t size = count_sum(array->dims[0]);
+    int64_t localsize = array->dims[0];
+    int64_t size;
+    MPI_Allreduce(&localsize, &size, 1, MPI_INT64, MPI_SUM, comm);
     int NumFiles;
 
     if(IO.EnableAggregatedIO) {
@@ -701,23 +1167,35 @@ void petaio_save_block(BigFile * bf, char * blockname, BigArray * array, int ver
     if(verbose && size > 0) {
         message(0, "Will write %td particles to %d Files for %s\n", size, NumFiles, blockname);
     }
+    double precision;
+    const char * codec = petaio_block_codec(blockname, array->dtype, &precision);
+    if(codec) {
+        if(0 != big_file_mpi_write_block_compressed(bf, blockname, array, codec, precision, NumFiles, NumWriters, comm)) {
+            endrun(0, "Failed to write compressed block at %s:%s\n", blockname,
+                    big_file_get_error_message());
+        }
+        if(verbose && size > 0)
+            message(0, "Done writing %td particles with codec %s\n", size, codec);
+        return;
+    }
+
     /* create the block */
     /* dims[1] is the number of members per item */
-    if(0 != big_file_mpi_create_block(bf, &bb, blockname, array->dtype, array->dims[1], NumFiles, size, MPI_COMM_WORLD)) {
+    if(0 != big_file_mpi_create_block(bf, &bb, blockname, array->dtype, array->dims[1], NumFiles, size, comm)) {
         endrun(0, "Failed to create block at %s:%s\n", blockname,
                     big_file_get_error_message());
     }
     if(0 != big_block_seek(&bb, &ptr, 0)) {
         endrun(0, "Failed to seek:%s\n", big_file_get_error_message());
     }
-    if(0 != big_block_mpi_write(&bb, &ptr, array, NumWriters, MPI_COMM_WORLD)) {
+    if(0 != big_block_mpi_write(&bb, &ptr, array, NumWriters, comm)) {
         endrun(0, "Failed to write :%s\n", big_file_get_error_message());
     }
 
     if(verbose && size > 0)
         message(0, "Done writing %td particles to %d Files\n", size, NumFiles);
 
-    if(0 != big_block_mpi_close(&bb, MPI_COMM_WORLD)) {
+    if(0 != big_block_mpi_close(&bb, comm)) {
         endrun(0, "Failed to close block at %s:%s\n", blockname,
                 big_file_get_error_message());
     }
@@ -49,7 +49,15 @@ void petaio_save_block(BigFile * bf, char * blockname, BigArray * array, int ver
 int petaio_read_block(BigFile * bf, char * blockname, BigArray * array, int required);
 
 void petaio_save_snapshot(struct IOTable * IOTable, int verbose, const char *fmt, ...);
+/* As petaio_save_snapshot, but if AsyncSnapshotMemory is set the particle blocks are copied to
+ * staging buffers and written by a background thread. Returns 1 if the snapshot is being written
+ * in the background: it is only complete after petaio_wait_snapshot.*/
+int petaio_save_snapshot_async(struct IOTable * IOTable, int verbose, const char *fmt, ...);
+/* Wait for a snapshot being written in the background to complete. Collective.*/
+void petaio_wait_snapshot(void);
 void petaio_read_snapshot(int num, MPI_Comm Comm);
+/* Read the particles in the snapshot fname. If ic, read only the blocks present in initial conditions.*/
+void petaio_read_internal(char * fname, int ic, struct IOTable * IOTable, MPI_Comm Comm);
 void petaio_read_header(int num);
 
 void
@@ -21,10 +21,11 @@ layout_prepare(PetaPM * pm,
 static void layout_finish(struct Layout * L);
 static void layout_build_and_exchange_cells_to_pfft(PetaPM * pm, struct Layout * L, double * meshbuf, double * real);
 static void layout_build_and_exchange_cells_to_local(PetaPM * pm, struct Layout * L, double * meshbuf, double * real);
+static void layout_build_and_exchange_vector_to_local(PetaPM * pm, struct Layout * L, double * meshbuf, double * meshvec, double * real, const ptrdiff_t realstride);
 
 /* cell_iterator needs to be thread safe !*/
 typedef void (* cell_iterator)(double * cell_value, double * comm_buffer);
-static void layout_iterate_cells(PetaPM * pm, struct Layout * L, cell_iterator iter, double * real);
+static void layout_iterate_cells(PetaPM * pm, struct Layout * L, cell_iterator iter, double * real, const int ncomp, const ptrdiff_t cstride);
 
 struct Pencil { /* a pencil starting at offset, with lenght len */
     int offset[3];
@@ -45,11 +46,11 @@ static void verify_density_field(PetaPM * pm, double * real, double * meshbuf, c
 
 static MPI_Datatype MPI_PENCIL;
 
-/*Used only in MP-GenIC*/
+/*Used only in MP-GenIC. Allocated on the top of the stack, so that it may outlive the particle tables.*/
 pfft_complex *
 petapm_alloc_rhok(PetaPM * pm)
 {
-    pfft_complex * rho_k = (pfft_complex * ) mymalloc("PMrho_k", pm->priv->fftsize * sizeof(double));
+    pfft_complex * rho_k = (pfft_complex * ) mymalloc2("PMrho_k", pm->priv->fftsize * sizeof(double));
     memset(rho_k, 0, pm->priv->fftsize * sizeof(double));
     return rho_k;
 }
@@ -78,11 +79,15 @@ int *petapm_get_ntask2d(PetaPM * pm) {
     return pm->NTask2d;
 }
 
+/* Number of threads for FFT plans, set by petapm_module_init*/
+static int FFTThreads = 1;
+
 void
 petapm_module_init(int Nthreads)
 {
     pfft_init();
 
+    FFTThreads = Nthreads;
     pfft_plan_with_nthreads(Nthreads);
 
     /* initialize the MPI Datatype of pencil */
@@ -90,6 +95,29 @@ petapm_module_init(int Nthreads)
     MPI_Type_commit(&MPI_PENCIL);
 }
 
+/* Plan the forward and backward FFTs for the threads set with pfft_plan_with_nthreads*/
+static void
+petapm_plan_fft(PetaPM * pm, pfft_plan * forw, pfft_plan * back)
+{
+    ptrdiff_t n[3] = {pm->Nmesh, pm->Nmesh, pm->Nmesh};
+    /* planning the fft; need temporary arrays */
+
+    double * real = (double * ) mymalloc("PMreal", pm->priv->fftsize * sizeof(double));
+    pfft_complex * rho_k = (pfft_complex * ) mymalloc("PMrho_k", pm->priv->fftsize * sizeof(double));
+    pfft_complex * complx = (pfft_complex *) mymalloc("PMcomplex", pm->priv->fftsize * sizeof(double));
+
+    *forw = pfft_plan_dft_r2c_3d(
+        n, real, rho_k, pm->priv->comm_cart_2d, PFFT_FORWARD,
+        PFFT_TRANSPOSED_OUT | PFFT_ESTIMATE | PFFT_TUNE | PFFT_DESTROY_INPUT);
+    *back = pfft_plan_dft_c2r_3d(
+        n, complx, real, pm->priv->comm_cart_2d, PFFT_BACKWARD,
+        PFFT_TRANSPOSED_IN | PFFT_ESTIMATE | PFFT_TUNE | PFFT_DESTROY_INPUT);
+
+    myfree(complx);
+    myfree(rho_k);
+    myfree(real);
+}
+
 void
 petapm_init(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G, MPI_Comm comm)
 {
@@ -100,6 +128,8 @@ petapm_init(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G, MPI_
     pm->G = G;
     pm->CellSize = BoxSize / Nmesh;
     pm->comm = comm;
+    pm->Origin[0] = pm->Origin[1] = pm->Origin[2] = 0;
+    pm->PeriodicBoxSize = 0;
 
     ptrdiff_t n[3] = {Nmesh, Nmesh, Nmesh};
     ptrdiff_t np[2];
@@ -162,22 +192,9 @@ petapm_init(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G, MPI_
     petapm_region_init_strides(&pm->real_space_region);
     petapm_region_init_strides(&pm->fourier_space_region);
 
-    /* planning the fft; need temporary arrays */
-
-    double * real = (double * ) mymalloc("PMreal", pm->priv->fftsize * sizeof(double));
-    pfft_complex * rho_k = (pfft_complex * ) mymalloc("PMrho_k", pm->priv->fftsize * sizeof(double));
-    pfft_complex * complx = (pfft_complex *) mymalloc("PMcomplex", pm->priv->fftsize * sizeof(double));
-
-    pm->priv->plan_forw = pfft_plan_dft_r2c_3d(
-        n, real, rho_k, pm->priv->comm_cart_2d, PFFT_FORWARD,
-        PFFT_TRANSPOSED_OUT | PFFT_ESTIMATE | PFFT_TUNE | PFFT_DESTROY_INPUT);
-    pm->priv->plan_back = pfft_plan_dft_c2r_3d(
-        n, complx, real, pm->priv->comm_cart_2d, PFFT_BACKWARD,
-        PFFT_TRANSPOSED_IN | PFFT_ESTIMATE | PFFT_TUNE | PFFT_DESTROY_INPUT);
-
-    myfree(complx);
-    myfree(rho_k);
-    myfree(real);
+    petapm_plan_fft(pm, &pm->priv->plan_forw, &pm->priv->plan_back);
+    pm->priv->fft_threads = FFTThreads;
+    pm->priv->alt_threads = 0;
 
     /* now lets fill up the mesh2task arrays */
 
@@ -211,15 +228,65 @@ petapm_init(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G, MPI_
     myfree(tmp);
 }
 
+void
+petapm_set_nonperiodic_region(PetaPM * pm, const double Origin[3], double BoxSize, double PeriodicBoxSize)
+{
+    int k;
+    for(k = 0; k < 3; k ++)
+        pm->Origin[k] = Origin[k];
+    pm->BoxSize = BoxSize;
+    pm->CellSize = BoxSize / pm->Nmesh;
+    pm->PeriodicBoxSize = PeriodicBoxSize;
+}
+
+void
+petapm_set_fft_threads(PetaPM * pm, int Nthreads)
+{
+    PetaPMPriv * priv = pm->priv;
+    if(Nthreads == priv->fft_threads)
+        return;
+    /* Swap the kept plans in, or replace them with new ones*/
+    if(Nthreads != priv->alt_threads) {
+        if(priv->alt_threads > 0) {
+            pfft_destroy_plan(priv->alt_forw);
+            pfft_destroy_plan(priv->alt_back);
+        }
+        pfft_plan_with_nthreads(Nthreads);
+        petapm_plan_fft(pm, &priv->alt_forw, &priv->alt_back);
+        pfft_plan_with_nthreads(FFTThreads);
+        priv->alt_threads = Nthreads;
+    }
+    pfft_plan forw = priv->plan_forw, back = priv->plan_back;
+    priv->plan_forw = priv->alt_forw;
+    priv->plan_back = priv->alt_back;
+    priv->alt_forw = forw;
+    priv->alt_back = back;
+    priv->alt_threads = priv->fft_threads;
+    priv->fft_threads = Nthreads;
+}
+
 void
 petapm_destroy(PetaPM * pm)
 {
     pfft_destroy_plan(pm->priv->plan_forw);
     pfft_destroy_plan(pm->priv->plan_back);
+    if(pm->priv->alt_threads > 0) {
+        pfft_destroy_plan(pm->priv->alt_forw);
+        pfft_destroy_plan(pm->priv->alt_back);
+    }
     MPI_Comm_free(&pm->priv->comm_cart_2d);
     myfree(pm->Mesh2Task[0]);
 }
 
+/* The three FFT arrays, the CIC mesh buffer and the cell exchange buffers
+ * (each of the latter taken to be twice an FFT array), the particle to region map
+ * and some room for the pencils and the power spectrum.*/
+size_t
+petapm_force_memory_estimate(PetaPM * pm, int64_t NumPart)
+{
+    return 7 * pm->priv->fftsize * sizeof(double) + NumPart * sizeof(int) + 16L * 1024 * 1024;
+}
+
 /*
  * read out field to particle i, with value no need to be thread safe
  * (particle i is never done by same thread)
@@ -255,6 +322,7 @@ petapm_force_init(
         int * Nregions,
         void * userdata) {
     CPS = pstruct;
+    pm->userdata = userdata;
 
     *Nregions = 0;
     PetaPMRegion * regions = prepare(pm, pstruct, userdata, Nregions);
@@ -345,6 +413,78 @@ petapm_force_c2r(PetaPM * pm,
     walltime_measure("/PMgrav/Misc");
 
 }
+/* Vector readouts: pm_iterate passes a pointer to component 0, in meshbuf.
+ * The other components are at the same offset in CurMeshVec.*/
+static petapm_readout_vector_func CurVectorReadout;
+static double * CurMeshVec;
+
+static void
+readout_vector(PetaPM * pm, int i, double * mesh, double weight)
+{
+    const ptrdiff_t cell = mesh - pm->priv->meshbuf;
+    const double value[3] = {mesh[0], CurMeshVec[cell], CurMeshVec[pm->priv->meshbufsize + cell]};
+    CurVectorReadout(pm, i, value, weight);
+}
+
+/* As petapm_force_c2r, but each function has three transfer functions, which are transformed,
+ * exchanged and read out together. This needs three real meshes at once, but one exchange and one readout.*/
+void
+petapm_force_c2r_vector(PetaPM * pm,
+        pfft_complex * rho_k,
+        PetaPMRegion * regions,
+        const int Nregions,
+        PetaPMVectorFunctions * functions)
+{
+    const size_t fftsize = pm->priv->fftsize;
+    PetaPMVectorFunctions * f;
+    for (f = functions; f->name; f ++) {
+        double * real = (double * ) mymalloc2("PMreal", 3 * fftsize * sizeof(double));
+        int c;
+        for(c = 0; c < 3; c++) {
+            pfft_complex * complx = (pfft_complex *) mymalloc("PMcomplex", fftsize * sizeof(double));
+            pm_apply_transfer_function(pm, rho_k, complx, f->transfer[c]);
+            walltime_measure("/PMgrav/calc");
+            pfft_execute_dft_c2r(pm->priv->plan_back, complx, real + c * fftsize);
+            walltime_measure("/PMgrav/c2r");
+            myfree(complx);
+        }
+        double * meshvec = (double *) mymalloc("PMmeshvec", 2 * pm->priv->meshbufsize * sizeof(double));
+        /* This frees real*/
+        layout_build_and_exchange_vector_to_local(pm, &pm->priv->layout, pm->priv->meshbuf, meshvec, real, fftsize);
+        walltime_measure("/PMgrav/comm");
+
+        CurVectorReadout = f->readout;
+        CurMeshVec = meshvec;
+        pm_iterate(pm, readout_vector, regions, Nregions);
+        myfree(meshvec);
+        walltime_measure("/PMgrav/readout");
+    }
+    walltime_measure("/PMgrav/Misc");
+}
+
+/* Apply a transfer function to rho_k and transform to a real space mesh,
+ * in the layout of petapm_get_real_region. Used by MP-GenIC for 2LPT.*/
+double *
+petapm_c2r_mesh(PetaPM * pm, pfft_complex * rho_k, petapm_transfer_func transfer)
+{
+    pfft_complex * complx = (pfft_complex *) mymalloc("PMcomplex", pm->priv->fftsize * sizeof(double));
+    pm_apply_transfer_function(pm, rho_k, complx, transfer);
+    double * real = (double * ) mymalloc2("PMreal", pm->priv->fftsize * sizeof(double));
+    pfft_execute_dft_c2r(pm->priv->plan_back, complx, real);
+    myfree(complx);
+    return real;
+}
+
+/* Transform a real space mesh in the layout of petapm_get_real_region to Fourier space.
+ * Like petapm_force_r2c, the result is not normalised. The input is destroyed. Used by MP-GenIC for 2LPT.*/
+pfft_complex *
+petapm_r2c_mesh(PetaPM * pm, double * real)
+{
+    pfft_complex * complx = (pfft_complex *) mymalloc("PMcomplex", pm->priv->fftsize * sizeof(double));
+    pfft_execute_dft_r2c(pm->priv->plan_forw, real, complx);
+    return complx;
+}
+
 void petapm_force_finish(PetaPM * pm) {
     layout_finish(&pm->priv->layout);
     myfree(pm->priv->meshbuf);
@@ -519,6 +659,17 @@ layout_build_pencils(PetaPM * pm,
 
 }
 
+/* The pencil and cell exchanges: optionally aggregated per node*/
+static void
+petapm_alltoallv(void * sendbuf, int * sendcnts, int * sdispls, MPI_Datatype sendtype,
+        void * recvbuf, int * recvcnts, int * rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    if(MPIU_Use_hierarchical_alltoallv(ALLTOALLV_PM))
+        MPI_Alltoallv_hierarchical(sendbuf, sendcnts, sdispls, sendtype, recvbuf, recvcnts, rdispls, recvtype, comm);
+    else
+        MPI_Alltoallv(sendbuf, sendcnts, sdispls, sendtype, recvbuf, recvcnts, rdispls, recvtype, comm);
+}
+
 static void layout_exchange_pencils(struct Layout * L) {
     int i;
     int offset;
@@ -538,7 +689,7 @@ static void layout_exchange_pencils(struct Layout * L) {
         offset += L->NpSend[i];
     }
 
-    MPI_Alltoallv(
+    petapm_alltoallv(
             L->PencilSend, L->NpSend, L->DpSend, MPI_PENCIL,
             L->PencilRecv, L->NpRecv, L->DpRecv, MPI_PENCIL,
             L->comm);
@@ -602,7 +753,7 @@ layout_build_and_exchange_cells_to_pfft(
     }
 
     /* receive cells */
-    MPI_Alltoallv(
+    petapm_alltoallv(
             L->BufSend, L->NcSend, L->DcSend, MPI_DOUBLE,
             L->BufRecv, L->NcRecv, L->DcRecv, MPI_DOUBLE,
             L->comm);
@@ -624,7 +775,7 @@ layout_build_and_exchange_cells_to_pfft(
     message(0, "totmassExport = %g totmassImport = %g\n", totmassExport, totmassImport);
 #endif
 
-    layout_iterate_cells(pm, L, to_pfft, real);
+    layout_iterate_cells(pm, L, to_pfft, real, 1, 0);
     myfree(L->BufRecv);
     myfree(L->BufSend);
 }
@@ -647,7 +798,7 @@ layout_build_and_exchange_cells_to_local(
     int offset;
 
     /*layout_iterate_cells transfers real to L->BufRecv*/
-    layout_iterate_cells(pm, L, to_region, real);
+    layout_iterate_cells(pm, L, to_region, real, 1, 0);
 
     /*Real is done now: reuse the memory for BufSend*/
     myfree(real);
@@ -656,7 +807,7 @@ layout_build_and_exchange_cells_to_local(
 
     /* exchange cells */
     /* notice the order is reversed from to_pfft */
-    MPI_Alltoallv(
+    petapm_alltoallv(
             L->BufRecv, L->NcRecv, L->DcRecv, MPI_DOUBLE,
             L->BufSend, L->NcSend, L->DcSend, MPI_DOUBLE,
             L->comm);
@@ -674,7 +825,57 @@ layout_build_and_exchange_cells_to_local(
     myfree(L->BufRecv);
 }
 
-/* iterate over the pairs of real field cells and RecvBuf cells
+/* readout the three components of a vector field on their pfft host, then exchange them
+ * to the domain host together. Component 0 goes to meshbuf, components 1 and 2 to meshvec,
+ * which holds two meshbufs.*/
+static void
+layout_build_and_exchange_vector_to_local(
+        PetaPM * pm,
+        struct Layout * L,
+        double * meshbuf,
+        double * meshvec,
+        double * real,
+        const ptrdiff_t realstride)
+{
+    L->BufRecv = mymalloc("PMBufRecv", 3 * L->NcImport * sizeof(double));
+    int i;
+    int offset;
+
+    layout_iterate_cells(pm, L, to_region, real, 3, realstride);
+
+    myfree(real);
+    L->BufSend = mymalloc("PMBufSend", 3 * L->NcExport * sizeof(double));
+
+    /* The cell counts are unchanged if each cell is a vector*/
+    MPI_Datatype MPI_VECTOR_CELL;
+    MPI_Type_contiguous(3, MPI_DOUBLE, &MPI_VECTOR_CELL);
+    MPI_Type_commit(&MPI_VECTOR_CELL);
+    petapm_alltoallv(
+            L->BufRecv, L->NcRecv, L->DcRecv, MPI_VECTOR_CELL,
+            L->BufSend, L->NcSend, L->DcSend, MPI_VECTOR_CELL,
+            L->comm);
+    MPI_Type_free(&MPI_VECTOR_CELL);
+
+    const size_t meshsize = pm->priv->meshbufsize;
+    offset = 0;
+    for(i = 0; i < L->NpExport; i ++) {
+        struct Pencil * p = &L->PencilSend[i];
+        int j;
+        for(j = 0; j < p->len; j++) {
+            const double * cell = L->BufSend + 3 * (offset + j);
+            meshbuf[p->meshbuf_first + j] = cell[0];
+            meshvec[p->meshbuf_first + j] = cell[1];
+            meshvec[meshsize + p->meshbuf_first + j] = cell[2];
+        }
+        offset += p->len;
+    }
+    myfree(L->BufSend);
+    myfree(L->BufRecv);
+}
+
+/* iterate over the pairs of real field cells and RecvBuf cells.
+ * For vector fields with ncomp components, the components are cstride apart in real
+ * and adjacent in RecvBuf.
  *
  * !!! iter has to be thread safe. !!!
  * */
@@ -682,7 +883,9 @@ static void
 layout_iterate_cells(PetaPM * pm,
                      struct Layout * L,
                      cell_iterator iter,
-                     double * real)
+                     double * real,
+                     const int ncomp,
+                     const ptrdiff_t cstride)
 {
     int i;
 #pragma omp parallel for
@@ -714,7 +917,9 @@ layout_iterate_cells(PetaPM * pm,
             /*
              * operate on the pencil, either modifying real or BufRecv
              * */
-            iter(&real[linear], &L->BufRecv[p->first + j]);
+            int c;
+            for(c = 0; c < ncomp; c++)
+                iter(&real[linear + c * cstride], &L->BufRecv[(p->first + j) * ncomp + c]);
         }
     }
 }
@@ -764,7 +969,11 @@ pm_iterate_one(PetaPM * pm,
 
     PetaPMRegion * region = &regions[RegionInd];
     for(k = 0; k < 3; k++) {
-        double tmp = Pos[k] / pm->CellSize;
+        double x = Pos[k] - pm->Origin[k];
+        /* Non-periodic meshes: wrap the particle into the frame of the mesh*/
+        if(pm->PeriodicBoxSize > 0 && x < 0)
+            x += pm->PeriodicBoxSize;
+        double tmp = x / pm->CellSize;
         iCell[k] = floor(tmp);
         Res[k] = tmp - iCell[k];
         iCell[k] -= region->offset[k];
@@ -49,8 +49,14 @@ typedef struct PetaPMPriv {
     /* These varibles are initialized by petapm_init*/
 
     int fftsize;
+    /* FFT plans for fft_threads threads, used by petapm_force*/
     pfft_plan plan_forw;
     pfft_plan plan_back;
+    int fft_threads;
+    /* Plans for a different thread count kept by petapm_set_fft_threads; 0 threads if none*/
+    pfft_plan alt_forw;
+    pfft_plan alt_back;
+    int alt_threads;
     MPI_Comm comm_cart_2d;
 
     /* these variables are allocated every force calculation */
@@ -69,6 +75,15 @@ typedef struct PetaPM {
     double Asmth;
     double BoxSize;
     double G;
+    /* A non-periodic mesh covers only part of the periodic particle box.
+     * Origin is the position of mesh cell zero in the particle box and
+     * PeriodicBoxSize the size of the particle box, used to wrap particle positions.
+     * For a periodic mesh covering the whole box both are zero.*/
+    double Origin[3];
+    double PeriodicBoxSize;
+    /* userdata of the current petapm_force call, so the transfer and readout functions can see it.
+     * Set by petapm_force_init.*/
+    void * userdata;
     PetaPMPriv priv[1];
     int ThisTask2d[2];
     int NTask2d[2];
@@ -96,6 +111,15 @@ typedef struct {
     petapm_readout_func readout;
 } PetaPMFunctions;
 
+/* A vector field: three transfer functions, read out together. value holds the three components.*/
+typedef void (*petapm_readout_vector_func)(PetaPM * pm, int i, const double value[3], double weight);
+
+typedef struct {
+    char * name;
+    petapm_transfer_func transfer[3];
+    petapm_readout_vector_func readout;
+} PetaPMVectorFunctions;
+
 /* this mixes up fourier space analysis; with transfer. Shall split them. */
 typedef struct {
     /* this is a fourier space readout; need a better name */
@@ -112,7 +136,15 @@ void petapm_module_init(int Nthreads);
 
 void petapm_init(PetaPM * pm, double BoxSize, double Asmth, int Nmesh, double G, MPI_Comm comm);
 void petapm_destroy(PetaPM * pm);
+/* Use FFT plans for Nthreads OpenMP threads in the following petapm_force calls,
+ * rather than the count given to petapm_module_init. The plans for the last two counts are kept. Collective.*/
+void petapm_set_fft_threads(PetaPM * pm, int Nthreads);
+/* Place a non-periodic mesh of physical size BoxSize with cell zero at Origin, inside a periodic particle box of size PeriodicBoxSize.
+ * The transform is still periodic over BoxSize: callers should zero-pad by only placing particles in the lower half of the mesh.*/
+void petapm_set_nonperiodic_region(PetaPM * pm, const double Origin[3], double BoxSize, double PeriodicBoxSize);
 void petapm_region_init_strides(PetaPMRegion * region);
+/* Rough upper bound on the memory allocated by one petapm_force call for NumPart local particles*/
+size_t petapm_force_memory_estimate(PetaPM * pm, int64_t NumPart);
 
 void petapm_force(PetaPM * pm,
         petapm_prepare_func prepare,
@@ -133,7 +165,14 @@ void petapm_force_c2r(PetaPM * pm,
         pfft_complex * rho_k, PetaPMRegion * regions,
         const int Nregions,
         PetaPMFunctions * functions);
+void petapm_force_c2r_vector(PetaPM * pm,
+        pfft_complex * rho_k, PetaPMRegion * regions,
+        const int Nregions,
+        PetaPMVectorFunctions * functions);
 void petapm_force_finish(PetaPM * pm);
+/* Transforms of whole meshes, for operations in real space between FFTs. Used in MP-GenIC.*/
+double * petapm_c2r_mesh(PetaPM * pm, pfft_complex * rho_k, petapm_transfer_func transfer);
+pfft_complex * petapm_r2c_mesh(PetaPM * pm, double * real);
 
 PetaPMRegion * petapm_get_fourier_region(PetaPM * pm);
 PetaPMRegion * petapm_get_real_region(PetaPM * pm);
@@ -28,6 +28,7 @@
 #include "metal_return.h"
 #include "slotsmanager.h"
 #include "hci.h"
+#include "treewalk.h"
 #include "fof.h"
 #include "cooling_qso_lightup.h"
 #include "lightcone.h"
@@ -41,6 +42,10 @@ static FILE  *FdCPU;    /*!< file handle for cpu.txt log-file. */
 static FILE *FdSfr;     /*!< file handle for sfr.txt log-file. */
 static FILE *FdBlackHoles;  /*!< file handle for blackholes.txt log-file. */
 static FILE *FdBlackholeDetails;  /*!< file handle for BlackholeDetails binary file. */
+static FILE *FdTrace;  /*!< file handle for the per-rank walltime trace. */
+#ifdef PERF_COUNTERS
+static FILE *FdCounters;  /*!< file handle for counters.txt, the hardware counters of the cpu.txt clocks. */
+#endif
 
 static struct ClockTable Clocks;
 
@@ -60,6 +65,61 @@ open_outputfiles(int RestartSnapNum);
 static void
 close_outputfiles(void);
 
+static void
+register_hci_parameters(HCIManager * manager);
+
+/* Getters and setters for the performance parameters which may be changed at runtime with the HCI setparam file.*/
+static double get_ErrTolForceAcc(void) { return get_gravshort_treepar().ErrTolForceAcc; }
+static void set_ErrTolForceAcc(double value)
+{
+    struct gravshort_tree_params tp = get_gravshort_treepar();
+    tp.ErrTolForceAcc = value;
+    set_gravshort_treepar(tp);
+}
+static double get_PairwiseActiveFraction(void) { return All.PairwiseActiveFraction; }
+static void set_PairwiseActiveFraction(double value) { All.PairwiseActiveFraction = value; }
+static double get_MaxDomainTimeBinDepth(void) { return All.MaxDomainTimeBinDepth; }
+static void set_MaxDomainTimeBinDepth(double value) { All.MaxDomainTimeBinDepth = value; }
+static double get_AutoSnapshotTime(void) { return All.AutoSnapshotTime; }
+static void set_AutoSnapshotTime(double value)
+{
+    All.AutoSnapshotTime = value;
+    HCI_DEFAULT_MANAGER->AutoCheckPointTime = value;
+}
+static double get_ImportBufferBoost(void) { return get_treewalk_params().ImportBufferBoost; }
+static void set_ImportBufferBoost(double value)
+{
+    struct treewalk_params twp = get_treewalk_params();
+    twp.ImportBufferBoost = value;
+    set_treewalk_par(twp);
+}
+static double get_TreeWalkMaxChunkSize(void) { return get_treewalk_params().MaxChunkSize; }
+static void set_TreeWalkMaxChunkSize(double value)
+{
+    struct treewalk_params twp = get_treewalk_params();
+    twp.MaxChunkSize = value;
+    set_treewalk_par(twp);
+}
+static double get_TreeWalkBufferFraction(void) { return get_treewalk_params().BufferFraction; }
+static void set_TreeWalkBufferFraction(double value)
+{
+    struct treewalk_params twp = get_treewalk_params();
+    twp.BufferFraction = value;
+    set_treewalk_par(twp);
+}
+
+static void
+register_hci_parameters(HCIManager * manager)
+{
+    hci_register_parameter(manager, "ErrTolForceAcc", 0, 0, 1, get_ErrTolForceAcc, set_ErrTolForceAcc);
+    hci_register_parameter(manager, "PairwiseActiveFraction", 0, 0, 1, get_PairwiseActiveFraction, set_PairwiseActiveFraction);
+    hci_register_parameter(manager, "MaxDomainTimeBinDepth", 1, 0, TIMEBINS, get_MaxDomainTimeBinDepth, set_MaxDomainTimeBinDepth);
+    hci_register_parameter(manager, "AutoSnapshotTime", 0, 0, 1e10, get_AutoSnapshotTime, set_AutoSnapshotTime);
+    hci_register_parameter(manager, "ImportBufferBoost", 1, 0, 100, get_ImportBufferBoost, set_ImportBufferBoost);
+    hci_register_parameter(manager, "TreeWalkMaxChunkSize", 1, 1, 1e6, get_TreeWalkMaxChunkSize, set_TreeWalkMaxChunkSize);
+    hci_register_parameter(manager, "TreeWalkBufferFraction", 0, 1e-3, 1, get_TreeWalkBufferFraction, set_TreeWalkBufferFraction);
+}
+
 /*! This function performs the initial set-up of the simulation. First, the
  *  parameterfile is set, then routines for setting units, reading
  *  ICs/restart-files are called, auxialiary memory is allocated, etc.
@@ -72,6 +132,7 @@ int begrun(int RestartFlag, int RestartSnapNum)
     }
 
     hci_init(HCI_DEFAULT_MANAGER, All.OutputDir, All.TimeLimitCPU, All.AutoSnapshotTime, All.SnapshotWithFOF);
+    register_hci_parameters(HCI_DEFAULT_MANAGER);
 
     petapm_module_init(omp_get_max_threads());
     petaio_init();
@@ -127,6 +188,23 @@ use_pairwise_gravity(ActiveParticles * Act, struct part_manager_type * PartManag
     return total_active < All.PairwiseActiveFraction * total_particle;
 }
 
+/* Arguments for the short-range tree force computed while the PM force is in flight*/
+struct ShortRangeArgs {
+    const ActiveParticles * act;
+    PetaPM * pm;
+    const GravPMHighRes * hr;
+    ForceTree * tree;
+    double rho0;
+    int NeutrinoTracer;
+};
+
+static void
+grav_short_tree_overlapped(void * userdata)
+{
+    struct ShortRangeArgs * args = (struct ShortRangeArgs *) userdata;
+    grav_short_tree(args->act, args->pm, args->hr, args->tree, args->rho0, args->NeutrinoTracer, All.FastParticleType);
+}
+
 /*! This routine contains the main simulation loop that iterates over
  * single timesteps. The loop terminates when the cpu-time limit is
  * reached, when a `stop' file is found in the output directory, or
@@ -143,6 +221,10 @@ run(int RestartSnapNum)
     int SnapshotFileCount = RestartSnapNum;
     PetaPM pm = {0};
     gravpm_init_periodic(&pm, All.BoxSize, All.Asmth, All.Nmesh, All.G);
+    /* Optional high resolution mesh for zoom simulations */
+    GravPMHighRes pmhr = {0};
+    if(All.HighResNmesh > 0)
+        gravpm_init_highres(&pmhr, All.BoxSize, All.Asmth, All.Nmesh, All.HighResNmesh, All.HighResParticleTypes, All.G);
 
     DomainDecomp ddecomp[1] = {0};
 
@@ -208,6 +290,9 @@ run(int RestartSnapNum)
             update_random_offset(rel_random_shift);
         }
 
+        /* Time the PM steps, including the domain decomposition, for the DomainOverDecompositionFactor search*/
+        const double tstep = second();
+
         int extradomain = is_timebin_active(times.mintimebin + All.MaxDomainTimeBinDepth, times.Ti_Current);
         /* drift and ddecomp decomposition */
         /* at first step this is a noop */
@@ -230,6 +315,11 @@ run(int RestartSnapNum)
         }
         update_lastactive_drift(&times);
 
+        /* Positions are synchronised on PM steps: move the high resolution
+         * region and flag the particles inside it before the tree is built,
+         * as the short-range force depends on it. */
+        if(is_PM)
+            gravpm_highres_set_region(&pmhr);
 
         ActiveParticles Act = {0};
         rebuild_activelist(&Act, &times, NumCurrentTiStep);
@@ -290,14 +380,17 @@ run(int RestartSnapNum)
         const int NeutrinoTracer =  All.HybridNeutrinosOn && (All.Time <= All.HybridNuPartTime);
         const double rho0 = All.CP.Omega0 * 3 * All.CP.Hubble * All.CP.Hubble / (8 * M_PI * All.G);
 
-        if(All.TreeGravOn) {
+        /* On PM steps the tree force may run concurrently with the PM force*/
+        const int overlapstep = is_PM && All.TreeGravOn && !pairwisestep && All.PMOverlapThreads > 0;
+
+        if(All.TreeGravOn && !overlapstep) {
             /* Do a short range pairwise only step if desired*/
             if(pairwisestep) {
                 struct gravshort_tree_params gtp = get_gravshort_treepar();
-                grav_short_pair(&Act, &pm, &Tree, gtp.Rcut, rho0, NeutrinoTracer, All.FastParticleType);
+                grav_short_pair(&Act, &pm, &pmhr, &Tree, gtp.Rcut, rho0, NeutrinoTracer, All.FastParticleType);
             }
             else
-                grav_short_tree(&Act, &pm, &Tree, rho0, NeutrinoTracer, All.FastParticleType);
+                grav_short_tree(&Act, &pm, &pmhr, &Tree, rho0, NeutrinoTracer, All.FastParticleType);
         }
 
         /* We use the total gravitational acc.
@@ -311,7 +404,12 @@ run(int RestartSnapNum)
         * or include hydro in the opening angle.*/
         if(is_PM)
         {
-            gravpm_force(&pm, &Tree);
+            if(overlapstep) {
+                struct ShortRangeArgs args = {&Act, &pm, &pmhr, &Tree, rho0, NeutrinoTracer};
+                gravpm_force_overlap(&pm, &pmhr, &Tree, All.PMOverlapThreads, grav_short_tree_overlapped, &args);
+            }
+            else
+                gravpm_force(&pm, &pmhr, &Tree);
 
             /* compute and output energy statistics if desired. */
             if(All.OutputEnergyDebug)
@@ -398,6 +496,9 @@ run(int RestartSnapNum)
             }
         }
 
+        if(is_PM)
+            domain_tune_overdecomposition(timediff(tstep, second()));
+
         /* If a snapshot is requested, write it.
          * write_checkpoint is responsible to maintain a valid ddecomp and tree after it is called.
          *
@@ -486,6 +587,9 @@ run(int RestartSnapNum)
         free_activelist(&Act);
     }
 
+    /* The last snapshot may still be being written*/
+    wait_checkpoint();
+    gravpm_destroy_highres(&pmhr);
     close_outputfiles();
 }
 
@@ -501,6 +605,17 @@ void write_cpu_log(int NumCurrentTiStep, FILE * FdCPU)
         walltime_report(FdCPU, 0, MPI_COMM_WORLD);
         fflush(FdCPU);
     }
+#ifdef PERF_COUNTERS
+    if(FdCounters)
+    {
+        int NTask;
+        MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+        fprintf(FdCounters, "Step %d, Time: %g, MPIs: %d Threads: %d Elapsed: %g\n", NumCurrentTiStep, All.Time, NTask, omp_get_max_threads(), Clocks.ElapsedTime);
+        walltime_report_counters(FdCounters, 0, MPI_COMM_WORLD);
+        fflush(FdCounters);
+    }
+#endif
+    walltime_trace_flush(NumCurrentTiStep);
 }
 
 /* We operate in a situation where the particles are in a coordinate frame
@@ -553,6 +668,10 @@ open_outputfiles(int RestartSnapNum)
     FdBlackHoles = NULL;
     FdSfr = NULL;
     FdBlackholeDetails = NULL;
+    FdTrace = NULL;
+#ifdef PERF_COUNTERS
+    FdCounters = NULL;
+#endif
 
     if(RestartSnapNum != -1) {
         postfix = fastpm_strdup_printf("-R%03d", RestartSnapNum);
@@ -569,6 +688,15 @@ open_outputfiles(int RestartSnapNum)
         myfree(buf);
     }
 
+    if(All.TraceEvents > 0) {
+        buf = fastpm_strdup_printf("%s/%s%s/%06d.json", All.OutputDir, All.TraceFile, postfix, ThisTask);
+        fastpm_path_ensure_dirname(buf);
+        if(!(FdTrace = fopen(buf, "a")))
+            endrun(1, "Failed to open trace file %s\n", buf);
+        myfree(buf);
+    }
+    walltime_trace_init(FdTrace, All.TraceEvents);
+
     /* only the root processors writes to the log files */
     if(ThisTask != 0) {
         return;
@@ -580,6 +708,14 @@ open_outputfiles(int RestartSnapNum)
         endrun(1, "error in opening file '%s'\n", buf);
     myfree(buf);
 
+#ifdef PERF_COUNTERS
+    buf = fastpm_strdup_printf("%s/%s%s", All.OutputDir, "counters.txt", postfix);
+    fastpm_path_ensure_dirname(buf);
+    if(!(FdCounters = fopen(buf, mode)))
+        endrun(1, "error in opening file '%s'\n", buf);
+    myfree(buf);
+#endif
+
     if(All.OutputEnergyDebug) {
         buf = fastpm_strdup_printf("%s/%s%s", All.OutputDir, All.EnergyFile, postfix);
         fastpm_path_ensure_dirname(buf);
@@ -613,6 +749,10 @@ close_outputfiles(void)
 {
     if(FdCPU)
         fclose(FdCPU);
+#ifdef PERF_COUNTERS
+    if(FdCounters)
+        fclose(FdCounters);
+#endif
     if(FdEnergy)
         fclose(FdEnergy);
     if(FdSfr)
@@ -621,6 +761,9 @@ close_outputfiles(void)
         fclose(FdBlackHoles);
     if(FdBlackholeDetails)
         fclose(FdBlackholeDetails);
+    walltime_trace_free();
+    if(FdTrace)
+        fclose(FdTrace);
 }
 
 /*! Computes conversion factors between internal code units and the
@@ -100,13 +100,13 @@ void runtests(int RestartSnapNum)
 
     ForceTree Tree = {0};
     force_tree_rebuild(&Tree, ddecomp, All.BoxSize, 1, 1, All.OutputDir);
-    gravpm_force(&pm, &Tree);
+    gravpm_force(&pm, NULL, &Tree);
     force_tree_rebuild(&Tree, ddecomp, All.BoxSize, 1, 1, All.OutputDir);
 
     struct gravshort_tree_params origtreeacc = get_gravshort_treepar();
     struct gravshort_tree_params treeacc = origtreeacc;
     const double rho0 = All.CP.Omega0 * 3 * All.CP.Hubble * All.CP.Hubble / (8 * M_PI * All.G);
-    grav_short_pair(&Act, &pm, &Tree, treeacc.Rcut, rho0, 0, All.FastParticleType);
+    grav_short_pair(&Act, &pm, NULL, &Tree, treeacc.Rcut, rho0, 0, All.FastParticleType);
 
     double (* PairAccn)[3] = mymalloc2("PairAccns", 3*sizeof(double) * PartManager->NumPart);
 
@@ -116,7 +116,7 @@ void runtests(int RestartSnapNum)
 
     treeacc.ErrTolForceAcc = 0;
     set_gravshort_treepar(treeacc);
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
 
     /* This checks fully opened tree force against pair force*/
     double meanerr, maxerr;
@@ -135,8 +135,8 @@ void runtests(int RestartSnapNum)
     treeacc = origtreeacc;
     set_gravshort_treepar(treeacc);
     /* Code automatically sets the UseTreeBH parameter.*/
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
 
     petaio_save_snapshot(&IOTable, 0, "%s/PART-tree-%03d", All.OutputDir, RestartSnapNum);
 
@@ -150,8 +150,8 @@ void runtests(int RestartSnapNum)
     /* This checks the tree against a larger Rcut.*/
     treeacc.Rcut = 9.5;
     set_gravshort_treepar(treeacc);
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
     petaio_save_snapshot(&IOTable, 0, "%s/PART-tree-rcut-%03d", All.OutputDir, RestartSnapNum);
 
     check_accns(&meanerr,&maxerr,PairAccn, meanacc);
@@ -165,11 +165,11 @@ void runtests(int RestartSnapNum)
     force_tree_free(&Tree);
     gravpm_init_periodic(&pm, All.BoxSize, All.Asmth, All.Nmesh/2., All.G);
     force_tree_rebuild(&Tree, ddecomp, All.BoxSize, 1, 1, All.OutputDir);
-    gravpm_force(&pm, &Tree);
+    gravpm_force(&pm, NULL, &Tree);
     force_tree_rebuild(&Tree, ddecomp, All.BoxSize, 1, 1, All.OutputDir);
     set_gravshort_treepar(treeacc);
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
-    grav_short_tree(&Act, &pm, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
+    grav_short_tree(&Act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
     petaio_save_snapshot(&IOTable, 0, "%s/PART-tree-nmesh2-%03d", All.OutputDir, RestartSnapNum);
 
     check_accns(&meanerr, &maxerr, PairAccn, meanacc);
@@ -1,4 +1,5 @@
 #include <string.h>
+#include <omp.h>
 #include "slotsmanager.h"
 #include "partmanager.h"
 
@@ -80,6 +81,7 @@ slots_convert(int parent, int ptype, int placement, struct part_manager_type * p
     }
     /*Type changed after slot updated*/
     pman->Base[parent].Type = ptype;
+    slots_emit_change(parent, pman);
     return parent;
 }
 
@@ -138,7 +140,8 @@ slots_split_particle(int parent, double childmass, struct part_manager_type * pm
 }
 
 /* remove garbage particles, holes in sph chunk and holes in bh buffer.
- * This algorithm is O(n), and shifts particles over the holes.
+ * This algorithm is O(n) and threaded. It shifts particles over the holes,
+ * or, if there are only a few holes, fills them from the end of the array (see slots_gc_compact).
  * compact_slots is a 6-member array, 1 if that slot should be compacted, 0 otherwise.
  * As slots_gc_base preserves the order of the slots, one may usually skip compaction.*/
 int
@@ -157,6 +160,10 @@ slots_gc(int * compact_slots, struct part_manager_type * pman, struct slots_mana
 
     MPI_Allreduce(MPI_IN_PLACE, &tree_invalid, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
 
+    if(tree_invalid) {
+        EISlotsAfterGC event = {.pman = pman};
+        event_emit(&EventSlotsAfterGC, (EIBase *) &event);
+    }
     return tree_invalid;
 }
 
@@ -165,10 +172,10 @@ slots_gc(int * compact_slots, struct part_manager_type * pman, struct slots_mana
 #define PART(i, ptype, pman, sman) (sman ? (void *) BASESLOT_PI(i, ptype, sman) : (void *) &pman->Base[i])
 
 /*Find the next garbage particle*/
-static int
-slots_find_next_garbage(int start, int used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
+static int64_t
+slots_find_next_garbage(int64_t start, int64_t used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
 {
-    int i, nextgc = used;
+    int64_t i, nextgc = used;
     /*Find another garbage particle*/
     for(i = start; i < used; i++)
         if(GARBAGE(i, ptype, pman, sman)) {
@@ -179,10 +186,10 @@ slots_find_next_garbage(int start, int used, int ptype, struct part_manager_type
 }
 
 /*Find the next non-garbage particle*/
-static int
-slots_find_next_nongarbage(int start, int used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
+static int64_t
+slots_find_next_nongarbage(int64_t start, int64_t used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
 {
-    int i, nextgc = used;
+    int64_t i, nextgc = used;
     /*Find another garbage particle*/
     for(i = start; i < used; i++)
         if(!GARBAGE(i, ptype, pman, sman)) {
@@ -192,41 +199,186 @@ slots_find_next_nongarbage(int start, int used, int ptype, struct part_manager_t
     return nextgc;
 }
 
-/*Compaction algorithm*/
-static int
-slots_gc_compact(const int used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
+/* Serial compaction of the range [start, used): the non-garbage entries
+ * are shifted down, in order, to start at start. Returns the number of garbage entries.*/
+static int64_t
+slots_gc_compact_range(const int64_t start, const int64_t used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
 {
     /*Find first garbage particle: can't use bisection here as not sorted.*/
-    int nextgc = slots_find_next_garbage(0, used, ptype, pman, sman);
+    int64_t nextgc = slots_find_next_garbage(start, used, ptype, pman, sman);
     size_t size = sizeof(struct particle_data);
     if(sman)
         size = sman->info[ptype].elsize;
-    int ngc = 0;
+    int64_t ngc = 0;
     /*Note each particle is tested exactly once*/
     while(nextgc < used) {
         /*Now lastgc contains a garbage*/
-        int lastgc = nextgc;
+        int64_t lastgc = nextgc;
         /*Find a non-garbage after it*/
-        int src = slots_find_next_nongarbage(lastgc+1, used, ptype, pman, sman);
+        int64_t src = slots_find_next_nongarbage(lastgc+1, used, ptype, pman, sman);
         /*If no more non-garbage particles, don't bother copying, just add a skip*/
         if(src == used) {
             ngc += src - lastgc;
             break;
         }
         /*Destination is shifted already*/
-        int dest = lastgc - ngc;
+        int64_t dest = lastgc - ngc;
 
         /*Find another garbage particle*/
         nextgc = slots_find_next_garbage(src + 1, used, ptype, pman, sman);
 
         /*Add number of particles we skipped*/
         ngc += src - lastgc;
-        int nmove = nextgc - src +1;
-//         message(1,"i = %d, PI = %d-> %d, nm=%d\n",i, src, dest, nmove);
+        int64_t nmove = nextgc - src;
         memmove(PART(dest, ptype, pman, sman),PART(src, ptype, pman, sman),nmove*size);
     }
+    return ngc;
+}
+
+/* Count the garbage entries in [start, end)*/
+static int64_t
+slots_count_garbage(const int64_t start, const int64_t end, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
+{
+    int64_t i, ngc = 0;
+    for(i = start; i < end; i++)
+        ngc += GARBAGE(i, ptype, pman, sman) ? 1 : 0;
+    return ngc;
+}
+
+/* Below this fraction of garbage the holes are filled from the tail of the array.
+ * This moves only as many entries as there is garbage, but does not preserve the order.*/
+#define GC_TAILFILL_FRACTION (1./32)
+
+/* Fill the garbage holes in [0, used - ngc) with the non-garbage entries in [used - ngc, used).
+ * The k-th hole gets the k-th non-garbage entry of the tail. Each thread fills the holes
+ * in its chunk of the head, and finds its first source entry from the per-chunk counts of the tail.*/
+static void
+slots_gc_tailfill(const int64_t used, const int64_t ngc, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
+{
+    const int64_t nlive = used - ngc;
+    const int NumThreads = omp_get_max_threads();
+    /* Holes in each chunk of the head and non-garbage in each chunk of the tail,
+     * converted to cumulative counts.*/
+    int64_t * nholes = ta_malloc("nholes", int64_t, 2 * (NumThreads + 1));
+    int64_t * nmovers = nholes + NumThreads + 1;
+    size_t size = sizeof(struct particle_data);
+    if(sman)
+        size = sman->info[ptype].elsize;
+
+    nholes[0] = nmovers[0] = 0;
+    #pragma omp parallel num_threads(NumThreads)
+    {
+        const int tid = omp_get_thread_num();
+        const int64_t hstart = nlive * tid / NumThreads, hend = nlive * (tid + 1) / NumThreads;
+        const int64_t tstart = nlive + ngc * tid / NumThreads, tend = nlive + ngc * (tid + 1) / NumThreads;
+        nholes[tid + 1] = slots_count_garbage(hstart, hend, ptype, pman, sman);
+        nmovers[tid + 1] = (tend - tstart) - slots_count_garbage(tstart, tend, ptype, pman, sman);
+        #pragma omp barrier
+        #pragma omp single
+        {
+            int i;
+            for(i = 0; i < NumThreads; i++) {
+                nholes[i + 1] += nholes[i];
+                nmovers[i + 1] += nmovers[i];
+            }
+            if(nholes[NumThreads] != nmovers[NumThreads])
+                endrun(1, "GC: %ld holes but %ld entries to move into them\n", nholes[NumThreads], nmovers[NumThreads]);
+        }
+        if(nholes[tid + 1] > nholes[tid]) {
+            /* Find the tail chunk containing the first entry to move*/
+            int chunk = 0;
+            while(nmovers[chunk + 1] <= nholes[tid])
+                chunk++;
+            int64_t src = nlive + ngc * chunk / NumThreads - 1;
+            int64_t skip = nholes[tid] - nmovers[chunk];
+            do {
+                src = slots_find_next_nongarbage(src + 1, used, ptype, pman, sman);
+            } while(skip-- > 0);
+            int64_t dest = slots_find_next_garbage(hstart, hend, ptype, pman, sman);
+            while(1) {
+                memcpy(PART(dest, ptype, pman, sman), PART(src, ptype, pman, sman), size);
+                dest = slots_find_next_garbage(dest + 1, hend, ptype, pman, sman);
+                if(dest >= hend)
+                    break;
+                src = slots_find_next_nongarbage(src + 1, used, ptype, pman, sman);
+            }
+        }
+    }
+    ta_free(nholes);
+}
+
+/* Move n entries from src down to dest < src. The ranges may overlap, but windows
+ * of the length of the shift do not, so each window is copied in parallel.
+ * If there would be too many windows, just do a serial memmove.*/
+static void
+slots_gc_move_down(char * base, const int64_t dest, const int64_t src, const int64_t n, const size_t size)
+{
+    const int64_t shift = src - dest;
+    if(shift == 0 || n == 0)
+        return;
+    if(n > 64 * shift) {
+        memmove(base + dest * size, base + src * size, n * size);
+        return;
+    }
+    int64_t done;
+    for(done = 0; done < n; done += shift) {
+        const int64_t nwin = n - done < shift ? n - done : shift;
+        #pragma omp parallel
+        {
+            const int tid = omp_get_thread_num();
+            const int nthr = omp_get_num_threads();
+            const int64_t lo = nwin * tid / nthr, hi = nwin * (tid + 1) / nthr;
+            if(hi > lo)
+                memcpy(base + (dest + done + lo) * size, base + (src + done + lo) * size, (hi - lo) * size);
+        }
+    }
+}
+
+/*Compaction algorithm. Returns the number of garbage entries removed from the first used entries.
+ * With little garbage the holes are filled from the tail. Otherwise each thread compacts
+ * its own chunk in order, and the compacted chunks are moved down to offsets given by
+ * a prefix sum over the garbage counts of the chunks before them. This preserves the order.*/
+static int64_t
+slots_gc_compact(const int64_t used, int ptype, struct part_manager_type * pman, struct slots_manager_type * sman)
+{
+    if(used <= 0)
+        return 0;
+    const int NumThreads = omp_get_max_threads();
+    int64_t * ngarbage = ta_malloc("ngarbage", int64_t, NumThreads + 1);
+    int64_t ngc = 0;
+    int i;
+
+    #pragma omp parallel num_threads(NumThreads)
+    {
+        const int tid = omp_get_thread_num();
+        ngarbage[tid] = slots_count_garbage(used * tid / NumThreads, used * (tid + 1) / NumThreads, ptype, pman, sman);
+    }
+    for(i = 0; i < NumThreads; i++)
+        ngc += ngarbage[i];
+
+    if(ngc > 0 && ngc < used && ngc <= GC_TAILFILL_FRACTION * used)
+        slots_gc_tailfill(used, ngc, ptype, pman, sman);
+    else if(ngc > 0 && ngc < used) {
+        size_t size = sizeof(struct particle_data);
+        if(sman)
+            size = sman->info[ptype].elsize;
+        #pragma omp parallel num_threads(NumThreads)
+        {
+            const int tid = omp_get_thread_num();
+            slots_gc_compact_range(used * tid / NumThreads, used * (tid + 1) / NumThreads, ptype, pman, sman);
+        }
+        /* Chunk 0 is already in place*/
+        int64_t before = ngarbage[0];
+        for(i = 1; i < NumThreads; i++) {
+            const int64_t start = used * i / NumThreads;
+            const int64_t nlive = used * (i + 1) / NumThreads - start - ngarbage[i];
+            slots_gc_move_down(PART(0, ptype, pman, sman), start - before, start, nlive, size);
+            before += ngarbage[i];
+        }
+    }
+    ta_free(ngarbage);
     if(ngc > used)
-        endrun(1, "ngc = %d > used = %d!\n", ngc, used);
+        endrun(1, "ngc = %ld > used = %ld!\n", ngc, used);
     return ngc;
 }
 
@@ -444,10 +596,10 @@ slots_gc_sorted(struct part_manager_type * pman, struct slots_manager_type * sma
     int ptype;
     /* Resort the particles such that those of the same type and key are close by.
      * The locality is broken by the exchange. */
-    qsort_openmp(pman->Base, pman->NumPart, sizeof(struct particle_data), order_by_type_and_key);
+    /*Remove garbage particles first, so they are not sorted*/
+    pman->NumPart -= slots_gc_compact(pman->NumPart, -1, pman, NULL);
 
-    /*Remove garbage particles*/
-    pman->NumPart = slots_get_last_garbage(0, pman->NumPart -1 , -1, pman, NULL);
+    qsort_openmp(pman->Base, pman->NumPart, sizeof(struct particle_data), order_by_type_and_key);
 
     /*Set up ReverseLink*/
     slots_gc_mark(pman, sman);
@@ -455,6 +607,8 @@ slots_gc_sorted(struct part_manager_type * pman, struct slots_manager_type * sma
     for(ptype = 0; ptype < 6; ptype++) {
         if(!SLOTS_ENABLED(ptype, sman))
             continue;
+        /*Reduce slots used*/
+        slots_gc_sweep(ptype, pman, sman);
         /* sort the used ones
          * by their location in the P array */
         qsort_openmp(sman->info[ptype].ptr,
@@ -462,10 +616,10 @@ slots_gc_sorted(struct part_manager_type * pman, struct slots_manager_type * sma
                  sman->info[ptype].elsize,
                  slot_cmp_reverse_link);
 
-        /*Reduce slots used*/
-        SlotsManager->info[ptype].size = slots_get_last_garbage(0, sman->info[ptype].size-1, ptype, pman, sman);
         slots_gc_collect(ptype, pman, sman);
     }
+    EISlotsAfterGC event = {.pman = pman};
+    event_emit(&EventSlotsAfterGC, (EIBase *) &event);
 #ifdef DEBUG
     slots_check_id_consistency(pman, sman);
 #endif
@@ -581,6 +735,14 @@ slots_mark_garbage(int i, struct part_manager_type * pman, struct slots_manager_
     if(SLOTS_ENABLED(type, sman)) {
         BASESLOT_PI(pman->Base[i].PI, type, sman)->ReverseLink = pman->MaxPart + 100;
     }
+    slots_emit_change(i, pman);
+}
+
+void
+slots_emit_change(int i, const struct part_manager_type * pman)
+{
+    EISlotsChange event = {.i = i, .pman = pman};
+    event_emit(&EventSlotsChange, (EIBase *) &event);
 }
 
 void
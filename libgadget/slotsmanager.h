@@ -150,4 +150,18 @@ typedef struct {
     int child;
 } EISlotsFork;
 
+typedef struct {
+    EIBase base;
+    const struct part_manager_type * pman;
+} EISlotsAfterGC;
+
+typedef struct {
+    EIBase base;
+    int i;
+    const struct part_manager_type * pman;
+} EISlotsChange;
+
+/* Emit the change event for particle i. */
+void slots_emit_change(int i, const struct part_manager_type * pman);
+
 #endif
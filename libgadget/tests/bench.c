@@ -0,0 +1,239 @@
+/* Shared setup for the bench_ microbenchmarks: synthetic particle sets and timing reports.*/
+#include <mpi.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <gsl/gsl_rng.h>
+
+#include <libgadget/utils.h>
+#include <libgadget/allvars.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/slotsmanager.h>
+#include <libgadget/walltime.h>
+#include <libgadget/domain.h>
+#include <libgadget/forcetree.h>
+#include <libgadget/physconst.h>
+
+#include "bench.h"
+
+struct global_data_all_processes All;
+static struct ClockTable CT;
+
+/* Halos of the NFW set: shared by all ranks*/
+#define BENCH_NHALO 64
+#define BENCH_NFW_CONC 10.
+#define BENCH_NFW_FRAC 0.75
+
+struct BenchParams
+bench_init(int argc, char ** argv)
+{
+    MPI_Init(&argc, &argv);
+    init_endrun(1);
+    tamalloc_init();
+
+    struct BenchParams bp = {0};
+    bp.Type = BENCH_UNIFORM;
+    bp.NumPart = 32*32*32;
+    bp.Nrepeat = 5;
+    bp.BoxSize = 25000;
+    double MemoryMB = 4096;
+    if(argc > 1) {
+        if(!strcmp(argv[1], "uniform"))
+            bp.Type = BENCH_UNIFORM;
+        else if(!strcmp(argv[1], "nfw"))
+            bp.Type = BENCH_NFW;
+        else if(!strcmp(argv[1], "glass"))
+            bp.Type = BENCH_GLASS;
+        else
+            endrun(1, "Usage: %s [uniform|nfw|glass] [particles per rank] [repeats] [memory in MB per node]\n", argv[0]);
+    }
+    if(argc > 2)
+        bp.NumPart = atol(argv[2]);
+    if(argc > 3)
+        bp.Nrepeat = atoi(argv[3]);
+    if(argc > 4)
+        MemoryMB = atof(argv[4]);
+    if(bp.NumPart < 1 || bp.Nrepeat < 1)
+        endrun(1, "Need at least one particle and one repeat, not %ld and %d\n", bp.NumPart, bp.Nrepeat);
+
+    mymalloc_init(MemoryMB);
+    walltime_init(&CT);
+
+    /* A z=9 dark matter box, as in the gravity tests*/
+    All.BoxSize = bp.BoxSize;
+    All.MassiveNuLinRespOn = 0;
+    All.FastParticleType = 2;
+    All.CP.CMBTemperature = 2.7255;
+    All.CP.HubbleParam = 0.697;
+    All.CP.Omega0 = 0.2814;
+    All.CP.OmegaCDM = 0.2814 - 0.0464;
+    All.CP.OmegaBaryon = 0.0464;
+    All.CP.OmegaLambda = 0.7186;
+    All.Time = 0.1;
+    All.G = 43.0071;
+    All.UnitLength_in_cm = CM_PER_MPC/1000.;
+    strncpy(All.OutputDir, ".", 5);
+
+    struct DomainParams dp = {0};
+    dp.DomainOverDecompositionFactor = 4;
+    dp.DomainUseGlobalSorting = 1;
+    dp.TopNodeAllocFactor = 0.5;
+    dp.SetAsideFactor = 1;
+    set_domain_par(dp);
+    init_forcetree_params(All.FastParticleType);
+
+    int NTask;
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    const char * names[3] = {"uniform", "nfw", "glass"};
+    message(0, "Benchmarking on %s particles, %ld per rank, %d ranks of %d threads, %d repeats.\n",
+            names[bp.Type], bp.NumPart, NTask, omp_get_max_threads(), bp.Nrepeat);
+    return bp;
+}
+
+/* Radius in units of the scale radius enclosing a fraction u of the mass of an NFW halo truncated at the concentration*/
+static double
+nfw_radius(double u)
+{
+    const double mtot = log(1 + BENCH_NFW_CONC) - BENCH_NFW_CONC / (1 + BENCH_NFW_CONC);
+    double lo = 0, hi = BENCH_NFW_CONC;
+    int i;
+    for(i = 0; i < 50; i++) {
+        double x = (lo + hi) / 2;
+        if(log(1 + x) - x / (1 + x) < u * mtot)
+            lo = x;
+        else
+            hi = x;
+    }
+    return (lo + hi) / 2;
+}
+
+void
+bench_make_particles(const struct BenchParams * bp, int64_t MaxPart)
+{
+    int ThisTask, NTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+
+    particle_alloc_memory(MaxPart);
+    /* Only dark matter, so no slots are enabled, but the exchange needs the (empty) slot memory*/
+    slots_init(0.01 * MaxPart, SlotsManager);
+    int64_t NSlots[6] = {0};
+    slots_reserve(1, NSlots, SlotsManager);
+    if(bp->NumPart > MaxPart)
+        endrun(1, "%ld particles do not fit in %ld slots\n", bp->NumPart, MaxPart);
+
+    const double BoxSize = bp->BoxSize;
+    int64_t NumPart = bp->NumPart;
+    int64_t FirstID = NumPart * ThisTask;
+    gsl_rng * rng = gsl_rng_alloc(gsl_rng_ranlxd1);
+    int64_t i;
+    if(bp->Type == BENCH_GLASS) {
+        /* Each rank takes a contiguous set of the points of a grid with about NumPart * NTask points*/
+        const int64_t Ngrid = floor(cbrt(NumPart * NTask) + 0.5);
+        const int64_t Ntot = Ngrid * Ngrid * Ngrid;
+        FirstID = Ntot * ThisTask / NTask;
+        NumPart = Ntot * (ThisTask + 1) / NTask - FirstID;
+        const double cell = BoxSize / Ngrid;
+        gsl_rng_set(rng, 1729 + ThisTask);
+        for(i = 0; i < NumPart; i++) {
+            const int64_t id = FirstID + i;
+            const int64_t xyz[3] = {id / Ngrid / Ngrid, (id / Ngrid) % Ngrid, id % Ngrid};
+            int k;
+            for(k = 0; k < 3; k++)
+                P[i].Pos[k] = (xyz[k] + 0.5 + 0.2 * (gsl_rng_uniform(rng) - 0.5)) * cell;
+        }
+    }
+    else {
+        double halos[BENCH_NHALO][3];
+        /* Same halos on every rank*/
+        gsl_rng_set(rng, 1729);
+        for(i = 0; i < BENCH_NHALO; i++) {
+            int k;
+            for(k = 0; k < 3; k++)
+                halos[i][k] = BoxSize * gsl_rng_uniform(rng);
+        }
+        gsl_rng_set(rng, 1730 + ThisTask);
+        /* Halos have a virial radius of a fifth of the mean halo separation*/
+        const double rs = BoxSize / cbrt(BENCH_NHALO) / 5 / BENCH_NFW_CONC;
+        for(i = 0; i < NumPart; i++) {
+            int k;
+            if(bp->Type == BENCH_UNIFORM || gsl_rng_uniform(rng) > BENCH_NFW_FRAC) {
+                for(k = 0; k < 3; k++)
+                    P[i].Pos[k] = BoxSize * gsl_rng_uniform(rng);
+                continue;
+            }
+            const int h = gsl_rng_uniform_int(rng, BENCH_NHALO);
+            const double r = rs * nfw_radius(gsl_rng_uniform(rng));
+            const double mu = 2 * gsl_rng_uniform(rng) - 1;
+            const double phi = 2 * M_PI * gsl_rng_uniform(rng);
+            const double dir[3] = {sqrt(1 - mu * mu) * cos(phi), sqrt(1 - mu * mu) * sin(phi), mu};
+            for(k = 0; k < 3; k++) {
+                double x = halos[h][k] + r * dir[k];
+                while(x < 0)
+                    x += BoxSize;
+                while(x >= BoxSize)
+                    x -= BoxSize;
+                P[i].Pos[k] = x;
+            }
+        }
+    }
+    gsl_rng_free(rng);
+
+    #pragma omp parallel for
+    for(i = 0; i < NumPart; i++) {
+        P[i].Type = 1;
+        P[i].Mass = 1;
+        P[i].ID = FirstID + i;
+        P[i].TimeBin = 0;
+        P[i].IsGarbage = 0;
+        P[i].Key = PEANO(P[i].Pos, BoxSize);
+    }
+    PartManager->NumPart = NumPart;
+}
+
+void
+bench_free_particles(void)
+{
+    slots_free(SlotsManager);
+    myfree(PartManager->TimeBinChanged);
+    myfree(PartManager->TimeBinLink);
+    myfree(PartManager->Base);
+    PartManager->NumPart = 0;
+}
+
+double
+bench_start(void)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    return second();
+}
+
+double
+bench_stop(double tstart)
+{
+    MPI_Barrier(MPI_COMM_WORLD);
+    return second() - tstart;
+}
+
+void
+bench_report(const char * kernel, const double * times, int Nrepeat, double count, const char * unit)
+{
+    double tmin = times[0], tmean = 0;
+    int i;
+    for(i = 0; i < Nrepeat; i++) {
+        tmean += times[i] / Nrepeat;
+        if(times[i] < tmin)
+            tmin = times[i];
+    }
+    double total;
+    MPI_Allreduce(&count, &total, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    message(0, "%-24s best %10.4g s mean %10.4g s  %10.4g %s/s\n", kernel, tmin, tmean, total / tmin, unit);
+}
+
+void
+bench_finish(void)
+{
+    MPI_Finalize();
+}
@@ -0,0 +1,42 @@
+#ifndef BENCH_H
+#define BENCH_H
+/* Shared setup for the bench_ microbenchmarks, which time one kernel
+ * on a synthetic particle set outside of a full simulation.*/
+
+#include <stdint.h>
+#include <libgadget/allvars.h>
+
+enum BenchParticles {
+    BENCH_UNIFORM = 0, /* Poisson distributed*/
+    BENCH_NFW = 1,  /* Most particles in NFW halos, the rest uniform*/
+    BENCH_GLASS = 2, /* A grid with small random displacements: close to a glass for timing purposes*/
+};
+
+struct BenchParams {
+    enum BenchParticles Type;
+    /* Particles on each rank*/
+    int64_t NumPart;
+    /* Number of times the kernel is run*/
+    int Nrepeat;
+    double BoxSize;
+};
+
+/* Initialise MPI, the allocators, the clocks and the All structure, and read the arguments:
+ * name [uniform|nfw|glass] [particles per rank] [repeats] [memory in MB per node]*/
+struct BenchParams bench_init(int argc, char ** argv);
+
+/* Allocate MaxPart particles per rank and fill NumPart of them with the chosen set of
+ * type 1 particles of unit mass with Peano keys.*/
+void bench_make_particles(const struct BenchParams * bp, int64_t MaxPart);
+void bench_free_particles(void);
+
+/* Time of the kernel call, with the ranks synchronised before and after*/
+double bench_start(void);
+double bench_stop(double tstart);
+
+/* Print the fastest and mean time of the repeats and the throughput of the fastest, as count (summed over ranks) per second*/
+void bench_report(const char * kernel, const double * times, int Nrepeat, double count, const char * unit);
+
+void bench_finish(void);
+
+#endif
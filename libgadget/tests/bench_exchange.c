@@ -0,0 +1,65 @@
+/* Times the particle exchange between ranks on a synthetic particle set.
+ * Usage: bench_exchange [uniform|nfw|glass] [particles per rank] [repeats] [memory in MB per node]
+ * Each repeat sends half of the particles of each rank to the next rank, after a domain decomposition.*/
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libgadget/utils.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/slotsmanager.h>
+#include <libgadget/domain.h>
+#include <libgadget/exchange.h>
+
+#include "bench.h"
+
+struct layout_data {
+    int ThisTask;
+    int NTask;
+    int shift;
+};
+
+static int
+bench_exchange_layout(int i, const void * userdata)
+{
+    const struct layout_data * ld = userdata;
+    if((P[i].ID + ld->shift) % 2)
+        return (ld->ThisTask + 1) % ld->NTask;
+    return ld->ThisTask;
+}
+
+int main(int argc, char ** argv)
+{
+    struct BenchParams bp = bench_init(argc, argv);
+    bench_make_particles(&bp, 3 * bp.NumPart + 1000);
+
+    DomainDecomp ddecomp = {0};
+    domain_decompose_full(&ddecomp);
+
+    struct layout_data ld;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ld.ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &ld.NTask);
+
+    double * times = ta_malloc("times", double, bp.Nrepeat);
+    double sent = 0;
+    int r;
+    for(r = 0; r < bp.Nrepeat; r++) {
+        int64_t i;
+        ld.shift = r;
+        sent = 0;
+        for(i = 0; i < PartManager->NumPart; i++)
+            sent += bench_exchange_layout(i, &ld) != ld.ThisTask;
+        double tstart = bench_start();
+        if(domain_exchange(bench_exchange_layout, &ld, 0, NULL, PartManager, SlotsManager, 10000, MPI_COMM_WORLD))
+            endrun(1, "Could not exchange the particles\n");
+        times[r] = bench_stop(tstart);
+    }
+    bench_report("domain_exchange", times, bp.Nrepeat, sent, "particles");
+    bench_report("domain_exchange", times, bp.Nrepeat, sent * sizeof(struct particle_data), "bytes");
+
+    ta_free(times);
+    domain_free(&ddecomp);
+    bench_free_particles();
+    bench_finish();
+    return 0;
+}
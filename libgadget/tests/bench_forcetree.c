@@ -0,0 +1,82 @@
+/* Times the tree build and the short-range tree gravity walk on a synthetic particle set.
+ * Usage: bench_forcetree [uniform|nfw|glass] [particles per rank] [repeats] [memory in MB per node]*/
+#include <mpi.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+
+#include <libgadget/utils.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/domain.h>
+#include <libgadget/forcetree.h>
+#include <libgadget/gravity.h>
+#include <libgadget/petapm.h>
+#include <libgadget/timestep.h>
+
+#include "bench.h"
+
+int main(int argc, char ** argv)
+{
+    struct BenchParams bp = bench_init(argc, argv);
+    /* Room for the imbalance in particle number after the domain decomposition*/
+    bench_make_particles(&bp, 3 * bp.NumPart + 1000);
+
+    int64_t TotNumPart;
+    MPI_Allreduce(&PartManager->NumPart, &TotNumPart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+
+    DomainDecomp ddecomp = {0};
+    domain_decompose_full(&ddecomp);
+
+    /* The PM mesh sets the short-range force split*/
+    petapm_module_init(omp_get_max_threads());
+    PetaPM pm = {0};
+    const double Asmth = 1.5;
+    gravpm_init_periodic(&pm, bp.BoxSize, Asmth, 2 * cbrt(TotNumPart), All.G);
+
+    struct gravshort_tree_params treeacc = {0};
+    treeacc.BHOpeningAngle = 0.175;
+    /* Barnes-Hut on the first walk, then the relative opening criterion, as in a run*/
+    treeacc.TreeUseBH = 2;
+    treeacc.Rcut = 6;
+    treeacc.ErrTolForceAcc = 0.005;
+    treeacc.FractionalGravitySoftening = 1./30.;
+    set_gravshort_treepar(treeacc);
+    gravshort_set_softenings(bp.BoxSize / cbrt(TotNumPart));
+    gravshort_fill_ntab(SHORTRANGE_FORCE_WINDOW_TYPE_EXACT, Asmth);
+    const double rho0 = All.CP.Omega0 * 3 * All.CP.Hubble * All.CP.Hubble / (8 * M_PI * All.G);
+
+    double * times = ta_malloc("times", double, bp.Nrepeat);
+    ForceTree Tree = {0};
+    int r;
+    for(r = 0; r < bp.Nrepeat; r++) {
+        double tstart = bench_start();
+        force_tree_rebuild(&Tree, &ddecomp, bp.BoxSize, 0, 1, NULL);
+        times[r] = bench_stop(tstart);
+        if(r < bp.Nrepeat - 1)
+            force_tree_free(&Tree);
+    }
+    bench_report("force_tree_rebuild", times, bp.Nrepeat, PartManager->NumPart, "particles");
+
+    ActiveParticles act = {0};
+    act.NumActiveParticle = PartManager->NumPart;
+    /* Untimed: the first walk uses the Barnes-Hut criterion and sets the old accelerations*/
+    grav_short_tree(&act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
+    double interactions = 0;
+    for(r = 0; r < bp.Nrepeat; r++) {
+        double tstart = bench_start();
+        grav_short_tree(&act, &pm, NULL, &Tree, rho0, 0, All.FastParticleType);
+        times[r] = bench_stop(tstart);
+        interactions = grav_short_tree_interactions();
+    }
+    bench_report("grav_short_tree", times, bp.Nrepeat, PartManager->NumPart, "particles");
+    bench_report("grav_short_tree", times, bp.Nrepeat, interactions, "interactions");
+
+    ta_free(times);
+    force_tree_free(&Tree);
+    petapm_destroy(&pm);
+    domain_free(&ddecomp);
+    bench_free_particles();
+    bench_finish();
+    return 0;
+}
@@ -0,0 +1,59 @@
+/* Times the periodic PM force on a synthetic particle set.
+ * Usage: bench_gravpm [uniform|nfw|glass] [particles per rank] [repeats] [memory in MB per node]
+ * The mesh has twice as many cells per side as the mean particle grid.*/
+#include <mpi.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+
+#include <libgadget/utils.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/domain.h>
+#include <libgadget/forcetree.h>
+#include <libgadget/gravity.h>
+#include <libgadget/petapm.h>
+
+#include "bench.h"
+
+int main(int argc, char ** argv)
+{
+    struct BenchParams bp = bench_init(argc, argv);
+    bench_make_particles(&bp, 3 * bp.NumPart + 1000);
+
+    int64_t TotNumPart;
+    MPI_Allreduce(&PartManager->NumPart, &TotNumPart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+
+    DomainDecomp ddecomp = {0};
+    domain_decompose_full(&ddecomp);
+
+    petapm_module_init(omp_get_max_threads());
+    PetaPM pm = {0};
+    const int Nmesh = 2 * cbrt(TotNumPart);
+    gravpm_init_periodic(&pm, bp.BoxSize, 1.5, Nmesh, All.G);
+
+    double * times = ta_malloc("times", double, bp.Nrepeat);
+    int r;
+    for(r = 0; r < bp.Nrepeat; r++) {
+        /* The PM regions come from the tree, which the PM force frees: rebuild it outside the timer*/
+        ForceTree Tree = {0};
+        force_tree_rebuild(&Tree, &ddecomp, bp.BoxSize, 0, 1, NULL);
+        double tstart = bench_start();
+        gravpm_force(&pm, NULL, &Tree);
+        times[r] = bench_stop(tstart);
+        force_tree_free(&Tree);
+    }
+    int ThisTask, NTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    bench_report("gravpm_force", times, bp.Nrepeat, PartManager->NumPart, "particles");
+    /* Mesh cells are counted once, over all ranks*/
+    bench_report("gravpm_force", times, bp.Nrepeat, ThisTask == 0 ? pow(Nmesh, 3) : 0, "cells");
+
+    ta_free(times);
+    petapm_destroy(&pm);
+    domain_free(&ddecomp);
+    bench_free_particles();
+    bench_finish();
+    return 0;
+}
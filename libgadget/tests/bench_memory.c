@@ -0,0 +1,72 @@
+/* Times the tree walk access pattern over blocks of the arena options of MainMemoryArena.
+ * Usage: bench_memory [uniform|nfw|glass] [items] [repeats] [memory in MB per node]
+ * The particle set is ignored: each block holds items doubles, filled and read by all threads.
+ * On a multi-socket node a first touched arena should scale across sockets.*/
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#include <libgadget/utils.h>
+
+#include "bench.h"
+
+/* Read the block the way a tree walk reads particles: each thread takes a static slice
+ * of the array, and for each item reads a neighbour close to it in memory.*/
+static double
+walk_block(const double * data, size_t n)
+{
+    double total = 0;
+    size_t i;
+    #pragma omp parallel for schedule(static) reduction(+: total)
+    for(i = 0; i < n; i++) {
+        const size_t j = (i * 2654435761u) % 512;
+        const size_t k = i >= j ? i - j : i + j;
+        total += data[i] + data[k];
+    }
+    return total;
+}
+
+static double
+bench_arena(const struct BenchParams * bp, const char * label, int flags)
+{
+    const size_t n = bp->NumPart;
+    Allocator A0[1];
+    if(ALLOC_ENOMEMORY == allocator_init_arena(A0, "Arena", n * sizeof(double) + 8192, 0, flags))
+        endrun(1, "Could not map a %s arena of %ld items\n", label, n);
+    /* Fill the block as the particle loops would, from all threads*/
+    double * data = allocator_alloc_bot(A0, "data", n * sizeof(double));
+    size_t i;
+    #pragma omp parallel for schedule(static)
+    for(i = 0; i < n; i++)
+        data[i] = i % 1000;
+
+    double * times = ta_malloc("times", double, bp->Nrepeat);
+    double sum = 0;
+    int r;
+    for(r = 0; r < bp->Nrepeat; r++) {
+        double tstart = bench_start();
+        sum = walk_block(data, n);
+        times[r] = bench_stop(tstart);
+    }
+    char name[64];
+    snprintf(name, sizeof(name), "%s (flags %d)", label, A0->arena_flags);
+    bench_report(name, times, bp->Nrepeat, 2. * n * sizeof(double) / 1e9, "GB");
+    ta_free(times);
+    allocator_free(data);
+    allocator_destroy(A0);
+    return sum;
+}
+
+int main(int argc, char ** argv)
+{
+    struct BenchParams bp = bench_init(argc, argv);
+    const double sum0 = bench_arena(&bp, "malloc", 0);
+    const double sum1 = bench_arena(&bp, "firsttouch", ALLOC_ARENA_FIRSTTOUCH);
+    const double sum2 = bench_arena(&bp, "hugepages,firsttouch", ALLOC_ARENA_HUGEPAGES | ALLOC_ARENA_FIRSTTOUCH);
+    const double sum3 = bench_arena(&bp, "hugetlb,firsttouch", ALLOC_ARENA_HUGETLB | ALLOC_ARENA_FIRSTTOUCH);
+    if(sum0 != sum1 || sum0 != sum2 || sum0 != sum3)
+        endrun(1, "Arenas read different data: %g %g %g %g\n", sum0, sum1, sum2, sum3);
+    bench_finish();
+    return 0;
+}
@@ -0,0 +1,57 @@
+/* Times the merge and sample sorts of qsort_openmp with increasing thread counts.
+ * Usage: bench_openmpsort [uniform|nfw|glass] [items] [repeats] [memory in MB per node]
+ * The particle set is ignored: the items are random integers. Each rank sorts its own array.*/
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#include <libgadget/utils.h>
+#include <libgadget/utils/openmpsort.h>
+
+#include "bench.h"
+
+static int
+compare_int(const void *a, const void *b)
+{
+    return (*(int*)a > *(int*)b) - (*(int*)a < *(int*)b);
+}
+
+int main(int argc, char ** argv)
+{
+    struct BenchParams bp = bench_init(argc, argv);
+    const size_t size = bp.NumPart;
+    int * a = mymalloc2("items", size * sizeof(int));
+    double * times = ta_malloc("times", double, bp.Nrepeat);
+    const int maxthreads = omp_get_max_threads();
+    int samplesort;
+    for(samplesort = 0; samplesort < 2; samplesort++) {
+        int nthreads;
+        qsort_openmp_set_samplesort(samplesort ? 0 : (size_t) -1);
+        for(nthreads = 1; nthreads <= maxthreads; nthreads *= 2) {
+            omp_set_num_threads(nthreads);
+            int r;
+            for(r = 0; r < bp.Nrepeat; r++) {
+                size_t i;
+                srand48(8675309 + r);
+                for(i = 0; i < size; i++)
+                    a[i] = (int) (size * drand48());
+                double tstart = bench_start();
+                qsort_openmp(a, size, sizeof(int), compare_int);
+                times[r] = bench_stop(tstart);
+                for(i = 1; i < size; i++)
+                    if(a[i-1] > a[i])
+                        endrun(1, "Array not sorted at %ld: %d > %d\n", i, a[i-1], a[i]);
+            }
+            char label[64];
+            snprintf(label, sizeof(label), "%s sort %d threads", samplesort ? "sample" : "merge", nthreads);
+            bench_report(label, times, bp.Nrepeat, size, "items");
+        }
+    }
+    omp_set_num_threads(maxthreads);
+    qsort_openmp_set_samplesort(1 << 22);
+    ta_free(times);
+    myfree(a);
+    bench_finish();
+    return 0;
+}
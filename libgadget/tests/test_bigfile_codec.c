@@ -0,0 +1,204 @@
+/*Tests for the compressed bigfile blocks*/
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <bigfile-mpi.h>
+#include "stub.h"
+
+/* A slowly varying integer field, like Peano-sorted IDs*/
+static int64_t
+id_of(int64_t g)
+{
+    return 1000 + 3 * g + (g % 7 == 0);
+}
+
+static double
+pos_of(int64_t g, int k)
+{
+    return fmod(g * 0.37 + k * 11.1, 100.);
+}
+
+static void
+test_codec_integers(void ** state)
+{
+    const size_t n = 100000;
+    int64_t * ids = malloc(n * sizeof(int64_t));
+    uint32_t * gen = malloc(3 * n * sizeof(uint32_t));
+    size_t i;
+    for(i = 0; i < n; i++) {
+        ids[i] = id_of(i);
+        gen[3 * i] = i;
+        gen[3 * i + 1] = rand();
+        gen[3 * i + 2] = 4000000000u - i;
+    }
+    size_t bound = big_codec_bound(BIG_CODEC_SHUFFLE_LZ, "=i8", 1, n);
+    char * buf = malloc(bound);
+    ptrdiff_t used = big_codec_encode(BIG_CODEC_SHUFFLE_LZ, 0, "=i8", 1, n, ids, buf, bound);
+    assert_true(used > 0);
+    /* Delta coding makes this very compressible*/
+    assert_true(used < (ptrdiff_t) (n * sizeof(int64_t) / 8));
+    int64_t * ids2 = malloc(n * sizeof(int64_t));
+    assert_int_equal(big_codec_decode(BIG_CODEC_SHUFFLE_LZ, 0, "=i8", 1, n, buf, used, ids2), 0);
+    assert_memory_equal(ids, ids2, n * sizeof(int64_t));
+    /* Truncated data is an error, not a crash*/
+    assert_int_not_equal(big_codec_decode(BIG_CODEC_SHUFFLE_LZ, 0, "=i8", 1, n, buf, used / 2, ids2), 0);
+    free(buf);
+
+    /* Several columns, one of them incompressible*/
+    bound = big_codec_bound(BIG_CODEC_SHUFFLE_LZ, "=u4", 3, n);
+    buf = malloc(bound);
+    used = big_codec_encode(BIG_CODEC_SHUFFLE_LZ, 0, "=u4", 3, n, gen, buf, bound);
+    assert_true(used > 0 && (size_t) used <= bound);
+    uint32_t * gen2 = malloc(3 * n * sizeof(uint32_t));
+    assert_int_equal(big_codec_decode(BIG_CODEC_SHUFFLE_LZ, 0, "=u4", 3, n, buf, used, gen2), 0);
+    assert_memory_equal(gen, gen2, 3 * n * sizeof(uint32_t));
+
+    /* Empty input*/
+    used = big_codec_encode(BIG_CODEC_SHUFFLE_LZ, 0, "=u4", 3, 0, gen, buf, bound);
+    assert_true(used > 0);
+    assert_int_equal(big_codec_decode(BIG_CODEC_SHUFFLE_LZ, 0, "=u4", 3, 0, buf, used, gen2), 0);
+    free(buf);
+    free(gen2);
+    free(ids2);
+    free(gen);
+    free(ids);
+}
+
+static void
+test_codec_quantise(void ** state)
+{
+    const size_t n = 50000;
+    const double precision = 1e-3;
+    double * pos = malloc(3 * n * sizeof(double));
+    float * vel = malloc(3 * n * sizeof(float));
+    size_t i;
+    for(i = 0; i < 3 * n; i++) {
+        pos[i] = pos_of(i / 3, i % 3);
+        vel[i] = 300. * rand() / RAND_MAX - 150.;
+    }
+    size_t bound = big_codec_bound(BIG_CODEC_QUANTISE_LZ, "=f8", 3, n);
+    char * buf = malloc(bound);
+    ptrdiff_t used = big_codec_encode(BIG_CODEC_QUANTISE_LZ, precision, "=f8", 3, n, pos, buf, bound);
+    assert_true(used > 0);
+    assert_true(used < (ptrdiff_t) (3 * n * sizeof(double) / 2));
+    double * pos2 = malloc(3 * n * sizeof(double));
+    assert_int_equal(big_codec_decode(BIG_CODEC_QUANTISE_LZ, precision, "=f8", 3, n, buf, used, pos2), 0);
+    for(i = 0; i < 3 * n; i++)
+        assert_true(fabs(pos2[i] - pos[i]) <= 0.5 * precision * (1 + 1e-9));
+    free(buf);
+
+    bound = big_codec_bound(BIG_CODEC_QUANTISE_LZ, "=f4", 3, n);
+    buf = malloc(bound);
+    used = big_codec_encode(BIG_CODEC_QUANTISE_LZ, precision, "=f4", 3, n, vel, buf, bound);
+    assert_true(used > 0);
+    float * vel2 = malloc(3 * n * sizeof(float));
+    assert_int_equal(big_codec_decode(BIG_CODEC_QUANTISE_LZ, precision, "=f4", 3, n, buf, used, vel2), 0);
+    for(i = 0; i < 3 * n; i++)
+        assert_true(fabs(vel2[i] - vel[i]) <= 0.5 * precision + 2e-7 * fabs(vel[i]));
+
+    /* Quantisation is only for floating point, and needs a precision*/
+    assert_true(big_codec_encode(BIG_CODEC_QUANTISE_LZ, precision, "=i8", 1, n, vel, buf, bound) < 0);
+    assert_true(big_codec_encode(BIG_CODEC_QUANTISE_LZ, 0, "=f4", 3, n, vel, buf, bound) < 0);
+    free(vel2);
+    free(buf);
+    free(pos2);
+    free(vel);
+    free(pos);
+}
+
+/* Write a compressed block with one distribution of rows over the ranks and
+ * read it back with a different one, so chunks are split between readers.*/
+static void
+test_compressed_block_mpi(void ** state)
+{
+    int ThisTask, NTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+
+    char dirname[] = "/tmp/test_bigfile_codec_XXXXXX";
+    if(ThisTask == 0)
+        assert_true(mkdtemp(dirname) != NULL);
+    MPI_Bcast(dirname, sizeof(dirname), MPI_CHAR, 0, MPI_COMM_WORLD);
+
+    BigFile bf;
+    assert_int_equal(big_file_mpi_create(&bf, dirname, MPI_COMM_WORLD), 0);
+
+    /* More than one chunk on some ranks, none on the last*/
+    const int64_t wsize = ThisTask == NTask - 1 && NTask > 1 ? 0 : 300000 + 1000 * ThisTask;
+    int64_t wstart = 0, total = 0;
+    MPI_Exscan(&wsize, &wstart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+    if(ThisTask == 0)
+        wstart = 0;
+    MPI_Allreduce(&wsize, &total, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+
+    struct {double pos[3]; int64_t id;} * P = malloc((wsize + 1) * sizeof(P[0]));
+    int64_t i;
+    for(i = 0; i < wsize; i++) {
+        P[i].id = id_of(wstart + i);
+        int k;
+        for(k = 0; k < 3; k++)
+            P[i].pos[k] = pos_of(wstart + i, k);
+    }
+    BigArray array;
+    big_array_init(&array, &P[0].id, "i8", 2, (size_t[]){wsize, 1}, (ptrdiff_t[]){sizeof(P[0]), sizeof(int64_t)});
+    assert_int_equal(big_file_mpi_write_block_compressed(&bf, "1/ID", &array, BIG_CODEC_SHUFFLE_LZ, 0, 2, 2, MPI_COMM_WORLD), 0);
+    big_array_init(&array, &P[0].pos[0], "f8", 2, (size_t[]){wsize, 3}, (ptrdiff_t[]){sizeof(P[0]), sizeof(double)});
+    assert_int_equal(big_file_mpi_write_block_compressed(&bf, "1/Position", &array, BIG_CODEC_QUANTISE_LZ, 1e-4, 2, 2, MPI_COMM_WORLD), 0);
+    free(P);
+
+    /* Read back evenly, converting the IDs to u8*/
+    const int64_t rstart = total * ThisTask / NTask;
+    const int64_t rsize = total * (ThisTask + 1) / NTask - rstart;
+    uint64_t * ids = malloc((rsize + 1) * sizeof(uint64_t));
+    double * pos = malloc((rsize + 1) * 3 * sizeof(double));
+    BigBlock bb;
+    BigBlockPtr ptr;
+    assert_int_equal(big_file_mpi_open_block(&bf, &bb, "1/ID", MPI_COMM_WORLD), 0);
+    assert_int_equal(big_block_seek(&bb, &ptr, 0), 0);
+    big_array_init(&array, ids, "u8", 2, (size_t[]){rsize, 1}, NULL);
+    assert_int_equal(big_block_mpi_read(&bb, &ptr, &array, 1, MPI_COMM_WORLD), 0);
+    assert_int_equal(big_block_mpi_close(&bb, MPI_COMM_WORLD), 0);
+
+    assert_int_equal(big_file_mpi_open_block(&bf, &bb, "1/Position", MPI_COMM_WORLD), 0);
+    assert_int_equal(big_block_seek(&bb, &ptr, 0), 0);
+    big_array_init(&array, pos, "f8", 2, (size_t[]){rsize, 3}, NULL);
+    assert_int_equal(big_block_mpi_read(&bb, &ptr, &array, NTask, MPI_COMM_WORLD), 0);
+    /* Asking for the wrong number of columns fails on all ranks*/
+    assert_int_equal(big_block_seek(&bb, &ptr, 0), 0);
+    big_array_init(&array, pos, "f8", 2, (size_t[]){rsize, 1}, NULL);
+    assert_int_not_equal(big_block_mpi_read(&bb, &ptr, &array, NTask, MPI_COMM_WORLD), 0);
+    assert_int_equal(big_block_mpi_close(&bb, MPI_COMM_WORLD), 0);
+
+    for(i = 0; i < rsize; i++) {
+        assert_int_equal(ids[i], id_of(rstart + i));
+        int k;
+        for(k = 0; k < 3; k++)
+            assert_true(fabs(pos[3 * i + k] - pos_of(rstart + i, k)) <= 0.5e-4 * (1 + 1e-9));
+    }
+    free(pos);
+    free(ids);
+    assert_int_equal(big_file_mpi_close(&bf, MPI_COMM_WORLD), 0);
+    MPI_Barrier(MPI_COMM_WORLD);
+    if(ThisTask == 0) {
+        char cmd[128];
+        snprintf(cmd, sizeof(cmd), "rm -rf %s", dirname);
+        assert_int_equal(system(cmd), 0);
+    }
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_codec_integers),
+        cmocka_unit_test(test_codec_quantise),
+        cmocka_unit_test(test_compressed_block_mpi),
+    };
+    return cmocka_run_group_tests_mpi(tests, NULL, NULL);
+}
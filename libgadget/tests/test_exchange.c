@@ -207,12 +207,53 @@ test_exchange_uneven(void **state)
     return;
 }
 
+/* Send straight from the particle table, with some garbage and an uneven layout that grows the slots*/
+static void
+test_exchange_direct(void **state)
+{
+    int64_t newSlots[6] = {NUMPART1, NUMPART1, NUMPART1, NUMPART1, NUMPART1, NUMPART1};
+
+    setup_particles(newSlots);
+    int i;
+    struct ExchangeParams ep = {1};
+    set_exchange_par(ep);
+
+    slots_mark_garbage(PartManager->NumPart - 1, PartManager, SlotsManager);
+    TotNumPart -= NTask;
+
+    int fail = domain_exchange(&test_exchange_layout_func_uneven, NULL, 1, NULL, PartManager, SlotsManager, 10000, MPI_COMM_WORLD);
+
+    assert_all_true(!fail);
+
+    if(ThisTask == 0) {
+        assert_int_equal(SlotsManager->info[0].size, NUMPART1 * NTask);
+    }
+
+    slots_check_id_consistency(PartManager, SlotsManager);
+    domain_test_id_uniqueness(PartManager);
+
+    for(i = 0; i < PartManager->NumPart; i ++) {
+        assert_true (P[i].IsGarbage == 0);
+        if(P[i].Type == 0) {
+            assert_true (ThisTask == 0);
+        } else {
+            assert_true(P[i].ID % NTask == 1Lu * ThisTask);
+        }
+    }
+
+    ep.DirectSend = 0;
+    set_exchange_par(ep);
+    teardown_particles(state);
+    return;
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_exchange_with_garbage),
         cmocka_unit_test(test_exchange),
         cmocka_unit_test(test_exchange_zero_slots),
         cmocka_unit_test(test_exchange_uneven),
+        cmocka_unit_test(test_exchange_direct),
     };
     return cmocka_run_group_tests_mpi(tests, NULL, NULL);
 }
@@ -158,20 +158,10 @@ static int check_against_force_direct(double ErrTolForceAcc)
     return 0;
 }
 
-static void do_force_test(double BoxSize, int Nmesh, double Asmth, double ErrTolForceAcc, int direct)
+/* Compute the PM and tree forces on all particles. hr is the high resolution mesh, or NULL.
+ * If PMStep is 0 only the tree force is computed, and the PM force is kept from the last call, as between PM steps.*/
+static void compute_forces(double BoxSize, int Nmesh, double Asmth, double ErrTolForceAcc, GravPMHighRes * hr, const int PMStep)
 {
-    /*Sort by peano key so this is more realistic*/
-    int i;
-    #pragma omp parallel for
-    for(i=0; i<PartManager->NumPart; i++) {
-        P[i].Type = 1;
-        P[i].Key = PEANO(P[i].Pos, BoxSize);
-        P[i].Mass = 1;
-        P[i].ID = i;
-        P[i].TimeBin = 0;
-        P[i].IsGarbage = 0;
-    }
-
     ActiveParticles act = {0};
     act.NumActiveParticle = PartManager->NumPart;
 
@@ -181,10 +171,15 @@ static void do_force_test(double BoxSize, int Nmesh, double Asmth, double ErrTol
     PetaPM pm = {0};
     gravpm_init_periodic(&pm, BoxSize, Asmth, Nmesh, All.G);
     ForceTree Tree = {0};
-    force_tree_rebuild(&Tree, &ddecomp, BoxSize, 1, 1, NULL);
+    /* As in run.c, the region is placed before the tree is built*/
+    if(hr && PMStep)
+        gravpm_highres_set_region(hr);
+    force_tree_rebuild(&Tree, &ddecomp, BoxSize, 0, 1, NULL);
     gravshort_fill_ntab(SHORTRANGE_FORCE_WINDOW_TYPE_EXACT, Asmth);
-    gravpm_force(&pm, &Tree);
-    force_tree_rebuild(&Tree, &ddecomp, BoxSize, 1, 1, NULL);
+    if(PMStep) {
+        gravpm_force(&pm, hr, &Tree);
+        force_tree_rebuild(&Tree, &ddecomp, BoxSize, 0, 1, NULL);
+    }
     const double rho0 = All.CP.Omega0 * 3 * All.CP.Hubble * All.CP.Hubble / (8 * M_PI * All.G);
 
     /* Barnes-Hut on first iteration*/
@@ -200,12 +195,29 @@ static void do_force_test(double BoxSize, int Nmesh, double Asmth, double ErrTol
     gravshort_set_softenings(All.BoxSize / cbrt(PartManager->NumPart));
 
     /* Twice so the opening angle is consistent*/
-    grav_short_tree(&act, &pm, &Tree, rho0, 0, 2);
-    grav_short_tree(&act, &pm, &Tree, rho0, 0, 2);
+    grav_short_tree(&act, &pm, hr, &Tree, rho0, 0, 2);
+    grav_short_tree(&act, &pm, hr, &Tree, rho0, 0, 2);
 
     force_tree_free(&Tree);
     petapm_destroy(&pm);
     domain_free(&ddecomp);
+}
+
+static void do_force_test(double BoxSize, int Nmesh, double Asmth, double ErrTolForceAcc, int direct)
+{
+    /*Sort by peano key so this is more realistic*/
+    int i;
+    #pragma omp parallel for
+    for(i=0; i<PartManager->NumPart; i++) {
+        P[i].Type = 1;
+        P[i].Key = PEANO(P[i].Pos, BoxSize);
+        P[i].Mass = 1;
+        P[i].ID = i;
+        P[i].TimeBin = 0;
+        P[i].IsGarbage = 0;
+    }
+
+    compute_forces(BoxSize, Nmesh, Asmth, ErrTolForceAcc, NULL, 1);
     if(direct)
         check_against_force_direct(ErrTolForceAcc);
 }
@@ -359,11 +371,192 @@ static int teardown_tree(void **state) {
     return 0;
 }
 
+/* Is particle i inside the high resolution region at its current position?*/
+static int
+inside_highres_region(const GravPMHighRes * hr, int i)
+{
+    int k;
+    for(k = 0; k < 3; k++) {
+        double x = P[i].Pos[k] - hr->Origin[k];
+        if(x < 0)
+            x += All.BoxSize;
+        if(x >= hr->Size)
+            return 0;
+    }
+    return 1;
+}
+
+enum ZoomClass {
+    ZOOM_INSIDE = 0,
+    ZOOM_OUTSIDE = 1,
+    /* Crossed the edge of the region since the last PM step*/
+    ZOOM_CROSSING = 2,
+};
+
+static int
+zoom_class(const GravPMHighRes * hr, int i)
+{
+    if(P[i].HighRes != inside_highres_region(hr, i))
+        return ZOOM_CROSSING;
+    return P[i].HighRes ? ZOOM_INSIDE : ZOOM_OUTSIDE;
+}
+
+/* Store the total acceleration of each particle by ID, as the domain decomposition reorders them.*/
+static void
+store_accns(double * accn)
+{
+    int64_t i;
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int k;
+        for(k=0; k<3; k++)
+            accn[3 * P[i].ID + k] = P[i].GravPM[k] + P[i].GravAccel[k];
+    }
+}
+
+/* Compare the accelerations (by ID) of the particles of one class to a reference,
+ * relative to their mean reference acceleration. Returns the number of particles in the class.*/
+static int64_t
+check_zoom_accns(const GravPMHighRes * hr, const double * accn, const double * ref, const enum ZoomClass which, const char * refname, const double ErrTolForceAcc)
+{
+    const char * names[] = {"inside", "outside", "crossing"};
+    double meanacc = 0, meanerr = 0, maxerr = 0;
+    int64_t i, n = 0;
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int k;
+        if(zoom_class(hr, i) != which)
+            continue;
+        n++;
+        for(k=0; k<3; k++)
+            meanacc += fabs(ref[3 * P[i].ID + k]);
+    }
+    if(n == 0)
+        return 0;
+    meanacc /= 3 * n;
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int k;
+        if(zoom_class(hr, i) != which)
+            continue;
+        for(k=0; k<3; k++) {
+            double err = fabs(accn[3 * P[i].ID + k] - ref[3 * P[i].ID + k]) / meanacc;
+            meanerr += err;
+            if(maxerr < err)
+                maxerr = err;
+        }
+    }
+    meanerr /= 3 * n;
+    message(0, "Zoom, %s the region: %ld particles, mean rel err %g max rel err %g from the %s force, mean acc %g\n",
+            names[which], n, meanerr, maxerr, refname, meanacc);
+    /* Both forces have tree and mesh errors of order ErrTolForceAcc*/
+    assert_true(maxerr < 6 * ErrTolForceAcc);
+    assert_true(meanerr < 1.6 * ErrTolForceAcc);
+    return n;
+}
+
+/* A zoom simulation: high resolution particles (type 1) in a small region, surrounded by low resolution
+ * particles (type 2) which are denser near it. The force with the high resolution mesh is checked against
+ * the force with the periodic mesh alone, for particles inside the region, outside it, and crossing its edge
+ * between PM steps. The particles inside the region are also checked against a direct summation.*/
+static void test_force_zoom(void ** state) {
+    int numpart = PartManager->NumPart;
+    struct forcetree_testdata * data = * (struct forcetree_testdata **) state;
+    gsl_rng * r = data->r;
+    P = mymalloc("part", numpart*sizeof(struct particle_data));
+    memset(P, 0, numpart*sizeof(struct particle_data));
+    int i;
+    for(i=0; i<numpart; i++) {
+        int j;
+        const int highres = i < 3 * numpart / 4;
+        const int near = i < 7 * numpart / 8;
+        for(j=0; j<3; j++) {
+            if(highres)
+                P[i].Pos[j] = All.BoxSize * (0.3 + 0.1 * gsl_rng_uniform(r));
+            else if(near)
+                P[i].Pos[j] = All.BoxSize * (0.2 + 0.3 * gsl_rng_uniform(r));
+            else
+                P[i].Pos[j] = All.BoxSize * gsl_rng_uniform(r);
+        }
+        P[i].Type = highres ? 1 : 2;
+        P[i].Key = PEANO(P[i].Pos, All.BoxSize);
+        P[i].Mass = 1;
+        P[i].ID = i;
+        P[i].TimeBin = 0;
+        P[i].IsGarbage = 0;
+    }
+    PartManager->NumPart = numpart;
+    PartManager->MaxPart = numpart;
+
+    const int Nmesh = 48;
+    const double Asmth = 1.5, ErrTolForceAcc = 0.002;
+    double * periodic = (double *) mymalloc("periodic", 3*sizeof(double) * numpart);
+    double * accn = (double *) mymalloc("accelerations", 3*sizeof(double) * numpart);
+    compute_forces(All.BoxSize, Nmesh, Asmth, ErrTolForceAcc, NULL, 1);
+    store_accns(periodic);
+
+    GravPMHighRes hr[1] = {0};
+    gravpm_init_highres(hr, All.BoxSize, Asmth, Nmesh, 64, 2, All.G);
+    compute_forces(All.BoxSize, Nmesh, Asmth, ErrTolForceAcc, hr, 1);
+    store_accns(accn);
+
+    /* The region holds all the high resolution particles and some low resolution particles*/
+    int64_t nlowres = 0;
+    for(i = 0; i < PartManager->NumPart; i++) {
+        assert_int_equal(gravpm_is_highres_particle(hr, i), inside_highres_region(hr, i));
+        if(P[i].Type == 1)
+            assert_true(P[i].HighRes);
+        else
+            nlowres += P[i].HighRes;
+    }
+    assert_true(nlowres > 0);
+    assert_true(check_zoom_accns(hr, accn, periodic, ZOOM_INSIDE, "periodic", ErrTolForceAcc) > 0);
+    assert_true(check_zoom_accns(hr, accn, periodic, ZOOM_OUTSIDE, "periodic", ErrTolForceAcc) > 0);
+
+    /* The direct summation mirrors the box only once, so it is accurate only
+     * where the force is dominated by the nearby mass: that is, inside the region.
+     * Even there the periodic mesh alone is up to 10 ErrTolForceAcc off from it.*/
+    double * direct = (double *) mymalloc("direct", 3*sizeof(double) * numpart);
+    force_direct(accn);
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int k;
+        for(k=0; k<3; k++)
+            direct[3 * P[i].ID + k] = accn[3 * i + k];
+    }
+    store_accns(accn);
+    check_zoom_accns(hr, accn, direct, ZOOM_INSIDE, "direct", 4 * ErrTolForceAcc);
+    myfree(direct);
+
+    /* Between PM steps the particles move and some cross the edge of the region.
+     * Moving them all together leaves the forces unchanged, so the mesh force from the last
+     * PM step is still correct, provided the tree force keeps the split of that step.*/
+    const double shift = 3 * hr->pm->CellSize;
+    for(i = 0; i < PartManager->NumPart; i++) {
+        int k;
+        for(k = 0; k < 3; k++) {
+            P[i].Pos[k] += shift;
+            if(P[i].Pos[k] >= All.BoxSize)
+                P[i].Pos[k] -= All.BoxSize;
+        }
+        P[i].Key = PEANO(P[i].Pos, All.BoxSize);
+    }
+    compute_forces(All.BoxSize, Nmesh, Asmth, ErrTolForceAcc, hr, 0);
+    store_accns(accn);
+    compute_forces(All.BoxSize, Nmesh, Asmth, ErrTolForceAcc, NULL, 1);
+    store_accns(periodic);
+    assert_true(check_zoom_accns(hr, accn, periodic, ZOOM_CROSSING, "periodic", ErrTolForceAcc) > 0);
+    check_zoom_accns(hr, accn, periodic, ZOOM_INSIDE, "periodic", ErrTolForceAcc);
+    check_zoom_accns(hr, accn, periodic, ZOOM_OUTSIDE, "periodic", ErrTolForceAcc);
+
+    gravpm_destroy_highres(hr);
+    myfree(accn);
+    myfree(periodic);
+    myfree(P);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_force_flat),
         cmocka_unit_test(test_force_close),
         cmocka_unit_test(test_force_random),
+        cmocka_unit_test(test_force_zoom),
     };
     return cmocka_run_group_tests_mpi(tests, setup_tree, teardown_tree);
 }
@@ -158,6 +158,55 @@ test_hci_terminate(void ** state)
     assert_int_equal(action->write_snapshot, 0);
 }
 
+static void
+write_file(char * prefix, char * b, char * content)
+{
+    char * fn = fastpm_strdup_printf("%s/%s", prefix, b);
+    FILE * fp = fopen(fn, "w");
+    myfree(fn);
+    fputs(content, fp);
+    fclose(fp);
+}
+
+static double ErrTol = 0.005;
+static double get_errtol(void) { return ErrTol; }
+static void set_errtol(double value) { ErrTol = value; }
+static double Depth = 8;
+static double get_depth(void) { return Depth; }
+static void set_depth(double value) { Depth = value; }
+
+static void
+test_hci_setparam(void ** state)
+{
+    HCIAction action[1];
+    hci_override_now(manager, 0.0);
+    hci_init(manager, prefix, 10.0, 1.0, 1);
+    hci_register_parameter(manager, "ErrTolForceAcc", 0, 0, 1, get_errtol, set_errtol);
+    hci_register_parameter(manager, "MaxDomainTimeBinDepth", 1, 0, 20, get_depth, set_depth);
+
+    write_file(prefix, "setparam", "# Faster gravity\nErrTolForceAcc 0.01\n\nMaxDomainTimeBinDepth 4 # comment\n");
+    hci_override_now(manager, 0.5);
+    hci_query(manager, action);
+    assert_false(exists(prefix, "setparam"));
+    assert_int_equal(action->type, HCI_SET_PARAMETERS);
+    assert_int_equal(action->write_snapshot, 0);
+    assert_true(ErrTol == 0.01);
+    assert_true(Depth == 4);
+
+    /* An unknown parameter, a value out of range or a non-integer for an integer parameter
+     * reject the whole request*/
+    char * bad[3] = {"ErrTolForceAcc 0.02\nTimeMax 2\n", "ErrTolForceAcc 0.02\nMaxDomainTimeBinDepth 30\n", "MaxDomainTimeBinDepth 2.5\nErrTolForceAcc 0.02\n"};
+    int i;
+    for(i = 0; i < 3; i++) {
+        write_file(prefix, "setparam", bad[i]);
+        hci_override_now(manager, 0.6 + 0.1 * i);
+        hci_query(manager, action);
+        assert_int_equal(action->type, HCI_SET_PARAMETERS);
+        assert_true(ErrTol == 0.01);
+        assert_true(Depth == 4);
+    }
+}
+
 static int setup(void ** state)
 {
     char * ret = mkdtemp(prefix);
@@ -180,6 +229,7 @@ int main(void) {
         cmocka_unit_test(test_hci_stop),
         cmocka_unit_test(test_hci_checkpoint),
         cmocka_unit_test(test_hci_terminate),
+        cmocka_unit_test(test_hci_setparam),
     };
     return cmocka_run_group_tests_mpi(tests, setup, teardown);
 }
@@ -4,8 +4,12 @@
 #include <cmocka.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
 
 #include "stub.h"
+#include "../utils/mymalloc.h"
 
 static void
 test_allocator(void ** state)
@@ -107,12 +111,225 @@ test_allocator_malloc(void ** state)
     allocator_destroy(A0);
 }
 
+/* A thread with its own arena can allocate while another thread uses A_MAIN*/
+static void
+test_thread_allocator(void ** state)
+{
+    Allocator A1[1];
+    allocator_init(A_MAIN, "MAIN", 4096 * 1024 * 2, 1, NULL);
+    allocator_init(A1, "A1", 4096 * 1024, 1, A_MAIN);
+    size_t mainused = allocator_get_used_size(A_MAIN, ALLOC_DIR_BOTH);
+    size_t a1used = 0;
+    int nthreads = 1;
+
+    #pragma omp parallel num_threads(2)
+    {
+        const int tid = omp_get_thread_num();
+        if(tid == 1)
+            mymalloc_set_thread_allocator(A1);
+        void * p1 = mymalloc("M+1", 1024);
+        void * p2 = ta_malloc("T+1", char, 1024);
+        #pragma omp barrier
+        #pragma omp master
+        {
+            nthreads = omp_get_num_threads();
+            a1used = allocator_get_used_size(A1, ALLOC_DIR_BOTH);
+        }
+        #pragma omp barrier
+        ta_free(p2);
+        myfree(p1);
+        mymalloc_set_thread_allocator(NULL);
+    }
+    /* Only the second thread, if we have one, used A1: two blocks, each with a header*/
+    if(nthreads > 1)
+        assert_true(a1used >= 2 * 1024 + 2 * sizeof(void *));
+    else
+        assert_int_equal(a1used, 0);
+    assert_int_equal(allocator_get_used_size(A1, ALLOC_DIR_BOTH), 0);
+    assert_int_equal(allocator_get_used_size(A_MAIN, ALLOC_DIR_BOTH), mainused);
+    assert_true(MainAllocator == A_MAIN);
+
+    allocator_destroy(A1);
+    allocator_destroy(A_MAIN);
+}
+
+/* The threads of a parallel region started by a thread with its own arena use that arena,
+ * and the threads of a region started by another thread do not.*/
+static void
+test_thread_allocator_nested(void ** state)
+{
+    Allocator A1[1];
+    allocator_init(A_MAIN, "MAIN", 4096 * 1024 * 2, 1, NULL);
+    allocator_init(A1, "A1", 4096 * 1024, 1, A_MAIN);
+    const int maxlevels = omp_get_max_active_levels();
+    omp_set_max_active_levels(2);
+    int wrong[2] = {0, 0};
+    int nthreads = 1;
+
+    #pragma omp parallel num_threads(2)
+    {
+        const int tid = omp_get_thread_num();
+        if(tid == 1)
+            mymalloc_set_thread_allocator(A1);
+        #pragma omp master
+        nthreads = omp_get_num_threads();
+        int nwrong = 0;
+        #pragma omp parallel num_threads(3) reduction(+: nwrong)
+        {
+            nwrong += (MainAllocator != (tid == 1 ? A1 : A_MAIN)) + (TempAllocator != (tid == 1 ? A1 : A_TEMP));
+            /* One thread of the team allocates, as the PM code does*/
+            if(tid == 1) {
+                #pragma omp single
+                {
+                    void * p1 = mymalloc("M+1", 1024);
+                    nwrong += allocator_get_used_size(A1, ALLOC_DIR_BOTH) == 0;
+                    myfree(p1);
+                }
+            }
+        }
+        wrong[tid] = nwrong;
+        mymalloc_set_thread_allocator(NULL);
+    }
+    omp_set_max_active_levels(maxlevels);
+    assert_int_equal(wrong[0], 0);
+    if(nthreads > 1)
+        assert_int_equal(wrong[1], 0);
+    /* Once restored, nested teams use A_MAIN again*/
+    #pragma omp parallel num_threads(2)
+    {
+        #pragma omp parallel num_threads(2)
+        {
+            #pragma omp critical
+            wrong[0] += MainAllocator != A_MAIN;
+        }
+    }
+    assert_int_equal(wrong[0], 0);
+    assert_int_equal(allocator_get_used_size(A1, ALLOC_DIR_BOTH), 0);
+
+    allocator_destroy(A1);
+    allocator_destroy(A_MAIN);
+}
+
+/* The profile records the peak, the phase it happened in and the largest request per name*/
+static void
+test_allocator_profile(void ** state)
+{
+    Allocator A0[1];
+    allocator_init(A0, "Default", 4096 * 1024, 1, NULL);
+    assert_int_equal(allocator_profile_peak(A0), 0);
+    assert_int_equal(allocator_profile_enable(A0), 0);
+
+    void * p1 = allocator_alloc_bot(A0, "M+1", 100000);
+    allocator_profile_phase(A0, "/First");
+    void * p2 = allocator_alloc_bot(A0, "M+2", 300000);
+    void * q1 = allocator_alloc_top(A0, "M-1", 200000);
+    size_t peak = allocator_get_used_size(A0, ALLOC_DIR_BOTH);
+    allocator_free(q1);
+    allocator_free(p2);
+    allocator_profile_phase(A0, "/Second");
+    p2 = allocator_alloc_bot(A0, "M+2", 10000);
+    allocator_profile_phase(A0, "/Third");
+    allocator_free(p2);
+    allocator_free(p1);
+
+    assert_int_equal(allocator_profile_peak(A0), peak);
+    char * buf = NULL;
+    size_t len = 0;
+    FILE * fp = open_memstream(&buf, &len);
+    allocator_profile_report(A0, fp);
+    fclose(fp);
+    message(0, "%s", buf);
+    assert_non_null(strstr(buf, "during /Second"));
+    /* Blocks live at the peak*/
+    assert_non_null(strstr(buf, "M-1"));
+    assert_non_null(strstr(buf, "Blocks live at peak (3)"));
+    /* Largest allocation by name, largest first*/
+    assert_true(strstr(buf, " M+2 ") < strstr(buf, " M-1 "));
+    /* Peak and total kbytes and number of allocations of M+2*/
+    char * byname = strstr(buf, "Largest allocation by name");
+    assert_non_null(byname);
+    char * line = strstr(byname, " M+2 ");
+    assert_non_null(line);
+    long kpeak, ktotal, count;
+    assert_int_equal(sscanf(line, " M+2 %ld %ld %ld", &kpeak, &ktotal, &count), 3);
+    assert_int_equal(kpeak, 300000 / 1024);
+    assert_int_equal(ktotal, 310000 / 1024);
+    assert_int_equal(count, 2);
+    free(buf);
+    allocator_destroy(A0);
+}
+
+/* A first touch arena places and zeros the pages of each block when it is the first to reach them,
+ * and never again: pages reused by later blocks keep their contents. The bandwidth is timed in bench_memory.*/
+static void
+test_arena_firsttouch(void ** state)
+{
+    Allocator A0[1];
+    const size_t n = 64 * 1024;
+    assert_int_equal(allocator_init_arena(A0, "Arena", 4 * n * sizeof(double) + 4 * 4096, 0, ALLOC_ARENA_FIRSTTOUCH), 0);
+    assert_int_equal(A0->untouched_bottom, 0);
+    assert_int_equal(A0->untouched_top, A0->size);
+
+    double * bot = allocator_alloc_bot(A0, "bot", n * sizeof(double));
+    double * top = allocator_alloc_top(A0, "top", n * sizeof(double));
+    assert_int_equal(A0->untouched_bottom, A0->bottom);
+    assert_int_equal(A0->untouched_top, A0->top);
+    size_t i;
+    for(i = 0; i < n; i++) {
+        assert_true(bot[i] == 0);
+        assert_true(top[i] == 0);
+        bot[i] = top[i] = i;
+    }
+    /* Growing a block places only the new pages*/
+    bot = allocator_realloc(A0, bot, 2 * n * sizeof(double));
+    top = allocator_realloc(A0, top, 2 * n * sizeof(double));
+    assert_int_equal(A0->untouched_bottom, A0->bottom);
+    assert_int_equal(A0->untouched_top, A0->top);
+    for(i = 0; i < n; i++) {
+        assert_true(bot[i] == i);
+        assert_true(top[i] == i);
+        assert_true(bot[n + i] == 0);
+    }
+    const size_t untouched_bottom = A0->untouched_bottom;
+    allocator_free(top);
+    allocator_free(bot);
+    /* A new block reuses the placed pages as they are*/
+    bot = allocator_alloc_bot(A0, "bot", n * sizeof(double));
+    assert_int_equal(A0->untouched_bottom, untouched_bottom);
+    assert_true(bot[1] == 1);
+    allocator_free(bot);
+    allocator_destroy(A0);
+}
+
+/* If the explicit huge page pool is empty, a hugetlb arena gets transparent huge pages,
+ * exactly as if they had been requested.*/
+static void
+test_arena_hugetlb_fallback(void ** state)
+{
+    Allocator A0[1], A1[1];
+    allocator_override_hugetlb_unavailable(1);
+    assert_int_equal(allocator_init_arena(A0, "Arena", 4 * 1024 * 1024, 1, ALLOC_ARENA_HUGETLB | ALLOC_ARENA_FIRSTTOUCH), 0);
+    allocator_override_hugetlb_unavailable(0);
+    assert_int_equal(allocator_init_arena(A1, "Arena", 4 * 1024 * 1024, 1, ALLOC_ARENA_HUGEPAGES | ALLOC_ARENA_FIRSTTOUCH), 0);
+    message(0, "hugetlb fallback flags %d, hugepages flags %d\n", A0->arena_flags, A1->arena_flags);
+    assert_int_equal(A0->arena_flags & ALLOC_ARENA_HUGETLB, 0);
+    assert_int_equal(A0->arena_flags, A1->arena_flags);
+    assert_true(A0->mapsize > 0);
+    allocator_destroy(A1);
+    allocator_destroy(A0);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_allocator),
         cmocka_unit_test(test_allocator_malloc),
         cmocka_unit_test(test_sub_allocator),
+        cmocka_unit_test(test_thread_allocator),
+        cmocka_unit_test(test_thread_allocator_nested),
+        cmocka_unit_test(test_allocator_profile),
+        cmocka_unit_test(test_arena_firsttouch),
+        cmocka_unit_test(test_arena_hugetlb_fallback),
     };
     return cmocka_run_group_tests_mpi(tests, NULL, NULL);
 }
@@ -134,7 +134,7 @@ int compar_int(void * d1, void * d2)
         return 1;
 }
 
-static void
+static double
 do_mpsort_test(int64_t srcsize, int bits, int staggered, int gather)
 {
     int ThisTask;
@@ -169,6 +169,7 @@ do_mpsort_test(int64_t srcsize, int bits, int staggered, int gather)
     generate(src, srcsize, bits, seed);
 
     int64_t srcsum = checksum(src, srcsize, MPI_COMM_WORLD);
+    double elapsed;
 //         if(ThisTask == 0)
 //        mpsort_setup_timers(512);
     {
@@ -194,6 +195,7 @@ do_mpsort_test(int64_t srcsize, int bits, int staggered, int gather)
         check_sorted(dest, sizeof(int64_t), destsize, compar_int, MPI_COMM_WORLD);
 
         message(0, "MPSort total time: %g\n", end - start);
+        elapsed = end - start;
 //         if(ThisTask == 0) {
 //             mpsort_mpi_report_last_run();
 //                mpsort_free_timers();
@@ -203,6 +205,7 @@ do_mpsort_test(int64_t srcsize, int bits, int staggered, int gather)
     mpsort_mpi_unset_options(MPSORT_REQUIRE_GATHER_SORT + MPSORT_DISABLE_GATHER_SORT);
     myfree(dest);
     myfree(src);
+    return elapsed;
 }
 
 static void fof_radix_Group_TotalCountTaskDiffMinID(const void * a, void * radix, void * arg) {
@@ -300,8 +303,13 @@ static void
 test_basegroup(void ** state)
 {
     do_long_radix_test(50);
+    do_long_radix_test(5000);
     /* This is chosen because it fails in travis*/
     do_long_radix_test(0);
+    /* The comparison sort should agree*/
+    mpsort_mpi_set_options(MPSORT_COMPARISON_LOCAL_SORT);
+    do_long_radix_test(5000);
+    mpsort_mpi_unset_options(MPSORT_COMPARISON_LOCAL_SORT);
 }
 
 static void
@@ -334,6 +342,18 @@ test_mpsort_gather(void ** state)
     do_mpsort_test(2000, 32, 0, 0);
 }
 
+/* Time the radix sort of the local arrays against the comparison sort*/
+static void
+test_mpsort_benchmark(void ** state)
+{
+    const int64_t size = 400000;
+    double tradix = do_mpsort_test(size, 64, 0, 0);
+    mpsort_mpi_set_options(MPSORT_COMPARISON_LOCAL_SORT);
+    double tcompar = do_mpsort_test(size, 64, 0, 0);
+    mpsort_mpi_unset_options(MPSORT_COMPARISON_LOCAL_SORT);
+    message(0, "Sorting %ld items per rank: radix sort %g s, comparison sort %g s\n", size, tradix, tcompar);
+}
+
 int main(void)
 {
     const struct CMUnitTest tests[] = {
@@ -341,6 +361,7 @@ int main(void)
         cmocka_unit_test(test_mpsort_stagger),
         cmocka_unit_test(test_basegroup),
         cmocka_unit_test(test_mpsort_gather),
+        cmocka_unit_test(test_mpsort_benchmark),
     };
     return cmocka_run_group_tests_mpi(tests, NULL, NULL);
 }
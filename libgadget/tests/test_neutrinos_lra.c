@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <omp.h>
+#include <gsl/gsl_integration.h>
+#include <gsl/gsl_interp.h>
 #include "../neutrinos_lra.h"
 #include "../omega_nu_single.h"
 #include "../physconst.h"
@@ -15,6 +18,7 @@
 /** Fit to the special function J(x) that is accurate to better than 3% relative and 0.07% absolute*/
 double specialJ(const double x, const double vcmnubylight, const double nufrac_low);
 double fslength(Cosmology * CP, const double logai, const double logaf, const double light);
+void get_delta_nu_combined(Cosmology * CP, const _delta_tot_table * const d_tot, const double a, double delta_nu_curr[]);
 
 void petaio_save_block(BigFile * bf, char * blockname, BigArray * array, int verbose) {};
 int petaio_read_block(BigFile * bf, char * blockname, BigArray * array, int required)
@@ -110,11 +114,132 @@ static void test_fslength(void **state)
     assert_true(fabs(fslength(&CP, log(0.1), log(0.5),299792.)/ 5427.8/(0.6/kT) -1 ) < 1e-5);
 }
 
+/* Parameters for the reference delta_nu integrand, below*/
+struct ref_delta_nu_params
+{
+    double k;
+    double mnubykT;
+    double loga;
+    double light;
+    double qc;
+    double nufrac_low;
+    Cosmology * CP;
+    gsl_interp * spline;
+    const double * scale;
+    const double * delta_tot;
+};
+
+/* Integrand for delta_nu with adaptive quadrature, computing each free-streaming length exactly*/
+static double
+ref_delta_nu_int(double logai, void * params)
+{
+    struct ref_delta_nu_params * p = params;
+    double fsl = fslength(p->CP, logai, p->loga, p->light);
+    double delta_tot = gsl_interp_eval(p->spline, p->scale, p->delta_tot, logai, NULL);
+    double ai = exp(logai);
+    return fsl / (ai * hubble_function(p->CP, ai)) * specialJ(p->k * fsl / p->mnubykT, p->qc, p->nufrac_low) * delta_tot;
+}
+
+/* Reference delta_nu for all species, by adaptive quadrature over the full history for each mode*/
+static void
+ref_delta_nu_combined(Cosmology * CP, const _delta_tot_table * const d_tot, const double a, double delta_nu[])
+{
+    const double Omega_nu_tot = get_omega_nu_nopart(d_tot->omnu, a);
+    const double logai = log(d_tot->TimeTransfer);
+    const double fsl_A0a = fslength(CP, logai, log(a), d_tot->light);
+    const double deriv_prefac = d_tot->TimeTransfer * (hubble_function(CP, d_tot->TimeTransfer) / d_tot->light) * d_tot->TimeTransfer;
+    gsl_integration_workspace * w = gsl_integration_workspace_alloc(200);
+    gsl_interp * spline = gsl_interp_alloc(gsl_interp_cspline, d_tot->ia);
+    int mi, ik;
+    memset(delta_nu, 0, d_tot->nk * sizeof(double));
+    for(mi = 0; mi < NUSPECIES; mi++) {
+        if(d_tot->omnu->nu_degeneracies[mi] == 0)
+            continue;
+        const double omeganu = d_tot->omnu->nu_degeneracies[mi] * omega_nu_single(d_tot->omnu, a, mi);
+        struct ref_delta_nu_params p;
+        p.mnubykT = d_tot->omnu->RhoNuTab[mi].mnu / d_tot->omnu->kBtnu;
+        p.loga = log(a);
+        p.light = d_tot->light;
+        p.qc = particle_nu_fraction(&d_tot->omnu->hybnu, a, 0) > 0 ? d_tot->omnu->hybnu.vcrit * p.mnubykT : 0;
+        p.nufrac_low = d_tot->omnu->hybnu.nufrac_low[0];
+        p.CP = CP;
+        p.spline = spline;
+        p.scale = d_tot->scalefact;
+        gsl_function F;
+        F.function = &ref_delta_nu_int;
+        F.params = &p;
+        for(ik = 0; ik < d_tot->nk; ik++) {
+            double d_nu = specialJ(d_tot->wavenum[ik] * fsl_A0a / p.mnubykT, 0, p.nufrac_low) * d_tot->delta_nu_init[ik] * (1 + deriv_prefac * fsl_A0a);
+            double integ, abserr;
+            p.k = d_tot->wavenum[ik];
+            p.delta_tot = d_tot->delta_tot[ik];
+            gsl_interp_init(spline, d_tot->scalefact, d_tot->delta_tot[ik], d_tot->ia);
+            gsl_integration_qag(&F, logai, log(a), 0, 1e-7, 200, 6, w, &integ, &abserr);
+            d_nu += d_tot->delta_nu_prefac * integ;
+            delta_nu[ik] += d_nu * omeganu / Omega_nu_tot;
+        }
+    }
+    gsl_interp_free(spline);
+    gsl_integration_workspace_free(w);
+}
+
+/* Fill the delta_tot table with a growing, scale dependent history and compare
+ * delta_nu from the tabulated quadrature to the reference. */
+static void
+do_delta_nu_test(Cosmology * CP, const double tol)
+{
+    const int nk = 16, na = 30;
+    const double UnitTime_in_s = 3.08568e16, UnitLength_in_cm = 3.085678e21;
+    int ik, i;
+    init_neutrinos_lra(nk, 0.01, 1, CP->Omega0, &CP->ONu, UnitTime_in_s, UnitLength_in_cm);
+    _delta_tot_table * d_tot = &delta_tot_table;
+    d_tot->ia = na;
+    for(i = 0; i < na; i++)
+        d_tot->scalefact[i] = log(0.01 * (1 + i));
+    for(ik = 0; ik < nk; ik++) {
+        /* k from 0.01 to 10 h/Mpc, in h/kpc*/
+        d_tot->wavenum[ik] = 1e-5 * pow(10, 3. * ik / (nk - 1));
+        for(i = 0; i < na; i++)
+            d_tot->delta_tot[ik][i] = 0.01 * (1 + i) * 1e4 / (1 + pow(d_tot->wavenum[ik] / 1e-4, 1.5));
+        d_tot->delta_nu_init[ik] = 0.3 * d_tot->delta_tot[ik][0];
+    }
+    const double a = exp(d_tot->scalefact[na - 1]);
+    double delta_nu[16], ref[16];
+    double start = omp_get_wtime();
+    get_delta_nu_combined(CP, d_tot, a, delta_nu);
+    double mid = omp_get_wtime();
+    ref_delta_nu_combined(CP, d_tot, a, ref);
+    double end = omp_get_wtime();
+    message(0, "delta_nu: tabulated %g s, adaptive %g s\n", mid - start, end - mid);
+    for(ik = 0; ik < nk; ik++) {
+        message(0, "k = %g delta_nu = %g reference %g\n", d_tot->wavenum[ik], delta_nu[ik], ref[ik]);
+        assert_true(fabs(delta_nu[ik] / ref[ik] - 1) < tol);
+    }
+    myfree(d_tot->delta_nu_last);
+    myfree(d_tot->scalefact);
+    myfree(d_tot->delta_tot);
+}
+
+/* Check the fixed quadrature over the stored times agrees with adaptive quadrature*/
+static void test_delta_nu_quadrature(void **state)
+{
+    Cosmology CP;
+    double MNu[3] = {0.15, 0.15, 0.15};
+    setup_cosmology(&CP, MNu);
+    do_delta_nu_test(&CP, 1e-4);
+    /* With hybrid neutrinos the specialJ table is used for truncated distributions*/
+    double MNu2[3] = {0.3, 0.15, 0.05};
+    setup_cosmology(&CP, MNu2);
+    init_hybrid_nu(&CP.ONu.hybnu, MNu2, 850, LIGHTCGS/1e5, 0.1, CP.ONu.kBtnu);
+    do_delta_nu_test(&CP, 1e-4);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_allocate_delta_tot_table),
         cmocka_unit_test(test_specialJ),
         cmocka_unit_test(test_fslength),
+        cmocka_unit_test(test_delta_nu_quadrature),
     };
     return cmocka_run_group_tests_mpi(tests, NULL, NULL);
 }
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 
 #include "stub.h"
+#include "../utils/openmpsort.h"
 
 #if 0
 static int checksorted(int * start, int nmemb) {
@@ -99,10 +100,87 @@ static void test_openmpsort(void ** state) {
 
 }
 
+struct keyed
+{
+    int key;
+    int idx;
+};
+
+static int compare_keyed(const void *a, const void *b) {
+    return ((struct keyed *) a)->key - ((struct keyed *) b)->key;
+}
+
+struct keyed_big
+{
+    int key;
+    int idx;
+    char pad[56];
+};
+
+static int compare_keyed_big(const void *a, const void *b) {
+    return ((struct keyed_big *) a)->key - ((struct keyed_big *) b)->key;
+}
+
+/* Many equal keys: items with equal keys must stay in their original order*/
+static void test_openmpsort_stable(void ** state) {
+    int size = 100003;
+    int i, samplesort;
+    struct keyed * a = (struct keyed *) malloc(size * sizeof(struct keyed));
+    struct keyed_big * b = (struct keyed_big *) malloc(size * sizeof(struct keyed_big));
+    for(samplesort = 0; samplesort < 2; samplesort++) {
+        qsort_openmp_set_samplesort(samplesort ? 1000 : (size_t) -1);
+        srand48(8675309);
+        for(i = 0; i < size; i++) {
+            a[i].key = b[i].key = (int) (100 * drand48());
+            a[i].idx = b[i].idx = i;
+        }
+        qsort_openmp(a, size, sizeof(struct keyed), compare_keyed);
+        qsort_openmp(b, size, sizeof(struct keyed_big), compare_keyed_big);
+        for(i = 1; i < size; i++) {
+            assert_true(a[i-1].key < a[i].key || (a[i-1].key == a[i].key && a[i-1].idx < a[i].idx));
+            assert_true(b[i-1].key < b[i].key || (b[i-1].key == b[i].key && b[i-1].idx < b[i].idx));
+        }
+    }
+    qsort_openmp_set_samplesort(1 << 22);
+    free(b);
+    free(a);
+}
+
+/* Both sorts with a few thread counts, and arrays smaller than the sample.
+ * Timings are in bench_openmpsort.*/
+static void test_openmpsort_threads(void ** state) {
+    int size = 1 << 16;
+    int i, samplesort;
+    int * a = (int *) malloc(size * sizeof(int));
+    const int maxthreads = omp_get_max_threads();
+    for(samplesort = 0; samplesort < 2; samplesort++) {
+        int nthreads;
+        qsort_openmp_set_samplesort(samplesort ? 0 : (size_t) -1);
+        for(nthreads = 1; nthreads <= 4; nthreads *= 2) {
+            omp_set_num_threads(nthreads);
+            int n;
+            /* Empty, tiny and large arrays*/
+            for(n = 0; n <= size; n = n ? n * 16 : 1) {
+                srand48(8675309);
+                for(i = 0; i < n; i++)
+                    a[i] = (int) (size * drand48());
+                qsort_openmp(a, n, sizeof(int), compare);
+                for(i = 1; i < n; i++)
+                    assert_true(a[i-1] <= a[i]);
+            }
+        }
+    }
+    omp_set_num_threads(maxthreads);
+    qsort_openmp_set_samplesort(1 << 22);
+    free(a);
+}
+
 int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_openmpsort),
         cmocka_unit_test(test_openmpsort_struct),
+        cmocka_unit_test(test_openmpsort_stable),
+        cmocka_unit_test(test_openmpsort_threads),
     };
     return cmocka_run_group_tests_mpi(tests, NULL, NULL);
 }
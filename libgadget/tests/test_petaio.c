@@ -0,0 +1,213 @@
+/*Test that a snapshot reads back the same with and without ReadIntoDomain*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stub.h"
+
+#include <libgadget/utils.h>
+#include <libgadget/allvars.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/slotsmanager.h>
+#include <libgadget/petaio.h>
+
+struct global_data_all_processes All;
+
+#define NUMPART 1000
+#define SNAPSHOT "test_petaio_snap"
+
+/* The values stored for a particle, as a function of its ID. The velocity is exact in single precision.*/
+static void
+particle_props(const int64_t id, double * pos, double * vel)
+{
+    int k;
+    for(k = 0; k < 3; k++) {
+        /* Scattered over the box, strictly inside it*/
+        pos[k] = (((id * (2 * k + 7919)) % 9973) + 0.5) / 9973. * All.BoxSize;
+        vel[k] = ((id * (k + 3)) % 512) * 0.25 - 64;
+    }
+}
+
+static void
+set_read_into_domain(int ReadIntoDomain)
+{
+    ParameterSet * ps = parameter_set_new();
+    param_declare_int(ps, "BytesPerFile", OPTIONAL, 1024 * 1024 * 1024, "");
+    param_declare_int(ps, "NumWriters", OPTIONAL, 0, "");
+    param_declare_int(ps, "MinNumWriters", OPTIONAL, 1, "");
+    param_declare_int(ps, "WritersPerFile", OPTIONAL, 8, "");
+    param_declare_int(ps, "EnableAggregatedIO", OPTIONAL, 0, "");
+    param_declare_int(ps, "AggregatedIOThreshold", OPTIONAL, 1024 * 1024 * 256, "");
+    param_declare_double(ps, "AsyncSnapshotMemory", OPTIONAL, 0, "");
+    param_declare_int(ps, "CompressIntegerBlocks", OPTIONAL, 0, "");
+    param_declare_double(ps, "QuantisedPositionPrecision", OPTIONAL, 0, "");
+    param_declare_double(ps, "QuantisedVelocityPrecision", OPTIONAL, 0, "");
+    param_declare_int(ps, "ReadIntoDomain", OPTIONAL, 0, "");
+
+    char * error;
+    char content[64];
+    snprintf(content, 64, "ReadIntoDomain = %d\n", ReadIntoDomain);
+    assert_int_equal(param_parse(ps, content, &error), 0);
+    set_petaio_params(ps);
+    petaio_init();
+    parameter_set_free(ps);
+}
+
+static void
+init_slots(void)
+{
+    slots_init(0.01 * NUMPART, SlotsManager);
+    slots_set_enabled(0, sizeof(struct sph_particle_data), SlotsManager);
+    slots_set_enabled(4, sizeof(struct star_particle_data), SlotsManager);
+    slots_set_enabled(5, sizeof(struct bh_particle_data), SlotsManager);
+}
+
+static void
+free_particles(void)
+{
+    myfree(PartManager->TimeBinChanged);
+    myfree(PartManager->TimeBinLink);
+    myfree(PartManager->Base);
+    PartManager->NumPart = 0;
+}
+
+/* Read the snapshot and check that every rank holds the particles it should.
+ * If placed, the ranks hold consecutive segments of the Peano-Hilbert curve.*/
+static void
+do_read_test(int ReadIntoDomain)
+{
+    int NTask, ThisTask;
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+
+    set_read_into_domain(ReadIntoDomain);
+    init_slots();
+
+    struct IOTable IOTable = {0};
+    register_io_blocks(&IOTable, 0);
+    petaio_read_internal(SNAPSHOT, 1, &IOTable, MPI_COMM_WORLD);
+    destroy_io_blocks(&IOTable);
+
+    int64_t i, NumPart = PartManager->NumPart, TotNumPart;
+    MPI_Allreduce(&NumPart, &TotNumPart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+    assert_int_equal(TotNumPart, (int64_t) NUMPART * NTask);
+
+    /* Every particle is present once, with the values it was written with*/
+    char * seen = ta_malloc("seen", char, TotNumPart);
+    memset(seen, 0, TotNumPart);
+    peano_t minkey = PEANOCELLS;
+    peano_t maxkey = 0;
+    for(i = 0; i < NumPart; i++) {
+        double pos[3], vel[3];
+        int k;
+        assert_int_equal(P[i].Type, 1);
+        assert_true(P[i].ID < (MyIDType) TotNumPart);
+        particle_props(P[i].ID, pos, vel);
+        for(k = 0; k < 3; k++) {
+            assert_true(P[i].Pos[k] == pos[k]);
+            assert_true(P[i].Vel[k] == vel[k]);
+        }
+        assert_int_equal(seen[P[i].ID], 0);
+        seen[P[i].ID] = 1;
+        const peano_t key = PEANO(P[i].Pos, All.BoxSize);
+        if(key < minkey)
+            minkey = key;
+        if(key > maxkey)
+            maxkey = key;
+    }
+    int64_t nseen = 0;
+    for(i = 0; i < TotNumPart; i++)
+        nseen += seen[i];
+    MPI_Allreduce(MPI_IN_PLACE, &nseen, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+    assert_int_equal(nseen, TotNumPart);
+    ta_free(seen);
+
+    if(ReadIntoDomain) {
+        /* Each rank reads an even share, and keeps that many particles*/
+        assert_int_equal(NumPart, NUMPART);
+        peano_t * keys = ta_malloc("keys", peano_t, 2 * NTask);
+        peano_t mykeys[2] = {minkey, maxkey};
+        MPI_Allgather(mykeys, 2 * sizeof(peano_t), MPI_BYTE, keys, 2 * sizeof(peano_t), MPI_BYTE, MPI_COMM_WORLD);
+        int task;
+        for(task = 1; task < NTask; task++)
+            assert_true(keys[2 * task - 1] <= keys[2 * task]);
+        ta_free(keys);
+    }
+
+    slots_free(SlotsManager);
+    free_particles();
+}
+
+static void
+test_read_plain(void ** state)
+{
+    do_read_test(0);
+}
+
+static void
+test_read_into_domain(void ** state)
+{
+    do_read_test(1);
+}
+
+/* Write a snapshot of type 1 particles, with the IDs spread over the ranks out of Peano-Hilbert order*/
+static int
+setup_snapshot(void ** state)
+{
+    int NTask, ThisTask;
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+
+    All.BoxSize = 1000;
+    All.Time = All.TimeIC = 0.1;
+    All.cf.a = All.Time;
+    All.cf.hubble = 1;
+    All.CP.Omega0 = 0.3;
+    All.CP.OmegaLambda = 0.7;
+    All.CP.HubbleParam = 0.7;
+    All.PartAllocFactor = 2;
+    All.TotNumPartInit = (int64_t) NUMPART * NTask;
+    All.NTotalInit[1] = All.TotNumPartInit;
+    All.MassTable[1] = 1;
+    All.MassiveNuLinRespOn = 0;
+
+    set_read_into_domain(0);
+    init_slots();
+
+    particle_alloc_memory(2 * NUMPART);
+    PartManager->NumPart = NUMPART;
+    int i;
+    for(i = 0; i < NUMPART; i++) {
+        double pos[3], vel[3];
+        int k;
+        P[i].ID = (int64_t) i * NTask + ThisTask;
+        P[i].Type = 1;
+        P[i].Mass = 1;
+        particle_props(P[i].ID, pos, vel);
+        for(k = 0; k < 3; k++) {
+            P[i].Pos[k] = pos[k];
+            P[i].Vel[k] = vel[k];
+        }
+    }
+    struct IOTable IOTable = {0};
+    register_io_blocks(&IOTable, 0);
+    petaio_save_snapshot(&IOTable, 0, "%s", SNAPSHOT);
+    destroy_io_blocks(&IOTable);
+    free_particles();
+    return 0;
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_read_plain),
+        cmocka_unit_test(test_read_into_domain),
+    };
+    return cmocka_run_group_tests_mpi(tests, setup_snapshot, NULL);
+}
@@ -102,6 +102,76 @@ test_slots_gc_sorted(void **state)
     return;
 }
 
+/* Random garbage: a little, which fills holes from the tail,
+ * and a lot, which compacts in order on each thread.*/
+static void
+do_slots_gc_random(double fraction, int compact_all)
+{
+    setup_particles(NULL);
+    int i, ptype;
+    int compact[6];
+    int64_t nlive = 0, nslots[6] = {0};
+    /* IDs are the initial particle indices: record which survive, and their type*/
+    const int64_t NumPart = PartManager->NumPart;
+    int * live = ta_malloc("live", int, NumPart);
+    int * seen = ta_malloc("seen", int, NumPart);
+    srand48(31415);
+    for(i = 0; i < NumPart; i ++) {
+        seen[i] = 0;
+        live[i] = -1;
+        if(drand48() < fraction)
+            slots_mark_garbage(i, PartManager, SlotsManager);
+        else {
+            nlive++;
+            nslots[P[i].Type]++;
+            live[P[i].ID] = P[i].Type;
+        }
+    }
+    for(ptype = 0; ptype < 6; ptype ++)
+        compact[ptype] = compact_all;
+    slots_gc(compact, PartManager, SlotsManager);
+    assert_int_equal(PartManager->NumPart, nlive);
+    for(ptype = 0; ptype < 6; ptype ++)
+        assert_int_equal(SlotsManager->info[ptype].size, compact_all ? nslots[ptype] : 128);
+    for(i = 0; i < PartManager->NumPart; i ++)
+        assert_false(P[i].IsGarbage);
+    /* The order is kept unless we filled holes from the tail*/
+    if(fraction > 0.1)
+        for(i = 1; i < PartManager->NumPart; i ++)
+            assert_true(P[i-1].ID < P[i].ID);
+    slots_check_id_consistency(PartManager, SlotsManager);
+    /* Exactly the live particles survive, each once, with their slots*/
+    for(i = 0; i < PartManager->NumPart; i ++) {
+        assert_true(P[i].ID >= 0 && P[i].ID < NumPart);
+        assert_int_equal(live[P[i].ID], P[i].Type);
+        assert_int_equal(seen[P[i].ID], 0);
+        seen[P[i].ID] = 1;
+        assert_int_equal(BASESLOT_PI(P[i].PI, P[i].Type, SlotsManager)->ID, P[i].ID);
+    }
+    /* Compacted slots hold exactly the live particles of their type*/
+    for(ptype = 0; ptype < 6 && compact_all; ptype ++) {
+        int64_t j;
+        for(j = 0; j < SlotsManager->info[ptype].size; j++) {
+            struct particle_data_ext * ext = BASESLOT_PI(j, ptype, SlotsManager);
+            assert_int_equal(live[ext->ID], ptype);
+            assert_int_equal(seen[ext->ID], 1);
+            seen[ext->ID] = 2;
+        }
+    }
+    ta_free(seen);
+    ta_free(live);
+    teardown_particles(NULL);
+}
+
+static void
+test_slots_gc_random(void **state)
+{
+    do_slots_gc_random(0.01, 1);
+    do_slots_gc_random(0.01, 0);
+    do_slots_gc_random(0.4, 1);
+    do_slots_gc_random(0.4, 0);
+}
+
 static void
 test_slots_reserve(void **state)
 {
@@ -224,6 +294,7 @@ int main(void) {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_slots_gc),
         cmocka_unit_test(test_slots_gc_sorted),
+        cmocka_unit_test(test_slots_gc_random),
         cmocka_unit_test(test_slots_reserve),
         cmocka_unit_test(test_slots_fork),
         cmocka_unit_test(test_slots_convert),
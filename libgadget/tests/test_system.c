@@ -0,0 +1,125 @@
+/*Tests for the sparse and hierarchical collectives in utils/system.c*/
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <mpi.h>
+
+#include "stub.h"
+#include "../utils/mymalloc.h"
+#include "../utils/system.h"
+
+/* Number of items rank src sends to rank dest: sparse, with some empty pairs*/
+static int
+count_of(int src, int dest, int NTask, int seed)
+{
+    if((src + dest + seed) % 3 == 0)
+        return 0;
+    return (src * 7 + dest * 13 + seed) % 11;
+}
+
+static int64_t
+value_of(int src, int dest, int k)
+{
+    return ((int64_t) src << 40) + ((int64_t) dest << 20) + k;
+}
+
+static void
+test_alltoall_sparse(void ** state)
+{
+    int ThisTask, NTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+
+    int * send = ta_malloc("send", int, 2 * NTask);
+    int * recv = send + NTask;
+    int seed;
+    /* Several calls in a row, so messages of consecutive calls could cross*/
+    for(seed = 0; seed < 5; seed++) {
+        int i;
+        for(i = 0; i < NTask; i++)
+            send[i] = count_of(ThisTask, i, NTask, seed);
+        memset(recv, 0xff, sizeof(int) * NTask);
+        MPI_Alltoall_sparse(send, recv, MPI_INT, MPI_COMM_WORLD);
+        for(i = 0; i < NTask; i++)
+            assert_int_equal(recv[i], count_of(i, ThisTask, NTask, seed));
+    }
+    ta_free(send);
+}
+
+static void
+do_hierarchical_test(int ranks_per_node, int seed)
+{
+    int ThisTask, NTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    MPIU_Set_hierarchical_node_size(ranks_per_node);
+
+    int * sendcnts = ta_malloc("sendcnts", int, 4 * NTask);
+    int * sdispls = sendcnts + NTask;
+    int * recvcnts = sendcnts + 2 * NTask;
+    int * rdispls = sendcnts + 3 * NTask;
+    int i, nsend = 0, nrecv = 0;
+    /* Send displacements in reverse order, to check they are honoured*/
+    for(i = NTask - 1; i >= 0; i--) {
+        sendcnts[i] = count_of(ThisTask, i, NTask, seed);
+        sdispls[i] = nsend;
+        nsend += sendcnts[i];
+    }
+    for(i = 0; i < NTask; i++) {
+        recvcnts[i] = count_of(i, ThisTask, NTask, seed);
+        rdispls[i] = nrecv;
+        nrecv += recvcnts[i];
+    }
+    int64_t * sendbuf = mymalloc("sendbuf", sizeof(int64_t) * (nsend + 1));
+    int64_t * recvbuf = mymalloc("recvbuf", sizeof(int64_t) * (nrecv + 1));
+    for(i = 0; i < NTask; i++) {
+        int k;
+        for(k = 0; k < sendcnts[i]; k++)
+            sendbuf[sdispls[i] + k] = value_of(ThisTask, i, k);
+    }
+    memset(recvbuf, 0, sizeof(int64_t) * nrecv);
+
+    MPI_Alltoallv_hierarchical(sendbuf, sendcnts, sdispls, MPI_INT64, recvbuf, recvcnts, rdispls, MPI_INT64, MPI_COMM_WORLD);
+
+    for(i = 0; i < NTask; i++) {
+        int k;
+        for(k = 0; k < recvcnts[i]; k++)
+            assert_true(recvbuf[rdispls[i] + k] == value_of(i, ThisTask, k));
+    }
+    myfree(recvbuf);
+    myfree(sendbuf);
+    ta_free(sendcnts);
+    MPIU_Set_hierarchical_node_size(0);
+}
+
+static void
+test_alltoallv_hierarchical(void ** state)
+{
+    /* Shared memory nodes: usually one node here, which falls back to the flat exchange*/
+    do_hierarchical_test(0, 0);
+    /* One rank per node*/
+    do_hierarchical_test(1, 1);
+    /* Two and three ranks per node; with three the last node may be smaller*/
+    do_hierarchical_test(2, 2);
+    do_hierarchical_test(3, 3);
+    do_hierarchical_test(3, 4);
+    /* Leaders with little memory send the data in many rounds, some of which carry nothing for a pair*/
+    MPIU_Set_hierarchical_leader_memory(64);
+    do_hierarchical_test(2, 5);
+    do_hierarchical_test(3, 6);
+    MPIU_Set_hierarchical_leader_memory(0);
+}
+
+int main(void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_alltoall_sparse),
+        cmocka_unit_test(test_alltoallv_hierarchical),
+    };
+    return cmocka_run_group_tests_mpi(tests, NULL, NULL);
+}
@@ -0,0 +1,174 @@
+/*Tests for the per-timebin particle lists used to build the active particle list*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stub.h"
+
+#include <libgadget/allvars.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/slotsmanager.h>
+#include <libgadget/timestep.h>
+#include <libgadget/walltime.h>
+
+struct global_data_all_processes All;
+static struct ClockTable CT;
+
+#define NUMPART (128 * 6)
+#define MAXPART 1024
+/* Bins up to 10 are active at this time.*/
+#define TI_CURRENT (3 << 10)
+
+static DriftKickTimes times;
+
+/* A pseudo-random bin between 6 and 14, so that about half the particles are active*/
+static int
+test_bin(int64_t i, int seed)
+{
+    return 6 + ((i * 7919 + seed * 104729) % 9973) % 9;
+}
+
+/* Build the active list from the time bin lists, then from a scan of all particles,
+ * which is what rebuild_activelist does without lists, and check they agree.*/
+static void
+check_against_scan(void)
+{
+    ActiveParticles lists = {0}, scan = {0};
+    int64_t i, nactive = 0;
+    rebuild_activelist(&lists, &times, 0);
+
+    struct timebin_link * TimeBinLink = PartManager->TimeBinLink;
+    PartManager->TimeBinLink = NULL;
+    rebuild_activelist(&scan, &times, 0);
+    PartManager->TimeBinLink = TimeBinLink;
+
+    assert_true(lists.ActiveParticle);
+    assert_true(scan.ActiveParticle);
+    for(i = 0; i < PartManager->NumPart; i++)
+        if(!P[i].IsGarbage && !P[i].Swallowed && is_timebin_active(P[i].TimeBin, TI_CURRENT))
+            nactive++;
+    assert_true(nactive > 0);
+    assert_int_equal(lists.NumActiveParticle, nactive);
+    assert_int_equal(scan.NumActiveParticle, nactive);
+    for(i = 0; i < nactive; i++)
+        assert_int_equal(lists.ActiveParticle[i], scan.ActiveParticle[i]);
+
+    free_activelist(&scan);
+    free_activelist(&lists);
+}
+
+/* Move particles between bins, as find_timesteps would, with a change event for each.
+ * Returns the number of events.*/
+static int64_t
+move_particles(int64_t start, int64_t stride, int seed)
+{
+    int64_t i, n = 0;
+    for(i = start; i < PartManager->NumPart; i += stride) {
+        P[i].TimeBin = test_bin(i, seed);
+        slots_emit_change(i, PartManager);
+        n++;
+    }
+    return n;
+}
+
+static void
+test_timebin_lists(void ** state)
+{
+    /* The lists are built from scratch on the first rebuild*/
+    check_against_scan();
+
+    /* Particles changing bin*/
+    move_particles(0, 3, 1);
+    check_against_scan();
+
+    /* Garbage, a change of type, and new particles at the end*/
+    slots_mark_garbage(5, PartManager, SlotsManager);
+    slots_mark_garbage(6, PartManager, SlotsManager);
+    P[129].Swallowed = 1;
+    slots_emit_change(129, PartManager);
+    slots_convert(130, 4, -1, PartManager, SlotsManager);
+    int child = slots_split_particle(131, 0.5, PartManager);
+    slots_convert(child, 4, -1, PartManager, SlotsManager);
+    P[child].TimeBin = 7;
+    check_against_scan();
+
+    /* A garbage collection reorders the particles. Forking afterwards brings the number
+     * of particles back, so only the GC event shows the lists are stale.*/
+    int compact[6] = {1, 1, 1, 1, 1, 1};
+    slots_gc(compact, PartManager, SlotsManager);
+    assert_int_equal(PartManager->NumPart, NUMPART - 2 + 1);
+    slots_split_particle(300, 0.5, PartManager);
+    slots_split_particle(301, 0.5, PartManager);
+    assert_int_equal(PartManager->NumPart, NUMPART + 1);
+    move_particles(1, 5, 2);
+    check_against_scan();
+
+    /* More changes than fit in TimeBinChanged: the changes which are lost are to particles not changed before*/
+    int64_t nchanged;
+    for(nchanged = 0; nchanged <= PartManager->MaxTimeBinChanged; nchanged++) {
+        const int i = nchanged % 100;
+        P[i].TimeBin = test_bin(i, nchanged);
+        slots_emit_change(i, PartManager);
+    }
+    move_particles(100, 1, 3);
+    check_against_scan();
+
+    /* And the lists are updated incrementally again afterwards*/
+    move_particles(2, 7, 4);
+    check_against_scan();
+}
+
+static int
+setup_particles(void ** state)
+{
+    All.Time = 0.1;
+    /* rebuild_activelist measures its time*/
+    walltime_init(&CT);
+    particle_alloc_memory(MAXPART);
+    PartManager->NumPart = NUMPART;
+
+    int64_t newSlots[6] = {128, 128, 128, 128, 128, 128};
+    slots_init(0.01 * PartManager->MaxPart, SlotsManager);
+    slots_set_enabled(0, sizeof(struct sph_particle_data), SlotsManager);
+    slots_set_enabled(4, sizeof(struct star_particle_data), SlotsManager);
+    slots_set_enabled(5, sizeof(struct bh_particle_data), SlotsManager);
+    slots_reserve(1, newSlots, SlotsManager);
+    slots_setup_topology(PartManager, newSlots, SlotsManager);
+
+    int64_t i;
+    for(i = 0; i < PartManager->NumPart; i ++) {
+        P[i].ID = i;
+        P[i].Mass = 1;
+        P[i].TimeBin = test_bin(i, 0);
+        P[i].Ti_drift = TI_CURRENT;
+    }
+    slots_setup_id(PartManager, SlotsManager);
+
+    times.Ti_Current = TI_CURRENT;
+    times.PM_start = 0;
+    times.PM_length = 1 << 20;
+    return 0;
+}
+
+static int
+teardown_particles(void ** state)
+{
+    slots_free(SlotsManager);
+    myfree(PartManager->TimeBinChanged);
+    myfree(PartManager->TimeBinLink);
+    myfree(PartManager->Base);
+    return 0;
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_timebin_lists),
+    };
+    return cmocka_run_group_tests_mpi(tests, setup_particles, teardown_particles);
+}
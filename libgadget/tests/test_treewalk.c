@@ -0,0 +1,182 @@
+/*Tests for the online tuning of the treewalk scheduling parameters, with synthetic timings*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "stub.h"
+
+#include <libgadget/allvars.h>
+#include <libgadget/treewalk.h>
+
+struct global_data_all_processes All;
+
+#define WORK 1e5
+
+/* Time per particle for the values used by the next call*/
+typedef double (*cost_func)(const double value[TUNE_KNOBS], int64_t call);
+
+static void
+tuner_values(const struct TreeWalkTuner * tuner, double value[TUNE_KNOBS])
+{
+    value[0] = tuner->value[0];
+    value[1] = tuner->value[1];
+    if(tuner->trial)
+        value[tuner->knob] = tuner->trialvalue;
+}
+
+/* Feed the tuner until it converges, returning the number of calls*/
+static int64_t
+run_tuner(struct TreeWalkTuner * tuner, cost_func cost, int64_t maxcalls)
+{
+    int64_t call;
+    for(call = 0; call < maxcalls && !tuner->converged; call++) {
+        double value[TUNE_KNOBS];
+        tuner_values(tuner, value);
+        treewalk_tune_update(tuner, cost(value, call) * WORK, WORK);
+    }
+    return call;
+}
+
+static double
+cost_flat(const double value[TUNE_KNOBS], int64_t call)
+{
+    return 1e-6;
+}
+
+/* Fastest for a chunk size of 800, independent of the buffer fraction*/
+static double
+cost_chunk800(const double value[TUNE_KNOBS], int64_t call)
+{
+    return 1e-6 * (1 + 0.2 * fabs(log2(value[0] / 800)));
+}
+
+/* Independent of the values, but every call is faster than the last, as when the first steps
+ * start up or a simulation gets less clustered: comparing with earlier calls favours any trial.*/
+static double
+cost_faster(const double value[TUNE_KNOBS], int64_t call)
+{
+    return 1e-6 * pow(0.8, call);
+}
+
+/* Slower every call, as when structure forms, with a real optimum in the chunk size*/
+static double
+cost_slower_chunk800(const double value[TUNE_KNOBS], int64_t call)
+{
+    return cost_chunk800(value, call) * (1 + 0.1 * call);
+}
+
+static void
+test_tune_next_trial(void ** state)
+{
+    struct TreeWalkTuner tuner[1];
+    treewalk_tune_init(tuner, "test", 100, 1);
+    assert_false(tuner->converged);
+    assert_int_equal(tuner->knob, 0);
+    assert_true(tuner->trialvalue == 200);
+    assert_false(tuner->trial);
+
+    /* The buffer fraction can't go above one, so the first trial on it goes down*/
+    tuner->knob = 1;
+    tuner->dir = 1;
+    treewalk_tune_next_trial(tuner);
+    assert_int_equal(tuner->knob, 1);
+    assert_int_equal(tuner->dir, -1);
+    assert_true(tuner->trialvalue == 0.5);
+    assert_int_equal(tuner->nfail, 1);
+
+    /* A chunk size of one can't go down, so the next trial is on the fraction*/
+    treewalk_tune_init(tuner, "test", 1, 1./64);
+    tuner->knob = 0;
+    tuner->dir = -1;
+    tuner->nfail = 0;
+    treewalk_tune_next_trial(tuner);
+    assert_int_equal(tuner->knob, 1);
+    assert_true(tuner->trialvalue == 1./32);
+}
+
+static void
+test_tune_flat(void ** state)
+{
+    struct TreeWalkTuner tuner[1];
+    treewalk_tune_init(tuner, "test", 100, 1);
+    /* Three trials of eight calls: the chunk size up and down and the fraction down, all rejected*/
+    const int64_t ncalls = run_tuner(tuner, cost_flat, 1000);
+    assert_true(tuner->converged);
+    assert_int_equal(ncalls, 3 * 8);
+    assert_true(tuner->value[0] == 100);
+    assert_true(tuner->value[1] == 1);
+}
+
+static void
+test_tune_optimum(void ** state)
+{
+    struct TreeWalkTuner tuner[1];
+    treewalk_tune_init(tuner, "test", 100, 1);
+    run_tuner(tuner, cost_chunk800, 1000);
+    assert_true(tuner->converged);
+    assert_true(tuner->value[0] == 800);
+    assert_true(tuner->value[1] == 1);
+
+    /* Also from above*/
+    treewalk_tune_init(tuner, "test", 3200, 0.5);
+    run_tuner(tuner, cost_chunk800, 1000);
+    assert_true(tuner->converged);
+    assert_true(tuner->value[0] == 800);
+    assert_true(tuner->value[1] == 0.5);
+}
+
+static void
+test_tune_drift(void ** state)
+{
+    struct TreeWalkTuner tuner[1];
+    /* Calls getting faster do not make the trials look better*/
+    treewalk_tune_init(tuner, "test", 100, 0.5);
+    run_tuner(tuner, cost_faster, 1000);
+    assert_true(tuner->converged);
+    assert_true(tuner->value[0] == 100);
+    assert_true(tuner->value[1] == 0.5);
+
+    /* Calls getting slower do not hide a better value*/
+    treewalk_tune_init(tuner, "test", 100, 1);
+    run_tuner(tuner, cost_slower_chunk800, 1000);
+    assert_true(tuner->converged);
+    assert_true(tuner->value[0] == 800);
+}
+
+static void
+test_tune_work(void ** state)
+{
+    struct TreeWalkTuner tuner[1];
+    treewalk_tune_init(tuner, "test", 100, 1);
+    /* A call with much more work than the one before is not compared with it*/
+    treewalk_tune_update(tuner, 1, WORK);
+    assert_true(tuner->trial);
+    treewalk_tune_update(tuner, 1, 10 * WORK);
+    assert_int_equal(tuner->npairs, 0);
+    assert_int_equal(tuner->ncalls, 0);
+    assert_false(tuner->trial);
+    /* Similar work is*/
+    treewalk_tune_update(tuner, 1, WORK);
+    treewalk_tune_update(tuner, 1.2, 1.2 * WORK);
+    assert_int_equal(tuner->npairs, 1);
+    assert_int_equal(tuner->ncalls, 2);
+    /* The second pair runs the trial value first*/
+    assert_true(tuner->trial);
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tune_next_trial),
+        cmocka_unit_test(test_tune_flat),
+        cmocka_unit_test(test_tune_optimum),
+        cmocka_unit_test(test_tune_drift),
+        cmocka_unit_test(test_tune_work),
+    };
+    return cmocka_run_group_tests_mpi(tests, NULL, NULL);
+}
@@ -72,6 +72,121 @@ static inline int get_active_particle(const ActiveParticles * act, int pa)
         return pa;
 }
 
+/* Per-timebin membership lists. Every particle which is not garbage or swallowed
+ * is in a doubly linked list for its time bin (PartManager->TimeBinLink), and counted
+ * by type and bin, so that the active particle list is built by walking the active bins only.
+ * find_timesteps moves particles which change bin. Particles made garbage, swallowed or converted
+ * are queued by the SlotsChange event and new particles (forked or received in an exchange)
+ * are appended to the end of P, so both are relisted at the next rebuild_activelist.
+ * A GC reorders the particles and invalidates the lists, which are then rebuilt from scratch.*/
+static struct {
+    int valid;
+    int First[TIMEBINS+1];
+    int64_t Count[6][TIMEBINS+1];
+    /* Particles [0, NumPart) are listed. Later particles are new.*/
+    int64_t NumPart;
+    int64_t NChanged;
+} TimeBinLists;
+
+static int
+timebin_lists_eh_change(EIBase * event, void * userdata)
+{
+    EISlotsChange * ev = (EISlotsChange *) event;
+    if(ev->pman != PartManager || !TimeBinLists.valid || ev->i >= TimeBinLists.NumPart)
+        return 0;
+    int64_t n = atomic_fetch_and_add_64(&TimeBinLists.NChanged, 1);
+    if(n < PartManager->MaxTimeBinChanged)
+        PartManager->TimeBinChanged[n] = ev->i;
+    return 0;
+}
+
+static int
+timebin_lists_eh_gc(EIBase * event, void * userdata)
+{
+    EISlotsAfterGC * ev = (EISlotsAfterGC *) event;
+    if(ev->pman == PartManager)
+        TimeBinLists.valid = 0;
+    return 0;
+}
+
+static void
+timebin_lists_remove(int i)
+{
+    struct timebin_link * link = &PartManager->TimeBinLink[i];
+    if(link->Bin == TIMEBIN_UNLISTED)
+        return;
+    if(link->Prev >= 0)
+        PartManager->TimeBinLink[link->Prev].Next = link->Next;
+    else
+        TimeBinLists.First[link->Bin] = link->Next;
+    if(link->Next >= 0)
+        PartManager->TimeBinLink[link->Next].Prev = link->Prev;
+    TimeBinLists.Count[link->Type][link->Bin]--;
+    link->Bin = TIMEBIN_UNLISTED;
+}
+
+/* Make the list membership of particle i match its current state */
+static void
+timebin_lists_relist(int i)
+{
+    struct timebin_link * link = &PartManager->TimeBinLink[i];
+    const int listed = !(P[i].IsGarbage || P[i].Swallowed);
+    if(listed && link->Bin == P[i].TimeBin && link->Type == P[i].Type)
+        return;
+    timebin_lists_remove(i);
+    if(!listed)
+        return;
+    const int bin = P[i].TimeBin;
+    link->Bin = bin;
+    link->Type = P[i].Type;
+    link->Prev = -1;
+    link->Next = TimeBinLists.First[bin];
+    if(link->Next >= 0)
+        PartManager->TimeBinLink[link->Next].Prev = i;
+    TimeBinLists.First[bin] = i;
+    TimeBinLists.Count[link->Type][bin]++;
+}
+
+/* Bring the lists up to date. Returns 0 if there are no lists.*/
+static int
+timebin_lists_update(void)
+{
+    int64_t i;
+    if(!PartManager->TimeBinLink)
+        return 0;
+    event_listen(&EventSlotsChange, timebin_lists_eh_change, NULL);
+    event_listen(&EventSlotsAfterGC, timebin_lists_eh_gc, NULL);
+
+    if(TimeBinLists.NChanged > PartManager->MaxTimeBinChanged || PartManager->NumPart < TimeBinLists.NumPart)
+        TimeBinLists.valid = 0;
+
+    if(!TimeBinLists.valid) {
+        memset(TimeBinLists.Count, 0, sizeof(TimeBinLists.Count));
+        for(i = 0; i <= TIMEBINS; i++)
+            TimeBinLists.First[i] = -1;
+        TimeBinLists.NumPart = 0;
+    }
+    else {
+        for(i = 0; i < TimeBinLists.NChanged; i++)
+            timebin_lists_relist(PartManager->TimeBinChanged[i]);
+    }
+    /* New particles: either all of them, or those forked or received since the last update.*/
+    for(i = TimeBinLists.NumPart; i < PartManager->NumPart; i++) {
+        PartManager->TimeBinLink[i].Bin = TIMEBIN_UNLISTED;
+        timebin_lists_relist(i);
+    }
+    TimeBinLists.NumPart = PartManager->NumPart;
+    TimeBinLists.NChanged = 0;
+    TimeBinLists.valid = 1;
+    return 1;
+}
+
+static int
+cmp_int(const void * a, const void * b)
+{
+    return (*(const int *) a > *(const int *) b) - (*(const int *) a < *(const int *) b);
+}
+
 static int
 timestep_eh_slots_fork(EIBase * event, void * userdata)
 {
@@ -273,6 +388,15 @@ find_timesteps(const ActiveParticles * act, DriftKickTimes * times)
             maxTimeBin = bin;
     }
 
+    /* Move the particles which changed bin. Particles created this step are listed at the next rebuild. */
+    if(PartManager->TimeBinLink && TimeBinLists.valid) {
+        for(pa = 0; pa < act->NumActiveParticle; pa++) {
+            const int i = get_active_particle(act, pa);
+            if(i < TimeBinLists.NumPart)
+                timebin_lists_relist(i);
+        }
+    }
+
     MPI_Allreduce(MPI_IN_PLACE, &badstepsizecount, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
     MPI_Allreduce(MPI_IN_PLACE, &mTimeBin, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
     MPI_Allreduce(MPI_IN_PLACE, &maxTimeBin, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
@@ -302,6 +426,7 @@ find_timesteps(const ActiveParticles * act, DriftKickTimes * times)
             if(P[pa].Type == 5)
                 P[pa].TimeBin = mTimeBin;
         }
+        TimeBinLists.valid = 0;
     }
     if(badstepsizecount) {
         message(0, "bad timestep spotted: terminating and saving snapshot.\n");
@@ -740,10 +865,11 @@ inttime_t find_next_kick(inttime_t Ti_Current, int minTimeBin)
     return Ti_Current + dti_from_timebin(minTimeBin);
 }
 
-static void print_timebin_statistics(const DriftKickTimes * const times, const int NumCurrentTiStep, int * TimeBinCountType);
+static void print_timebin_statistics(const DriftKickTimes * const times, const int NumCurrentTiStep, int64_t TimeBinCountType[6][TIMEBINS+1]);
 
-/* mark the bins that will be active before the next kick*/
-int rebuild_activelist(ActiveParticles * act, const DriftKickTimes * const times, int NumCurrentTiStep)
+/* Find the active particles by scanning all particles. Used if there are no time bin lists.*/
+static void
+activelist_from_scan(ActiveParticles * act, const DriftKickTimes * const times, int64_t TimeBinCount[6][TIMEBINS+1])
 {
     int i;
 
@@ -800,9 +926,64 @@ int rebuild_activelist(ActiveParticles * act, const DriftKickTimes * const times
     ta_free(ActivePartSets);
     ta_free(NActiveThread);
 
+    /*Sum the thread-local memory*/
+    int tid, j;
+    for(tid = 0; tid < NumThreads; tid ++)
+        for(j = 0; j < 6 * (TIMEBINS+1); j++)
+            TimeBinCount[j / (TIMEBINS+1)][j % (TIMEBINS+1)] += TimeBinCountType[6 * (TIMEBINS+1) * tid + j];
+    myfree(TimeBinCountType);
+}
+
+/* Find the active particles by walking the lists of the active bins: O(active particles).*/
+static void
+activelist_from_lists(ActiveParticles * act, const DriftKickTimes * const times, int64_t TimeBinCount[6][TIMEBINS+1])
+{
+    int bin, ptype;
+    int64_t nactive = 0;
+    memcpy(TimeBinCount, TimeBinLists.Count, sizeof(TimeBinLists.Count));
+
+    if(is_PM_timestep(times)) {
+        act->ActiveParticle = NULL;
+        act->NumActiveParticle = PartManager->NumPart;
+        return;
+    }
+    for(bin = 0; bin <= TIMEBINS; bin++)
+        if(is_timebin_active(bin, times->Ti_Current))
+            for(ptype = 0; ptype < 6; ptype++)
+                nactive += TimeBinLists.Count[ptype][bin];
+
+    /*Need space for more particles than we have, because of star formation*/
+    act->ActiveParticle = (int *) mymalloc("ActiveParticle", (nactive + PartManager->MaxPart - PartManager->NumPart) * sizeof(int));
+    act->NumActiveParticle = 0;
+    for(bin = 0; bin <= TIMEBINS; bin++) {
+        if(!is_timebin_active(bin, times->Ti_Current))
+            continue;
+        int i;
+        for(i = TimeBinLists.First[bin]; i >= 0; i = PartManager->TimeBinLink[i].Next) {
+            if (P[i].Ti_drift != times->Ti_Current) {
+                endrun(5, "Particle %d type %d has drift time %x not ti_current %x!",i, P[i].Type, P[i].Ti_drift, times->Ti_Current);
+            }
+            act->ActiveParticle[act->NumActiveParticle++] = i;
+        }
+    }
+    if(act->NumActiveParticle != nactive)
+        endrun(5, "Time bin lists hold %ld active particles, but are counted as %ld\n", act->NumActiveParticle, nactive);
+    /* Same order as a scan of the particles, for memory locality in the tree walks*/
+    qsort_openmp(act->ActiveParticle, act->NumActiveParticle, sizeof(int), cmp_int);
+}
+
+/* mark the bins that will be active before the next kick*/
+int rebuild_activelist(ActiveParticles * act, const DriftKickTimes * const times, int NumCurrentTiStep)
+{
+    int64_t TimeBinCountType[6][TIMEBINS+1] = {{0}};
+
+    if(timebin_lists_update())
+        activelist_from_lists(act, times, TimeBinCountType);
+    else
+        activelist_from_scan(act, times, TimeBinCountType);
+
     /*Print statistics for this time bin*/
     print_timebin_statistics(times, NumCurrentTiStep, TimeBinCountType);
-    myfree(TimeBinCountType);
 
     /* Shrink the ActiveParticle array. We still need extra space for star formation,
      * but we do not need space for the known-inactive particles*/
@@ -829,7 +1010,7 @@ void free_activelist(ActiveParticles * act)
  * FdCPU the cumulative cpu-time consumption in various parts of the
  * code is stored.
  */
-static void print_timebin_statistics(const DriftKickTimes * const times, const int NumCurrentTiStep, int * TimeBinCountType)
+static void print_timebin_statistics(const DriftKickTimes * const times, const int NumCurrentTiStep, int64_t TimeBinCountType[6][TIMEBINS+1])
 {
     double z;
     int i;
@@ -839,17 +1020,7 @@ static void print_timebin_statistics(const DriftKickTimes * const times, const i
     int64_t tot_num_force = 0;
     int64_t TotNumPart = 0, TotNumType[6] = {0};
 
-    int NumThreads = omp_get_max_threads();
-    /*Sum the thread-local memory*/
-    for(i = 1; i < NumThreads; i ++) {
-        int j;
-        for(j=0; j < 6 * (TIMEBINS+1); j++)
-            TimeBinCountType[j] += TimeBinCountType[6 * (TIMEBINS+1) * i + j];
-    }
-
-    for(i = 0; i < 6; i ++) {
-        sumup_large_ints(TIMEBINS+1, &TimeBinCountType[(TIMEBINS+1) * i], tot_count_type[i]);
-    }
+    MPI_Allreduce(TimeBinCountType, tot_count_type, 6 * (TIMEBINS+1), MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
 
     for(i = 0; i<TIMEBINS+1; i++) {
         int j;
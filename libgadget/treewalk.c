@@ -10,6 +10,7 @@
 #include "partmanager.h"
 #include "domain.h"
 #include "forcetree.h"
+#include "walltime.h"
 
 #include <signal.h>
 #define BREAKPOINT raise(SIGTRAP)
@@ -32,8 +33,21 @@ struct TreeWalkThreadLocals
     size_t *Exportindex;
 };
 
-/*!< Memory factor to leave for (N imported particles) > (N exported particles). */
-static int ImportBufferBoost;
+/* Global treewalk parameters. Defaults are used by the tests, which do not read a parameter file.*/
+static struct treewalk_params TreeWalkParams = {0, 0, 100, 1.};
+
+/* Online tuning of the scheduling parameters: see struct TreeWalkTuner.*/
+#define TUNE_MAXLABELS 64
+#define TUNE_HYSTERESIS 0.05
+/* Number of pairs of calls timed for each trial. Even, so that a steady drift in the cost cancels*/
+#define TUNE_PAIRS 4
+/* Pairs of calls whose work differs by more than this factor are not compared*/
+#define TUNE_MAXWORKRATIO 1.5
+/* Treewalks with fewer particles than this per rank are too short to time reliably*/
+#define TUNE_MINWORK 1000
+
+static struct TreeWalkTuner TreeWalkTuners[TUNE_MAXLABELS];
+static int NTreeWalkTuners;
 
 static struct data_nodelist
 {
@@ -56,9 +70,144 @@ void set_treewalk_params(ParameterSet * ps)
 {
     int ThisTask;
     MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
-    if(ThisTask == 0)
-        ImportBufferBoost = param_get_int(ps, "ImportBufferBoost");
-    MPI_Bcast(&ImportBufferBoost, 1, MPI_INT, 0, MPI_COMM_WORLD);
+    if(ThisTask == 0) {
+        TreeWalkParams.ImportBufferBoost = param_get_int(ps, "ImportBufferBoost");
+        TreeWalkParams.AutoTune = param_get_int(ps, "TreeWalkAutoTune");
+        TreeWalkParams.MaxChunkSize = param_get_int(ps, "TreeWalkMaxChunkSize");
+        TreeWalkParams.BufferFraction = param_get_double(ps, "TreeWalkBufferFraction");
+        if(TreeWalkParams.MaxChunkSize < 1)
+            TreeWalkParams.MaxChunkSize = 1;
+        if(TreeWalkParams.BufferFraction <= 0 || TreeWalkParams.BufferFraction > 1)
+            endrun(0, "TreeWalkBufferFraction is %g, should be in (0, 1].\n", TreeWalkParams.BufferFraction);
+    }
+    MPI_Bcast(&TreeWalkParams, sizeof(TreeWalkParams), MPI_BYTE, 0, MPI_COMM_WORLD);
+}
+
+/* Change the treewalk parameters at runtime. Tuning, if enabled, restarts from the new values.*/
+void set_treewalk_par(struct treewalk_params tw_params)
+{
+    TreeWalkParams = tw_params;
+    NTreeWalkTuners = 0;
+}
+
+struct treewalk_params get_treewalk_params(void)
+{
+    return TreeWalkParams;
+}
+
+void
+treewalk_tune_init(struct TreeWalkTuner * tuner, const char * label, double MaxChunkSize, double BufferFraction)
+{
+    memset(tuner, 0, sizeof(*tuner));
+    strncpy(tuner->label, label, sizeof(tuner->label) - 1);
+    tuner->value[0] = MaxChunkSize;
+    tuner->value[1] = BufferFraction;
+    tuner->dir = 1;
+    treewalk_tune_next_trial(tuner);
+}
+
+/* Find the tuner of a named treewalk, creating it if needed. Returns NULL if tuning is off.*/
+static struct TreeWalkTuner *
+treewalk_get_tuner(const char * label)
+{
+    if(!TreeWalkParams.AutoTune || !label)
+        return NULL;
+    int i;
+    for(i = 0; i < NTreeWalkTuners; i++)
+        if(!strncmp(TreeWalkTuners[i].label, label, sizeof(TreeWalkTuners[i].label)))
+            return &TreeWalkTuners[i];
+    if(NTreeWalkTuners == TUNE_MAXLABELS)
+        return NULL;
+    struct TreeWalkTuner * tuner = &TreeWalkTuners[NTreeWalkTuners++];
+    treewalk_tune_init(tuner, label, TreeWalkParams.MaxChunkSize, TreeWalkParams.BufferFraction);
+    return tuner;
+}
+
+void
+treewalk_tune_next_trial(struct TreeWalkTuner * tuner)
+{
+    const double minval[TUNE_KNOBS] = {1, 1./64};
+    const double maxval[TUNE_KNOBS] = {4096, 1};
+    tuner->ncalls = 0;
+    tuner->npairs = 0;
+    tuner->logratio = 0;
+    tuner->trial = 0;
+    while(tuner->nfail < 2 * TUNE_KNOBS) {
+        const double trialvalue = tuner->value[tuner->knob] * (tuner->dir > 0 ? 2 : 0.5);
+        if(trialvalue >= minval[tuner->knob] && trialvalue <= maxval[tuner->knob]) {
+            tuner->trialvalue = trialvalue;
+            return;
+        }
+        /* Try the other direction, then the next knob*/
+        tuner->nfail++;
+        if(tuner->dir > 0)
+            tuner->dir = -1;
+        else {
+            tuner->dir = 1;
+            tuner->knob = (tuner->knob + 1) % TUNE_KNOBS;
+        }
+    }
+    tuner->converged = 1;
+    message(0, "Treewalk %s autotune converged: TreeWalkMaxChunkSize = %d TreeWalkBufferFraction = %g (%g us/particle).\n",
+            tuner->label, (int) tuner->value[0], tuner->value[1], tuner->cost * 1e6);
+}
+
+/* In pair p the current values run first if p is even, and second if p is odd*/
+static int
+treewalk_tune_is_trial(int64_t ncalls)
+{
+    return (ncalls % 2) != ((ncalls / 2) % 2);
+}
+
+void
+treewalk_tune_update(struct TreeWalkTuner * tuner, double elapsed, double work)
+{
+    if(tuner->converged || work <= 0)
+        return;
+    const double cost = elapsed / work;
+    if(!tuner->trial)
+        tuner->cost = cost;
+    if(tuner->ncalls % 2 == 0) {
+        /* First call of a pair*/
+        tuner->paircost = cost;
+        tuner->pairwork = work;
+        tuner->ncalls++;
+        tuner->trial = treewalk_tune_is_trial(tuner->ncalls);
+        return;
+    }
+    if(work > tuner->pairwork * TUNE_MAXWORKRATIO || work * TUNE_MAXWORKRATIO < tuner->pairwork) {
+        /* The work changed too much to compare: time this pair again*/
+        tuner->ncalls--;
+        tuner->trial = treewalk_tune_is_trial(tuner->ncalls);
+        return;
+    }
+    /* The second call of the pair ran with the trial value if the first did not*/
+    const double ratio = tuner->trial ? cost / tuner->paircost : tuner->paircost / cost;
+    tuner->logratio += log(ratio);
+    tuner->npairs++;
+    tuner->ncalls++;
+    tuner->trial = treewalk_tune_is_trial(tuner->ncalls);
+    if(tuner->npairs < TUNE_PAIRS)
+        return;
+
+    if(tuner->logratio / tuner->npairs < log(1 - TUNE_HYSTERESIS)) {
+        /* Keep the new value and carry on in the same direction*/
+        tuner->value[tuner->knob] = tuner->trialvalue;
+        tuner->cost *= exp(tuner->logratio / tuner->npairs);
+        tuner->nfail = 0;
+        message(0, "Treewalk %s autotune: MaxChunkSize %d BufferFraction %g (%g us/particle).\n",
+                tuner->label, (int) tuner->value[0], tuner->value[1], tuner->cost * 1e6);
+    }
+    else {
+        tuner->nfail++;
+        if(tuner->dir > 0)
+            tuner->dir = -1;
+        else {
+            tuner->dir = 1;
+            tuner->knob = (tuner->knob + 1) % TUNE_KNOBS;
+        }
+    }
+    treewalk_tune_next_trial(tuner);
 }
 
 static void ev_init_thread(const struct TreeWalkThreadLocals export, TreeWalk * const tw, LocalTreeWalk * lv);
@@ -199,7 +348,7 @@ ev_begin(TreeWalk * tw, int * active_set, const size_t size)
     /*This memory scales like the number of imports. In principle this could be much larger than Nexport
      * if the tree is very imbalanced and many processors all need to export to this one. In practice I have
      * not seen this happen, but provide a parameter to boost the memory for Nimport just in case.*/
-    bytesperbuffer += ImportBufferBoost * (tw->query_type_elsize + tw->result_type_elsize);
+    bytesperbuffer += TreeWalkParams.ImportBufferBoost * (tw->query_type_elsize + tw->result_type_elsize);
     /*Use all free bytes for the tree buffer, as in exchange. Leave some free memory for array overhead.*/
     size_t freebytes = mymalloc_freebytes();
     if(freebytes <= 4096 * 11 * bytesperbuffer) {
@@ -216,6 +365,27 @@ ev_begin(TreeWalk * tw, int * active_set, const size_t size)
     if(tw->BunchSize < 100)
         endrun(2,"Only enough free memory to export %d elements.\n", tw->BunchSize);
 
+    /* A smaller export buffer means more export iterations, but smaller messages and less memory to touch.*/
+    tw->MaxChunkSize = TreeWalkParams.MaxChunkSize;
+    double BufferFraction = TreeWalkParams.BufferFraction;
+    struct TreeWalkTuner * tuner = treewalk_get_tuner(tw->ev_label);
+    if(tuner) {
+        tw->MaxChunkSize = tuner->value[0];
+        BufferFraction = tuner->value[1];
+        /* Only the first iteration of a treewalk is timed, so only it runs a trial*/
+        if(tuner->trial && tw->Niteration == 0) {
+            if(tuner->knob == 0)
+                tw->MaxChunkSize = tuner->trialvalue;
+            else
+                BufferFraction = tuner->trialvalue;
+        }
+    }
+    if(BufferFraction < 1) {
+        tw->BunchSize *= BufferFraction;
+        if(tw->BunchSize < 100)
+            tw->BunchSize = 100;
+    }
+
     DataIndexTable =
         (struct data_index *) mymalloc("DataIndexTable", tw->BunchSize * sizeof(struct data_index));
     DataNodeList =
@@ -304,12 +474,13 @@ static int real_ev(struct TreeWalkThreadLocals export, TreeWalk * tw, size_t * d
      * so that we can break from the loop if needed.*/
     int chnk = 0;
     /* chunk size: 1 and 1000 were slightly (3 percent) slower than 8.
-     * FoF treewalk needs a larger chnksz to avoid contention.*/
+     * FoF treewalk needs a larger chnksz to avoid contention.
+     * The maximum is TreeWalkMaxChunkSize, or tuned at runtime.*/
     int chnksz = tw->WorkSetSize / (4*tw->NThread);
     if(chnksz < 1)
         chnksz = 1;
-    if(chnksz > 100)
-        chnksz = 100;
+    if(chnksz > tw->MaxChunkSize)
+        chnksz = tw->MaxChunkSize;
     do {
         /* Get another chunk from the global queue*/
         chnk = atomic_fetch_and_add(currentIndex, chnksz);
@@ -374,6 +545,8 @@ static int real_ev(struct TreeWalkThreadLocals export, TreeWalk * tw, size_t * d
 
     *dataindexoffset = lv->DataIndexOffset;
     *nexports = lv->Nexport;
+    #pragma omp atomic
+    tw->Ninteractions += lv->Ninteractions;
     return lastSucceeded;
 }
 
@@ -461,6 +634,17 @@ treewalk_build_queue(TreeWalk * tw, int * active_set, const size_t size, int may
     tw->WorkSetSize = nqueue;
 }
 
+/* Add the time this thread spent in a treewalk phase to the timeline trace, if there is one*/
+static void
+treewalk_trace_thread(TreeWalk * tw, const char * phase, double tstart)
+{
+    if(!walltime_trace_enabled())
+        return;
+    char name[128];
+    snprintf(name, sizeof(name), "/Tree/%s/%s", tw->ev_label, phase);
+    walltime_trace_event(name, tstart, second());
+}
+
 /* returns struct containing export counts */
 static void
 ev_primary(TreeWalk * tw)
@@ -481,7 +665,9 @@ ev_primary(TreeWalk * tw)
 #pragma omp parallel reduction(min: lastSucceeded)
     {
         int tid = omp_get_thread_num();
+        double tthread = second();
         lastSucceeded = real_ev(export, tw, &dataindexoffset[tid], &nexports[tid], &currentIndex);
+        treewalk_trace_thread(tw, "Primary", tthread);
     }
 
     int64_t i;
@@ -533,10 +719,12 @@ static void ev_secondary(TreeWalk * tw)
     struct TreeWalkThreadLocals export = ev_alloc_threadlocals(tw, tw->NTask, tw->NThread);
     int nnodes = tw->Nnodesinlist;
     int nlist = tw->Nlist;
-#pragma omp parallel reduction(+: nnodes) reduction(+: nlist)
+    int64_t ninteractions = tw->Ninteractions;
+#pragma omp parallel reduction(+: nnodes) reduction(+: nlist) reduction(+: ninteractions)
     {
         size_t j;
         LocalTreeWalk lv[1];
+        double tthread = second();
 
         ev_init_thread(export, tw, lv);
         lv->mode = 1;
@@ -550,9 +738,12 @@ static void ev_secondary(TreeWalk * tw)
         }
         nnodes += lv->Nnodesinlist;
         nlist += lv->Nlist;
+        ninteractions += lv->Ninteractions;
+        treewalk_trace_thread(tw, "Secondary", tthread);
     }
     tw->Nnodesinlist = nnodes;
     tw->Nlist = nlist;
+    tw->Ninteractions = ninteractions;
 
     ev_free_threadlocals(export);
     tend = second();
@@ -636,6 +827,7 @@ treewalk_run(TreeWalk * tw, int * active_set, size_t size)
     }
 
     if(tw->visit) {
+        const double tvisit = second();
         tw->Nexportfull = 0;
         tw->evaluated = NULL;
         do
@@ -662,6 +854,16 @@ treewalk_run(TreeWalk * tw, int * active_set, size_t size)
         } while(ev_ndone(tw) < tw->NTask);
         if(tw->evaluated)
             myfree(tw->evaluated);
+        struct TreeWalkTuner * tuner = treewalk_get_tuner(tw->ev_label);
+        if(tuner && tw->Niteration == 0) {
+            /* The time is the maximum over ranks, so that all ranks make the same choice.*/
+            double elapsed = timediff(tvisit, second());
+            double work = tw->WorkSetSize;
+            MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+            MPI_Allreduce(MPI_IN_PLACE, &work, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+            if(work >= TUNE_MINWORK * tw->NTask)
+                treewalk_tune_update(tuner, elapsed, work);
+        }
     }
 
 #ifdef DEBUG
@@ -695,12 +897,16 @@ ev_communicate(void * sendbuf, void * recvbuf, size_t elsize, const struct SendR
     MPI_Type_contiguous(elsize, MPI_BYTE, &type);
     MPI_Type_commit(&type);
 
+    int (*alltoallv)(void *, int *, int *, MPI_Datatype, void *, int *, int *, MPI_Datatype, MPI_Comm) = MPI_Alltoallv_sparse;
+    if(MPIU_Use_hierarchical_alltoallv(ALLTOALLV_TREEWALK))
+        alltoallv = MPI_Alltoallv_hierarchical;
+
     if(import) {
-        MPI_Alltoallv_sparse(
+        alltoallv(
                 sendbuf, sndrcv.Recv_count, sndrcv.Recv_offset, type,
                 recvbuf, sndrcv.Send_count, sndrcv.Send_offset, type, MPI_COMM_WORLD);
     } else {
-        MPI_Alltoallv_sparse(
+        alltoallv(
                 sendbuf, sndrcv.Send_count, sndrcv.Send_offset, type,
                 recvbuf, sndrcv.Recv_count, sndrcv.Recv_offset, type, MPI_COMM_WORLD);
     }
@@ -731,7 +937,7 @@ static struct SendRecvBuffer ev_get_remote(TreeWalk * tw)
     tw->Nexport -= sndrcv.Send_count[NTask];
 
     tstart = second();
-    MPI_Alltoall(sndrcv.Send_count, 1, MPI_INT, sndrcv.Recv_count, 1, MPI_INT, MPI_COMM_WORLD);
+    MPI_Alltoall_sparse(sndrcv.Send_count, sndrcv.Recv_count, MPI_INT, MPI_COMM_WORLD);
     tend = second();
     tw->timewait1 += timediff(tstart, tend);
 
@@ -132,6 +132,8 @@ struct TreeWalk {
     /* Stores the total number of node lists created for all exported particles.
      * Used to find the average number of nodes in each nodelist.*/
     int64_t Nlist;
+    /* Total number of particle and node interactions evaluated on this rank, primary and secondary.*/
+    int64_t Ninteractions;
     /* Total number of exported particles
      * (Nexport is only the exported particles in the current export buffer). */
     int64_t Nexport_sum;
@@ -150,6 +152,8 @@ struct TreeWalk {
     int BufferFullFlag;
     /* Number of particles we can fit into the export buffer*/
     size_t BunchSize;
+    /* Largest number of particles a thread takes from the work queue at once*/
+    int MaxChunkSize;
     /* List of neighbour candidates.*/
     int *Ngblist;
     /* Flag not allocating nighbour list*/
@@ -172,8 +176,67 @@ struct TreeWalk {
     double * minnumngb;
 };
 
+/* Global parameters of the treewalks*/
+struct treewalk_params
+{
+    /* Memory factor to leave for (N imported particles) > (N exported particles). */
+    int ImportBufferBoost;
+    /* Tune MaxChunkSize and BufferFraction at runtime, separately for each named treewalk.
+     * If set the values below are only the starting values.*/
+    int AutoTune;
+    /* Largest chunk of the work queue taken by a thread at once*/
+    int MaxChunkSize;
+    /* Fraction of the free memory used for the export buffer*/
+    double BufferFraction;
+};
+
+/* Online tuning of the scheduling parameters of a named treewalk. The first iteration
+ * of the treewalk is timed every step. A trial value of one of the knobs, moved up or down by a factor
+ * of two, is compared to the current values over TUNE_PAIRS pairs of consecutive calls with similar work,
+ * alternating which of the pair runs first so that steps becoming slower do not bias the choice.
+ * The trial value is kept only if it is faster by TUNE_HYSTERESIS.
+ * Once no move of either knob is faster the tuning stops and the chosen values are logged.*/
+#define TUNE_KNOBS 2
+struct TreeWalkTuner
+{
+    char label[64];
+    /* The largest chunk size and the export buffer fraction*/
+    double value[TUNE_KNOBS];
+    /* Value of the knob being tuned on trial calls*/
+    double trialvalue;
+    /* Time per particle of the current values on the last call which used them*/
+    double cost;
+    /* Knob being tuned and direction of the trial: 1 for up, -1 for down*/
+    int knob;
+    int dir;
+    /* Number of consecutive trials which were not faster*/
+    int nfail;
+    /* Next timed call uses the trial value*/
+    int trial;
+    int converged;
+    /* Calls and complete pairs timed for this trial, and the sum of log(trial cost / current cost) over the pairs*/
+    int64_t ncalls;
+    int npairs;
+    double logratio;
+    /* Cost and work of the first call of the current pair*/
+    double paircost;
+    double pairwork;
+};
+
+/* Start tuning from the given values*/
+void treewalk_tune_init(struct TreeWalkTuner * tuner, const char * label, double MaxChunkSize, double BufferFraction);
+/* Set the trial value for the next move, skipping moves which leave the allowed range.
+ * If there are no moves left, the tuning has converged.*/
+void treewalk_tune_next_trial(struct TreeWalkTuner * tuner);
+/* Record the time and the work (number of particles) of a call, which used the trial value if tuner->trial was set,
+ * and choose the values for the next call. The same on all ranks if the arguments are.*/
+void treewalk_tune_update(struct TreeWalkTuner * tuner, double elapsed, double work);
+
 /*Initialise treewalk parameters on first run*/
 void set_treewalk_params(ParameterSet * ps);
+/* Change the treewalk parameters during a run*/
+void set_treewalk_par(struct treewalk_params tw_params);
+struct treewalk_params get_treewalk_params(void);
 
 /* Do the distributed tree walking. Warning: as this is a threaded treewalk,
  * it may call tw->visit on particles more than once and in a noneterministic order.
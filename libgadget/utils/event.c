@@ -53,5 +53,6 @@ event_emit(EventSpec * eh, EIBase * event)
 
 EventSpec EventSlotsFork = {"SlotsFork", 0, {{0}}};
 EventSpec EventSlotsAfterGC = {"SlotsAfterGC", 0, {{0}}};
+EventSpec EventSlotsChange = {"SlotsChange", 0, {{0}}};
 
 
@@ -39,5 +39,7 @@ event_emit(EventSpec * eh, EIBase * event);
 extern EventSpec EventSlotsFork;
 /* GC is done, things may have been violated. */
 extern EventSpec EventSlotsAfterGC;
+/* A particle is made garbage, swallowed or changes type. */
+extern EventSpec EventSlotsChange;
 
 #endif
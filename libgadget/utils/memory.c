@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <sys/mman.h>
 #include "memory.h"
 #include "endrun.h"
 
@@ -20,16 +22,68 @@ struct BlockHeader {
     char annotation[];
 } ;
 
-int
-allocator_init(Allocator * alloc, const char * name, size_t request_size, int zero, Allocator * parent)
+/* Pretend the explicit huge page pool is empty, for testing the fallback*/
+static int HugeTLBUnavailable = 0;
+
+void
+allocator_override_hugetlb_unavailable(int unavailable)
+{
+    HugeTLBUnavailable = unavailable;
+}
+
+/* Map a top-level arena of size bytes. Stores the mapped size, and clears the huge page
+ * options in flags that could not be honoured.*/
+static void *
+allocator_map_arena(size_t size, int * flags, size_t * mapsize)
+{
+    void * rawbase;
+#ifdef MAP_HUGETLB
+    if((*flags & ALLOC_ARENA_HUGETLB) && !HugeTLBUnavailable) {
+        /* Explicit huge pages must be mapped in whole pages: assume the default 2MB size*/
+        const size_t hugepage = 2 * 1024 * 1024;
+        *mapsize = (size + hugepage - 1) / hugepage * hugepage;
+        rawbase = mmap(NULL, *mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if(rawbase != MAP_FAILED)
+            return rawbase;
+    }
+#endif
+    /* Fall back to transparent huge pages*/
+    if(*flags & ALLOC_ARENA_HUGETLB) {
+        *flags &= ~ALLOC_ARENA_HUGETLB;
+        *flags |= ALLOC_ARENA_HUGEPAGES;
+    }
+    *mapsize = size;
+    rawbase = mmap(NULL, *mapsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(rawbase == MAP_FAILED)
+        return NULL;
+#ifdef MADV_HUGEPAGE
+    if(*flags & ALLOC_ARENA_HUGEPAGES)
+        if(madvise(rawbase, *mapsize, MADV_HUGEPAGE))
+            *flags &= ~ALLOC_ARENA_HUGEPAGES;
+#else
+    *flags &= ~ALLOC_ARENA_HUGEPAGES;
+#endif
+    return rawbase;
+}
+
+static int
+allocator_init_full(Allocator * alloc, const char * name, size_t request_size, int zero, Allocator * parent, int flags)
 {
     size_t size = (request_size / ALIGNMENT + 1) * ALIGNMENT;
+    size_t mapsize = 0;
 
     void * rawbase;
     if (parent) {
         rawbase = allocator_alloc(parent, name, size + ALIGNMENT, ALLOC_DIR_BOT, "Child");
         if(rawbase == NULL)
             return ALLOC_ENOMEMORY;
+        /* Memory of a child has already been placed by its parent*/
+        flags = 0;
+    }
+    else if(flags & (ALLOC_ARENA_HUGEPAGES | ALLOC_ARENA_HUGETLB)) {
+        rawbase = allocator_map_arena(size + ALIGNMENT, &flags, &mapsize);
+        if(rawbase == NULL)
+            return ALLOC_ENOMEMORY;
     }
     else
         if(posix_memalign(&rawbase, ALIGNMENT, size + ALIGNMENT))
@@ -40,16 +94,34 @@ allocator_init(Allocator * alloc, const char * name, size_t request_size, int ze
     alloc->base = ((char*) rawbase) + ALIGNMENT - ((size_t) rawbase % ALIGNMENT);
     alloc->size = size;
     alloc->use_malloc = 0;
+    alloc->arena_flags = flags;
+    alloc->mapsize = mapsize;
+    alloc->profile = NULL;
     strncpy(alloc->name, name, 11);
     alloc->refcount = 1;
     alloc->top = alloc->size;
     alloc->bottom = 0;
+    /* A first touch arena starts with no page placed: each allocation places the pages it is the first to reach*/
+    alloc->untouched_bottom = 0;
+    alloc->untouched_top = (flags & ALLOC_ARENA_FIRSTTOUCH) ? alloc->size : 0;
 
     allocator_reset(alloc, zero);
 
     return 0;
 }
 
+int
+allocator_init(Allocator * alloc, const char * name, size_t request_size, int zero, Allocator * parent)
+{
+    return allocator_init_full(alloc, name, request_size, zero, parent, 0);
+}
+
+int
+allocator_init_arena(Allocator * alloc, const char * name, size_t request_size, int zero, int flags)
+{
+    return allocator_init_full(alloc, name, request_size, zero, NULL, flags);
+}
+
 int
 allocator_malloc_init(Allocator * alloc, const char * name, size_t request_size, int zero, Allocator * parent)
 {
@@ -68,6 +140,9 @@ allocator_malloc_init(Allocator * alloc, const char * name, size_t request_size,
 
     alloc->parent = parent;
     alloc->use_malloc = 1;
+    alloc->arena_flags = 0;
+    alloc->mapsize = 0;
+    alloc->profile = NULL;
     alloc->rawbase = rawbase;
     alloc->base = rawbase;
     alloc->size = size;
@@ -75,6 +150,8 @@ allocator_malloc_init(Allocator * alloc, const char * name, size_t request_size,
     alloc->refcount = 1;
     alloc->top = alloc->size;
     alloc->bottom = 0;
+    alloc->untouched_bottom = 0;
+    alloc->untouched_top = 0;
 
     allocator_reset(alloc, zero);
 
@@ -96,12 +173,284 @@ allocator_reset(Allocator * alloc, int zero)
     alloc->top = alloc->size;
     alloc->bottom = 0;
 
+    /* Untouched pages are zeroed when they are first allocated*/
     if(zero) {
-        memset(alloc->base, 0, alloc->size);
+        memset(alloc->base, 0, alloc->untouched_bottom);
+        memset((char *) alloc->base + alloc->untouched_top, 0, alloc->size - alloc->untouched_top);
     }
     return 0;
 }
 
+/* Zero the pages of the block [start, end) of a first touch arena which no earlier block has reached,
+ * page by page with a static schedule. A static loop over the block then finds the part it works on
+ * on the NUMA domain of its thread, wherever the block sits in the arena. Blocks reusing pages keep
+ * the placement of the first block that reached them.*/
+static void
+allocator_first_touch(Allocator * alloc, size_t start, size_t end)
+{
+    if(start < alloc->untouched_bottom)
+        start = alloc->untouched_bottom;
+    if(end > alloc->untouched_top)
+        end = alloc->untouched_top;
+    if(start >= end)
+        return;
+    const size_t npage = (end - start) / ALIGNMENT;
+    size_t i;
+    #pragma omp parallel for schedule(static)
+    for(i = 0; i < npage; i++)
+        memset((char *) alloc->base + start + i * ALIGNMENT, 0, ALIGNMENT);
+    /* Blocks grow inwards from either end, so the untouched pages stay contiguous*/
+    if(start == alloc->untouched_bottom)
+        alloc->untouched_bottom = end;
+    else
+        alloc->untouched_top = start;
+}
+
+/* The profile has fixed size tables, so recording never allocates.
+ * Names beyond the table capacity are counted but not recorded.*/
+#define PROFILE_NAMES 256
+#define PROFILE_PHASES 512
+#define PROFILE_BLOCKS 64
+
+struct ProfileName {
+    char name[32];
+    size_t peak; /* Largest single request*/
+    size_t total; /* Sum of all requests*/
+    int64_t count;
+};
+
+struct ProfilePhase {
+    char name[128];
+    size_t peak; /* Largest usage during any interval ending at this phase*/
+    int64_t count;
+};
+
+struct ProfileBlock {
+    char name[32];
+    char annotation[48];
+    size_t request_size;
+    size_t size;
+    int dir;
+};
+
+struct AllocatorProfile {
+    /* Overall high-water mark, including headers and alignment*/
+    size_t peak;
+    /* Sum of the requested sizes of the blocks live at the peak*/
+    size_t peak_requested;
+    /* Smallest free gap between top and bottom, which is usually the peak*/
+    size_t min_free;
+    /* Largest usage since the last phase*/
+    size_t interval_peak;
+    /* The phase during which the peak happened: known only once that phase ends*/
+    char peak_phase[128];
+    int peak_pending;
+    /* Blocks live at the peak*/
+    int nblocks;
+    int nblocks_live;
+    struct ProfileBlock blocks[PROFILE_BLOCKS];
+    int nnames;
+    int64_t names_dropped;
+    struct ProfileName names[PROFILE_NAMES];
+    int nphases;
+    int64_t phases_dropped;
+    struct ProfilePhase phases[PROFILE_PHASES];
+};
+
+/* Find the slot for a name in an open addressed table of nslot entries, each of stride bytes,
+ * whose name is the first member. Returns -1 if the name is not there and the table is full. */
+static int
+profile_find_slot(void * table, size_t stride, int nslot, int * nused, const char * name, size_t namelen)
+{
+    unsigned int hash = 5381;
+    const char * c;
+    for(c = name; *c && c < name + namelen - 1; c++)
+        hash = hash * 33 + (unsigned char) *c;
+    int i;
+    for(i = 0; i < nslot; i++) {
+        char * slot = (char *) table + ((hash + i) % nslot) * stride;
+        if(slot[0] == '\0') {
+            /* Leave one slot free so lookups of new names always terminate quickly*/
+            if(*nused >= nslot - 1)
+                return -1;
+            const size_t len = strnlen(name, namelen - 1);
+            memcpy(slot, name, len);
+            slot[len] = '\0';
+            (*nused)++;
+            return (hash + i) % nslot;
+        }
+        if(0 == strncmp(slot, name, namelen - 1))
+            return (hash + i) % nslot;
+    }
+    return -1;
+}
+
+int
+allocator_profile_enable(Allocator * alloc)
+{
+    if(alloc->profile)
+        return 0;
+    alloc->profile = calloc(1, sizeof(AllocatorProfile));
+    if(!alloc->profile)
+        return ALLOC_ENOMEMORY;
+    alloc->profile->min_free = allocator_get_free_size(alloc);
+    strcpy(alloc->profile->peak_phase, "(unfinished)");
+    return 0;
+}
+
+/* Record a new allocation. The bookkeeping is already updated for it.*/
+static void
+allocator_profile_alloc(Allocator * alloc, struct BlockHeader * header)
+{
+    AllocatorProfile * prof = alloc->profile;
+    #pragma omp critical (_allocator_profile_)
+    {
+        int i = profile_find_slot(prof->names, sizeof(prof->names[0]), PROFILE_NAMES, &prof->nnames, header->name, sizeof(prof->names[0].name));
+        if(i >= 0) {
+            struct ProfileName * pn = &prof->names[i];
+            if(header->request_size > pn->peak)
+                pn->peak = header->request_size;
+            pn->total += header->request_size;
+            pn->count++;
+        }
+        else
+            prof->names_dropped++;
+
+        size_t used = allocator_get_used_size(alloc, ALLOC_DIR_BOTH);
+        size_t nfree = allocator_get_free_size(alloc);
+        if(nfree < prof->min_free)
+            prof->min_free = nfree;
+        if(used > prof->interval_peak)
+            prof->interval_peak = used;
+        /* A new peak: save the live blocks. Only the first allocations of a run
+         * usually set new peaks, so this is rare.*/
+        if(used > prof->peak) {
+            prof->peak = used;
+            prof->peak_pending = 1;
+            prof->peak_requested = 0;
+            prof->nblocks = 0;
+            prof->nblocks_live = 0;
+            AllocatorIter iter[1];
+            for(allocator_iter_start(iter, alloc); !allocator_iter_ended(iter); allocator_iter_next(iter))
+            {
+                prof->peak_requested += iter->request_size;
+                prof->nblocks_live++;
+                if(prof->nblocks >= PROFILE_BLOCKS)
+                    continue;
+                struct ProfileBlock * pb = &prof->blocks[prof->nblocks++];
+                strncpy(pb->name, iter->name, sizeof(pb->name) - 1);
+                pb->name[sizeof(pb->name) - 1] = '\0';
+                strncpy(pb->annotation, iter->annotation, sizeof(pb->annotation) - 1);
+                pb->annotation[sizeof(pb->annotation) - 1] = '\0';
+                pb->request_size = iter->request_size;
+                pb->size = iter->size;
+                pb->dir = iter->dir;
+            }
+        }
+    }
+}
+
+void
+allocator_profile_phase(Allocator * alloc, const char * phase)
+{
+    AllocatorProfile * prof = alloc->profile;
+    if(!prof)
+        return;
+    #pragma omp critical (_allocator_profile_)
+    {
+        int i = profile_find_slot(prof->phases, sizeof(prof->phases[0]), PROFILE_PHASES, &prof->nphases, phase, sizeof(prof->phases[0].name));
+        if(i >= 0) {
+            struct ProfilePhase * ph = &prof->phases[i];
+            if(prof->interval_peak > ph->peak)
+                ph->peak = prof->interval_peak;
+            ph->count++;
+        }
+        else
+            prof->phases_dropped++;
+        if(prof->peak_pending) {
+            strncpy(prof->peak_phase, phase, sizeof(prof->peak_phase) - 1);
+            prof->peak_pending = 0;
+        }
+        prof->interval_peak = allocator_get_used_size(alloc, ALLOC_DIR_BOTH);
+    }
+}
+
+size_t
+allocator_profile_peak(Allocator * alloc)
+{
+    if(!alloc->profile)
+        return 0;
+    return alloc->profile->peak;
+}
+
+static int
+profile_name_cmp(const void * a, const void * b)
+{
+    const struct ProfileName * na = *(struct ProfileName * const *) a;
+    const struct ProfileName * nb = *(struct ProfileName * const *) b;
+    return (na->peak < nb->peak) - (na->peak > nb->peak);
+}
+
+static int
+profile_phase_cmp(const void * a, const void * b)
+{
+    const struct ProfilePhase * pa = *(struct ProfilePhase * const *) a;
+    const struct ProfilePhase * pb = *(struct ProfilePhase * const *) b;
+    return (pa->peak < pb->peak) - (pa->peak > pb->peak);
+}
+
+void
+allocator_profile_report(Allocator * alloc, FILE * fp)
+{
+    AllocatorProfile * prof = alloc->profile;
+    if(!prof)
+        return;
+    int i, n;
+    fprintf(fp, "Allocator %s: total %td kbytes, peak %td kbytes (%.1f%%) during %s\n",
+            alloc->name, alloc->size / 1024, prof->peak / 1024, 100. * prof->peak / alloc->size,
+            prof->peak_pending ? "(unfinished)" : prof->peak_phase);
+    fprintf(fp, " Requested at peak: %td kbytes; headers and alignment: %td kbytes; least free: %td kbytes\n",
+            prof->peak_requested / 1024, (prof->peak - prof->peak_requested) / 1024, prof->min_free / 1024);
+    fprintf(fp, " Blocks live at peak (%d):\n", prof->nblocks_live);
+    fprintf(fp, " %-20s | %c | %-12s %-12s | %s\n", "Name", 'd', "Requested", "Allocated", "Annotation");
+    for(i = 0; i < prof->nblocks; i++) {
+        struct ProfileBlock * pb = &prof->blocks[i];
+        fprintf(fp, " %-20s | %c | %012td %012td | %s\n",
+                pb->name, "T?B"[pb->dir + 1], pb->request_size / 1024, pb->size / 1024, pb->annotation);
+    }
+    if(prof->nblocks < prof->nblocks_live)
+        fprintf(fp, " ... %d more blocks\n", prof->nblocks_live - prof->nblocks);
+
+    /* Tables sorted by peak, largest first*/
+    void ** sorted = malloc(sizeof(void *) * (PROFILE_NAMES > PROFILE_PHASES ? PROFILE_NAMES : PROFILE_PHASES));
+    for(i = 0, n = 0; i < PROFILE_PHASES; i++)
+        if(prof->phases[i].name[0])
+            sorted[n++] = &prof->phases[i];
+    qsort(sorted, n, sizeof(void *), profile_phase_cmp);
+    fprintf(fp, " High-water mark by phase:\n");
+    fprintf(fp, " %-64s %12s %10s\n", "Phase", "Peak (kB)", "Count");
+    for(i = 0; i < n; i++) {
+        struct ProfilePhase * ph = sorted[i];
+        fprintf(fp, " %-64s %012td %10ld\n", ph->name, ph->peak / 1024, (long) ph->count);
+    }
+    if(prof->phases_dropped)
+        fprintf(fp, " ... %ld intervals in unrecorded phases\n", (long) prof->phases_dropped);
+
+    for(i = 0, n = 0; i < PROFILE_NAMES; i++)
+        if(prof->names[i].name[0])
+            sorted[n++] = &prof->names[i];
+    qsort(sorted, n, sizeof(void *), profile_name_cmp);
+    fprintf(fp, " Largest allocation by name:\n");
+    fprintf(fp, " %-20s %12s %12s %10s\n", "Name", "Peak (kB)", "Total (kB)", "Count");
+    for(i = 0; i < n; i++) {
+        struct ProfileName * pn = sorted[i];
+        fprintf(fp, " %-20s %012td %012td %10ld\n", pn->name, pn->peak / 1024, pn->total / 1024, (long) pn->count);
+    }
+    if(prof->names_dropped)
+        fprintf(fp, " ... %ld allocations with unrecorded names\n", (long) prof->names_dropped);
+    free(sorted);
+}
+
 static void *
 allocator_alloc_va(Allocator * alloc, const char * name, size_t request_size, int dir, char * fmt, va_list va)
 {
@@ -121,6 +470,8 @@ allocator_alloc_va(Allocator * alloc, const char * name, size_t request_size, in
             endrun(1, "Not enough memory for %s %td bytes\n", name, size);
         }
         ptr = alloc->base + alloc->bottom;
+        if(alloc->untouched_bottom < alloc->untouched_top)
+            allocator_first_touch(alloc, alloc->bottom, alloc->bottom + size);
         alloc->bottom += size;
         alloc->refcount += 1;
     } else if (dir == ALLOC_DIR_TOP) {
@@ -129,6 +480,8 @@ allocator_alloc_va(Allocator * alloc, const char * name, size_t request_size, in
             endrun(1, "Not enough memory for %s %td bytes\n", name, size);
         }
         ptr = alloc->base + alloc->top - size;
+        if(alloc->untouched_bottom < alloc->untouched_top)
+            allocator_first_touch(alloc, alloc->top - size, alloc->top);
         alloc->refcount += 1;
         alloc->top -= size;
     } else {
@@ -148,6 +501,9 @@ allocator_alloc_va(Allocator * alloc, const char * name, size_t request_size, in
 
     vsprintf(header->annotation, fmt, va);
 
+    if(alloc->profile)
+        allocator_profile_alloc(alloc, header);
+
     void * cptr;
     if(alloc->use_malloc) {
         /* prepend a copy of the header to the malloc block; allocator_free will use it*/
@@ -181,8 +537,12 @@ allocator_destroy(Allocator * alloc)
     }
     if(alloc->parent)
         allocator_dealloc(alloc->parent, alloc->rawbase);
+    else if(alloc->mapsize)
+        munmap(alloc->rawbase, alloc->mapsize);
     else
         free(alloc->rawbase);
+    free(alloc->profile);
+    alloc->profile = NULL;
     return 0;
 }
 
@@ -2,8 +2,10 @@
 #define _MEMORY_H_
 
 #include <stddef.h>
+#include <stdio.h>
 
 typedef struct Allocator Allocator;
+typedef struct AllocatorProfile AllocatorProfile;
 
 #define ALLOC_ENOTALLOC -3
 #define ALLOC_EMISMATCH -2
@@ -13,6 +15,15 @@ typedef struct Allocator Allocator;
 #define ALLOC_DIR_BOT +1
 #define ALLOC_DIR_BOTH 0
 
+/* Options for the backing memory of an arena, see allocator_init_arena*/
+/* Map the arena with mmap and ask for transparent huge pages*/
+#define ALLOC_ARENA_HUGEPAGES 1
+/* Map the arena from the explicit huge page pool (MAP_HUGETLB), falling back to transparent huge pages*/
+#define ALLOC_ARENA_HUGETLB 2
+/* Place the pages of each block on first allocation, touching them in parallel with a static schedule,
+ * so a static loop over the block (particles, tree, mesh) works on pages local to each thread*/
+#define ALLOC_ARENA_FIRSTTOUCH 4
+
 struct Allocator {
     char name[12];
     Allocator * parent;
@@ -26,6 +37,12 @@ struct Allocator {
 
     int refcount;
     int use_malloc; /* only do the book keeping. delegate to libc malloc/free */
+    int arena_flags; /* ALLOC_ARENA options in effect */
+    size_t mapsize; /* size of the mmap of rawbase, or 0 if it came from posix_memalign or a parent */
+    /* Pages in [untouched_bottom, untouched_top) have not yet been placed by ALLOC_ARENA_FIRSTTOUCH */
+    size_t untouched_bottom;
+    size_t untouched_top;
+    AllocatorProfile * profile; /* High-water mark records, if enabled by allocator_profile_enable */
 };
 
 typedef struct AllocatorIter AllocatorIter;
@@ -47,6 +64,16 @@ struct AllocatorIter {
 int
 allocator_init(Allocator * alloc, const char * name, size_t size, int zero, Allocator * parent);
 
+/* Like allocator_init without a parent, but with ALLOC_ARENA options for the backing memory.
+ * If huge pages are not available the arena uses normal pages: the options
+ * in effect are in alloc->arena_flags. */
+int
+allocator_init_arena(Allocator * alloc, const char * name, size_t size, int zero, int flags);
+
+/* For testing: if unavailable is true, mapping from the explicit huge page pool always fails.*/
+void
+allocator_override_hugetlb_unavailable(int unavailable);
+
 int
 allocator_malloc_init(Allocator * alloc,
         const char * name, size_t size, int zero, Allocator * parent
@@ -110,4 +137,22 @@ allocator_print(Allocator * alloc);
 int
 allocator_reset(Allocator * alloc, int zero);
 
+/* Start recording the high-water marks of an allocator: overall, per block name and per phase,
+ * with the list of live blocks at the overall peak. Costs a hash lookup per allocation.*/
+int
+allocator_profile_enable(Allocator * alloc);
+
+/* Mark the end of a phase of the program (usually a walltime clock):
+ * the largest usage since the previous call is attributed to this phase.*/
+void
+allocator_profile_phase(Allocator * alloc, const char * phase);
+
+/* Write the recorded high-water marks to fp. Does nothing if the profile is not enabled.*/
+void
+allocator_profile_report(Allocator * alloc, FILE * fp);
+
+/* Peak usage in bytes, including headers and alignment; 0 if the profile is not enabled.*/
+size_t
+allocator_profile_peak(Allocator * alloc);
+
 #endif
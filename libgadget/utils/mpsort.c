@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include <mpi.h>
+#include <omp.h>
 
 #include "mpsort.h"
 #include "system.h"
@@ -180,8 +181,15 @@ void _setup_radix_sort(
 
 /****
  * sort by radix;
- * internally this uses qsort_r of glibc.
  *
+ * The radix of every item is computed once and stored with the index of the item.
+ * These records are sorted with a parallel, stable LSD radix sort, one byte per pass,
+ * and the items are then permuted in a single pass.
+ * The radix is treated as an unsigned integer of rsize bytes in native byte order,
+ * which is what _setup_radix_sort compares.
+ *
+ * If the option MPSORT_COMPARISON_LOCAL_SORT is set, or there is not enough memory for
+ * the records, falls back to a comparison sort which recomputes the radix in every comparison.
  **** */
 static struct crstruct _cacr_d;
 
@@ -194,7 +202,7 @@ static int _compute_and_compar_radix(const void * p1, const void * p2) {
     return c1;
 }
 
-static void radix_sort(void * base, size_t nmemb, size_t size,
+static void comparison_sort(void * base, size_t nmemb, size_t size,
         void (*radix)(const void * ptr, void * radix, void * arg),
         size_t rsize,
         void * arg) {
@@ -205,6 +213,121 @@ static void radix_sort(void * base, size_t nmemb, size_t size,
     qsort_openmp(_cacr_d.base, _cacr_d.nmemb, _cacr_d.size, _compute_and_compar_radix);
 }
 
+/* One LSD pass on byte `byte` of the records, from src to dest.
+ * The records are split in nchunk contiguous chunks, each chunk is scattered by one thread,
+ * after the records with the same digit from the lower chunks; so the pass is stable.
+ * Returns 0 if all the records have the same digit and nothing was done.*/
+static int
+_radix_pass(const uint64_t * src, uint64_t * dest, size_t nmemb, size_t nwords, size_t byte,
+        size_t * count, int nchunk)
+{
+    const size_t chnk = nmemb / nchunk + 1;
+    int t;
+    memset(count, 0, sizeof(size_t) * 256 * nchunk);
+    #pragma omp parallel for
+    for(t = 0; t < nchunk; t++) {
+        size_t * mycount = count + 256 * t;
+        size_t i, end = (t + 1) * chnk;
+        if(end > nmemb)
+            end = nmemb;
+        for(i = t * chnk; i < end; i++) {
+            const unsigned char * key = (const unsigned char *) (src + i * nwords + 1);
+            mycount[key[byte]]++;
+        }
+    }
+    /* Exclusive prefix sum, by digit then chunk*/
+    size_t offset = 0;
+    int digit;
+    for(digit = 0; digit < 256; digit++) {
+        size_t ndigit = 0;
+        for(t = 0; t < nchunk; t++) {
+            const size_t c = count[256 * t + digit];
+            count[256 * t + digit] = offset;
+            offset += c;
+            ndigit += c;
+        }
+        if(ndigit == nmemb)
+            return 0;
+    }
+    #pragma omp parallel for
+    for(t = 0; t < nchunk; t++) {
+        size_t * mypos = count + 256 * t;
+        size_t i, end = (t + 1) * chnk;
+        if(end > nmemb)
+            end = nmemb;
+        for(i = t * chnk; i < end; i++) {
+            const uint64_t * rec = src + i * nwords;
+            const unsigned char * key = (const unsigned char *) (rec + 1);
+            uint64_t * out = dest + (mypos[key[byte]]++) * nwords;
+            size_t w;
+            for(w = 0; w < nwords; w++)
+                out[w] = rec[w];
+        }
+    }
+    return 1;
+}
+
+static void radix_sort(void * base, size_t nmemb, size_t size,
+        void (*radix)(const void * ptr, void * radix, void * arg),
+        size_t rsize,
+        void * arg) {
+
+    if(nmemb <= 1)
+        return;
+
+    /* A record is the index of the item followed by its radix, padded to whole words*/
+    const size_t nwords = 1 + (rsize + 7) / 8;
+    const int nchunk = omp_get_max_threads();
+    const size_t needed = 2 * nmemb * nwords * sizeof(uint64_t) + nmemb * size + sizeof(size_t) * 256 * nchunk + 4096 * 8;
+
+    if(mpsort_mpi_has_options(MPSORT_COMPARISON_LOCAL_SORT) || needed > mymalloc_freebytes()) {
+        comparison_sort(base, nmemb, size, radix, rsize, arg);
+        return;
+    }
+
+    uint64_t * const recA = mymalloc("RadixRecords", nmemb * nwords * sizeof(uint64_t));
+    uint64_t * const recB = mymalloc("RadixRecords2", nmemb * nwords * sizeof(uint64_t));
+    uint64_t * rec = recA, * rec2 = recB;
+    size_t * count = mymalloc("RadixCount", sizeof(size_t) * 256 * nchunk);
+
+    size_t i;
+    #pragma omp parallel for
+    for(i = 0; i < nmemb; i++) {
+        uint64_t * r = rec + i * nwords;
+        r[0] = i;
+        r[nwords - 1] = 0;
+        radix((char *) base + i * size, r + 1, arg);
+    }
+
+    /* Least significant byte first*/
+    const union {
+        uint32_t i;
+        char c[4];
+    } be_detect = {0x01020304};
+    const int bigendian = be_detect.c[0] == 1;
+    size_t p;
+    for(p = 0; p < rsize; p++) {
+        const size_t byte = bigendian ? rsize - 1 - p : p;
+        if(_radix_pass(rec, rec2, nmemb, nwords, byte, count, nchunk)) {
+            uint64_t * tmp = rec;
+            rec = rec2;
+            rec2 = tmp;
+        }
+    }
+    myfree(count);
+
+    /* Permute the items: gather them in sorted order and copy back*/
+    char * sorted = mymalloc("RadixSorted", nmemb * size);
+    #pragma omp parallel for
+    for(i = 0; i < nmemb; i++)
+        memcpy(sorted + i * size, (char *) base + rec[i * nwords] * size, size);
+    memcpy(base, sorted, nmemb * size);
+    myfree(sorted);
+
+    myfree(recB);
+    myfree(recA);
+}
+
 
 /*
  * returns index of the last item satisfying
@@ -1431,6 +1554,8 @@ static void _mpsort_mpi_parse_env()
         mpsort_mpi_set_options(MPSORT_DISABLE_GATHER_SORT);
     if(getenv("MPSORT_REQUIRE_GATHER_SORT "))
         mpsort_mpi_set_options(MPSORT_REQUIRE_GATHER_SORT );
+    if(getenv("MPSORT_COMPARISON_LOCAL_SORT"))
+        mpsort_mpi_set_options(MPSORT_COMPARISON_LOCAL_SORT);
 }
 
 void
@@ -4,6 +4,8 @@
 /* MPI support */
 #define MPSORT_DISABLE_GATHER_SORT (1 << 3)
 #define MPSORT_REQUIRE_GATHER_SORT (1 << 4)
+/* Sort locally with a comparison sort on the radix, rather than a radix sort. Slower, but needs less memory.*/
+#define MPSORT_COMPARISON_LOCAL_SORT (1 << 5)
 
 void mpsort_mpi_set_options(int options);
 int mpsort_mpi_has_options(int options);
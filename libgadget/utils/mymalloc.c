@@ -21,10 +21,59 @@ Allocator A_MAIN[1];
  * */
 Allocator A_TEMP[1];
 
+/* Private arenas of the calling thread, set by mymalloc_set_thread_allocator*/
+static Allocator * ThreadMainAllocator = A_MAIN;
+static Allocator * ThreadTempAllocator = A_TEMP;
+#pragma omp threadprivate(ThreadMainAllocator, ThreadTempAllocator)
+
+/* Private arenas of the threads of the outermost parallel region, by thread number,
+ * for the teams of the regions nested inside them: their threads have fresh threadprivate copies.
+ * Each entry is written by its own thread before it starts a nested region, and read only
+ * by that thread and its nested teams.*/
+#define MAXTHREADARENAS 64
+static Allocator * NestedMainAllocator[MAXTHREADARENAS];
+static Allocator * NestedTempAllocator[MAXTHREADARENAS];
+
+/* Thread number in the outermost parallel region, if the caller is in a region nested inside it, else -1.*/
+static int
+nested_arena_owner(void)
+{
+    if(omp_get_level() < 2)
+        return -1;
+    const int owner = omp_get_ancestor_thread_num(1);
+    if(owner < 0 || owner >= MAXTHREADARENAS || !NestedMainAllocator[owner])
+        return -1;
+    return owner;
+}
+
+Allocator *
+mymalloc_main_allocator(void)
+{
+    const int owner = nested_arena_owner();
+    return owner >= 0 ? NestedMainAllocator[owner] : ThreadMainAllocator;
+}
+
+Allocator *
+mymalloc_temp_allocator(void)
+{
+    const int owner = nested_arena_owner();
+    return owner >= 0 ? NestedTempAllocator[owner] : ThreadTempAllocator;
+}
+
 #ifdef VALGRIND
 #define allocator_init allocator_malloc_init
+#define allocator_init_arena(alloc, name, size, zero, flags) allocator_malloc_init(alloc, name, size, zero, NULL)
 #endif
 
+/* ALLOC_ARENA options for the backing memory of A_MAIN*/
+static int MainArenaFlags = 0;
+
+void
+mymalloc_set_arena_options(int flags)
+{
+    MainArenaFlags = flags;
+}
+
 void
 tamalloc_init(void)
 {
@@ -64,10 +113,31 @@ mymalloc_init(double MaxMemSizePerNode)
         endrun(2, "Mem too small! MB/node=%g, nodespercpu = %g NTask = %d\n", MaxMemSizePerNode, nodespercpu, NTask);
 
 
-    if (MPIU_Any(ALLOC_ENOMEMORY == allocator_init(A_MAIN, "MAIN", n, 1, NULL), MPI_COMM_WORLD)) {
+    if (MPIU_Any(ALLOC_ENOMEMORY == allocator_init_arena(A_MAIN, "MAIN", n, 1, MainArenaFlags), MPI_COMM_WORLD)) {
         endrun(0, "Insufficient memory for the MAIN allocator on at least one nodes."
                   "Requestion %td bytes. Try reducing MaxMemSizePerNode. Also check the node health status.\n", n);
     }
+    if(MainArenaFlags)
+        message(0, "MAIN allocator arena: %s%s%s\n",
+                A_MAIN->arena_flags & ALLOC_ARENA_HUGETLB ? "explicit huge pages " :
+                (A_MAIN->arena_flags & ALLOC_ARENA_HUGEPAGES ? "transparent huge pages " : "normal pages "),
+                A_MAIN->arena_flags & ALLOC_ARENA_FIRSTTOUCH ? "with parallel first touch" : "",
+                (MainArenaFlags & ~A_MAIN->arena_flags) ? " (huge pages unavailable on rank 0)" : "");
+}
+
+void
+mymalloc_set_thread_allocator(Allocator * alloc)
+{
+    ThreadMainAllocator = alloc ? alloc : A_MAIN;
+    ThreadTempAllocator = alloc ? alloc : A_TEMP;
+    /* Hand the arena on to the teams of nested parallel regions*/
+    if(omp_get_level() == 1) {
+        const int tid = omp_get_thread_num();
+        if(tid >= MAXTHREADARENAS)
+            endrun(1, "Thread %d cannot have a private arena: only %d threads can\n", tid, MAXTHREADARENAS);
+        NestedMainAllocator[tid] = alloc;
+        NestedTempAllocator[tid] = alloc;
+    }
 }
 
 static size_t highest_memory_usage = 0;
@@ -6,29 +6,44 @@
 extern Allocator A_MAIN[1];
 extern Allocator A_TEMP[1];
 
+/* Allocators used by the mymalloc and ta_malloc families on the calling thread.
+ * These are A_MAIN and A_TEMP, unless the thread, or the thread a parallel region
+ * it is in was started from, has been handed a private arena with mymalloc_set_thread_allocator.*/
+Allocator * mymalloc_main_allocator(void);
+Allocator * mymalloc_temp_allocator(void);
+#define MainAllocator mymalloc_main_allocator()
+#define TempAllocator mymalloc_temp_allocator()
+
+/* Set the ALLOC_ARENA options for the main memory block. Call before mymalloc_init.*/
+void mymalloc_set_arena_options(int flags);
 /* Initialize the main memory block*/
 void mymalloc_init(double MemoryMB);
 /* Initialize the small temporary memory block*/
 void tamalloc_init(void);
 void report_detailed_memory_usage(const char *label, const char * fmt, ...);
+/* Direct all mymalloc and ta_malloc calls made by the calling thread to alloc, so that thread
+ * can allocate while another thread is using A_MAIN. If the calling thread is in a parallel region
+ * (eg, the PM thread of gravpm_force_overlap), the teams of the parallel regions it starts use alloc too.
+ * NULL restores A_MAIN and A_TEMP.*/
+void mymalloc_set_thread_allocator(Allocator * alloc);
 
-#define  mymalloc(name, size)            allocator_alloc_bot(A_MAIN, name, size)
-#define  mymalloc2(name, size)           allocator_alloc_top(A_MAIN, name, size)
+#define  mymalloc(name, size)            allocator_alloc_bot(MainAllocator, name, size)
+#define  mymalloc2(name, size)           allocator_alloc_top(MainAllocator, name, size)
 
-#define  myrealloc(ptr, size)     allocator_realloc(A_MAIN, ptr, size)
+#define  myrealloc(ptr, size)     allocator_realloc(MainAllocator, ptr, size)
 #define  myfree(x)                 allocator_free(x)
 
-#define  ma_malloc(name, type, nele)            (type*) allocator_alloc_bot(A_MAIN, name, sizeof(type) * (nele))
-#define  ma_malloc2(name, type, nele)           (type*) allocator_alloc_top(A_MAIN, name, sizeof(type) * (nele))
+#define  ma_malloc(name, type, nele)            (type*) allocator_alloc_bot(MainAllocator, name, sizeof(type) * (nele))
+#define  ma_malloc2(name, type, nele)           (type*) allocator_alloc_top(MainAllocator, name, sizeof(type) * (nele))
 #define  ma_free(p) allocator_free(p)
 
-#define  ta_malloc(name, type, nele)            (type*) allocator_alloc_bot(A_TEMP, name, sizeof(type) * (nele))
-#define  ta_malloc2(name, type, nele)           (type*) allocator_alloc_top(A_TEMP, name, sizeof(type) * (nele))
+#define  ta_malloc(name, type, nele)            (type*) allocator_alloc_bot(TempAllocator, name, sizeof(type) * (nele))
+#define  ta_malloc2(name, type, nele)           (type*) allocator_alloc_top(TempAllocator, name, sizeof(type) * (nele))
 #define  ta_reset()     allocator_reset(A_TEMP, 0)
 #define  ta_free(p) allocator_free(p)
 
 #define  report_memory_usage(x)    report_detailed_memory_usage(x, "%s:%d", __FILE__, __LINE__)
-#define  mymalloc_freebytes()       allocator_get_free_size(A_MAIN)
-#define  mymalloc_usedbytes()       allocator_get_used_size(A_MAIN, ALLOC_DIR_BOTH)
+#define  mymalloc_freebytes()       allocator_get_free_size(MainAllocator)
+#define  mymalloc_usedbytes()       allocator_get_used_size(MainAllocator, ALLOC_DIR_BOTH)
 
 #endif
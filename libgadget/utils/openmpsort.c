@@ -202,148 +202,277 @@ static void merge(void * base1, size_t nmemb1, void * base2, size_t nmemb2, void
     }
 }
 
-void qsort_openmp(void *base, size_t nmemb, size_t size,
-                         int(*compar)(const void *, const void *)) {
-    int Nt = omp_get_max_threads();
-    ptrdiff_t * Anmemb = ta_malloc("Anmemb", ptrdiff_t, Nt);
-    ptrdiff_t * Anmemb_old = ta_malloc("Anmemb_old", ptrdiff_t, Nt);
+/* Arrays with at least this many items are sorted with a sample sort rather than a merge sort.*/
+static size_t SampleSortMinItems = 1 << 22;
 
-    void ** Abase_store = ta_malloc("Abase", void *, Nt);
-    void ** Atmp_store = ta_malloc("Atmp", void *, Nt);
-    void ** Abase = Abase_store;
-    void ** Atmp = Atmp_store;
+void
+qsort_openmp_set_samplesort(size_t min_items)
+{
+    SampleSortMinItems = min_items;
+}
 
-    /*Should I use indirect sorting?*/
-    int indirect = 0;
-    if(size > 32)
-        indirect = 1;
-    void * tmp;
-    /*NOTE: if this allocation becomes a problem,
-     * switch to glibc's quicksort (serial!) */
+/* Compare two items of the array being sorted: for indirect sorts the items are pointers.*/
+static inline int
+_item_compar(const char * a, const char * b, __compar_fn_t compar, int indirect)
+{
     if(indirect)
-        tmp = mymalloc("qsort",2*nmemb*sizeof(void *) + size);
-    else
-        tmp = mymalloc("qsort", size * nmemb);
+        return compar(*(void * const *) a, *(void * const *) b);
+    return compar(a, b);
+}
+
+/* Co-rank for a stable merge of A (m items) and B (n items), which takes A first on ties:
+ * returns how many of the first k merged items come from A.*/
+static size_t
+_merge_corank(size_t k, const char * A, size_t m, const char * B, size_t n, size_t s, __compar_fn_t compar, int indirect)
+{
+    size_t lo = k > n ? k - n : 0;
+    size_t hi = k < m ? k : m;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo + 1) / 2;
+        /* A[mid-1] is among the first k unless it sorts after B[k-mid]*/
+        if(_item_compar(A + (mid - 1) * s, B + (k - mid) * s, compar, indirect) <= 0)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
+
+/* One round of the parallel merge: runs r and r+1, for even r, are merged from src into dst.
+ * Runs are contiguous, run r being bounds[r] .. bounds[r+1].
+ * Thread tid of Nt writes items tid * nmemb / Nt .. (tid + 1) * nmemb / Nt of dst,
+ * whichever runs they belong to, finding where its segments start in each run by bisection. */
+static void
+_merge_round(const char * src, char * dst, const size_t * bounds, int nruns, size_t nmemb, size_t s,
+        __compar_fn_t compar, int indirect, int tid, int Nt)
+{
+    const size_t o0 = tid * nmemb / Nt;
+    const size_t o1 = (tid + 1) * nmemb / Nt;
+    int r;
+    for(r = 0; r < nruns; r += 2) {
+        const size_t start = bounds[r];
+        const size_t mid = bounds[r + 1];
+        const size_t end = r + 1 < nruns ? bounds[r + 2] : mid;
+        const size_t k0 = (o0 > start ? o0 : start) - start;
+        const size_t k1 = (o1 < end ? o1 : end);
+        if(k1 <= start || k1 - start <= k0)
+            continue;
+        const char * A = src + start * s;
+        const char * B = src + mid * s;
+        const size_t m = mid - start, n = end - mid;
+        const size_t i0 = _merge_corank(k0, A, m, B, n, s, compar, indirect);
+        const size_t i1 = _merge_corank(k1 - start, A, m, B, n, s, compar, indirect);
+        merge((void *) (A + i0 * s), i1 - i0, (void *) (B + (k0 - i0) * s), (k1 - start - i1) - (k0 - i0),
+                dst + (start + k0) * s, s, compar, indirect);
+    }
+}
+
+/* Choose the glibc msort variant for items of size s at base*/
+static int
+_msort_var(const char * base, size_t s, int indirect)
+{
+    if(indirect)
+        return 3;
+    /*Copied from glibc*/
+    if ((s & (sizeof (uint32_t) - 1)) == 0
+        && ((char *) base - (char *) 0) % __alignof__ (uint32_t) == 0)
+      {
+        if (s == sizeof (uint32_t))
+          return 0;
+        else if (s == sizeof (uint64_t)
+                 && ((char *) base - (char *) 0) % __alignof__ (uint64_t) == 0)
+          return 1;
+        else if ((s & (sizeof (unsigned long) - 1)) == 0
+                 && ((char *) base - (char *) 0)
+                    % __alignof__ (unsigned long) == 0)
+          return 2;
+      }
+    /*End copied from glibc*/
+    return 4;
+}
+
+/* Merge sort of src, using dst as scratch. The threads sort contiguous runs of the array,
+ * which are then merged pairwise in rounds using all threads. The result is in src. */
+static void
+_parallel_merge_sort(char * src, char * dst, size_t nmemb, size_t s, __compar_fn_t compar, int indirect)
+{
+    int Nt = omp_get_max_threads();
+    size_t * bounds = ta_malloc("bounds", size_t, Nt + 1);
+    int nruns = 0;
+    const int var = _msort_var(src, s, indirect);
 
 #pragma omp parallel
     {
-        int tid = omp_get_thread_num();
+        const int tid = omp_get_thread_num();
         /* actual number of threads*/
-        int Nt = omp_get_num_threads();
-
-        /* domain decomposition */
-        ptrdiff_t start = tid * nmemb / Nt;
-        ptrdiff_t end = (tid + 1) * nmemb / Nt;
-        /* save decoposition to global array for merging */
-        Anmemb[tid] = end - start;
-        Anmemb_old[tid] = end - start;
-        Abase[tid] = ((char*) base) + start * size;
-        Atmp[tid] = ((char*) tmp) + start * size;
+        const int Nt = omp_get_num_threads();
+        const size_t start = tid * nmemb / Nt;
+        const size_t end = (tid + 1) * nmemb / Nt;
+        bounds[tid] = start;
+        if(tid == 0) {
+            bounds[Nt] = nmemb;
+            nruns = Nt;
+        }
 
         struct msort_param p;
-        p.t = Atmp[tid];
-        p.s = size;
-        p.var = 4;
+        p.t = dst + start * s;
+        p.s = s;
+        p.var = var;
         p.cmp = compar;
-        /*For large arrays we use an indirect sort following glibc*/
-        if(indirect)
-        {
-            /* Indirect sorting: copy everything in this thread to the new pointer space,
-             * which is after the tmp space. */
-            char *ip = (char *) Abase[tid];
-            void **tp = (void **) (tmp + (nmemb + start)* sizeof (void *));
-            void **t = tp;
-            void *end = (void *) (tp + Anmemb[tid]);
-
-            while ((void *) t < end)
-            {
-              *t++ = ip;
-              ip += size;
-            }
-            p.s = sizeof (void *);
-            p.var = 3;
-            Abase[tid] = tp;
-            Atmp[tid] = ((char*) tmp) + start * p.s;
-            p.t = Atmp[tid];
-        }
-        else {
-            /*Copied from glibc*/
-            if ((size & (sizeof (uint32_t) - 1)) == 0
-                && ((char *) base - (char *) 0) % __alignof__ (uint32_t) == 0)
-              {
-                if (size == sizeof (uint32_t))
-                  p.var = 0;
-                else if (size == sizeof (uint64_t)
-                         && ((char *) base - (char *) 0) % __alignof__ (uint64_t) == 0)
-                  p.var = 1;
-                else if ((size & (sizeof (unsigned long) - 1)) == 0
-                         && ((char *) base - (char *) 0)
-                            % __alignof__ (unsigned long) == 0)
-                  p.var = 2;
-              }
-            /*End copied from glibc*/
-        }
-        msort_with_tmp (&p, Abase[tid], Anmemb[tid]);
-        /* now each sub array is sorted, kick start the merging */
-        int sep;
-        for (sep = 1; sep < Nt; sep *=2 ) {
-            int color = tid / sep;
-            int key = tid % sep;
-#if 0
-            if(tid == 0) {
-                printf("sep = %d Abase[0] %p base %p, Atmp[0] %p tmp %p\n",
-                        sep, Abase[0], base, Atmp[0], tmp);
-                printf("base 73134 = %d 73135 = %d\n", ((int*) base)[73134], ((int*) base)[73135]);
-                printf("tmp  73134 = %d 73135 = %d\n", ((int*) tmp )[73134], ((int*) tmp )[73135]);
-            }
-#endif
-#pragma omp barrier
-            /* only group leaders work */
-            if(key == 0 && color % 2 == 0) {
-                int nextT = tid + sep;
-                /*merge with next guy */
-                /* only even leaders arrives to this point*/
-                if(nextT >= Nt) {
-                    /* no next guy, copy directly.*/
-                    merge(Abase[tid], Anmemb[tid], NULL, 0, Atmp[tid], p.s, compar, indirect);
-                }  else {
-#if 0
-                    printf("%d + %d merging with %td/%td:%td %td/%td:%td\n", tid, nextT,
-                            ((char*)Abase[tid] - (char*) base) / size,
-                            ((char*)Abase[tid] - (char*) tmp) / size,
-                            Anmemb[tid],
-                            ((char*)Abase[nextT] - (char*) base) / size,
-                            ((char*)Abase[nextT] - (char*) tmp) / size,
-                            Anmemb[nextT]);
-#endif
-                    merge(Abase[tid], Anmemb[tid], Abase[nextT], Anmemb[nextT], Atmp[tid], p.s, compar, indirect);
-                    /* merge two lists */
-                    Anmemb[tid] = Anmemb[tid] + Anmemb[nextT];
-                    Anmemb[nextT] = 0;
-                }
-            }
+        msort_with_tmp (&p, src + start * s, end - start);
 
-            /* now swap Abase and Atmp for next merge */
+        char * from = src;
+        char * to = dst;
+#pragma omp barrier
+        while(nruns > 1) {
+            _merge_round(from, to, bounds, nruns, nmemb, s, compar, indirect, tid, Nt);
 #pragma omp barrier
             if(tid == 0) {
-                void ** a = Abase;
-                Abase = Atmp;
-                Atmp = a;
+                int r;
+                for(r = 0; 2 * r < nruns; r++)
+                    bounds[r] = bounds[2 * r];
+                nruns = (nruns + 1) / 2;
+                bounds[nruns] = nmemb;
             }
-            /* at this point Abase contains the sorted array */
-        }
+            char * tmp = from;
+            from = to;
+            to = tmp;
 #pragma omp barrier
-        /* output was written to the tmp rather than desired location, copy it */
-        if((!indirect && Abase[0] != base)
-                || (indirect && Abase[0] != tmp + nmemb * sizeof(void *))) {
-            memmove(Atmp[tid], Abase[tid], Anmemb_old[tid] * p.s);
         }
+        /* output was written to the scratch rather than desired location, copy it */
+        if(from != src)
+            memcpy(src + start * s, from + start * s, (end - start) * s);
+    }
+    ta_free(bounds);
+}
+
+/* Find the bucket of an item: the number of splitters which do not sort after it.
+ * Equal items go to the same bucket.*/
+static int
+_sample_bucket(const char * item, const char * splitters, int nsplit, size_t s, __compar_fn_t compar, int indirect)
+{
+    int lo = 0, hi = nsplit;
+    while(lo < hi) {
+        int mid = (lo + hi) / 2;
+        if(_item_compar(splitters + mid * s, item, compar, indirect) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
+    return lo;
+}
+
+/* Sample sort of src, using dst as scratch: the items are scattered stably into buckets
+ * bounded by splitters drawn from a regular sample, and each bucket is sorted by one thread.
+ * This moves every item only a few times, whereas the merge sort moves it once per round.
+ * It is stable: equal items share a bucket, and the scatter preserves their order.*/
+static void
+_parallel_sample_sort(char * src, char * dst, size_t nmemb, size_t s, __compar_fn_t compar, int indirect)
+{
+    const int Nt = omp_get_max_threads();
+    const int nbucket = 4 * Nt;
+    const int oversample = 32;
+    const int nsample = nbucket * oversample;
 
-    ta_free(Atmp_store);
-    ta_free(Abase_store);
-    ta_free(Anmemb_old);
-    ta_free(Anmemb);
+    /* Regularly spaced sample, sorted; splitters are every oversample-th item*/
+    char * sample = ta_malloc("sample", char, 2 * nsample * s);
+    int i;
+    for(i = 0; i < nsample; i++)
+        memcpy(sample + i * s, src + (i * nmemb / nsample) * s, s);
+    struct msort_param p;
+    p.t = sample + nsample * s;
+    p.s = s;
+    p.var = _msort_var(sample, s, indirect);
+    p.cmp = compar;
+    msort_with_tmp(&p, sample, nsample);
+    for(i = 0; i < nbucket - 1; i++)
+        memmove(sample + i * s, sample + ((i + 1) * oversample - 1) * s, s);
+
+    /* Counts of each chunk in each bucket, then the offsets, by bucket and then chunk*/
+    size_t * offset = ta_malloc("offset", size_t, (size_t) Nt * nbucket + nbucket + 1);
+    size_t * bucketstart = offset + (size_t) Nt * nbucket;
+    memset(offset, 0, sizeof(size_t) * Nt * nbucket);
+    int t;
+#pragma omp parallel for
+    for(t = 0; t < Nt; t++) {
+        size_t j;
+        for(j = t * nmemb / Nt; j < (t + 1) * nmemb / Nt; j++)
+            offset[t * nbucket + _sample_bucket(src + j * s, sample, nbucket - 1, s, compar, indirect)]++;
+    }
+    size_t total = 0;
+    int b;
+    for(b = 0; b < nbucket; b++) {
+        bucketstart[b] = total;
+        for(t = 0; t < Nt; t++) {
+            size_t c = offset[t * nbucket + b];
+            offset[t * nbucket + b] = total;
+            total += c;
+        }
+    }
+    bucketstart[nbucket] = nmemb;
+#pragma omp parallel for
+    for(t = 0; t < Nt; t++) {
+        size_t j;
+        for(j = t * nmemb / Nt; j < (t + 1) * nmemb / Nt; j++) {
+            const int b = _sample_bucket(src + j * s, sample, nbucket - 1, s, compar, indirect);
+            memcpy(dst + (offset[t * nbucket + b]++) * s, src + j * s, s);
+        }
+    }
+
+    /* Sort each bucket in dst, with the same range of src as scratch*/
+    const int var = _msort_var(dst, s, indirect);
+#pragma omp parallel for schedule(dynamic)
+    for(b = 0; b < nbucket; b++) {
+        struct msort_param p;
+        p.t = src + bucketstart[b] * s;
+        p.s = s;
+        p.var = var;
+        p.cmp = compar;
+        msort_with_tmp(&p, dst + bucketstart[b] * s, bucketstart[b + 1] - bucketstart[b]);
+    }
+#pragma omp parallel for
+    for(t = 0; t < Nt; t++) {
+        const size_t start = t * nmemb / Nt, end = (t + 1) * nmemb / Nt;
+        memcpy(src + start * s, dst + start * s, (end - start) * s);
+    }
+    ta_free(offset);
+    ta_free(sample);
+}
+
+void qsort_openmp(void *base, size_t nmemb, size_t size,
+                         int(*compar)(const void *, const void *)) {
+
+    /*Should I use indirect sorting?*/
+    int indirect = 0;
+    if(size > 32)
+        indirect = 1;
+    void * tmp;
+    /*NOTE: if this allocation becomes a problem,
+     * switch to glibc's quicksort (serial!) */
+    if(indirect)
+        tmp = mymalloc("qsort",2*nmemb*sizeof(void *) + size);
+    else
+        tmp = mymalloc("qsort", size * nmemb);
+
+    /* The array being sorted: for large items, the pointers to them, stored after the scratch space*/
+    char * src = base;
+    size_t s = size;
+    if(indirect) {
+        void ** tp = (void **) ((char *) tmp + nmemb * sizeof (void *));
+        size_t i;
+        #pragma omp parallel for
+        for(i = 0; i < nmemb; i++)
+            tp[i] = (char *) base + i * size;
+        src = (char *) tp;
+        s = sizeof(void *);
+    }
+
+    /* The sample sort needs at least as many items as it samples*/
+    const size_t samplemin = (size_t) 4 * omp_get_max_threads() * 32;
+    if(nmemb >= SampleSortMinItems && nmemb >= samplemin && omp_get_max_threads() > 1)
+        _parallel_sample_sort(src, tmp, nmemb, s, compar, indirect);
+    else
+        _parallel_merge_sort(src, tmp, nmemb, s, compar, indirect);
 
     /*Copied from glibc*/
     /* tp[0] .. tp[n - 1] is now sorted, copy around entries of
@@ -6,4 +6,8 @@
 void qsort_openmp(void *base, size_t nmemb, size_t size,
                          int(*compar)(const void *, const void *));
 
+/* Set the smallest array qsort_openmp sorts with a sample sort rather than a merge sort.
+ * Both are stable. Used by the tests.*/
+void qsort_openmp_set_samplesort(size_t min_items);
+
 #endif
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
@@ -351,6 +352,71 @@ int MPI_Alltoallv_smart(void *sendbuf, int *sendcnts, int *sdispls,
     return ret;
 }
 
+/* Tags used by MPI_Alltoall_sparse. Consecutive calls alternate between them:
+ * a rank can only start call k+1 once every rank has entered the barrier of call k,
+ * but a slow rank may still be probing for messages of call k. It cannot see messages of call k+2.*/
+#define SPARSE_TAG 101937
+static int sparse_tag_parity;
+
+int MPI_Alltoall_sparse(const void *sendbuf, void *recvbuf, MPI_Datatype type, MPI_Comm comm)
+{
+    int NTask;
+    MPI_Comm_size(comm, &NTask);
+    ptrdiff_t lb, elsize;
+    MPI_Type_get_extent(type, &lb, &elsize);
+
+    const int tag = SPARSE_TAG + sparse_tag_parity;
+    sparse_tag_parity = !sparse_tag_parity;
+
+    memset(recvbuf, 0, elsize * NTask);
+
+    int target, nsend = 0;
+    for(target = 0; target < NTask; target++) {
+        const char * item = (const char *) sendbuf + elsize * target;
+        ptrdiff_t b;
+        for(b = 0; b < elsize; b++)
+            if(item[b]) break;
+        if(b < elsize)
+            nsend++;
+    }
+
+    MPI_Request * requests = ta_malloc("requests", MPI_Request, nsend + 1);
+    nsend = 0;
+    for(target = 0; target < NTask; target++) {
+        const char * item = (const char *) sendbuf + elsize * target;
+        ptrdiff_t b;
+        for(b = 0; b < elsize; b++)
+            if(item[b]) break;
+        if(b == elsize)
+            continue;
+        /* Synchronous: completes only once the message has been matched by the receiver*/
+        MPI_Issend(item, 1, type, target, tag, comm, &requests[nsend++]);
+    }
+
+    MPI_Request barrier;
+    int inbarrier = 0, done = 0;
+    while(!done) {
+        int flag;
+        MPI_Status status;
+        MPI_Iprobe(MPI_ANY_SOURCE, tag, comm, &flag, &status);
+        if(flag)
+            MPI_Recv((char *) recvbuf + elsize * status.MPI_SOURCE, 1, type, status.MPI_SOURCE, tag, comm, MPI_STATUS_IGNORE);
+        if(inbarrier) {
+            MPI_Test(&barrier, &done, MPI_STATUS_IGNORE);
+        } else {
+            int sent;
+            MPI_Testall(nsend, requests, &sent, MPI_STATUSES_IGNORE);
+            /* All our messages have been received: tell the others we are done sending.*/
+            if(sent) {
+                MPI_Ibarrier(comm, &barrier);
+                inbarrier = 1;
+            }
+        }
+    }
+    ta_free(requests);
+    return MPI_SUCCESS;
+}
+
 int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
         MPI_Datatype sendtype, void *recvbuf, int *recvcnts,
         int *rdispls, MPI_Datatype recvtype, MPI_Comm comm) {
@@ -431,6 +497,393 @@ int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
     return 0;
 }
 
+/* Layout of the ranks of a communicator over the nodes, cached on the communicator as an attribute.*/
+struct NodeLayout {
+    /* Ranks on our node*/
+    MPI_Comm NodeComm;
+    /* Rank 0 of each node, ordered by node. MPI_COMM_NULL on the other ranks.*/
+    MPI_Comm LeaderComm;
+    int NNodes;
+    /* Ranks per node used to build this layout: 0 for shared memory nodes.*/
+    int RanksPerNode;
+    /* Members[NodeFirst[n]] .. Members[NodeFirst[n+1]-1] are the ranks on node n, in node rank order.*/
+    int * NodeFirst;
+    int * Members;
+};
+
+static int NodeLayoutKey = MPI_KEYVAL_INVALID;
+static int HierarchicalSites;
+static int HierarchicalRanksPerNode;
+static int64_t HierarchicalLeaderMemory;
+
+void
+MPIU_Set_hierarchical_alltoallv(int sites)
+{
+    HierarchicalSites = sites;
+}
+
+int
+MPIU_Use_hierarchical_alltoallv(enum AlltoallvSite site)
+{
+    return (HierarchicalSites & site) != 0;
+}
+
+void
+MPIU_Set_hierarchical_node_size(int ranks_per_node)
+{
+    HierarchicalRanksPerNode = ranks_per_node;
+}
+
+void
+MPIU_Set_hierarchical_leader_memory(int64_t bytes)
+{
+    HierarchicalLeaderMemory = bytes;
+}
+
+static void
+node_layout_free(struct NodeLayout * L)
+{
+    MPI_Comm_free(&L->NodeComm);
+    if(L->LeaderComm != MPI_COMM_NULL)
+        MPI_Comm_free(&L->LeaderComm);
+    free(L->Members);
+    free(L->NodeFirst);
+    free(L);
+}
+
+static int
+node_layout_delete(MPI_Comm comm, int keyval, void * attr, void * extra)
+{
+    node_layout_free((struct NodeLayout *) attr);
+    return MPI_SUCCESS;
+}
+
+/* Find (building it on first use) the node layout of a communicator. Collective.*/
+static struct NodeLayout *
+node_layout_get(MPI_Comm comm)
+{
+    #pragma omp critical (_node_layout_key_)
+    {
+        if(NodeLayoutKey == MPI_KEYVAL_INVALID)
+            MPI_Comm_create_keyval(MPI_COMM_NULL_COPY_FN, node_layout_delete, &NodeLayoutKey, NULL);
+    }
+    struct NodeLayout * L;
+    int found;
+    MPI_Comm_get_attr(comm, NodeLayoutKey, &L, &found);
+    if(found && L->RanksPerNode == HierarchicalRanksPerNode)
+        return L;
+    /* The test node size changed: rebuild. */
+    if(found)
+        MPI_Comm_delete_attr(comm, NodeLayoutKey);
+
+    int ThisTask, NTask;
+    MPI_Comm_rank(comm, &ThisTask);
+    MPI_Comm_size(comm, &NTask);
+
+    L = malloc(sizeof(struct NodeLayout));
+    L->RanksPerNode = HierarchicalRanksPerNode;
+    if(L->RanksPerNode > 0)
+        MPI_Comm_split(comm, ThisTask / L->RanksPerNode, ThisTask, &L->NodeComm);
+    else
+        MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, ThisTask, MPI_INFO_NULL, &L->NodeComm);
+
+    int NodeRank;
+    MPI_Comm_rank(L->NodeComm, &NodeRank);
+    MPI_Comm_split(comm, NodeRank == 0 ? 0 : MPI_UNDEFINED, ThisTask, &L->LeaderComm);
+
+    /* Node of this rank: the rank of its leader in LeaderComm */
+    int me[2] = {0, NodeRank};
+    if(L->LeaderComm != MPI_COMM_NULL)
+        MPI_Comm_rank(L->LeaderComm, &me[0]);
+    MPI_Bcast(&me[0], 1, MPI_INT, 0, L->NodeComm);
+
+    int * all = ta_malloc("nodeof", int, 2 * NTask);
+    MPI_Allgather(me, 2, MPI_INT, all, 2, MPI_INT, comm);
+
+    int i;
+    L->NNodes = 0;
+    for(i = 0; i < NTask; i++)
+        if(L->NNodes < all[2 * i] + 1)
+            L->NNodes = all[2 * i] + 1;
+    L->NodeFirst = calloc(L->NNodes + 1, sizeof(int));
+    L->Members = malloc(NTask * sizeof(int));
+    for(i = 0; i < NTask; i++)
+        L->NodeFirst[all[2 * i] + 1]++;
+    for(i = 0; i < L->NNodes; i++)
+        L->NodeFirst[i + 1] += L->NodeFirst[i];
+    for(i = 0; i < NTask; i++)
+        L->Members[L->NodeFirst[all[2 * i]] + all[2 * i + 1]] = i;
+    ta_free(all);
+
+    MPI_Comm_set_attr(comm, NodeLayoutKey, L);
+    return L;
+}
+
+/* Items of a pair count sent in a round: the count is split evenly over the rounds,
+ * so both the sender and the receiver know the split.*/
+static inline int64_t
+round_start(const int64_t count, const int rnd, const int nrounds)
+{
+    return count * rnd / nrounds;
+}
+
+static inline int
+round_count(const int64_t count, const int rnd, const int nrounds)
+{
+    return round_start(count, rnd + 1, nrounds) - round_start(count, rnd, nrounds);
+}
+
+/* Number of rounds so that the leader holds at most its free memory (or HierarchicalLeaderMemory)
+ * for the data of a round, and the item counts and displacements of a node fit in an int. Collective.*/
+static int
+hierarchical_rounds(const struct NodeLayout * L, const int64_t nsend, const int64_t nrecv, const size_t elsize, MPI_Comm comm)
+{
+    int64_t items[2] = {nsend, nrecv}, nodeitems[2];
+    MPI_Allreduce(items, nodeitems, 2, MPI_INT64, MPI_SUM, L->NodeComm);
+
+    int64_t budget = HierarchicalLeaderMemory;
+    if(budget == 0)
+        budget = mymalloc_freebytes() / 2;
+    MPI_Bcast(&budget, 1, MPI_INT64, 0, L->NodeComm);
+    if(budget < 1)
+        budget = 1;
+
+    /* The leader keeps two copies of the data sent and received by its node in a round*/
+    const int64_t leaderbytes = 2 * (nodeitems[0] + nodeitems[1]) * elsize;
+    int64_t nrounds = (leaderbytes + budget - 1) / budget;
+    /* Leave room for the rounding of each pair count*/
+    const int64_t maxitems = INT_MAX / 2;
+    const int64_t nodemax = nodeitems[0] > nodeitems[1] ? nodeitems[0] : nodeitems[1];
+    if(nrounds < (nodemax + maxitems - 1) / maxitems)
+        nrounds = (nodemax + maxitems - 1) / maxitems;
+    if(nrounds < 1)
+        nrounds = 1;
+    MPI_Allreduce(MPI_IN_PLACE, &nrounds, 1, MPI_INT64, MPI_MAX, comm);
+    if(nrounds > INT_MAX)
+        endrun(1, "Hierarchical alltoallv of %ld items per node needs %ld rounds with %ld bytes on the leader\n", nodemax, nrounds, budget);
+    return nrounds;
+}
+
+/* One round of MPI_Alltoallv_hierarchical. packed holds the nsend items for this round ordered by destination rank,
+ * sendcnts[r] of them for rank r. Fills mine with the nrecv items received, ordered by source node, then source rank on that node.*/
+static void
+hierarchical_round(const struct NodeLayout * L, MPI_Datatype item, const size_t elsize,
+        char * packed, int * sendcnts, int nsend, char * mine, int nrecv, const int NTask)
+{
+    int NodeSize;
+    MPI_Comm_size(L->NodeComm, &NodeSize);
+    const int leader = L->LeaderComm != MPI_COMM_NULL;
+
+    int i, r, s;
+    char * ptr;
+
+    /* The leader collects the data and the counts of its node: nodecounts[s * NTask + r] is sent from s to r.*/
+    int * nodecounts = NULL, * gathercounts = NULL, * gatherdispls = NULL;
+    char * gathered = NULL;
+    if(leader) {
+        nodecounts = mymalloc2("HierNodeCounts", sizeof(int) * NodeSize * NTask);
+        gathercounts = ta_malloc("gathercounts", int, NodeSize);
+        gatherdispls = ta_malloc("gatherdispls", int, NodeSize);
+    }
+    MPI_Gather(sendcnts, NTask, MPI_INT, nodecounts, NTask, MPI_INT, 0, L->NodeComm);
+
+    /* Fits in an int: the rounds are sized so that every node total does.*/
+    int ngathered = 0;
+    if(leader) {
+        for(s = 0; s < NodeSize; s++) {
+            gatherdispls[s] = ngathered;
+            gathercounts[s] = 0;
+            for(r = 0; r < NTask; r++)
+                gathercounts[s] += nodecounts[s * NTask + r];
+            ngathered += gathercounts[s];
+        }
+        gathered = mymalloc2("HierGathered", (size_t) ngathered * elsize + 1);
+    }
+    MPI_Gatherv(packed, nsend, item, gathered, gathercounts, gatherdispls, item, 0, L->NodeComm);
+
+    if(leader) {
+        const int NNodes = L->NNodes;
+        int * cntsendcounts = ta_malloc("cntsendcounts", int, 6 * NNodes);
+        int * cntsenddispls = cntsendcounts + NNodes;
+        int * cntrecvcounts = cntsendcounts + 2 * NNodes;
+        int * cntrecvdispls = cntsendcounts + 3 * NNodes;
+        int * datasendcounts = cntsendcounts + 4 * NNodes;
+        int * datarecvcounts = cntsendcounts + 5 * NNodes;
+        int * datasenddispls = ta_malloc("datasenddispls", int, 2 * NNodes);
+        int * datarecvdispls = datasenddispls + NNodes;
+        int64_t * colbase = ta_malloc("colbase", int64_t, NTask);
+
+        /* Counts for node D, ordered by destination rank in D, then source rank on this node.
+         * The counts from node S are ordered by destination rank here, then source rank in S.*/
+        int * cntsend = mymalloc2("HierCntSend", sizeof(int) * NodeSize * NTask);
+        int * cntrecv = mymalloc2("HierCntRecv", sizeof(int) * NodeSize * NTask);
+        int ndatasend = 0;
+        int d;
+        for(d = 0; d < NNodes; d++) {
+            const int dsize = L->NodeFirst[d + 1] - L->NodeFirst[d];
+            cntsendcounts[d] = NodeSize * dsize;
+            cntsenddispls[d] = NodeSize * L->NodeFirst[d];
+            cntrecvcounts[d] = NodeSize * dsize;
+            cntrecvdispls[d] = NodeSize * L->NodeFirst[d];
+            datasenddispls[d] = ndatasend;
+            datasendcounts[d] = 0;
+            for(i = L->NodeFirst[d]; i < L->NodeFirst[d + 1]; i++) {
+                r = L->Members[i];
+                colbase[r] = ndatasend;
+                for(s = 0; s < NodeSize; s++) {
+                    const int n = nodecounts[s * NTask + r];
+                    cntsend[NodeSize * i + s] = n;
+                    datasendcounts[d] += n;
+                    ndatasend += n;
+                }
+            }
+        }
+        MPI_Alltoallv(cntsend, cntsendcounts, cntsenddispls, MPI_INT,
+                      cntrecv, cntrecvcounts, cntrecvdispls, MPI_INT, L->LeaderComm);
+
+        /* Reorder the gathered data by destination node and rank*/
+        char * datasend = mymalloc2("HierDataSend", (size_t) ndatasend * elsize + 1);
+        ptr = gathered;
+        for(s = 0; s < NodeSize; s++) {
+            for(r = 0; r < NTask; r++) {
+                const int n = nodecounts[s * NTask + r];
+                memcpy(datasend + colbase[r] * elsize, ptr, n * elsize);
+                colbase[r] += n;
+                ptr += n * elsize;
+            }
+        }
+
+        int ndatarecv = 0;
+        for(d = 0; d < NNodes; d++) {
+            datarecvdispls[d] = ndatarecv;
+            datarecvcounts[d] = 0;
+            for(i = 0; i < cntrecvcounts[d]; i++)
+                datarecvcounts[d] += cntrecv[cntrecvdispls[d] + i];
+            ndatarecv += datarecvcounts[d];
+        }
+        char * datarecv = mymalloc2("HierDataRecv", (size_t) ndatarecv * elsize + 1);
+        MPI_Alltoallv(datasend, datasendcounts, datasenddispls, item,
+                      datarecv, datarecvcounts, datarecvdispls, item, L->LeaderComm);
+
+        /* Regroup by destination rank on this node: for each rank, the data from each node in turn.
+         * In the chunk from node S, the data for local rank r starts after that for the lower ranks.*/
+        char * scattered = mymalloc2("HierScattered", (size_t) ndatarecv * elsize + 1);
+        int * scattercounts = ta_malloc("scattercounts", int, 2 * NodeSize);
+        int * scatterdispls = scattercounts + NodeSize;
+        int64_t * chunkpos = ta_malloc("chunkpos", int64_t, NNodes);
+        for(d = 0; d < NNodes; d++)
+            chunkpos[d] = datarecvdispls[d];
+        int nscattered = 0;
+        for(r = 0; r < NodeSize; r++) {
+            scatterdispls[r] = nscattered;
+            for(d = 0; d < NNodes; d++) {
+                const int ssize = L->NodeFirst[d + 1] - L->NodeFirst[d];
+                int n = 0;
+                for(s = 0; s < ssize; s++)
+                    n += cntrecv[cntrecvdispls[d] + r * ssize + s];
+                memcpy(scattered + (size_t) nscattered * elsize, datarecv + chunkpos[d] * elsize, n * elsize);
+                chunkpos[d] += n;
+                nscattered += n;
+            }
+            scattercounts[r] = nscattered - scatterdispls[r];
+        }
+        ta_free(chunkpos);
+        /* Can't free datarecv and friends yet: the stack is LIFO. */
+        MPI_Scatterv(scattered, scattercounts, scatterdispls, item, mine, nrecv, item, 0, L->NodeComm);
+
+        ta_free(scattercounts);
+        myfree(scattered);
+        myfree(datarecv);
+        myfree(datasend);
+        myfree(cntrecv);
+        myfree(cntsend);
+        ta_free(colbase);
+        ta_free(datasenddispls);
+        ta_free(cntsendcounts);
+        myfree(gathered);
+        ta_free(gatherdispls);
+        ta_free(gathercounts);
+        myfree(nodecounts);
+    } else {
+        MPI_Scatterv(NULL, NULL, NULL, item, mine, nrecv, item, 0, L->NodeComm);
+    }
+}
+
+int MPI_Alltoallv_hierarchical(void *sendbuf, int *sendcnts, int *sdispls,
+        MPI_Datatype sendtype, void *recvbuf, int *recvcnts,
+        int *rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+    const struct NodeLayout * L = node_layout_get(comm);
+
+    int NTask;
+    MPI_Comm_size(comm, &NTask);
+
+    ptrdiff_t lb, elsize, recv_elsize;
+    int size, recv_size;
+    MPI_Type_get_extent(sendtype, &lb, &elsize);
+    MPI_Type_get_extent(recvtype, &lb, &recv_elsize);
+    MPI_Type_size(sendtype, &size);
+    MPI_Type_size(recvtype, &recv_size);
+
+    /* Nothing to aggregate. The layout is the same on all ranks, so this is collective.*/
+    if(L->NNodes == 1 || L->NNodes == NTask)
+        return MPI_Alltoallv_sparse(sendbuf, sendcnts, sdispls, sendtype, recvbuf, recvcnts, rdispls, recvtype, comm);
+
+    if(size != elsize || recv_size != recv_elsize || elsize != recv_elsize)
+        endrun(1, "MPI_Alltoallv_hierarchical needs identical contiguous types: size %d extent %td, recv size %d extent %td\n",
+            size, elsize, recv_size, recv_elsize);
+
+    MPI_Datatype item;
+    MPI_Type_contiguous(elsize, MPI_BYTE, &item);
+    MPI_Type_commit(&item);
+
+    int i, r, s;
+    int64_t nsend = 0, nrecv = 0;
+    for(r = 0; r < NTask; r++) {
+        nsend += sendcnts[r];
+        nrecv += recvcnts[r];
+    }
+
+    /* The data is sent in rounds, each carrying a share of every pair count.*/
+    const int nrounds = hierarchical_rounds(L, nsend, nrecv, elsize, comm);
+    int * roundsend = ta_malloc("roundcnts", int, 2 * NTask);
+    int * roundrecv = roundsend + NTask;
+    int rnd;
+    for(rnd = 0; rnd < nrounds; rnd++) {
+        int rsend = 0, rrecv = 0;
+        for(r = 0; r < NTask; r++) {
+            roundsend[r] = round_count(sendcnts[r], rnd, nrounds);
+            roundrecv[r] = round_count(recvcnts[r], rnd, nrounds);
+            rsend += roundsend[r];
+            rrecv += roundrecv[r];
+        }
+
+        /* Pack our data in order of destination rank*/
+        char * packed = mymalloc2("HierPacked", (size_t) rsend * elsize + 1);
+        char * ptr = packed;
+        for(r = 0; r < NTask; r++) {
+            memcpy(ptr, (char *) sendbuf + (sdispls[r] + round_start(sendcnts[r], rnd, nrounds)) * elsize, roundsend[r] * elsize);
+            ptr += roundsend[r] * elsize;
+        }
+        char * mine = mymalloc2("HierRecv", (size_t) rrecv * elsize + 1);
+
+        hierarchical_round(L, item, elsize, packed, roundsend, rsend, mine, rrecv, NTask);
+
+        /* Our data arrives ordered by source node, then source rank on that node*/
+        ptr = mine;
+        for(i = 0; i < NTask; i++) {
+            s = L->Members[i];
+            memcpy((char *) recvbuf + (rdispls[s] + round_start(recvcnts[s], rnd, nrounds)) * elsize, ptr, roundrecv[s] * elsize);
+            ptr += roundrecv[s] * elsize;
+        }
+        myfree(mine);
+        myfree(packed);
+    }
+    ta_free(roundsend);
+    MPI_Type_free(&item);
+    return 0;
+}
+
 /* return the number of hosts */
 int
 cluster_get_num_hosts(void)
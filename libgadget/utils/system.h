@@ -59,6 +59,41 @@ int MPI_Alltoallv_sparse(void *sendbuf, int *sendcnts, int *sdispls,
         MPI_Datatype sendtype, void *recvbuf, int *recvcnts,
         int *rdispls, MPI_Datatype recvtype, MPI_Comm comm);
 
+/* Like MPI_Alltoall with one item of type per rank, but only the non-zero items are sent.
+ * Partners are discovered with a non-blocking consensus (synchronous sends plus MPI_Ibarrier),
+ * so the communication scales with the number of ranks we actually talk to, not with NTask.
+ * Items which are not received are zeroed. Collective.*/
+int MPI_Alltoall_sparse(const void *sendbuf, void *recvbuf, MPI_Datatype type, MPI_Comm comm);
+
+/* Same arguments as MPI_Alltoallv, but aggregates messages per shared memory node:
+ * each rank's data is gathered on its node leader, the leaders exchange one message per
+ * pair of nodes, and the data is scattered to the destination ranks on the node.
+ * The data is sent in as many rounds as needed for a round to fit in half the free memory
+ * of the leaders, with the counts of a node below INT_MAX.
+ * The datatypes must be contiguous. Falls back to MPI_Alltoallv_sparse if there is only
+ * one node or one rank per node. Collective.*/
+int MPI_Alltoallv_hierarchical(void *sendbuf, int *sendcnts, int *sdispls,
+        MPI_Datatype sendtype, void *recvbuf, int *recvcnts,
+        int *rdispls, MPI_Datatype recvtype, MPI_Comm comm);
+
+/* Call sites which may use MPI_Alltoallv_hierarchical. Flags to MPIU_Set_hierarchical_alltoallv.*/
+enum AlltoallvSite {
+    ALLTOALLV_PM = 1, /* Pencil and cell exchanges of the PM */
+    ALLTOALLV_EXCHANGE = 2, /* Particle exchange of the domain */
+    ALLTOALLV_TREEWALK = 4, /* Treewalk export and import */
+};
+
+/* Select the call sites which use MPI_Alltoallv_hierarchical.*/
+void MPIU_Set_hierarchical_alltoallv(int sites);
+/* True if the call site should use MPI_Alltoallv_hierarchical.*/
+int MPIU_Use_hierarchical_alltoallv(enum AlltoallvSite site);
+/* Group consecutive ranks into nodes of this size in MPI_Alltoallv_hierarchical,
+ * rather than by shared memory. 0 restores the default. For tests.*/
+void MPIU_Set_hierarchical_node_size(int ranks_per_node);
+/* Bytes a node leader may use for the data of each round of MPI_Alltoallv_hierarchical,
+ * rather than half of its free memory. 0 restores the default. For tests.*/
+void MPIU_Set_hierarchical_leader_memory(int64_t bytes);
+
 double timediff(double t0, double t1);
 double second(void);
 size_t sizemax(size_t a, size_t b);
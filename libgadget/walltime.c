@@ -2,13 +2,25 @@
 #include <mpi.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <omp.h>
 #include "walltime.h"
 
 #include "utils.h"
 
+#ifdef PERF_COUNTERS
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
 static struct ClockTable * CT = NULL;
 
+/* Each thread measures from its own last call, so that a thread
+ * working concurrently with the main thread (eg, the PM force while the
+ * tree walk runs) can keep its own clocks.*/
 static double WallTimeClock;
+#pragma omp threadprivate(WallTimeClock)
 static double LastReportTime;
 
 static void walltime_clock_insert(char * name);
@@ -16,11 +28,151 @@ static void walltime_summary_clocks(struct Clock * C, int N, int root, MPI_Comm
 static void walltime_update_parents();
 static double seconds();
 
+/* One interval in the trace ring buffer. The name is an index into the interned names,
+ * as clock indices move when new clocks are inserted.*/
+struct TraceEvent {
+    double tstart;
+    double tend;
+    int name;
+    int thread;
+};
+
+static struct {
+    FILE * fd;
+    struct TraceEvent * events;
+    int64_t nevents;
+    /* Total events recorded and total events written: the ring holds the last nevents.*/
+    int64_t head;
+    int64_t tail;
+    /* Time origin: ranks take it after a barrier, so timelines line up across ranks*/
+    double origin;
+    int ThisTask;
+    int Nnames;
+    char names[512][128];
+} Trace;
+
+#ifdef PERF_COUNTERS
+static const char * CounterNames[WALLTIME_NCOUNTERS] = {"cycles", "instructions", "llc-misses", "branch-misses"};
+static const uint64_t CounterConfig[WALLTIME_NCOUNTERS] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+
+/* One perf event group per OpenMP thread, led by the cycle counter,
+ * so that a single read returns all the counters of a thread.
+ * Threads of nested parallel regions (the PM overlap) are not counted.*/
+static struct {
+    int NThread;
+    int * fd;
+    /* Position of each counter in the group, -1 if the kernel or CPU does not provide it*/
+    int pos[WALLTIME_NCOUNTERS];
+    int ngroup;
+    /* Counts at the end of the last measured interval*/
+    double last[WALLTIME_NCOUNTERS];
+} Counters;
+
+static int
+walltime_counter_open(int counter, pid_t tid, int group_fd)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = CounterConfig[counter];
+    /* Allowed with the default perf_event_paranoid*/
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, 0);
+}
+
+/* Sum the counters over all threads of this rank*/
+static void
+walltime_counters_read(double * counts)
+{
+    uint64_t buf[1 + WALLTIME_NCOUNTERS];
+    int t, c;
+    for(c = 0; c < WALLTIME_NCOUNTERS; c++)
+        counts[c] = 0;
+    for(t = 0; t < Counters.NThread; t++) {
+        if(read(Counters.fd[t], buf, sizeof(buf)) < (ssize_t) sizeof(uint64_t) * (1 + Counters.ngroup))
+            continue;
+        for(c = 0; c < WALLTIME_NCOUNTERS; c++)
+            if(Counters.pos[c] >= 0)
+                counts[c] += buf[1 + Counters.pos[c]];
+    }
+}
+
+static void
+walltime_counters_init(void)
+{
+    int t, c;
+    Counters.NThread = 0;
+    Counters.ngroup = 0;
+    /* Counters are per thread, so find the kernel thread ids of the OpenMP threads*/
+    const int NThread = omp_get_max_threads();
+    pid_t * tids = calloc(NThread, sizeof(pid_t));
+    #pragma omp parallel
+    tids[omp_get_thread_num()] = syscall(SYS_gettid);
+
+    Counters.fd = malloc(NThread * sizeof(int));
+    for(t = 0; t < NThread; t++) {
+        int ngroup = 0;
+        int leader = walltime_counter_open(0, tids[t], -1);
+        if(leader < 0)
+            break;
+        Counters.fd[t] = leader;
+        Counters.pos[0] = ngroup++;
+        for(c = 1; c < WALLTIME_NCOUNTERS; c++) {
+            /* The available counters are the ones on the first thread*/
+            if(t > 0 && Counters.pos[c] < 0)
+                continue;
+            int fd = walltime_counter_open(c, tids[t], leader);
+            if(fd < 0 && t > 0)
+                break;
+            Counters.pos[c] = fd < 0 ? -1 : ngroup++;
+        }
+        if(c < WALLTIME_NCOUNTERS)
+            break;
+        Counters.ngroup = ngroup;
+        Counters.NThread++;
+    }
+    free(tids);
+    if(Counters.NThread < NThread) {
+        message(0, "Hardware counters not available on %d of %d threads (check perf_event_paranoid): not recorded.\n", NThread - Counters.NThread, NThread);
+        /* The file descriptors of partly opened threads are left to close at exit*/
+        Counters.NThread = 0;
+        return;
+    }
+    for(c = 0; c < WALLTIME_NCOUNTERS; c++)
+        if(Counters.pos[c] < 0)
+            message(0, "Hardware counter %s is not available.\n", CounterNames[c]);
+    walltime_counters_read(Counters.last);
+}
+
+/* Add the counts since the last measurement to a clock. The counters cover all threads,
+ * so intervals measured inside a parallel region are skipped and their counts go to the next interval.*/
+static void
+walltime_counters_measure(struct Clock * clock)
+{
+    if(Counters.NThread == 0 || omp_in_parallel())
+        return;
+    double now[WALLTIME_NCOUNTERS];
+    int c;
+    walltime_counters_read(now);
+    for(c = 0; c < WALLTIME_NCOUNTERS; c++) {
+        if(clock)
+            clock->counts[c] += now[c] - Counters.last[c];
+        Counters.last[c] = now[c];
+    }
+}
+#endif
+
 void walltime_init(struct ClockTable * ct) {
     CT = ct;
     CT->Nmax = 512;
     CT->N = 0;
     CT->ElapsedTime = 0;
+#ifdef PERF_COUNTERS
+    walltime_counters_init();
+#endif
     walltime_reset();
     walltime_clock_insert("/");
     LastReportTime = seconds();
@@ -48,6 +200,23 @@ static void walltime_summary_clocks(struct Clock * C, int N, int root, MPI_Comm
         C[i].mean = sum[i] / NTask;
     }
     ta_free(t);
+#ifdef PERF_COUNTERS
+    /* The counters of each clock are contiguous, so reduce them all at once*/
+    double * c = ta_malloc("counters", double, WALLTIME_NCOUNTERS * N);
+    for(i = 0; i < N; i ++)
+        memcpy(c + i * WALLTIME_NCOUNTERS, C[i].counts, sizeof(C[i].counts));
+    double * csum = ta_malloc("countsum", double, WALLTIME_NCOUNTERS * N);
+    double * cmax = ta_malloc("countmax", double, WALLTIME_NCOUNTERS * N);
+    MPI_Reduce(c, csum, WALLTIME_NCOUNTERS * N, MPI_DOUBLE, MPI_SUM, root, comm);
+    MPI_Reduce(c, cmax, WALLTIME_NCOUNTERS * N, MPI_DOUBLE, MPI_MAX, root, comm);
+    for(i = 0; i < N; i ++) {
+        memcpy(C[i].countsum, csum + i * WALLTIME_NCOUNTERS, sizeof(C[i].countsum));
+        memcpy(C[i].countmax, cmax + i * WALLTIME_NCOUNTERS, sizeof(C[i].countmax));
+    }
+    ta_free(cmax);
+    ta_free(csum);
+    ta_free(c);
+#endif
 }
 
 /* put min max mean of MPI ranks to rank 0*/
@@ -58,6 +227,11 @@ void walltime_summary(int root, MPI_Comm comm) {
     /* add to the cumulative time */
     for(i = 0; i < CT->N; i ++) {
         CT->AC[i].time += CT->C[i].time;
+#ifdef PERF_COUNTERS
+        int c;
+        for(c = 0; c < WALLTIME_NCOUNTERS; c++)
+            CT->AC[i].counts[c] += CT->C[i].counts[c];
+#endif
     }
     walltime_summary_clocks(CT->C, CT->N, root, comm);
     walltime_summary_clocks(CT->AC, CT->N, root, comm);
@@ -65,6 +239,9 @@ void walltime_summary(int root, MPI_Comm comm) {
     /* clear .time for next step */
     for(i = 0; i < CT->N; i ++) {
         CT->C[i].time = 0;
+#ifdef PERF_COUNTERS
+        memset(CT->C[i].counts, 0, sizeof(CT->C[i].counts));
+#endif
     }
     MPI_Barrier(comm);
     /* wo do this here because all processes are sync after summary_clocks*/
@@ -160,9 +337,17 @@ static void walltime_update_parents() {
         char * prefix = CT->C[i].name;
         int l = strlen(prefix);
         double t = 0;
+#ifdef PERF_COUNTERS
+        double counts[WALLTIME_NCOUNTERS] = {0};
+        int c;
+#endif
         for(j = i + 1; j < CT->N; j++) {
             if(0 == strncmp(prefix, CT->C[j].name, l)) {
                 t += CT->C[j].time;
+#ifdef PERF_COUNTERS
+                for(c = 0; c < WALLTIME_NCOUNTERS; c++)
+                    counts[c] += CT->C[j].counts[c];
+#endif
                 CT->Nchildren[i] ++;
             } else {
                 break;
@@ -170,25 +355,46 @@ static void walltime_update_parents() {
         }
         /* update only if there are children */
         if (t > 0) CT->C[i].time = t;
+#ifdef PERF_COUNTERS
+        if(CT->Nchildren[i] > 0)
+            memcpy(CT->C[i].counts, counts, sizeof(counts));
+#endif
     }
 }
 
 void walltime_reset() {
     WallTimeClock = seconds();
+#ifdef PERF_COUNTERS
+    walltime_counters_measure(NULL);
+#endif
 }
 
 double walltime_add_internal(char * name, double dt) {
-    int id = walltime_clock(name);
-    CT->C[id].time += dt;
+    #pragma omp critical (_walltime_)
+    {
+        int id = walltime_clock(name);
+        CT->C[id].time += dt;
+    }
     return dt;
 }
 double walltime_measure_internal(char * name) {
     double t = seconds();
     double dt = t - WallTimeClock;
+    if(name[0] != '.')
+        walltime_trace_event(name, WallTimeClock, t);
     WallTimeClock = seconds();
     if(name[0] != '.') {
-        int id = walltime_clock(name);
-        CT->C[id].time += dt;
+        #pragma omp critical (_walltime_)
+        {
+            int id = walltime_clock(name);
+            CT->C[id].time += dt;
+#ifdef PERF_COUNTERS
+            walltime_counters_measure(&CT->C[id]);
+#endif
+        }
+        /* Attribute the memory high-water mark of this interval to the clock.
+         * A thread with a private arena (the PM thread of an overlapped force) leaves the A_MAIN profile alone.*/
+        allocator_profile_phase(MainAllocator, name);
     }
     return dt;
 }
@@ -217,6 +423,95 @@ static double seconds(void)
 {
   return MPI_Wtime();
 }
+int walltime_trace_enabled(void)
+{
+    return Trace.events != NULL;
+}
+
+void walltime_trace_init(FILE * fd, int nevents)
+{
+    Trace.fd = NULL;
+    Trace.events = NULL;
+    Trace.head = Trace.tail = 0;
+    Trace.Nnames = 0;
+    MPI_Comm_rank(MPI_COMM_WORLD, &Trace.ThisTask);
+    MPI_Barrier(MPI_COMM_WORLD);
+    Trace.origin = seconds();
+    if(nevents <= 0 || !fd)
+        return;
+    Trace.fd = fd;
+    Trace.nevents = nevents;
+    /* Lives for the whole run, so it is kept out of the stack allocators*/
+    Trace.events = malloc(sizeof(struct TraceEvent) * nevents);
+    if(!Trace.events)
+        endrun(1, "Could not allocate %d trace events\n", nevents);
+    /* Chrome trace 'JSON array' format: the closing bracket is optional,
+     * so events can be appended as the run goes. A file reopened by a later
+     * run already has the opening bracket.*/
+    fseek(Trace.fd, 0, SEEK_END);
+    if(ftell(Trace.fd) == 0)
+        fprintf(Trace.fd, "[\n");
+}
+
+void walltime_trace_free(void)
+{
+    free(Trace.events);
+    Trace.events = NULL;
+    Trace.fd = NULL;
+}
+
+static int
+walltime_trace_name(const char * name)
+{
+    int i;
+    for(i = 0; i < Trace.Nnames; i++)
+        if(0 == strcmp(Trace.names[i], name))
+            return i;
+    /* Too many names: the remaining ones share the last slot*/
+    if(Trace.Nnames == 512)
+        return 511;
+    strncpy(Trace.names[Trace.Nnames], name, sizeof(Trace.names[0]) - 1);
+    return Trace.Nnames++;
+}
+
+void walltime_trace_event(const char * name, double tstart, double tend)
+{
+    if(!Trace.events)
+        return;
+    int64_t slot;
+    int id;
+    #pragma omp critical (_walltime_trace_)
+    {
+        id = walltime_trace_name(name);
+        slot = Trace.head++;
+    }
+    struct TraceEvent * ev = &Trace.events[slot % Trace.nevents];
+    ev->tstart = tstart;
+    ev->tend = tend;
+    ev->name = id;
+    ev->thread = omp_get_thread_num();
+}
+
+/* Write the events since the last flush. Events that were overwritten
+ * because the ring filled up are reported as a count.
+ * Must be called outside of parallel regions.*/
+void walltime_trace_flush(int step)
+{
+    if(!Trace.events)
+        return;
+    if(Trace.head - Trace.tail > Trace.nevents) {
+        fprintf(Trace.fd, "{\"name\": \"dropped\", \"ph\": \"i\", \"s\": \"p\", \"ts\": %.3f, \"pid\": %d, \"tid\": 0, \"args\": {\"step\": %d, \"events\": %ld}},\n",
+            (seconds() - Trace.origin) * 1e6, Trace.ThisTask, step, (long) (Trace.head - Trace.tail - Trace.nevents));
+        Trace.tail = Trace.head - Trace.nevents;
+    }
+    for(; Trace.tail < Trace.head; Trace.tail++) {
+        const struct TraceEvent * ev = &Trace.events[Trace.tail % Trace.nevents];
+        fprintf(Trace.fd, "{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, \"args\": {\"step\": %d}},\n",
+            Trace.names[ev->name], (ev->tstart - Trace.origin) * 1e6, (ev->tend - ev->tstart) * 1e6, Trace.ThisTask, ev->thread, step);
+    }
+    fflush(Trace.fd);
+}
+
 void walltime_report(FILE * fp, int root, MPI_Comm comm) {
     int rank;
     MPI_Comm_rank(comm, &rank);
@@ -247,6 +542,44 @@ void walltime_report(FILE * fp, int root, MPI_Comm comm) {
                 );
     }
 }
+#ifdef PERF_COUNTERS
+void walltime_report_counters(FILE * fp, int root, MPI_Comm comm) {
+    int rank, NTask;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &NTask);
+    if(rank != root) return;
+    int i;
+    for(i = 0; i < CT->N; i ++) {
+        char * name = CT->C[i].name;
+        int level = 0;
+        char * p = name;
+        while(*p) {
+            if(*p == '/') {
+                level ++;
+                name = p + 1;
+            }
+            p++;
+        }
+        /* if there is just one child, don't print it*/
+        if(CT->Nchildren[i] == 1) continue;
+        const double * sum = CT->C[i].countsum;
+        const double * asum = CT->AC[i].countsum;
+        /* Cycles: total and this step, summed over ranks, and the imbalance of this step.
+         * Then instructions per cycle, and cache and branch misses per thousand instructions, for this step.*/
+        fprintf(fp, "%*s%-26s  %10.4g %10.4g %6.2f  %6.3f %8.3f %8.3f\n",
+                level, "",  /* indents */
+                name,   /* just the last seg of name*/
+                asum[0] / 1e9,
+                sum[0] / 1e9,
+                sum[0] > 0 ? CT->C[i].countmax[0] * NTask / sum[0] : 0,
+                sum[0] > 0 ? sum[1] / sum[0] : 0,
+                sum[1] > 0 ? 1000 * sum[2] / sum[1] : 0,
+                sum[1] > 0 ? 1000 * sum[3] / sum[1] : 0
+                );
+    }
+}
+#endif
+
 #if 0
 #define HELLO atom(&atomtable, "Hello")
 #define WORLD atom(&atomtable, "WORLD")
@@ -36,6 +36,14 @@ double walltime_get(char * name, enum clocktype type);
 void walltime_summary(int root, MPI_Comm comm);
 void walltime_report(FILE * fd, int root, MPI_Comm comm);
 
+#ifdef PERF_COUNTERS
+/* Hardware counters (cycles, instructions, last level cache misses, branch misses)
+ * summed over the threads of this rank, attributed to the same clocks as the times.*/
+#define WALLTIME_NCOUNTERS 4
+/* Print the counters of each clock, summed over ranks, in the same layout as walltime_report*/
+void walltime_report_counters(FILE * fd, int root, MPI_Comm comm);
+#endif
+
 struct Clock {
     char name[128];
     double time;
@@ -43,6 +51,12 @@ struct Clock {
     double min;
     double mean;
     char symbol;
+#ifdef PERF_COUNTERS
+    /* Counts on this rank, and the sum and maximum over ranks (good only on root)*/
+    double counts[WALLTIME_NCOUNTERS];
+    double countsum[WALLTIME_NCOUNTERS];
+    double countmax[WALLTIME_NCOUNTERS];
+#endif
 };
 
 struct ClockTable {
@@ -58,4 +72,16 @@ struct ClockTable {
     double PMStepTime;
 };
 void walltime_init(struct ClockTable * table);
+
+/* Optional timeline trace: records the begin and end of every measured interval
+ * on this rank in a ring buffer of nevents entries. walltime_trace_flush appends
+ * the buffered events to fd as Chrome trace events (one JSON object per line),
+ * tagged with the step number. Collective, as it synchronises the time origin.
+ * nevents == 0 or fd == NULL disables tracing.*/
+void walltime_trace_init(FILE * fd, int nevents);
+void walltime_trace_flush(int step);
+void walltime_trace_free(void);
+/* Record an interval timed by the caller on the calling thread, eg, the per-thread treewalk phases.*/
+void walltime_trace_event(const char * name, double tstart, double tend);
+int walltime_trace_enabled(void);
 #endif
@@ -13,6 +13,16 @@ struct ic_part_data
   float Mass;
 };
 
+/* Parameters of the glass relaxation */
+struct glass_params {
+    /* Add a short-range tree force to a smoothed PM force, rather than using the PM force alone */
+    int UseTree;
+    /* Stop once the glass power spectrum changes by less than this fraction in a step. 0 always runs MaxSteps steps. */
+    double PowerTol;
+    /* Maximum number of steps */
+    int MaxSteps;
+};
+
 struct genic_config {
     int Ngrid, NgridGas, NGridNu;
     int Nmesh;
@@ -26,6 +36,7 @@ struct genic_config {
     double WDM_therm_mass;
     int MakeGlassGas;
     int MakeGlassCDM;
+    struct glass_params GlassP;
     int  NumFiles;
     int  NumWriters;
     /* Whether to save the pre-displacement positions to the snapshot*/
@@ -38,6 +49,10 @@ struct genic_config {
     char InitCondFile[100];
     double TimeIC;
     int UsePeculiarVelocity;
+    /* Add second order (2LPT) displacements and velocities*/
+    int TwoLPT;
+    /* Number of slabs the particles of each grid are made and written in*/
+    int NumSlabs;
 };
 
 #endif
@@ -14,6 +14,12 @@
 #include <libgadget/utils.h>
 #include <libgadget/powerspectrum.h>
 #include <libgadget/gravity.h>
+#include <libgadget/partmanager.h>
+#include <libgadget/slotsmanager.h>
+#include <libgadget/domain.h>
+#include <libgadget/exchange.h>
+#include <libgadget/forcetree.h>
+#include <libgadget/timestep.h>
 
 static void potential_transfer(PetaPM *pm, int64_t k2, int kpos[3], pfft_complex * value);
 static void force_x_transfer(PetaPM *pm, int64_t k2, int kpos[3], pfft_complex * value);
@@ -36,9 +42,11 @@ static PetaPMRegion * _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void
 
 static void glass_force(PetaPM * pm, double t_f, struct ic_part_data * ICP, const int NumPart);
 static void glass_stats(struct ic_part_data * ICP, int NumPart);
+static int glass_converged(Power * ps, const int64_t TotNumPart, double * lastpower, const struct glass_params GlassP, const int step);
+static void glass_evolve_tree(PetaPM * pm, const struct glass_params GlassP, char * pkoutname, struct ic_part_data * ICP, const int NumPart, const double UnitLength_in_cm, const char * OutputDir);
 
 int
-setup_glass(IDGenerator * idgen, PetaPM * pm, double shift, int seed, double mass, struct ic_part_data * ICP, const double UnitLength_in_cm, const char * OutputDir)
+setup_glass(IDGenerator * idgen, PetaPM * pm, double shift, int seed, double mass, struct ic_part_data * ICP, const struct glass_params GlassP, const double UnitLength_in_cm, const char * OutputDir)
 {
     gsl_rng * rng = gsl_rng_alloc(gsl_rng_ranlxd1);
     int ThisTask;
@@ -64,19 +72,26 @@ setup_glass(IDGenerator * idgen, PetaPM * pm, double shift, int seed, double mas
     gsl_rng_free(rng);
 
     char * fn = fastpm_strdup_printf("powerspectrum-glass-%08X", seed);
-    glass_evolve(pm, 14, fn, ICP, idgen->NumPart, UnitLength_in_cm, OutputDir);
+    glass_evolve(pm, GlassP, fn, ICP, idgen->NumPart, UnitLength_in_cm, OutputDir);
     myfree(fn);
 
     return idgen->NumPart;
 }
 
-void glass_evolve(PetaPM * pm, int nsteps, char * pkoutname, struct ic_part_data * ICP, const int NumPart, const double UnitLength_in_cm, const char * OutputDir)
+void glass_evolve(PetaPM * pm, const struct glass_params GlassP, char * pkoutname, struct ic_part_data * ICP, const int NumPart, const double UnitLength_in_cm, const char * OutputDir)
 {
+    if(GlassP.UseTree) {
+        glass_evolve_tree(pm, GlassP, pkoutname, ICP, NumPart, UnitLength_in_cm, OutputDir);
+        return;
+    }
     int i;
     int step = 0;
     double t_x = 0;
     double t_v = 0;
     double t_f = 0;
+    double lastpower = 0;
+    int64_t TotNumPart = NumPart;
+    MPI_Allreduce(MPI_IN_PLACE, &TotNumPart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
 
     /*Allocate memory for a power spectrum*/
     powerspectrum_alloc(pm->ps, pm->Nmesh, omp_get_max_threads(), 0, pm->BoxSize*UnitLength_in_cm);
@@ -91,7 +106,7 @@ void glass_evolve(PetaPM * pm, int nsteps, char * pkoutname, struct ic_part_data
      * 12 + 1 = 13, the first time phase is M_PI / 2, a close encounter to the minimum.
      *
      * */
-    for(step = 0; step < nsteps; step++) {
+    for(step = 0; step < GlassP.MaxSteps; step++) {
         /* leap-frog, K D D F K */
         double dt = M_PI / 2; /* step size */
         double hdt = 0.5 * dt; /* half a step */
@@ -137,12 +152,53 @@ void glass_evolve(PetaPM * pm, int nsteps, char * pkoutname, struct ic_part_data
 
         /*Now save the power spectrum*/
         powerspectrum_save(pm->ps, OutputDir, pkoutname, t_f, 1.0);
+        if(glass_converged(pm->ps, TotNumPart, &lastpower, GlassP, step))
+            break;
     }
 
     /*We are done with the power spectrum, free it*/
     powerspectrum_free(pm->ps);
 }
 
+/* Mean power on scales larger than twice the mean particle separation, relative to shot noise.
+ * A glass suppresses the large scale power, so this falls as the glass relaxes. */
+static double
+glass_large_scale_power(Power * ps, const int64_t TotNumPart)
+{
+    /* Half the particle Nyquist frequency, in the h/Mpc units of the power spectrum */
+    const double kmax = 0.5 * M_PI * cbrt(TotNumPart) / ps->BoxSize_in_MPC;
+    const double shotnoise = pow(ps->BoxSize_in_MPC, 3) / TotNumPart;
+    double power = 0;
+    int64_t nmodes = 0;
+    int i;
+    for(i = 0; i < ps->nonzero; i++) {
+        if(ps->kk[i] > kmax)
+            break;
+        power += ps->Power[i] * ps->Nmodes[i];
+        nmodes += ps->Nmodes[i];
+    }
+    if(nmodes == 0)
+        return 0;
+    return power / nmodes / shotnoise;
+}
+
+/* Has the large scale power changed by less than GlassP.PowerTol since the last step?
+ * The power spectrum is summed over all ranks, so they all agree. */
+static int
+glass_converged(Power * ps, const int64_t TotNumPart, double * lastpower, const struct glass_params GlassP, const int step)
+{
+    const double power = glass_large_scale_power(ps, TotNumPart);
+    message(0, "Glass large scale power / shot noise = %g\n", power);
+    int converged = 0;
+    /* Steps are a quarter of an oscillation: wait for a full oscillation before checking. */
+    if(GlassP.PowerTol > 0 && step >= 4 && fabs(power - *lastpower) <= GlassP.PowerTol * *lastpower)
+        converged = 1;
+    *lastpower = power;
+    if(converged)
+        message(0, "Glass converged after %d steps.\n", step + 1);
+    return converged;
+}
+
 
 static void
 glass_stats(struct ic_part_data * ICP, int NumPart) {
@@ -214,6 +270,44 @@ static void glass_force(PetaPM * pm, double t_f, struct ic_part_data * ICP, cons
 
 static double pot_factor;
 
+/* A single region around all the local particles.*/
+static PetaPMRegion *
+glass_bounding_region(PetaPM * pm, PetaPMParticleStruct * pstruct, int * Nregions)
+{
+    PetaPMRegion * regions = mymalloc2("Regions", sizeof(PetaPMRegion));
+    int k;
+    int r = 0;
+    int i;
+    double min[3] = {pm->BoxSize, pm->BoxSize, pm->BoxSize};
+    double max[3] = {0, 0, 0.};
+
+    for(i = 0; i < pstruct->NumPart; i ++) {
+        double * Pos = (double *) ((char *) pstruct->Parts + i * pstruct->elsize + pstruct->offset_pos);
+        for(k = 0; k < 3; k ++) {
+            if(min[k] > Pos[k])
+                min[k] = Pos[k];
+            if(max[k] < Pos[k])
+                max[k] = Pos[k];
+        }
+    }
+    /* No local particles: a small region at the origin, so the mesh buffers are still allocated*/
+    if(pstruct->NumPart == 0)
+        min[0] = min[1] = min[2] = 0;
+
+    for(k = 0; k < 3; k ++) {
+        regions[r].offset[k] = floor(min[k] / pm->BoxSize * pm->Nmesh - 1);
+        regions[r].size[k] = ceil(max[k] / pm->BoxSize * pm->Nmesh + 2);
+        regions[r].size[k] -= regions[r].offset[k];
+    }
+
+    /* setup the internal data structure of the region */
+    petapm_region_init_strides(&regions[r]);
+    *Nregions = 1;
+
+    walltime_measure("/PMgrav/Regions");
+    return regions;
+}
+
 static PetaPMRegion *
 _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nregions)
 {
@@ -229,22 +323,10 @@ _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nre
      * Need to divide by mean mass per cell to get delta */
     pot_factor = -1 * (-1) * pow(2 * M_PI / pm->BoxSize, -2);
 
-    PetaPMRegion * regions = mymalloc2("Regions", sizeof(PetaPMRegion));
-    int k;
-    int r = 0;
     int i;
-    double min[3] = {pm->BoxSize, pm->BoxSize, pm->BoxSize};
-    double max[3] = {0, 0, 0.};
     double totmass = 0;
 
     for(i = 0; i < NumPart; i ++) {
-        for(k = 0; k < 3; k ++) {
-            if(min[k] > ICP[i].Pos[k])
-                min[k] = ICP[i].Pos[k];
-            if(max[k] < ICP[i].Pos[k])
-                max[k] = ICP[i].Pos[k];
-        }
-
         totmass += ICP[i].Mass;
     }
 
@@ -253,18 +335,7 @@ _prepare(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nre
     /* 1 / pow(pm->Nmesh, 3) is included by the FFT, so just use total mass. */
     pot_factor /= totmass;
 
-    for(k = 0; k < 3; k ++) {
-        regions[r].offset[k] = floor(min[k] / pm->BoxSize * pm->Nmesh - 1);
-        regions[r].size[k] = ceil(max[k] / pm->BoxSize * pm->Nmesh + 2);
-        regions[r].size[k] -= regions[r].offset[k];
-    }
-
-    /* setup the internal data structure of the region */
-    petapm_region_init_strides(&regions[r]);
-    *Nregions = 1;
-
-    walltime_measure("/PMgrav/Regions");
-    return regions;
+    return glass_bounding_region(pm, pstruct, Nregions);
 }
 
 
@@ -297,9 +368,7 @@ static void potential_transfer(PetaPM *pm, int64_t k2, int kpos[3], pfft_complex
      * */
     const double fac = pot_factor * smth * f * f;
 
-    /*Compute the power spectrum*/
-    powerspectrum_add_mode(pm->ps, k2, kpos, value, f, pm->Nmesh);
-
+    /* The power spectrum is measured by measure_power_spectrum, the global readout function. */
     if(k2 == 0) {
         /* Remove zero mode corresponding to the mean.*/
         value[0][0] = 0.0;
@@ -355,3 +424,285 @@ static void readout_force_y(PetaPM *pm, int i, double * mesh, double weight) {
 static void readout_force_z(PetaPM *pm, int i, double * mesh, double weight) {
     curICP[i].Disp[2] += weight * mesh[0];
 }
+
+/********************
+ * TreePM glass.
+ *
+ * The particles are copied to the libgadget particle table and domain decomposed,
+ * so that the short-range force can be computed by the gravity tree walk.
+ * The long-range force is the PM force smoothed on the scale GLASS_ASMTH mesh cells,
+ * as in the simulation. Gravity is reversed by making G negative.
+ *********************/
+
+/* The short-range force table is calibrated for this split scale, in mesh cells. */
+#define GLASS_ASMTH 1.5
+
+static void readout_tree_force_x(PetaPM *pm, int i, double * mesh, double weight);
+static void readout_tree_force_y(PetaPM *pm, int i, double * mesh, double weight);
+static void readout_tree_force_z(PetaPM *pm, int i, double * mesh, double weight);
+static PetaPMFunctions tree_functions [] =
+{
+    {"ForceX", force_x_transfer, readout_tree_force_x},
+    {"ForceY", force_y_transfer, readout_tree_force_y},
+    {"ForceZ", force_z_transfer, readout_tree_force_z},
+    {NULL, NULL, NULL},
+};
+
+/* The long-range potential of the simulation, which also measures the power spectrum*/
+static PetaPMGlobalFunctions tree_global_functions = {NULL, NULL, gravpm_potential_transfer};
+
+static PetaPMRegion *
+_prepare_tree(PetaPM * pm, PetaPMParticleStruct * pstruct, void * userdata, int * Nregions)
+{
+    return glass_bounding_region(pm, pstruct, Nregions);
+}
+
+static void readout_tree_force_x(PetaPM *pm, int i, double * mesh, double weight) {
+    P[i].GravPM[0] += weight * mesh[0];
+}
+static void readout_tree_force_y(PetaPM *pm, int i, double * mesh, double weight) {
+    P[i].GravPM[1] += weight * mesh[0];
+}
+static void readout_tree_force_z(PetaPM *pm, int i, double * mesh, double weight) {
+    P[i].GravPM[2] += weight * mesh[0];
+}
+
+/* Computes the reversed TreePM force on the particle table,
+ * into GravPM and GravAccel, and measures the power spectrum.*/
+static void
+glass_force_tree(PetaPM * pm, DomainDecomp * ddecomp, const char * OutputDir)
+{
+    PetaPMParticleStruct pstruct = {
+        P,
+        sizeof(P[0]),
+        (char*) &P[0].Pos[0]  - (char*) P,
+        (char*) &P[0].Mass  - (char*) P,
+        NULL,
+        NULL,
+        PartManager->NumPart,
+    };
+
+    int i;
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i++)
+    {
+        P[i].GravPM[0] = P[i].GravPM[1] = P[i].GravPM[2] = 0;
+    }
+
+    powerspectrum_zero(pm->ps);
+    petapm_force(pm, _prepare_tree, &tree_global_functions, tree_functions, &pstruct, NULL);
+    powerspectrum_sum(pm->ps);
+    walltime_measure("/LongRange");
+
+    ForceTree Tree = {0};
+    force_tree_rebuild(&Tree, ddecomp, pm->BoxSize, 0, 1, OutputDir);
+    ActiveParticles act = {0};
+    act.NumActiveParticle = PartManager->NumPart;
+    /* rho0 only changes the potential, which is not used. */
+    grav_short_tree(&act, pm, NULL, &Tree, 0, 0, 2);
+    force_tree_free(&Tree);
+}
+
+/* Layout function sending each particle back to the rank it came from:
+ * the ID is the index of the particle in the original ordering.*/
+static int
+glass_home_task(int i, const void * userdata)
+{
+    const int64_t * FirstIndex = (const int64_t *) userdata;
+    int NTask;
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    int lo = 0, hi = NTask;
+    /* FirstIndex[lo] <= ID < FirstIndex[hi] */
+    while(hi - lo > 1) {
+        int mid = (lo + hi) / 2;
+        if(P[i].ID >= (MyIDType) FirstIndex[mid])
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static void
+glass_stats_tree(void)
+{
+    int i;
+    double acc2 = 0;
+    double vel2 = 0;
+    double n = PartManager->NumPart;
+    #pragma omp parallel for reduction(+: acc2, vel2)
+    for(i = 0; i < PartManager->NumPart; i++)
+    {
+        int k;
+        for(k = 0; k < 3; k++)
+        {
+            double acc = P[i].GravPM[k] + P[i].GravAccel[k];
+            acc2 += acc * acc;
+            vel2 += P[i].Vel[k] * P[i].Vel[k];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &acc2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &vel2, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    MPI_Allreduce(MPI_IN_PLACE, &n, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    message(0, "Force std = %g, vel std = %g\n", sqrt(acc2 / n), sqrt(vel2 / n));
+}
+
+/* Kick the particle table with the damped equation of motion used by glass_evolve. */
+static void
+glass_kick_tree(const double hdt)
+{
+    int i;
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i ++) {
+        int d;
+        for(d = 0; d < 3; d ++) {
+            /* mind the damping term */
+            double acc = P[i].GravPM[d] + P[i].GravAccel[d];
+            P[i].Vel[d] += (acc - P[i].Vel[d]) * hdt;
+        }
+    }
+}
+
+static void
+glass_evolve_tree(PetaPM * pm, const struct glass_params GlassP, char * pkoutname, struct ic_part_data * ICP, const int NumPart, const double UnitLength_in_cm, const char * OutputDir)
+{
+    int NTask, ThisTask;
+    MPI_Comm_size(MPI_COMM_WORLD, &NTask);
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    const double BoxSize = pm->BoxSize;
+
+    /* The ID of a particle is its index in the original ordering over all ranks. */
+    int64_t * FirstIndex = ta_malloc("FirstIndex", int64_t, NTask + 1);
+    int64_t NumPart64 = NumPart;
+    FirstIndex[0] = 0;
+    MPI_Allgather(&NumPart64, 1, MPI_INT64, FirstIndex + 1, 1, MPI_INT64, MPI_COMM_WORLD);
+    int i;
+    for(i = 0; i < NTask; i++)
+        FirstIndex[i+1] += FirstIndex[i];
+    const int64_t TotNumPart = FirstIndex[NTask];
+
+    double totmass = 0;
+    for(i = 0; i < NumPart; i ++)
+        totmass += ICP[i].Mass;
+    MPI_Allreduce(MPI_IN_PLACE, &totmass, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+    /* Reversed gravity, with 4 pi |G| rho = 1 so that, as for the PM glass, the oscillation period is 2 pi. */
+    const double G = - pow(BoxSize, 3) / (4 * M_PI * totmass);
+    PetaPM treepm[1];
+    petapm_init(treepm, BoxSize, GLASS_ASMTH, pm->Nmesh, G, MPI_COMM_WORLD);
+    powerspectrum_alloc(treepm->ps, treepm->Nmesh, omp_get_max_threads(), 0, BoxSize*UnitLength_in_cm);
+
+    /* Short-range force parameters. The relative opening criterion uses the old acceleration
+     * divided by G, which is negative here, so the purely geometric Barnes-Hut criterion is used.*/
+    struct gravshort_tree_params treeacc = {0};
+    treeacc.BHOpeningAngle = 0.3;
+    treeacc.TreeUseBH = 1;
+    treeacc.Rcut = 6;
+    treeacc.ErrTolForceAcc = 0.002;
+    treeacc.FractionalGravitySoftening = 1./30.;
+    set_gravshort_treepar(treeacc);
+    gravshort_set_softenings(BoxSize / cbrt(TotNumPart));
+    gravshort_fill_ntab(SHORTRANGE_FORCE_WINDOW_TYPE_EXACT, GLASS_ASMTH);
+    init_forcetree_params(2);
+
+    struct DomainParams dp = {0};
+    dp.DomainOverDecompositionFactor = IMAX(omp_get_max_threads(), 4);
+    dp.DomainUseGlobalSorting = 1;
+    dp.TopNodeAllocFactor = 0.5;
+    dp.SetAsideFactor = 1;
+    set_domain_par(dp);
+
+    /* Leave room for an uneven domain decomposition */
+    int64_t MaxPart = IMAX(NumPart, 1.5 * TotNumPart / NTask + 1000);
+    particle_alloc_memory(MaxPart);
+    PartManager->NumPart = NumPart;
+
+    #pragma omp parallel for
+    for(i = 0; i < NumPart; i++) {
+        int k;
+        for(k = 0; k < 3; k++) {
+            double x = fmod(ICP[i].Pos[k], BoxSize);
+            if(x < 0)
+                x += BoxSize;
+            P[i].Pos[k] = x;
+            P[i].Vel[k] = ICP[i].Vel[k];
+        }
+        P[i].Mass = ICP[i].Mass;
+        P[i].Type = 1;
+        P[i].ID = FirstIndex[ThisTask] + i;
+        P[i].Key = PEANO(P[i].Pos, BoxSize);
+    }
+
+    DomainDecomp ddecomp[1] = {{0}};
+    domain_decompose_full(ddecomp);
+
+    int step;
+    double t_x = 0;
+    double lastpower = 0;
+    glass_force_tree(treepm, ddecomp, OutputDir);
+
+    /* The same leap-frog, K D D F K, with damping, as the PM glass. */
+    for(step = 0; step < GlassP.MaxSteps; step++) {
+        double dt = M_PI / 2; /* step size */
+        double hdt = 0.5 * dt; /* half a step */
+
+        glass_kick_tree(hdt);
+        t_x += hdt;
+
+        /* Drift, wrapping the particles back into the box for the tree */
+        #pragma omp parallel for
+        for(i = 0; i < PartManager->NumPart; i ++) {
+            int d;
+            for(d = 0; d < 3; d ++) {
+                P[i].Pos[d] += P[i].Vel[d] * dt;
+                while(P[i].Pos[d] < 0)
+                    P[i].Pos[d] += BoxSize;
+                while(P[i].Pos[d] >= BoxSize)
+                    P[i].Pos[d] -= BoxSize;
+            }
+            P[i].Key = PEANO(P[i].Pos, BoxSize);
+        }
+        domain_maintain(ddecomp, NULL);
+
+        glass_force_tree(treepm, ddecomp, OutputDir);
+        const double t_f = t_x;
+
+        glass_kick_tree(hdt);
+        t_x += hdt;
+
+        message(0, "Generating tree glass, step = %d, t_f= %g, t_x = %g\n", step, t_f / (2 * M_PI), t_x / (2 * M_PI));
+        glass_stats_tree();
+
+        powerspectrum_save(treepm->ps, OutputDir, pkoutname, t_f, 1.0);
+        if(glass_converged(treepm->ps, TotNumPart, &lastpower, GlassP, step))
+            break;
+    }
+
+    domain_free(ddecomp);
+
+    /* Send the particles home and copy them back to their original places */
+    if(domain_exchange(glass_home_task, FirstIndex, 1, NULL, PartManager, SlotsManager, 10000, MPI_COMM_WORLD))
+        endrun(5, "Could not return the glass particles to their original ranks\n");
+    if(PartManager->NumPart != NumPart)
+        endrun(5, "Glass has %ld particles, expected %d\n", PartManager->NumPart, NumPart);
+
+    #pragma omp parallel for
+    for(i = 0; i < PartManager->NumPart; i++) {
+        const int64_t j = P[i].ID - FirstIndex[ThisTask];
+        int k;
+        for(k = 0; k < 3; k++) {
+            ICP[j].Pos[k] = P[i].Pos[k];
+            ICP[j].Vel[k] = P[i].Vel[k];
+            ICP[j].Disp[k] = P[i].GravPM[k] + P[i].GravAccel[k];
+        }
+    }
+
+    myfree(PartManager->TimeBinChanged);
+    myfree(PartManager->TimeBinLink);
+    myfree(P);
+    PartManager->NumPart = PartManager->MaxPart = 0;
+    powerspectrum_free(treepm->ps);
+    petapm_destroy(treepm);
+    ta_free(FirstIndex);
+}
@@ -17,25 +17,40 @@ typedef struct IDGenerator {
 void
 idgen_init(IDGenerator * idgen, PetaPM * pm, int Ngrid, double BoxSize);
 
+/* The particles of x rows [islab, islab+1) * size[0] / NumSlabs of idgen,
+ * which are a contiguous range of its indices. */
+void
+idgen_init_slab(IDGenerator * slab, const IDGenerator * idgen, int islab, int NumSlabs);
+
 uint64_t
 idgen_create_id_from_index(IDGenerator * idgen, int index);
 
 void
 idgen_create_pos_from_index(IDGenerator * idgen, int index, double pos[3]);
 
+/* Make the Gaussian white noise field in Fourier space, shared by all particle types. Free with myfree.*/
+pfft_complex * make_white_noise(PetaPM * pm, const struct genic_config GenicConfig);
+
+/* Make the 2LPT source term of a particle type in Fourier space from the white noise field, or return NULL
+ * if the type has no second order displacements. It does not depend on the particles, so is made once
+ * and used for every slab of the type. Free with myfree.*/
+pfft_complex * make_lpt2_source(PetaPM * pm, enum TransferType Type, pfft_complex * noise_k, const struct genic_config GenicConfig);
+
 /* Compute the displacement and velocity from the initial homogeneous particle distribution,
- * using the cosmological transfer functions. */
-void displacement_fields(PetaPM * pm, enum TransferType Type, struct ic_part_data * dispICP, const int NumPart, Cosmology * CP, const struct genic_config GenicConfig);
+ * using the white noise field noise_k and the cosmological transfer functions.
+ * If source_k, made by make_lpt2_source for the same type, is not NULL, 2LPT terms are added. */
+void displacement_fields(PetaPM * pm, enum TransferType Type, pfft_complex * noise_k, pfft_complex * source_k, struct ic_part_data * dispICP, const int NumPart, Cosmology * CP, const struct genic_config GenicConfig);
 
 /* Fill ICP with NumPart particles spaced on a regular 3D grid, whose structure is stored in the IDGenerator. */
 int setup_grid(IDGenerator * idgen, double shift, double mass, struct ic_part_data * ICP);
 
 /* Fill ICP with NumPart particles spaced out as a Lagrangian glass, calling glass_evolve
  * to move the particles with reversed gravity. */
-int setup_glass(IDGenerator * idgen, PetaPM * pm, double shift, int seed, double mass, struct ic_part_data * ICP, const double UnitLength_in_cm, const char * OutputDir);
+int setup_glass(IDGenerator * idgen, PetaPM * pm, double shift, int seed, double mass, struct ic_part_data * ICP, const struct glass_params GlassP, const double UnitLength_in_cm, const char * OutputDir);
 
-/* Evolve a distribution of particles with a reversed gravitational force. */
-void glass_evolve(PetaPM * pm, int nsteps, char * pkoutname, struct ic_part_data * ICP, const int NumPart, const double UnitLength_in_cm, const char * OutputDir);
+/* Evolve a distribution of particles with a reversed gravitational force,
+ * until the power spectrum converges or GlassP.MaxSteps steps are taken. */
+void glass_evolve(PetaPM * pm, const struct glass_params GlassP, char * pkoutname, struct ic_part_data * ICP, const int NumPart, const double UnitLength_in_cm, const char * OutputDir);
 
 /* Save the header of the ICs. */
 void saveheader(BigFile * bf, int64_t TotNumPartCDM, int64_t TotNumPartGas, int64_t TotNuPart, double nufrac, const double BoxSize, Cosmology * CP, const struct genic_config GenicConfig);
@@ -53,6 +68,24 @@ write_particle_data(IDGenerator * idgen,
                     int NumFiles, int NumWriters,
                     struct ic_part_data * curICP);
 
+/* Blocks of a particle type in the ICs, open so that the particles can be appended a slab at a time. */
+typedef struct ICWriter {
+    BigBlock blocks[5];
+    BigBlockPtr ptrs[5];
+    int Type;
+    int SavePrePos;
+    int NumWriters;
+} ICWriter;
+
+/* Create the blocks for TotNumPart particles of a type. */
+void open_particle_data(ICWriter * writer, const int Type, BigFile * bf, const int64_t TotNumPart, const int SavePrePos, int NumFiles, int NumWriters);
+
+/* Write the particles of idgen from every rank after those already written. Collective. */
+void append_particle_data(ICWriter * writer, IDGenerator * idgen, const uint64_t FirstID, struct ic_part_data * curICP);
+
+/* Close the blocks once all particles are written. */
+void close_particle_data(ICWriter * writer);
+
 /*Read a parameter file*/
 void read_parameterfile(char *fname, struct genic_config * GenicConfig, int * ShowBacktrace, double * MaxMemSizePerNode, Cosmology * CP);
 
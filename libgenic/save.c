@@ -46,32 +46,78 @@ void _bigfile_utils_create_block_from_c_array(BigFile * bf, void * baseptr, char
     }
 }
 
-static void saveblock(BigFile * bf, void * baseptr, int ptype, char * bname, char * dtype, int items_per_particle, const int NumPart, ptrdiff_t elsize, int NumFiles, int NumWriters) {
-    size_t dims[2];
+/* Create a block for TotNumPart particles of ptype, ready to be written from the start.*/
+static void
+open_ic_block(BigFile * bf, BigBlock * block, BigBlockPtr * ptr, int ptype, char * bname, char * dtype, int items_per_particle, const int64_t TotNumPart, int NumFiles)
+{
     char name[128];
     snprintf(name, 128, "%d/%s", ptype, bname);
 
-    dims[0] = NumPart;
-    dims[1] = items_per_particle;
-    _bigfile_utils_create_block_from_c_array(bf, baseptr, name, dtype, dims, elsize, NumFiles, NumWriters, MPI_COMM_WORLD);
+    if(0 != big_file_mpi_create_block(bf, block, name, dtype, items_per_particle, NumFiles, TotNumPart, MPI_COMM_WORLD)) {
+        endrun(0, "%s:%s\n", big_file_get_error_message(), name);
+    }
+
+    if(0 != big_block_seek(block, ptr, 0)) {
+        endrun(0, "Failed to seek:%s\n", big_file_get_error_message());
+    }
 }
 
+/* Write NumPart particles from every rank after the particles already written.
+ * big_block_mpi_write moves ptr past all the particles written by all ranks.*/
+static void
+append_ic_block(BigBlock * block, BigBlockPtr * ptr, void * baseptr, int items_per_particle, const int NumPart, ptrdiff_t elsize, int NumWriters)
+{
+    BigArray array;
+    size_t dims[2] = {NumPart, items_per_particle};
+    ptrdiff_t strides[2] = {elsize, dtype_itemsize(block->dtype)};
+
+    big_array_init(&array, baseptr, block->dtype, 2, dims, strides);
+
+    if(0 != big_block_mpi_write(block, ptr, &array, NumWriters, MPI_COMM_WORLD)) {
+        endrun(0, "Failed to write :%s\n", big_file_get_error_message());
+    }
+}
+
+enum ICBlocks {
+    IC_PREPOS = 0,
+    IC_DENSITY = 1,
+    IC_POS = 2,
+    IC_VEL = 3,
+    IC_ID = 4,
+};
 
 void
-write_particle_data(IDGenerator * idgen,
+open_particle_data(ICWriter * writer,
                     const int Type,
                     BigFile * bf,
-                    const uint64_t FirstID,
+                    const int64_t TotNumPart,
                     const int SavePrePos,
-                    int NumFiles, int NumWriters,
+                    int NumFiles, int NumWriters)
+{
+    writer->Type = Type;
+    writer->SavePrePos = SavePrePos;
+    writer->NumWriters = NumWriters;
+    if(SavePrePos)
+        open_ic_block(bf, &writer->blocks[IC_PREPOS], &writer->ptrs[IC_PREPOS], Type, "PrePosition", "f8", 3, TotNumPart, NumFiles);
+    open_ic_block(bf, &writer->blocks[IC_DENSITY], &writer->ptrs[IC_DENSITY], Type, "ICDensity", "f4", 1, TotNumPart, NumFiles);
+    open_ic_block(bf, &writer->blocks[IC_POS], &writer->ptrs[IC_POS], Type, "Position", "f8", 3, TotNumPart, NumFiles);
+    open_ic_block(bf, &writer->blocks[IC_VEL], &writer->ptrs[IC_VEL], Type, "Velocity", "f4", 3, TotNumPart, NumFiles);
+    open_ic_block(bf, &writer->blocks[IC_ID], &writer->ptrs[IC_ID], Type, "ID", "u8", 1, TotNumPart, NumFiles);
+}
+
+void
+append_particle_data(ICWriter * writer,
+                    IDGenerator * idgen,
+                    const uint64_t FirstID,
                     struct ic_part_data * curICP)
 {
+    const int NumWriters = writer->NumWriters;
     /* Write particles */
-    if(SavePrePos)
-        saveblock(bf, &curICP[0].PrePos, Type, "PrePosition", "f8", 3, idgen->NumPart, sizeof(curICP[0]), NumFiles, NumWriters);
-    saveblock(bf, &curICP[0].Density, Type, "ICDensity", "f4", 1, idgen->NumPart, sizeof(curICP[0]), NumFiles, NumWriters);
-    saveblock(bf, &curICP[0].Pos, Type, "Position", "f8", 3, idgen->NumPart, sizeof(curICP[0]), NumFiles, NumWriters);
-    saveblock(bf, &curICP[0].Vel, Type, "Velocity", "f4", 3, idgen->NumPart, sizeof(curICP[0]), NumFiles, NumWriters);
+    if(writer->SavePrePos)
+        append_ic_block(&writer->blocks[IC_PREPOS], &writer->ptrs[IC_PREPOS], &curICP[0].PrePos, 3, idgen->NumPart, sizeof(curICP[0]), NumWriters);
+    append_ic_block(&writer->blocks[IC_DENSITY], &writer->ptrs[IC_DENSITY], &curICP[0].Density, 1, idgen->NumPart, sizeof(curICP[0]), NumWriters);
+    append_ic_block(&writer->blocks[IC_POS], &writer->ptrs[IC_POS], &curICP[0].Pos, 3, idgen->NumPart, sizeof(curICP[0]), NumWriters);
+    append_ic_block(&writer->blocks[IC_VEL], &writer->ptrs[IC_VEL], &curICP[0].Vel, 3, idgen->NumPart, sizeof(curICP[0]), NumWriters);
     /*Generate and write IDs*/
     uint64_t * ids = mymalloc("IDs", idgen->NumPart * sizeof(uint64_t));
     memset(ids, 0, idgen->NumPart * sizeof(uint64_t));
@@ -81,11 +127,41 @@ write_particle_data(IDGenerator * idgen,
     {
         ids[i] = idgen_create_id_from_index(idgen, i) + FirstID;
     }
-    saveblock(bf, ids, Type, "ID", "u8", 1, idgen->NumPart, sizeof(uint64_t), NumFiles, NumWriters);
+    append_ic_block(&writer->blocks[IC_ID], &writer->ptrs[IC_ID], ids, 1, idgen->NumPart, sizeof(uint64_t), NumWriters);
     myfree(ids);
     walltime_measure("/Write");
 }
 
+void
+close_particle_data(ICWriter * writer)
+{
+    int i;
+    for(i = 0; i < IC_ID + 1; i++) {
+        if(i == IC_PREPOS && !writer->SavePrePos)
+            continue;
+        if(0 != big_block_mpi_close(&writer->blocks[i], MPI_COMM_WORLD)) {
+            endrun(0, "%s:%d\n", big_file_get_error_message(), i);
+        }
+    }
+}
+
+void
+write_particle_data(IDGenerator * idgen,
+                    const int Type,
+                    BigFile * bf,
+                    const uint64_t FirstID,
+                    const int SavePrePos,
+                    int NumFiles, int NumWriters,
+                    struct ic_part_data * curICP)
+{
+    ICWriter writer;
+    int64_t TotNumPart, NumPart = idgen->NumPart;
+    MPI_Allreduce(&NumPart, &TotNumPart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+    open_particle_data(&writer, Type, bf, TotNumPart, SavePrePos, NumFiles, NumWriters);
+    append_particle_data(&writer, idgen, FirstID, curICP);
+    close_particle_data(&writer);
+}
+
 /*Compute the mass array from the cosmology and the total number of particles.*/
 void compute_mass(double * mass, int64_t TotNumPartCDM, int64_t TotNumPartGas, int64_t TotNuPart, double nufrac, const double BoxSize, Cosmology * CP, const struct genic_config GenicConfig)
 {
@@ -0,0 +1,176 @@
+/*Tests for the TreePM glass: that it returns the particles in place and relaxes the large scales*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <gsl/gsl_rng.h>
+#include "stub.h"
+#include <libgadget/config.h>
+#include <libgadget/petapm.h>
+#include <libgadget/walltime.h>
+#include <libgenic/proto.h>
+
+#define BOX 100.
+#define NGRID 16
+#define NMESH 16
+
+static struct ClockTable CT;
+
+/* A grid with each particle moved by up to 1.5 grid cells along each axis, as in setup_glass.
+ * The positions are wrapped into the box.*/
+static int
+perturbed_grid(PetaPM * pm, struct ic_part_data * ICP)
+{
+    IDGenerator idgen[1];
+    idgen_init(idgen, pm, NGRID, BOX);
+    setup_grid(idgen, 0, 1, ICP);
+    int ThisTask;
+    MPI_Comm_rank(MPI_COMM_WORLD, &ThisTask);
+    gsl_rng * rng = gsl_rng_alloc(gsl_rng_ranlxd1);
+    gsl_rng_set(rng, 17 + ThisTask);
+    int i, k;
+    for(i = 0; i < idgen->NumPart; i++)
+        for(k = 0; k < 3; k++) {
+            double x = ICP[i].Pos[k] + BOX / NGRID * 3 * (gsl_rng_uniform(rng) - 0.5);
+            if(x < 0)
+                x += BOX;
+            if(x >= BOX)
+                x -= BOX;
+            ICP[i].Pos[k] = x;
+        }
+    gsl_rng_free(rng);
+    return idgen->NumPart;
+}
+
+/* Mean power relative to shot noise of the modes with |k| at most a quarter of the
+ * particle Nyquist frequency, from a direct Fourier sum over the particles.*/
+static double
+large_scale_power(const struct ic_part_data * ICP, const int NumPart)
+{
+    const int nmax = NGRID / 4;
+    const int nside = 2 * nmax + 1;
+    const int nk = nside * nside * nside;
+    double * modes = ta_malloc("modes", double, 2 * nk);
+    memset(modes, 0, 2 * nk * sizeof(double));
+    int m, i;
+    #pragma omp parallel for private(i)
+    for(m = 0; m < nk; m++) {
+        const int n[3] = {m / (nside * nside) - nmax, (m / nside) % nside - nmax, m % nside - nmax};
+        for(i = 0; i < NumPart; i++) {
+            const double phase = 2 * M_PI / BOX * (n[0] * ICP[i].Pos[0] + n[1] * ICP[i].Pos[1] + n[2] * ICP[i].Pos[2]);
+            modes[2 * m] += cos(phase);
+            modes[2 * m + 1] += sin(phase);
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, modes, 2 * nk, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+    int64_t TotNumPart = NumPart;
+    MPI_Allreduce(MPI_IN_PLACE, &TotNumPart, 1, MPI_INT64, MPI_SUM, MPI_COMM_WORLD);
+
+    double power = 0;
+    int nmodes = 0;
+    for(m = 0; m < nk; m++) {
+        const int n[3] = {m / (nside * nside) - nmax, (m / nside) % nside - nmax, m % nside - nmax};
+        const int n2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+        if(n2 == 0 || n2 > nmax * nmax)
+            continue;
+        power += (modes[2 * m] * modes[2 * m] + modes[2 * m + 1] * modes[2 * m + 1]) / TotNumPart;
+        nmodes++;
+    }
+    ta_free(modes);
+    return power / nmodes;
+}
+
+static void
+test_glass_tree_home(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    struct ic_part_data * ICP = mymalloc("ICP", NGRID * NGRID * NGRID * sizeof(struct ic_part_data));
+    struct ic_part_data * ICP0 = mymalloc("ICP0", NGRID * NGRID * NGRID * sizeof(struct ic_part_data));
+    const int NumPart = perturbed_grid(pm, ICP);
+    memcpy(ICP0, ICP, NumPart * sizeof(struct ic_part_data));
+
+    /* Without any steps the particles are domain decomposed, given a force and sent back,
+     * so each must be where it started, with a force on it.*/
+    struct glass_params GlassP = {0};
+    GlassP.UseTree = 1;
+    GlassP.MaxSteps = 0;
+    glass_evolve(pm, GlassP, "powerspectrum-glass-test", ICP, NumPart, 3.085678e21, ".");
+
+    double maxforce = 0;
+    int i, k;
+    for(i = 0; i < NumPart; i++)
+        for(k = 0; k < 3; k++) {
+            assert_true(ICP[i].Pos[k] == ICP0[i].Pos[k]);
+            assert_true(ICP[i].Vel[k] == 0);
+            if(fabs(ICP[i].Disp[k]) > maxforce)
+                maxforce = fabs(ICP[i].Disp[k]);
+        }
+    assert_true(maxforce > 0);
+
+    myfree(ICP0);
+    myfree(ICP);
+}
+
+static void
+test_glass_tree_power(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    struct ic_part_data * ICP_pm = mymalloc("ICP_pm", NGRID * NGRID * NGRID * sizeof(struct ic_part_data));
+    struct ic_part_data * ICP_tree = mymalloc("ICP_tree", NGRID * NGRID * NGRID * sizeof(struct ic_part_data));
+    const int NumPart = perturbed_grid(pm, ICP_pm);
+    memcpy(ICP_tree, ICP_pm, NumPart * sizeof(struct ic_part_data));
+    const double initpower = large_scale_power(ICP_pm, NumPart);
+
+    struct glass_params GlassP = {0};
+    GlassP.MaxSteps = 14;
+    glass_evolve(pm, GlassP, "powerspectrum-glass-test", ICP_pm, NumPart, 3.085678e21, ".");
+    const double pmpower = large_scale_power(ICP_pm, NumPart);
+
+    GlassP.UseTree = 1;
+    glass_evolve(pm, GlassP, "powerspectrum-glass-test", ICP_tree, NumPart, 3.085678e21, ".");
+    const double treepower = large_scale_power(ICP_tree, NumPart);
+    message(0, "Large scale power / shot noise: initial %g PM glass %g tree glass %g\n", initpower, pmpower, treepower);
+
+    /* The tree resolves the interparticle scale, which the PM mesh does not*/
+    assert_true(pmpower < initpower);
+    assert_true(treepower < pmpower);
+
+    myfree(ICP_tree);
+    myfree(ICP_pm);
+}
+
+static int
+setup_pm(void ** state)
+{
+    walltime_init(&CT);
+    petapm_module_init(omp_get_max_threads());
+    PetaPM * pm = malloc(sizeof(PetaPM));
+    petapm_init(pm, BOX, 0, NMESH, 1, MPI_COMM_WORLD);
+    *state = pm;
+    return 0;
+}
+
+static int
+teardown_pm(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    petapm_destroy(pm);
+    free(pm);
+    return 0;
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_glass_tree_home),
+        cmocka_unit_test(test_glass_tree_power),
+    };
+    return cmocka_run_group_tests_mpi(tests, setup_pm, teardown_pm);
+}
@@ -0,0 +1,339 @@
+/*Tests for the Zel'dovich and 2LPT displacements, against single and two mode density fields,
+ * and that making the particles in slabs does not change them*/
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#include <math.h>
+#include <mpi.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "stub.h"
+#include <libgadget/config.h>
+#include <libgadget/petapm.h>
+#include <libgadget/walltime.h>
+#include <libgadget/cosmology.h>
+#include <libgenic/proto.h>
+
+#define BOX 100.
+#define NMESH 16
+#define TIMEIC 0.1
+/* Amplitude of the power spectrum stub*/
+#define AMP 2.
+
+static struct ClockTable CT;
+
+/*stub: a flat spectrum, so the density field is the white noise field times AMP*/
+double DeltaSpec(double kmag, enum TransferType Type)
+{
+    return AMP;
+}
+
+/*stub*/
+double dlogGrowth(double kmag, enum TransferType Type)
+{
+    return 1;
+}
+
+/* The density field the displacements are made from*/
+typedef double (*density_func)(const double pos[3]);
+
+static double
+kwave(int n)
+{
+    return 2 * M_PI * n / BOX;
+}
+
+/* A single plane wave, which has no second order displacement*/
+static double
+plane_wave(const double pos[3])
+{
+    return 0.3 * cos(kwave(1) * pos[0] + kwave(2) * pos[1]);
+}
+
+#define TWOA 0.4
+#define TWOB 0.3
+/* Two orthogonal waves, whose second order source is TWOA TWOB cos(k1 x) cos(k2 y)*/
+static double
+two_modes(const double pos[3])
+{
+    return TWOA * cos(kwave(1) * pos[0]) + TWOB * cos(kwave(2) * pos[1]);
+}
+
+static void
+setup_cosmology(Cosmology * CP)
+{
+    memset(CP, 0, sizeof(Cosmology));
+    CP->Omega0 = 0.3;
+    CP->OmegaBaryon = 0.05;
+    CP->OmegaCDM = CP->Omega0 - CP->OmegaBaryon;
+    CP->OmegaLambda = 0.7;
+    CP->OmegaK = 1 - CP->Omega0 - CP->OmegaLambda;
+    CP->HubbleParam = 0.7;
+    CP->Hubble = 0.1;
+    CP->RadiationOn = 0;
+}
+
+/* Fourier transform the density field sampled on the mesh, scaled so that density_transfer
+ * and disp_transfer, which multiply the white noise by DeltaSpec / L^3/2, recover it.*/
+static pfft_complex *
+make_field(PetaPM * pm, density_func density)
+{
+    PetaPMRegion * region = petapm_get_real_region(pm);
+    double * real = (double *) petapm_alloc_rhok(pm);
+    const double Ncell = (double) pm->Nmesh * pm->Nmesh * pm->Nmesh;
+    const double norm = pow(pm->BoxSize, 1.5) / AMP / Ncell;
+    ptrdiff_t ip;
+    for(ip = 0; ip < region->totalsize; ip++) {
+        double pos[3];
+        pos[0] = (region->offset[0] + ip / region->strides[0]) * pm->BoxSize / pm->Nmesh;
+        pos[1] = (region->offset[1] + (ip % region->strides[0]) / region->strides[1]) * pm->BoxSize / pm->Nmesh;
+        pos[2] = (region->offset[2] + ip % region->strides[1]) * pm->BoxSize / pm->Nmesh;
+        real[ip] = density(pos) * norm;
+    }
+    pfft_complex * rho_k = petapm_r2c_mesh(pm, real);
+    myfree(real);
+    return rho_k;
+}
+
+/* Displace a grid of particles on the mesh points, so the mesh is read out exactly*/
+static int
+displace_grid(PetaPM * pm, pfft_complex * rho_k, int TwoLPT, Cosmology * CP, struct ic_part_data * ICP)
+{
+    IDGenerator idgen[1];
+    idgen_init(idgen, pm, NMESH, BOX);
+    setup_grid(idgen, 0, 1, ICP);
+    int i;
+    for(i = 0; i < idgen->NumPart; i++) {
+        int k;
+        for(k = 0; k < 3; k++)
+            ICP[i].PrePos[k] = ICP[i].Pos[k];
+    }
+    struct genic_config GenicConfig = {0};
+    GenicConfig.TimeIC = TIMEIC;
+    GenicConfig.TwoLPT = TwoLPT;
+    pfft_complex * source_k = make_lpt2_source(pm, DELTA_CB, rho_k, GenicConfig);
+    displacement_fields(pm, DELTA_CB, rho_k, source_k, ICP, idgen->NumPart, CP, GenicConfig);
+    if(source_k)
+        myfree(source_k);
+    return idgen->NumPart;
+}
+
+/* Maximal difference between a displacement and expected value, over all particles and axes*/
+static double
+max_error(const struct ic_part_data * ICP, const int NumPart, const int vel, const double (*expect)[3])
+{
+    double maxerr = 0;
+    int i, k;
+    for(i = 0; i < NumPart; i++)
+        for(k = 0; k < 3; k++) {
+            const double value = vel ? ICP[i].Vel[k] : ICP[i].Disp[k];
+            const double err = fabs(value - expect[i][k]);
+            if(err > maxerr)
+                maxerr = err;
+        }
+    MPI_Allreduce(MPI_IN_PLACE, &maxerr, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+    return maxerr;
+}
+
+static void
+test_2lpt_plane_wave(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    Cosmology CP;
+    setup_cosmology(&CP);
+    struct ic_part_data * ICP = mymalloc("ICP", NMESH * NMESH * NMESH * sizeof(struct ic_part_data));
+    double (*expect)[3] = mymalloc("expect", NMESH * NMESH * NMESH * sizeof(expect[0]));
+    pfft_complex * rho_k = make_field(pm, plane_wave);
+
+    const int NumPart = displace_grid(pm, rho_k, 1, &CP, ICP);
+    /* The Zel'dovich displacement, whose divergence is minus the density*/
+    const double k1 = kwave(1), k2 = kwave(2);
+    const double amp = 0.3 / (k1 * k1 + k2 * k2);
+    const double hubble_a = hubble_function(&CP, TIMEIC);
+    const double f1 = F_Omega(&CP, TIMEIC);
+    int i;
+    for(i = 0; i < NumPart; i++) {
+        const double phase = k1 * ICP[i].PrePos[0] + k2 * ICP[i].PrePos[1];
+        expect[i][0] = -amp * k1 * sin(phase);
+        expect[i][1] = -amp * k2 * sin(phase);
+        expect[i][2] = 0;
+    }
+    /* The second order source of a plane wave is zero, so 2LPT does not change anything*/
+    assert_true(max_error(ICP, NumPart, 0, (const double (*)[3]) expect) < 1e-5 * amp * k2);
+    for(i = 0; i < NumPart; i++) {
+        int k;
+        for(k = 0; k < 3; k++)
+            expect[i][k] *= TIMEIC * hubble_a * f1 / sqrt(TIMEIC);
+    }
+    assert_true(max_error(ICP, NumPart, 1, (const double (*)[3]) expect) < 1e-5 * amp * k2 * TIMEIC * hubble_a * f1 / sqrt(TIMEIC));
+
+    myfree(rho_k);
+    myfree(expect);
+    myfree(ICP);
+}
+
+static void
+test_2lpt_two_modes(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    Cosmology CP;
+    setup_cosmology(&CP);
+    struct ic_part_data * ICP = mymalloc("ICP", NMESH * NMESH * NMESH * sizeof(struct ic_part_data));
+    double (*expect)[3] = mymalloc("expect", NMESH * NMESH * NMESH * sizeof(expect[0]));
+    double (*lpt2)[3] = mymalloc("lpt2", NMESH * NMESH * NMESH * sizeof(lpt2[0]));
+    pfft_complex * rho_k = make_field(pm, two_modes);
+
+    const int NumPart = displace_grid(pm, rho_k, 1, &CP, ICP);
+    const double k1 = kwave(1), k2 = kwave(2);
+    const double hubble_a = hubble_function(&CP, TIMEIC);
+    const double f1 = F_Omega(&CP, TIMEIC);
+    const double Omega_a = CP.Omega0 / pow(TIMEIC, 3) * pow(CP.Hubble / hubble_a, 2);
+    /* Second order growth: D2 = -3/7 D1^2 Omega^(-1/143), f2 = 2 Omega^(6/11)*/
+    const double D2 = -3./7 * pow(Omega_a, -1./143);
+    const double f2 = 2 * pow(Omega_a, 6./11);
+    /* nabla^2 phi2 = phi_xx phi_yy = TWOA TWOB cos(k1 x) cos(k2 y), and psi2 = D2 grad phi2*/
+    const double amp2 = D2 * TWOA * TWOB / (k1 * k1 + k2 * k2);
+    assert_true(amp2 < 0);
+    int i, k;
+    for(i = 0; i < NumPart; i++) {
+        const double cx = cos(k1 * ICP[i].PrePos[0]), sx = sin(k1 * ICP[i].PrePos[0]);
+        const double cy = cos(k2 * ICP[i].PrePos[1]), sy = sin(k2 * ICP[i].PrePos[1]);
+        expect[i][0] = -TWOA / k1 * sx;
+        expect[i][1] = -TWOB / k2 * sy;
+        expect[i][2] = 0;
+        lpt2[i][0] = amp2 * k1 * sx * cy;
+        lpt2[i][1] = amp2 * k2 * cx * sy;
+        lpt2[i][2] = 0;
+    }
+    /* Small compared to the second order displacement, which is a few tenths*/
+    const double tol = 1e-5 * TWOA / k1;
+    for(i = 0; i < NumPart; i++)
+        for(k = 0; k < 3; k++)
+            expect[i][k] += lpt2[i][k];
+    assert_true(max_error(ICP, NumPart, 0, (const double (*)[3]) expect) < tol);
+
+    /* The velocity grows as f1 psi1 + f2 psi2*/
+    const double vel_prefac = TIMEIC * hubble_a / sqrt(TIMEIC);
+    for(i = 0; i < NumPart; i++)
+        for(k = 0; k < 3; k++)
+            expect[i][k] = vel_prefac * (f1 * (expect[i][k] - lpt2[i][k]) + f2 * lpt2[i][k]);
+    assert_true(max_error(ICP, NumPart, 1, (const double (*)[3]) expect) < tol * vel_prefac);
+
+    /* Without 2LPT only the first order remains*/
+    displace_grid(pm, rho_k, 0, &CP, ICP);
+    for(i = 0; i < NumPart; i++) {
+        expect[i][0] = -TWOA / k1 * sin(k1 * ICP[i].PrePos[0]);
+        expect[i][1] = -TWOB / k2 * sin(k2 * ICP[i].PrePos[1]);
+        expect[i][2] = 0;
+    }
+    assert_true(max_error(ICP, NumPart, 0, (const double (*)[3]) expect) < tol);
+
+    myfree(rho_k);
+    myfree(lpt2);
+    myfree(expect);
+    myfree(ICP);
+}
+
+/* Displace a grid from a white noise field in NumSlabs slabs, as MP-GenIC does,
+ * with the 2LPT source made once. The slabs are stored one after another in ICP.*/
+static void
+displace_slabs(PetaPM * pm, pfft_complex * noise_k, IDGenerator * idgen, const int NumSlabs, Cosmology * CP, const struct genic_config GenicConfig, struct ic_part_data * ICP, uint64_t * IDs)
+{
+    pfft_complex * source_k = make_lpt2_source(pm, DELTA_CB, noise_k, GenicConfig);
+    assert_true(source_k);
+    int islab, first = 0;
+    for(islab = 0; islab < NumSlabs; islab++) {
+        IDGenerator slab[1];
+        idgen_init_slab(slab, idgen, islab, NumSlabs);
+        setup_grid(slab, 0.3 * BOX / idgen->Ngrid, 1, ICP + first);
+        int i, k;
+        for(i = 0; i < slab->NumPart; i++) {
+            for(k = 0; k < 3; k++)
+                ICP[first + i].PrePos[k] = ICP[first + i].Pos[k];
+            IDs[first + i] = idgen_create_id_from_index(slab, i);
+        }
+        displacement_fields(pm, DELTA_CB, noise_k, source_k, ICP + first, slab->NumPart, CP, GenicConfig);
+        first += slab->NumPart;
+    }
+    assert_int_equal(first, idgen->NumPart);
+    myfree(source_k);
+}
+
+static void
+test_slabs(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    Cosmology CP;
+    setup_cosmology(&CP);
+    struct genic_config GenicConfig = {0};
+    GenicConfig.TimeIC = TIMEIC;
+    GenicConfig.TwoLPT = 1;
+    GenicConfig.Seed = 42;
+    /* Fewer particles than mesh cells, so they are not on the mesh points*/
+    IDGenerator idgen[1];
+    idgen_init(idgen, pm, 10, BOX);
+
+    struct ic_part_data * ICP1 = mymalloc("ICP1", idgen->NumPart * sizeof(struct ic_part_data));
+    struct ic_part_data * ICP3 = mymalloc("ICP3", idgen->NumPart * sizeof(struct ic_part_data));
+    uint64_t * IDs1 = mymalloc("IDs1", idgen->NumPart * sizeof(uint64_t));
+    uint64_t * IDs3 = mymalloc("IDs3", idgen->NumPart * sizeof(uint64_t));
+    pfft_complex * noise_k = make_white_noise(pm, GenicConfig);
+
+    displace_slabs(pm, noise_k, idgen, 1, &CP, GenicConfig, ICP1, IDs1);
+    displace_slabs(pm, noise_k, idgen, 3, &CP, GenicConfig, ICP3, IDs3);
+
+    /* The same particles in the same order, displaced by the same amount*/
+    double maxdisp = 0;
+    int i, k;
+    for(i = 0; i < idgen->NumPart; i++) {
+        assert_true(IDs1[i] == IDs3[i]);
+        for(k = 0; k < 3; k++) {
+            assert_true(ICP1[i].PrePos[k] == ICP3[i].PrePos[k]);
+            assert_true(ICP1[i].Pos[k] == ICP3[i].Pos[k]);
+            assert_true(ICP1[i].Vel[k] == ICP3[i].Vel[k]);
+            if(fabs(ICP1[i].Disp[k]) > maxdisp)
+                maxdisp = fabs(ICP1[i].Disp[k]);
+        }
+    }
+    assert_true(maxdisp > 0);
+
+    myfree(noise_k);
+    myfree(IDs3);
+    myfree(IDs1);
+    myfree(ICP3);
+    myfree(ICP1);
+}
+
+static int
+setup_pm(void ** state)
+{
+    walltime_init(&CT);
+    petapm_module_init(omp_get_max_threads());
+    PetaPM * pm = malloc(sizeof(PetaPM));
+    petapm_init(pm, BOX, 0, NMESH, 1, MPI_COMM_WORLD);
+    *state = pm;
+    return 0;
+}
+
+static int
+teardown_pm(void ** state)
+{
+    PetaPM * pm = (PetaPM *) *state;
+    petapm_destroy(pm);
+    free(pm);
+    return 0;
+}
+
+int main(void) {
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_2lpt_plane_wave),
+        cmocka_unit_test(test_2lpt_two_modes),
+        cmocka_unit_test(test_slabs),
+    };
+    return cmocka_run_group_tests_mpi(tests, setup_pm, teardown_pm);
+}
@@ -24,12 +24,14 @@ static void disp_x_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *
 static void disp_y_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
 static void disp_z_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
 static void readout_density(PetaPM * pm, int i, double * mesh, double weight);
-static void readout_vel_x(PetaPM * pm, int i, double * mesh, double weight);
-static void readout_vel_y(PetaPM * pm, int i, double * mesh, double weight);
-static void readout_vel_z(PetaPM * pm, int i, double * mesh, double weight);
-static void readout_disp_x(PetaPM * pm, int i, double * mesh, double weight);
-static void readout_disp_y(PetaPM * pm, int i, double * mesh, double weight);
-static void readout_disp_z(PetaPM * pm, int i, double * mesh, double weight);
+static void readout_vel(PetaPM * pm, int i, const double value[3], double weight);
+static void readout_disp(PetaPM * pm, int i, const double value[3], double weight);
+static void hessian_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
+static void lpt2_disp_x_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
+static void lpt2_disp_y_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
+static void lpt2_disp_z_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value);
+static void readout_lpt2(PetaPM * pm, int i, const double value[3], double weight);
+static pfft_complex * lpt2_source(PetaPM * pm, pfft_complex * rho_k);
 static void gaussian_fill(int Nmesh, PetaPMRegion * region, pfft_complex * rho_k, int UnitaryAmplitude, int InvertPhase, const int Seed);
 
 static inline double periodic_wrap(double x, const double BoxSize)
@@ -65,6 +67,17 @@ idgen_init(IDGenerator * idgen, PetaPM * pm, int Ngrid, double BoxSize)
     idgen->BoxSize = BoxSize;
 }
 
+void
+idgen_init_slab(IDGenerator * slab, const IDGenerator * idgen, int islab, int NumSlabs)
+{
+    *slab = *idgen;
+    const int start = (int64_t) idgen->size[0] * islab / NumSlabs;
+    const int end = (int64_t) idgen->size[0] * (islab + 1) / NumSlabs;
+    slab->offset[0] = idgen->offset[0] + start;
+    slab->size[0] = end - start;
+    slab->NumPart = slab->size[0] * slab->size[1] * slab->size[2];
+}
+
 uint64_t
 idgen_create_id_from_index(IDGenerator * idgen, int index)
 {
@@ -120,6 +133,9 @@ static PetaPMRegion * makeregion(PetaPM * pm, PetaPMParticleStruct * pstruct, vo
     int i;
     double min[3] = {pm->BoxSize, pm->BoxSize, pm->BoxSize};
     double max[3] = {0, 0, 0.};
+    /* No particles in this slab: a small region at the origin, so the mesh buffers are still allocated*/
+    if(NumPart == 0)
+        min[0] = min[1] = min[2] = 0;
 
     for(i = 0; i < NumPart; i ++) {
         for(k = 0; k < 3; k ++) {
@@ -146,8 +162,35 @@ static PetaPMRegion * makeregion(PetaPM * pm, PetaPMParticleStruct * pstruct, vo
 static enum TransferType ptype;
 /*Global to pass the particle data to the readout functions*/
 static struct ic_part_data * curICP;
+/*Globals to pass the axes of the second derivative to hessian_transfer*/
+static int hessian_axes[2];
+/*Second order growth factor, D2 / D1^2, and velocity factor for the 2LPT readouts*/
+static double lpt2_growth, lpt2_velfac;
 
-void displacement_fields(PetaPM * pm, enum TransferType Type, struct ic_part_data * dispICP, const int NumPart, Cosmology * CP, const struct genic_config GenicConfig) {
+pfft_complex *
+make_white_noise(PetaPM * pm, const struct genic_config GenicConfig)
+{
+    /*This allocates the memory*/
+    pfft_complex * rho_k = petapm_alloc_rhok(pm);
+
+    gaussian_fill(pm->Nmesh, petapm_get_fourier_region(pm),
+		  rho_k, GenicConfig.UnitaryAmplitude, GenicConfig.InvertPhase, GenicConfig.Seed);
+    walltime_measure("/Disp/Noise");
+    return rho_k;
+}
+
+pfft_complex *
+make_lpt2_source(PetaPM * pm, enum TransferType Type, pfft_complex * rho_k, const struct genic_config GenicConfig)
+{
+    /* Neutrino particles are left at first order.*/
+    if(!GenicConfig.TwoLPT || Type == DELTA_NU)
+        return NULL;
+    /*hessian_transfer uses the transfer function of this type*/
+    ptype = Type;
+    return lpt2_source(pm, rho_k);
+}
+
+void displacement_fields(PetaPM * pm, enum TransferType Type, pfft_complex * rho_k, pfft_complex * source_k, struct ic_part_data * dispICP, const int NumPart, Cosmology * CP, const struct genic_config GenicConfig) {
 
     /*MUST set this before doing force.*/
     ptype = Type;
@@ -177,17 +220,17 @@ void displacement_fields(PetaPM * pm, enum TransferType Type, struct ic_part_dat
      * Note that for the velocities we do NOT just use the velocity transfer functions.
      * The reason is because of the gauge: velocity transfer is in synchronous gauge for CLASS,
      * newtonian gauge for CAMB. But we want N-body gauge, which we get by taking the time derivative
-     * of the synchronous gauge density perturbations. See arxiv:1505.04756*/
+     * of the synchronous gauge density perturbations. See arxiv:1505.04756
+     * The three components of each vector are exchanged and read out together.*/
     PetaPMFunctions functions[] = {
         {"Density", density_transfer, readout_density},
-        {"DispX", disp_x_transfer, readout_disp_x},
-        {"DispY", disp_y_transfer, readout_disp_y},
-        {"DispZ", disp_z_transfer, readout_disp_z},
-        {"VelX", vel_x_transfer, readout_vel_x},
-        {"VelY", vel_y_transfer, readout_vel_y},
-        {"VelZ", vel_z_transfer, readout_vel_z},
         {NULL, NULL, NULL },
     };
+    PetaPMVectorFunctions vector_functions[] = {
+        {"Disp", {disp_x_transfer, disp_y_transfer, disp_z_transfer}, readout_disp},
+        {"Vel", {vel_x_transfer, vel_y_transfer, vel_z_transfer}, readout_vel},
+        {NULL, {NULL, NULL, NULL}, NULL },
+    };
 
     /*Set up the velocity pre-factors*/
     const double hubble_a = hubble_function(CP, GenicConfig.TimeIC);
@@ -201,11 +244,33 @@ void displacement_fields(PetaPM * pm, enum TransferType Type, struct ic_part_dat
         vel_prefac /= sqrt(GenicConfig.TimeIC);	/* converts to Gadget velocity */
     }
 
+    const double f1 = F_Omega(CP, GenicConfig.TimeIC);
     if(!GenicConfig.PowerP.ScaleDepVelocity) {
-        vel_prefac *= F_Omega(CP, GenicConfig.TimeIC);
+        vel_prefac *= f1;
         /* If different transfer functions are disabled, we can copy displacements to velocities
          * and we don't need the extra transfers.*/
-        functions[4].name = NULL;
+        vector_functions[1].name = NULL;
+    }
+
+    /* Second order Lagrangian perturbation theory (see eg, Scoccimarro 1998, Crocce et al 2006).
+     * The second order displacement is D2 grad phi2, where nabla^2 phi2 is the sum over i < j of
+     * phi_ii phi_jj - phi_ij^2, phi being the first order potential. D2 = -3/7 D1^2 Omega^(-1/143)
+     * and the second order velocity growth rate is f2 = 2 Omega^(6/11).
+     * The source is made by make_lpt2_source.*/
+    const int do2lpt = source_k != NULL;
+    PetaPMVectorFunctions lpt2_functions[] = {
+        {"2LPTDisp", {lpt2_disp_x_transfer, lpt2_disp_y_transfer, lpt2_disp_z_transfer}, readout_lpt2},
+        {NULL, {NULL, NULL, NULL}, NULL },
+    };
+    if(do2lpt) {
+        const double Omega_a = CP->Omega0 / pow(GenicConfig.TimeIC, 3) * pow(CP->Hubble / hubble_a, 2);
+        /* The minus sign of D2 cancels the one from the inverse Laplacian*/
+        lpt2_growth = 3./7. * pow(Omega_a, -1./143);
+        /* Velocities are multiplied by vel_prefac later, which may include f1.*/
+        lpt2_velfac = 2 * pow(Omega_a, 6./11);
+        if(!GenicConfig.PowerP.ScaleDepVelocity)
+            lpt2_velfac /= f1;
+        message(0, "Adding 2LPT displacements: D2/D1^2 = %g f2 = %g\n", -lpt2_growth, 2 * pow(Omega_a, 6./11));
     }
 
     int Nregions;
@@ -216,15 +281,21 @@ void displacement_fields(PetaPM * pm, enum TransferType Type, struct ic_part_dat
            &Nregions,
            &icprep);
 
-    /*This allocates the memory*/
-    pfft_complex * rho_k = petapm_alloc_rhok(pm);
-
-    gaussian_fill(pm->Nmesh, petapm_get_fourier_region(pm),
-		  rho_k, GenicConfig.UnitaryAmplitude, GenicConfig.InvertPhase, GenicConfig.Seed);
-
     petapm_force_c2r(pm, rho_k, regions, Nregions, functions);
+    petapm_force_c2r_vector(pm, rho_k, regions, Nregions, vector_functions);
 
-    myfree(rho_k);
+    /*Copy displacements to velocities if not done already, before adding the second order terms*/
+    if(!GenicConfig.PowerP.ScaleDepVelocity) {
+        #pragma omp parallel for
+        for(i = 0; i < NumPart; i++) {
+            int k;
+            for(k = 0; k < 3; k++)
+                curICP[i].Vel[k] = curICP[i].Disp[k];
+        }
+    }
+
+    if(do2lpt)
+        petapm_force_c2r_vector(pm, source_k, regions, Nregions, lpt2_functions);
     myfree(regions);
     petapm_force_finish(pm);
 
@@ -242,9 +313,6 @@ void displacement_fields(PetaPM * pm, enum TransferType Type, struct ic_part_dat
                 maxdisp = dis;
             /*Copy displacements to positions.*/
             curICP[i].Pos[k] += curICP[i].Disp[k];
-            /*Copy displacements to velocities if not done already*/
-            if(!GenicConfig.PowerP.ScaleDepVelocity)
-                curICP[i].Vel[k] = curICP[i].Disp[k];
             curICP[i].Vel[k] *= vel_prefac;
             absv += curICP[i].Vel[k] * curICP[i].Vel[k];
             curICP[i].Pos[k] = periodic_wrap(curICP[i].Pos[k], pm->BoxSize);
@@ -332,30 +400,114 @@ static void disp_z_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex *
     disp_transfer(pm, k2, kpos[2], value, 0);
 }
 
+/* Second derivative of the first order potential:
+ * d^2 phi / dx_i dx_j = k_i k_j / k^2 delta, on the axes in hessian_axes.*/
+static void hessian_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value) {
+    if(k2) {
+        double kmag = sqrt(k2) * 2 * M_PI / pm->BoxSize;
+        double fac = DeltaSpec(kmag, ptype) / sqrt(pm->BoxSize * pm->BoxSize * pm->BoxSize);
+        fac *= ((double) kpos[hessian_axes[0]]) * kpos[hessian_axes[1]] / k2;
+        value[0][0] *= fac;
+        value[0][1] *= fac;
+    } else {
+        value[0][0] = 0;
+        value[0][1] = 0;
+    }
+}
+
+/* Second order displacement from the Fourier transform of the 2LPT source term.
+ * The k = 0 mode, the mean of the source, is not a displacement.*/
+static void lpt2_disp_transfer(PetaPM * pm, int64_t k2, int kaxis, pfft_complex * value) {
+    if(k2) {
+        /* The forward transform is not normalised*/
+        const double Ncell = (double) pm->Nmesh * pm->Nmesh * pm->Nmesh;
+        double fac = pm->BoxSize / (2 * M_PI) * kaxis / k2 * lpt2_growth / Ncell;
+        double tmp = value[0][0];
+        value[0][0] = - value[0][1] * fac;
+        value[0][1] = tmp * fac;
+    } else {
+        value[0][0] = 0;
+        value[0][1] = 0;
+    }
+}
+
+static void lpt2_disp_x_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value) {
+    lpt2_disp_transfer(pm, k2, kpos[0], value);
+}
+static void lpt2_disp_y_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value) {
+    lpt2_disp_transfer(pm, k2, kpos[1], value);
+}
+static void lpt2_disp_z_transfer(PetaPM * pm, int64_t k2, int kpos[3], pfft_complex * value) {
+    lpt2_disp_transfer(pm, k2, kpos[2], value);
+}
+
+/* Compute the 2LPT source term, the sum over i < j of phi_ii phi_jj - phi_ij^2,
+ * on the real space mesh and return its Fourier transform. At most three meshes are
+ * held in real space at once: the source, the running sum of the diagonal terms, and the current term.*/
+static pfft_complex *
+lpt2_source(PetaPM * pm, pfft_complex * rho_k)
+{
+    const size_t size = petapm_get_real_region(pm)->totalsize;
+    size_t ip;
+
+    hessian_axes[0] = hessian_axes[1] = 0;
+    double * source = petapm_c2r_mesh(pm, rho_k, hessian_transfer);
+    hessian_axes[0] = hessian_axes[1] = 1;
+    double * diag = petapm_c2r_mesh(pm, rho_k, hessian_transfer);
+    #pragma omp parallel for
+    for(ip = 0; ip < size; ip++) {
+        const double xxyy = source[ip] * diag[ip];
+        diag[ip] += source[ip];
+        source[ip] = xxyy;
+    }
+    hessian_axes[0] = hessian_axes[1] = 2;
+    double * phi = petapm_c2r_mesh(pm, rho_k, hessian_transfer);
+    #pragma omp parallel for
+    for(ip = 0; ip < size; ip++)
+        source[ip] += diag[ip] * phi[ip];
+    myfree(phi);
+    myfree(diag);
+
+    int i, j;
+    for(i = 0; i < 3; i++)
+        for(j = i + 1; j < 3; j++) {
+            hessian_axes[0] = i;
+            hessian_axes[1] = j;
+            phi = petapm_c2r_mesh(pm, rho_k, hessian_transfer);
+            #pragma omp parallel for
+            for(ip = 0; ip < size; ip++)
+                source[ip] -= phi[ip] * phi[ip];
+            myfree(phi);
+        }
+    pfft_complex * source_k = petapm_r2c_mesh(pm, source);
+    myfree(source);
+    walltime_measure("/Disp/2LPT");
+    return source_k;
+}
+
 /**************
  * functions iterating over particle / mesh pairs
  ***************/
 static void readout_density(PetaPM * pm, int i, double * mesh, double weight) {
     curICP[i].Density += weight * mesh[0];
 }
-static void readout_vel_x(PetaPM * pm, int i, double * mesh, double weight) {
-    curICP[i].Vel[0] += weight * mesh[0];
-}
-static void readout_vel_y(PetaPM * pm, int i, double * mesh, double weight) {
-    curICP[i].Vel[1] += weight * mesh[0];
-}
-static void readout_vel_z(PetaPM * pm, int i, double * mesh, double weight) {
-    curICP[i].Vel[2] += weight * mesh[0];
-}
-
-static void readout_disp_x(PetaPM * pm, int i, double * mesh, double weight) {
-    curICP[i].Disp[0] += weight * mesh[0];
+static void readout_vel(PetaPM * pm, int i, const double value[3], double weight) {
+    int k;
+    for(k = 0; k < 3; k++)
+        curICP[i].Vel[k] += weight * value[k];
 }
-static void readout_disp_y(PetaPM * pm, int i, double * mesh, double weight) {
-    curICP[i].Disp[1] += weight * mesh[0];
+static void readout_disp(PetaPM * pm, int i, const double value[3], double weight) {
+    int k;
+    for(k = 0; k < 3; k++)
+        curICP[i].Disp[k] += weight * value[k];
 }
-static void readout_disp_z(PetaPM * pm, int i, double * mesh, double weight) {
-    curICP[i].Disp[2] += weight * mesh[0];
+/* Second order terms go to both the displacement and the velocity*/
+static void readout_lpt2(PetaPM * pm, int i, const double value[3], double weight) {
+    int k;
+    for(k = 0; k < 3; k++) {
+        curICP[i].Disp[k] += weight * value[k];
+        curICP[i].Vel[k] += lpt2_velfac * weight * value[k];
+    }
 }
 
 static void
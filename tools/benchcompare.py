@@ -0,0 +1,93 @@
+"""Extract the per-clock times of a run from its cpu.txt files, and compare them to a stored baseline.
+Used by the regression benchmarks in benchmarks/regression.
+
+Usage:
+    python benchcompare.py extract outputdir nsteps > timings.json
+    python benchcompare.py compare timings.json baseline.json tolerances.json
+compare exits with status 1 if any clock is slower than the baseline by more than its tolerance."""
+
+import json
+import re
+import sys
+import glob
+import os
+
+from parsebench import parse_file, TreeTime
+
+def flatten(tree, prefix=""):
+    """Flatten a tree of clocks into a dictionary of full clock names and times.
+    Parents have the total time of their children. The source line of each clock is stripped,
+    so that timings survive unrelated edits to the code."""
+    flat = {}
+    for (name, sub) in tree.items():
+        path = prefix + "/" + re.sub(r"@.*$", "", name)
+        flat[path] = flat.get(path, 0) + TreeTime(sub)
+        if isinstance(sub, dict):
+            for (k, v) in flatten(sub, path).items():
+                flat[k] = flat.get(k, 0) + v
+    return flat
+
+def extract(directory, nsteps):
+    """Get the cumulative times of each clock at the end of step nsteps of a run.
+    Only the first cpu.txt is used: a benchmark run is not restarted."""
+    cpu = os.path.join(directory, "cpu.txt")
+    if not os.path.exists(cpu):
+        raise IOError("No cpu.txt in %s" % directory)
+    head, stepd = parse_file(cpu, step=nsteps)
+    if head["Step"] < nsteps:
+        raise ValueError("Run in %s stopped at step %d, before step %d" % (directory, head["Step"], nsteps))
+    return {"Step": head["Step"], "MPI": head["MPI"], "Thread": head["Thread"], "Time": head["Time"], "Clocks": flatten(stepd)}
+
+def tolerance(name, tolerances):
+    """The relative tolerance of a clock: the one of the longest matching prefix, or the default."""
+    best = ""
+    for prefix in tolerances.get("clocks", {}):
+        if name.startswith(prefix) and len(prefix) > len(best):
+            best = prefix
+    if best:
+        return tolerances["clocks"][best]
+    return tolerances["default"]
+
+def compare(timings, baseline, tolerances):
+    """Compare timings to the baseline. Clocks shorter than the floor in the baseline are too noisy to compare.
+    Returns a list of regressions, as tuples of (clock, baseline time, new time, tolerance)."""
+    if timings["MPI"] != baseline["MPI"] or timings["Thread"] != baseline["Thread"]:
+        raise ValueError("Baseline ran with %d ranks and %d threads, not %d and %d" %
+                         (baseline["MPI"], baseline["Thread"], timings["MPI"], timings["Thread"]))
+    floor = tolerances["floor"]
+    regressions = []
+    allclocks = dict(baseline["Clocks"])
+    allclocks["Total"] = baseline["Time"]
+    newclocks = dict(timings["Clocks"])
+    newclocks["Total"] = timings["Time"]
+    for (name, base) in sorted(allclocks.items()):
+        if base < floor or name not in newclocks:
+            continue
+        tol = tolerance(name, tolerances)
+        new = newclocks[name]
+        status = "ok"
+        if new > base * (1 + tol):
+            status = "SLOWER"
+            regressions.append((name, base, new, tol))
+        elif new < base / (1 + tol):
+            status = "faster"
+        print("%-50s %10.3f %10.3f %+6.1f%% %s" % (name, base, new, (new / base - 1) * 100, status))
+    return regressions
+
+if __name__ == "__main__":
+    if len(sys.argv) == 4 and sys.argv[1] == "extract":
+        print(json.dumps(extract(sys.argv[2], int(sys.argv[3])), indent=1, sort_keys=True))
+    elif len(sys.argv) == 5 and sys.argv[1] == "compare":
+        with open(sys.argv[2]) as fd:
+            new_t = json.load(fd)
+        with open(sys.argv[3]) as fd:
+            base_t = json.load(fd)
+        with open(sys.argv[4]) as fd:
+            tols = json.load(fd)
+        regs = compare(new_t, base_t, tols)
+        for (clk, bt, nt, tl) in regs:
+            print("Regression: %s took %.3f s, baseline %.3f s, tolerance %.0f%%" % (clk, nt, bt, tl * 100))
+        sys.exit(1 if regs else 0)
+    else:
+        print(__doc__)
+        sys.exit(2)
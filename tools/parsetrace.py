@@ -0,0 +1,103 @@
+"""Quick script to parse the per-rank timeline traces output by MP-Gadget (the TraceFile directory)
+and find the ranks on the critical path of each step.
+
+The traces are in the Chrome trace format, and can also be loaded whole into chrome://tracing or Perfetto.
+Usage: python parsetrace.py outputdir/trace [nclocks]"""
+
+import glob
+import json
+import os
+import re
+import sys
+import collections
+
+def parse_event(line):
+    """Parse one line of a trace file into an event dictionary.
+    Returns None if the line is not an event (the opening bracket, or a truncated last line)."""
+    line = line.strip().rstrip(",")
+    if not line.startswith("{"):
+        return None
+    try:
+        return json.loads(line)
+    except ValueError:
+        return None
+
+def clock_name(name):
+    """Strip the source file and line from a clock name, so that the same clock measured
+    at different lines is summed together."""
+    return re.sub(r"@.*$", "", name)
+
+def is_wait(name):
+    """Clocks which measure time spent waiting for other ranks."""
+    return re.search(r"Wait|alltoall", name) is not None
+
+def parse_file(fname):
+    """Parse a trace file for one rank. Returns a dictionary of steps,
+    each holding a dictionary of clock names and total times in seconds, and the number of dropped events."""
+    steps = collections.defaultdict(lambda: collections.defaultdict(float))
+    dropped = 0
+    with open(fname) as fd:
+        for line in fd:
+            event = parse_event(line)
+            if event is None:
+                continue
+            if event["name"] == "dropped":
+                dropped += event["args"]["events"]
+                continue
+            #Only the walltime_measure intervals: per-thread treewalk phases overlap them.
+            if event["ph"] != "X" or "@" not in event["name"]:
+                continue
+            steps[event["args"]["step"]][clock_name(event["name"])] += event["dur"] / 1e6
+    return steps, dropped
+
+def parse_dir(dirname):
+    """Parse all the rank traces in a directory. Returns a dictionary of ranks."""
+    ranks = {}
+    for fname in glob.glob(os.path.join(dirname, "*.json")):
+        rank = int(os.path.basename(fname)[:-5])
+        steps, dropped = parse_file(fname)
+        if dropped > 0:
+            print("Rank %d dropped %d events: increase TraceEvents" % (rank, dropped))
+        ranks[rank] = steps
+    return ranks
+
+def critical_path(ranks, nclocks=3):
+    """For each step, find the rank which was busy for longest (excluding waits for other ranks),
+    which sets the length of the step, and the clocks with the largest imbalance across ranks.
+    Returns a list of dictionaries, one per step."""
+    allsteps = sorted(set(s for steps in ranks.values() for s in steps))
+    summary = []
+    for step in allsteps:
+        busy = {}
+        clocks = collections.defaultdict(dict)
+        for rank, steps in ranks.items():
+            times = steps.get(step, {})
+            busy[rank] = sum(t for (n, t) in times.items() if not is_wait(n))
+            for (n, t) in times.items():
+                if not is_wait(n):
+                    clocks[n][rank] = t
+        crit = max(busy, key=busy.get)
+        mean = sum(busy.values()) / len(busy)
+        #The excess time of the slowest rank in each clock over the mean rank
+        excess = []
+        for (n, times) in clocks.items():
+            slow = max(times, key=times.get)
+            cmean = sum(times.values()) / len(ranks)
+            excess.append((times[slow] - cmean, n, slow))
+        excess.sort(reverse=True)
+        summary.append({"Step": step, "Rank": crit, "Busy": busy[crit], "Mean": mean, "Clocks": excess[:nclocks]})
+    return summary
+
+def print_summary(summary):
+    """Print the critical path summary."""
+    for ss in summary:
+        imb = ss["Busy"] / ss["Mean"] if ss["Mean"] > 0 else 1
+        print("Step %d: critical rank %d busy %.3g s (mean %.3g s, imbalance %.2f)" % (ss["Step"], ss["Rank"], ss["Busy"], ss["Mean"], imb))
+        for (excess, name, rank) in ss["Clocks"]:
+            print("    %-40s slowest rank %d, %.3g s over mean" % (name, rank, excess))
+
+if __name__ == "__main__":
+    nclocks = 3
+    if len(sys.argv) > 2:
+        nclocks = int(sys.argv[2])
+    print_summary(critical_path(parse_dir(sys.argv[1]), nclocks))